@@ -0,0 +1,101 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+
+#include <bvh/bvh.hpp>
+#include <bvh/flattenbvh.hpp>
+#include <bvh/traversal.hpp>
+#include <core/mesh.hpp>
+#include <core/light.hpp>
+
+namespace scTracer::BVH
+{
+    constexpr float LIGHT_INTERSECTION_EPS = 0.0003f; // same as EPS of the integrator
+    constexpr float LIGHT_SPHERE_EPS = 0.001f;
+
+    // Intersection data of one analytic light, computed once at load instead of per ray
+    struct EmitterData
+    {
+        glm::vec3 position;
+        float type;
+        glm::vec3 normal; // quad: normalize(cross(u, v))
+        float planeD;     // quad: dot(normal, position)
+        glm::vec3 invU;   // quad: u / dot(u, u)
+        float radius;     // sphere
+        glm::vec3 invV;   // quad: v / dot(v, v)
+        int lightIndex;   // index into Scene::lights
+    };
+
+    // Leaf primitive policy for the light BVH, primIndex of a hit is the light index
+    template <bool kHideBackfaces>
+    struct EmitterPrimitives
+    {
+        const EmitterData *emitters{nullptr};
+
+        inline bool intersect(int prim, const glm::vec3 &origin, const glm::vec3 &direction, float tmax, QueryHit &candidate) const
+        {
+            const EmitterData &e = emitters[prim];
+            float t = -1.0f;
+            if (e.type == float(Core::LightType::RectLight))
+            {
+                float dt = glm::dot(direction, e.normal);
+                if (kHideBackfaces && dt > 0.0f)
+                    return false;
+                t = (e.planeD - glm::dot(e.normal, origin)) / dt;
+                if (!(t > LIGHT_INTERSECTION_EPS))
+                    return false;
+                glm::vec3 vi = origin + direction * t - e.position;
+                float a1 = glm::dot(e.invU, vi);
+                float a2 = glm::dot(e.invV, vi);
+                if (a1 < 0.0f || a1 > 1.0f || a2 < 0.0f || a2 > 1.0f)
+                    return false;
+            }
+            else if (e.type == float(Core::LightType::SphereLight))
+            {
+                glm::vec3 op = e.position - origin;
+                float b = glm::dot(op, direction);
+                float det = b * b - glm::dot(op, op) + e.radius * e.radius;
+                if (det < 0.0f)
+                    return false;
+                det = std::sqrt(det);
+                t = b - det;
+                if (t <= LIGHT_SPHERE_EPS)
+                    t = b + det;
+                if (t <= LIGHT_SPHERE_EPS)
+                    return false;
+            }
+            else
+                return false;
+
+            if (t >= tmax)
+                return false;
+            candidate.t = t;
+            candidate.primIndex = e.lightIndex;
+            return true;
+        }
+    };
+
+    class LightBVH
+    { // small single level BVH over the rect and sphere lights, distant lights are not intersectable
+    public:
+        LightBVH() = default;
+        ~LightBVH() = default;
+
+        void build(const std::vector<Core::Light> &lights);
+
+        // closest emitter, backfacing quads are hidden like in the GLSL ClosestHit
+        bool intersect1(const QueryRay &ray, QueryHit &hit) const;
+        bool occluded1(const QueryRay &ray) const;
+
+        inline bool empty() const { return mNodes.empty(); }
+        inline const EmitterData &emitter(int lightIndex) const { return mEmitters[mSlotOfLight[lightIndex]]; }
+
+    private:
+        std::vector<EmitterData> mEmitters; // in BVH leaf order
+        std::vector<int> mSlotOfLight;      // light index -> mEmitters slot
+        std::vector<BVHFlattor::FlatNode> mNodes;
+        int mCurrentNodeIndex{0};
+
+        int _flattenNode(const BvhStructure::Node *node);
+    };
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include <bvh/bb.hpp>
+#include <utils/aliasTable.hpp>
+
+namespace scTracer::Core
+{
+    class Scene;
+}
+
+namespace scTracer::BVH
+{
+    // World space triangle of an emissive material, sampled uniformly by area
+    struct EmissiveTriangle
+    {
+        glm::vec3 v0;
+        glm::vec3 e1;     // v1 - v0
+        glm::vec3 e2;     // v2 - v0
+        glm::vec3 normal; // emitting side, follows the vertex normals
+        glm::vec3 emission;
+        float area;
+    };
+
+    // Spatial and directional extent of the power of one or more emitters, pbrt-v4 style
+    struct LightBounds
+    {
+        BoundingBox bounds;
+        glm::vec3 w{0.0f, 0.0f, 1.0f}; // axis of the cone of emitter normals
+        float phi{0.0f};               // power
+        float cosTheta_o{1.0f};        // spread of the normals around w
+        float cosTheta_e{0.0f};        // spread of the emission around each normal
+
+        float importance(const glm::vec3 &p, const glm::vec3 &n) const;
+    };
+
+    class LightSampler
+    { // picks the emitter for next event estimation proportional to its estimated contribution
+    public:
+        LightSampler() = default;
+        ~LightSampler() = default;
+
+        // Emitter ids: [0, lights.size()) are Scene::lights, the emissive triangles follow
+        void build(const Core::Scene &scene);
+
+        // Picks an emitter for the shading point p with normal n (zero vector for none), -1 when nothing can contribute
+        int sample(const glm::vec3 &p, const glm::vec3 &n, float u, float &pmf) const;
+        // probability of sample() returning emitter from the same p and n
+        float pmf(const glm::vec3 &p, const glm::vec3 &n, int emitter) const;
+
+        // emitter id of a hit triangle, -1 if its material does not emit
+        inline int triangleEmitter(int instanceIndex, int primIndex) const
+        {
+            if (instanceIndex < 0 || instanceIndex >= int(mInstanceEmitterOffset.size()) || mInstanceEmitterOffset[instanceIndex] < 0)
+                return -1;
+            return mInstanceEmitterOffset[instanceIndex] + primIndex - mInstancePrimOffset[instanceIndex];
+        }
+        inline bool isTriangle(int emitter) const { return emitter >= mNumLights; }
+        inline const EmissiveTriangle &triangle(int emitter) const { return mTriangles[emitter - mNumLights]; }
+
+        inline bool empty() const { return mBounded.empty() && mInfinite.empty(); }
+        inline bool usesTree() const { return !mNodes.empty(); }
+        inline int getNumEmitters() const { return mNumLights + int(mTriangles.size()); }
+
+    private:
+        struct Node
+        {
+            LightBounds lightBounds;
+            int childOrEmitter; // second child of an interior node, the first one follows it directly
+            int isLeaf;
+        };
+
+        int mNumLights{0};
+        std::vector<EmissiveTriangle> mTriangles;
+        std::vector<int> mInstanceEmitterOffset; // instance -> emitter id of its first triangle, -1 for none
+        std::vector<int> mInstancePrimOffset;    // instance -> first primitive of its mesh
+
+        std::vector<int> mInfinite; // distant lights, picked uniformly
+        float mInfiniteProb{0.0f};
+
+        std::vector<int> mBounded;    // emitters with finite bounds
+        std::vector<int> mSlot;       // emitter id -> index into mBounded, -1 for none
+        Utils::AliasTable mAlias;     // over mBounded, used for small emitter counts
+        std::vector<Node> mNodes;     // light tree, used for many emitters
+        std::vector<uint64_t> mTrail; // per mBounded slot, child choices from the root, lowest bit first
+
+        int __buildTree(std::vector<std::pair<int, LightBounds>> &items, int begin, int end, uint64_t trail, int depth);
+    };
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+
+#include <bvh/flattenbvh.hpp>
+#include <bvh/traversal.hpp>
+
+namespace scTracer::BVH
+{
+    class RayQuery
+    { // closest-hit and any-hit queries on the flattened two level BVH
+    public:
+        RayQuery() = default;
+        ~RayQuery() = default;
+
+        // The query keeps pointers to the scene buffers, they must outlive it
+        void build(const BVHFlattor &flattor, const std::vector<int> &triIndices, const std::vector<glm::vec3> &vertices, const std::vector<glm::mat4> &transforms);
+        void updateTransforms(const std::vector<glm::mat4> &transforms);
+        // Enables the alpha tested kernels, pass nullptr to go back to opaque only
+        void setAlphaTest(bool (*fn)(const void *user, const QueryHit &candidate), const void *user);
+
+        // Single ray
+        bool intersect1(const QueryRay &ray, QueryHit &hit) const;
+        bool occluded1(const QueryRay &ray) const;
+
+        // Batched, hits[i] / occluded[i] belong to rays[i]
+        void intersect(const QueryRay *rays, QueryHit *hits, int count) const;
+        void occluded(const QueryRay *rays, bool *occluded, int count) const;
+
+        inline bool isBuilt() const { return mFlattor != nullptr; }
+
+    private:
+        const BVHFlattor *mFlattor{nullptr};
+        const int *mTriIndices{nullptr};
+        const glm::vec3 *mVertices{nullptr};
+        std::vector<glm::mat4> mInvTransforms;
+        int mTopLevelIndex{0};
+        AlphaTest mAlphaTest;
+        bool mInstancing{false};
+
+        // kernels picked from the traversal variants by _selectKernels, depending on what the scene uses
+        using KernelFn = bool (RayQuery::*)(const QueryRay &, QueryHit &) const;
+        KernelFn mIntersectFn{nullptr};
+        KernelFn mOccludedFn{nullptr};
+
+        template <QueryType kQuery, bool kInstancing, bool kAlphaTest>
+        bool _traverse(const QueryRay &ray, QueryHit &hit) const;
+        template <QueryType kQuery>
+        KernelFn _pickKernel() const;
+        void _selectKernels();
+        void _sortByOctant(const QueryRay *rays, int count, std::vector<int> &order) const;
+    };
+}
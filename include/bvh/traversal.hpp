@@ -0,0 +1,226 @@
+#pragma once
+#include <limits>
+#include <glm/glm.hpp>
+
+#include <bvh/flattenbvh.hpp>
+
+namespace scTracer::BVH
+{
+    // Ray and hit records of the query API, independent from the renderer types
+    struct QueryRay
+    {
+        glm::vec3 origin;
+        glm::vec3 direction;
+        float tmax;
+        QueryRay() : origin(0.0f), direction(0.0f), tmax(std::numeric_limits<float>::infinity()) {}
+        QueryRay(glm::vec3 o, glm::vec3 d, float tmax = std::numeric_limits<float>::infinity()) : origin(o), direction(d), tmax(tmax) {}
+    };
+
+    struct QueryHit
+    {
+        float t{std::numeric_limits<float>::infinity()};
+        glm::ivec3 vertIndices{-1}; // global vertex indices of the hit triangle
+        glm::vec3 bary{0.0f};       // barycentrics of vertIndices.x / .y / .z
+        int primIndex{-1};          // primitive index into the leaf primitive buffer
+        int instanceIndex{-1};
+        int materialIndex{-1};
+
+        inline bool valid() const { return primIndex != -1; }
+    };
+
+    enum class QueryType
+    {
+        Closest,
+        Any,
+    };
+
+    // Candidate filter for alpha tested geometry, returns false to ignore the hit and keep traversing
+    struct AlphaTest
+    {
+        bool (*fn)(const void *user, const QueryHit &candidate){nullptr};
+        const void *user{nullptr};
+
+        inline bool enabled() const { return fn != nullptr; }
+        inline bool accept(const QueryHit &candidate) const { return fn(user, candidate); }
+    };
+
+    // Returns the entry distance of the ray into the box, or -1 when it misses [0, tmax]
+    inline float intersectBox(const glm::vec3 &bmin, const glm::vec3 &bmax, const glm::vec3 &origin, const glm::vec3 &invDir, float tmax)
+    {
+        glm::vec3 f = (bmax - origin) * invDir;
+        glm::vec3 n = (bmin - origin) * invDir;
+
+        glm::vec3 tfar = glm::max(f, n);
+        glm::vec3 tnear = glm::min(f, n);
+
+        float t1 = glm::min(tfar.x, glm::min(tfar.y, tfar.z));
+        float t0 = glm::max(tnear.x, glm::max(tnear.y, tnear.z));
+        t0 = glm::max(t0, 0.0f);
+
+        return (t1 >= t0 && t0 <= tmax) ? t0 : -1.0f;
+    }
+
+    // Moller-Trumbore, returns (u, v, t), t is negative on a miss
+    inline glm::vec3 intersectTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, const glm::vec3 &origin, const glm::vec3 &direction)
+    {
+        glm::vec3 e0 = v1 - v0;
+        glm::vec3 e1 = v2 - v0;
+        glm::vec3 pv = glm::cross(direction, e1);
+        float det = glm::dot(e0, pv);
+
+        glm::vec3 tv = origin - v0;
+        glm::vec3 qv = glm::cross(tv, e0);
+
+        float invDet = 1.0f / det;
+        glm::vec3 uvt = glm::vec3(glm::dot(tv, pv), glm::dot(direction, qv), glm::dot(e1, qv)) * invDet;
+        if (uvt.x >= 0.0f && uvt.y >= 0.0f && uvt.x + uvt.y <= 1.0f && uvt.z >= 0.0f)
+            return uvt;
+        return glm::vec3(-1.0f);
+    }
+
+    // Leaf primitive policy for the packed scene triangles (3 vertex indices per triangle)
+    struct TrianglePrimitives
+    {
+        const int *triIndices{nullptr};
+        const glm::vec3 *vertices{nullptr};
+
+        inline bool intersect(int prim, const glm::vec3 &origin, const glm::vec3 &direction, float tmax, QueryHit &candidate) const
+        {
+            glm::ivec3 vertIndices = glm::ivec3(triIndices[prim * 3 + 0], triIndices[prim * 3 + 1], triIndices[prim * 3 + 2]);
+            glm::vec3 uvt = intersectTriangle(vertices[vertIndices.x], vertices[vertIndices.y], vertices[vertIndices.z], origin, direction);
+            if (uvt.z < 0.0f || uvt.z >= tmax)
+                return false;
+            candidate.t = uvt.z;
+            candidate.vertIndices = vertIndices;
+            candidate.bary = glm::vec3(1.0f - uvt.x - uvt.y, uvt.x, uvt.y);
+            candidate.primIndex = prim;
+            return true;
+        }
+    };
+
+    // Stack traversal of a flattened BVH, shared by every CPU query.
+    //   kQuery      closest hit, or stop at the first accepted hit
+    //   kInstancing transform the ray at TLAS leaves, off when every instance transform is identity
+    //   kAlphaTest  run the candidate filter before accepting a hit
+    //   Primitives  leaf policy, intersect(prim, origin, direction, tmax, candidate)
+    // The tree may be two level (TLAS leaves < 0) or a single BLAS-like tree.
+    template <QueryType kQuery, bool kInstancing, bool kAlphaTest, typename Primitives>
+    inline bool traverse(const BVHFlattor::FlatNode *nodes, int rootIndex, const Primitives &prims,
+                         const glm::mat4 *invTransforms, const AlphaTest &alpha,
+                         const QueryRay &ray, QueryHit &hit)
+    {
+        int stack[64];
+        int ptr = 0;
+        stack[ptr++] = -1;
+
+        int index = rootIndex;
+        int currInstance = -1;
+        int currMatID = -1;
+        bool BLAS = false;
+        float t = ray.tmax;
+
+        glm::vec3 origin = ray.origin;
+        glm::vec3 direction = ray.direction;
+        glm::vec3 invDir = 1.0f / direction;
+
+        while (index != -1)
+        {
+            glm::ivec3 LRLeaf = nodes[index].LeftRightLeaf;
+
+            int leftIndex = LRLeaf.x;
+            int rightIndex = LRLeaf.y;
+            int leaf = LRLeaf.z;
+
+            if (leaf > 0) // Leaf node of BLAS
+            {
+                for (int i = 0; i < rightIndex; i++) // Loop through primitives
+                {
+                    QueryHit candidate;
+                    if (!prims.intersect(leftIndex + i, origin, direction, t, candidate))
+                        continue;
+                    candidate.instanceIndex = currInstance;
+                    candidate.materialIndex = currMatID;
+
+                    if constexpr (kAlphaTest)
+                        if (!alpha.accept(candidate))
+                            continue;
+
+                    hit = candidate;
+                    if constexpr (kQuery == QueryType::Any)
+                        return true;
+                    t = candidate.t;
+                }
+            }
+            else if (leaf < 0) // Leaf node of TLAS
+            {
+                currInstance = -leaf - 1;
+                currMatID = rightIndex;
+
+                if constexpr (kInstancing)
+                {
+                    const glm::mat4 &invTransform = invTransforms[currInstance];
+                    origin = glm::vec3(invTransform * glm::vec4(ray.origin, 1.0f));
+                    direction = glm::vec3(invTransform * glm::vec4(ray.direction, 0.0f));
+                    invDir = 1.0f / direction;
+                }
+
+                // Add a marker. We'll return to this spot after we've traversed the entire BLAS
+                stack[ptr++] = -1;
+                index = leftIndex;
+                BLAS = true;
+                continue;
+            }
+            else
+            {
+                float leftHit = intersectBox(nodes[leftIndex].boundsmin, nodes[leftIndex].boundsmax, origin, invDir, t);
+                float rightHit = intersectBox(nodes[rightIndex].boundsmin, nodes[rightIndex].boundsmax, origin, invDir, t);
+
+                if (leftHit >= 0.0f && rightHit >= 0.0f)
+                {
+                    int deferred = -1;
+                    if (leftHit > rightHit)
+                    {
+                        index = rightIndex;
+                        deferred = leftIndex;
+                    }
+                    else
+                    {
+                        index = leftIndex;
+                        deferred = rightIndex;
+                    }
+
+                    stack[ptr++] = deferred;
+                    continue;
+                }
+                else if (leftHit >= 0.0f)
+                {
+                    index = leftIndex;
+                    continue;
+                }
+                else if (rightHit >= 0.0f)
+                {
+                    index = rightIndex;
+                    continue;
+                }
+            }
+            index = stack[--ptr];
+
+            // If we've traversed the entire BLAS then switch to back to TLAS and resume where we left off
+            if (BLAS && index == -1)
+            {
+                BLAS = false;
+
+                index = stack[--ptr];
+
+                if constexpr (kInstancing)
+                {
+                    origin = ray.origin;
+                    direction = ray.direction;
+                    invDir = 1.0f / direction;
+                }
+            }
+        }
+
+        return kQuery == QueryType::Closest && hit.valid();
+    }
+}
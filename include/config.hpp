@@ -7,6 +7,10 @@ namespace scTracer::Config
     extern const int default_height;
     extern const int default_texture_width;
     extern const int default_texutre_height;
+    extern const int cpu_tile_size;
+    extern const int cpu_wavefront_size;
+    extern const int cpu_texture_cache_tiles;
+    extern const int cpu_radiance_cache_cells;
     extern const std::string shaderFolder;
     extern const std::string sceneFolder;
     extern const std::string outputFolder;
@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace scTracer::Utils
+{
+    class ThreadPool;
+}
+
+namespace scTracer::Core
+{
+    class EnvironmentMap
+    { // equirectangular HDR background, +Y up, importance sampled by luminance * sin(theta)
+    public:
+        EnvironmentMap() = default;
+        ~EnvironmentMap() = default;
+
+        // .exr through tinyexr, anything else (.hdr) through stb_image. The sampling tables are built on threadPool
+        // if given, on the calling thread otherwise
+        bool load(const std::string &filename, Utils::ThreadPool *threadPool = nullptr);
+        void clear();
+
+        inline bool empty() const { return mData.empty(); }
+
+        // radiance arriving from direction dir
+        glm::vec3 eval(const glm::vec3 &dir) const;
+        // solid angle pdf of sample() returning dir
+        float pdf(const glm::vec3 &dir) const;
+        // picks a direction proportional to the luminance, returns its radiance
+        glm::vec3 sample(float r1, float r2, glm::vec3 &dir, float &pdf) const;
+
+        static glm::vec2 dirToUV(const glm::vec3 &dir);
+        static glm::vec3 uvToDir(const glm::vec2 &uv);
+
+        int mWidth{0};
+        int mHeight{0};
+        std::vector<float> mData; // RGB, first row is the top (+Y)
+        // (mWidth + 1) x mHeight, texel (x, y) is P(X <= x | y), the last column holds the marginal P(Y <= y)
+        // same layout as envMapCDFTex, so both renderers walk the same tables
+        std::vector<float> mCDF;
+        std::string name;
+
+    private:
+        void __buildCDF(Utils::ThreadPool *threadPool);
+        int __sampleRow(float u, float &du, float &pmf) const;
+        int __sampleColumn(int y, float u, float &du, float &pmf) const;
+    };
+}
@@ -25,6 +25,13 @@ namespace scTracer::Core
 
     MaterialType getMaterialType(const std::string &type);
 
+    enum AlphaMode // same values as ALPHA_MODE_* in the shaders
+    {
+        AlphaOpaque,
+        AlphaBlend,
+        AlphaMask
+    };
+
     class Material
     {
     public:
@@ -63,6 +70,36 @@ namespace scTracer::Core
         float padding2;
     };
 
+    // What the cpu bsdf reads, baked from Material once per scene. Everything the GLSL GetMaterial
+    // and TintColors derive per hit is precomputed, so a hit only keeps a pointer into the table
+    struct alignas(32) ShadingMaterial
+    {
+        glm::vec3 baseColor;
+        float metallic;
+
+        glm::vec3 emission;
+        float roughness; // clamped like the shaders do
+
+        glm::vec3 Csheen;   // sheen tint applied
+        float sheen;
+
+        glm::vec3 specTint; // Cspec0 = F0(eta) * specTint
+        float subsurface;
+
+        float ax; // anisotropic GGX alphas
+        float ay;
+        float clearcoat;
+        float clearcoatRoughness; // from clearcoatGloss
+
+        float specTrans;
+        float ior;
+        float dielectricWt; // (1 - metallic) * (1 - specTrans)
+        float baseLum;      // luminance of baseColor
+
+        static ShadingMaterial bake(const Material &mat);
+    };
+    static_assert(sizeof(ShadingMaterial) == 96, "three 32-byte blocks per material");
+
     const std::vector<std::string> materialSystemStrings{
         "PBRT",
         "PHONG",
@@ -7,8 +7,13 @@
 #include <core/mesh.hpp>
 #include <core/instance.hpp>
 #include <core/light.hpp>
+#include <core/envmap.hpp>
+#include <core/texturecache.hpp>
 
 #include <bvh/flattenbvh.hpp>
+#include <bvh/rayquery.hpp>
+#include <bvh/lightbvh.hpp>
+#include <bvh/lightsampler.hpp>
 namespace scTracer::Core
 {
 
@@ -17,7 +22,33 @@ namespace scTracer::Core
         int image_width;
         int image_height;
         int maxBounceDepth;
+        int rrDepth{3}; // russian roulette from this bounce on, -1 disables
         int maxSamples{64};
+        int renderThreads{0}; // cpu renderer workers, 0 for all hardware threads
+        int samplerType{1};   // cpu sampler, CPU::SamplerType, Sobol by default
+        bool wavefront{false};     // cpu renderer runs batched stages over ray queues instead of one path per pixel
+        int wavefrontSort{0};      // CPU::WavefrontSort, how queued rays or hits are reordered between stages
+        bool wavefrontSimd{false}; // bsdf samples 8 paths at a time with the SIMD Disney kernels, not bit exact with the scalar ones
+        bool restir{false};            // cpu direct light at the first bounce from ReSTIR reservoirs instead of one light sample
+        int restirCandidates{32};      // light samples resampled into a fresh reservoir
+        int restirSpatialNeighbors{4}; // reservoirs of nearby pixels merged per pass, 0 disables spatial reuse
+        bool restirTemporal{true};     // merge the reservoir the pixel ended the previous pass with
+        bool pathGuiding{false};         // cpu bsdf sampling mixed with directions learned in an SD-tree
+        int guidingIterations{5};        // learning iterations of 1, 2, 4, ... passes before the tree is frozen
+        float guidingBsdfFraction{0.5f}; // share of the bounces still sampled from the bsdf, kept above 0 so no direction is missed
+        bool radianceCache{false};       // cpu preview, paths end in a world space radiance cache after their first diffuse bounce
+        int radianceCachePasses{16};     // passes after a reset that preview before path tracing takes over, 0 previews for good
+        bool mlt{false};                      // cpu primary sample space Metropolis, for light transport paths rarely find
+        float mltLargeStepProbability{0.3f};  // mutations that draw a fresh path instead of perturbing the current one
+        int mltBootstrapSamples{1 << 16};     // independent paths that normalize the image and seed the chains
+        bool sppm{false};                     // cpu stochastic progressive photon mapping, for caustics through glass
+        int sppmPhotons{1 << 18};             // photons traced per pass
+        float sppmRadius{0.0f};               // gather radius of the first pass, 0 for 0.5% of the scene diagonal
+        int lookDevMode{0};    // CPU::LookDevMode, a lightweight integrator instead of full GI for blocking, 0 for off
+        float aoDistance{0.0f}; // ambient occlusion ray length, 0 for 10% of the scene diagonal
+        float adaptiveThreshold{0.0f}; // cpu adaptive sampling, relative error a pixel stops at, 0 disables
+        int adaptiveMinSamples{16};
+        float envMapIntensity{1.0f};
         SceneSettings(int image_width, int image_height, int maxBounceDepth = 4, int maxSamples = 128) : image_width(image_width), image_height(image_height), maxBounceDepth(maxBounceDepth), maxSamples(maxSamples) {}
         void printDebugInfo();
     };
@@ -32,10 +63,13 @@ namespace scTracer::Core
         void processScene();
 
         void deleteMeshes();
+        // loads an HDR environment map, an empty path removes it. threadPool, if given, builds its sampling tables
+        bool loadEnvMap(const std::string &filename, Utils::ThreadPool *threadPool = nullptr);
         void printDebugInfo();
 
         inline bool isDirty() const { return dirty; }
         inline bool isInitialized() const { return initialized; }
+        inline const BVH::BoundingBox &getSceneBounds() const { return sceneBounds; }
 
         bool dirty{true};
         bool instancesDirty{false};
@@ -48,14 +82,20 @@ namespace scTracer::Core
         Camera camera;
         SceneSettings settings;
         BVH::BVHFlattor bvhFlattor;
+        BVH::RayQuery rayQuery; // CPU side queries on bvhFlattor
+        BVH::LightBVH lightBVH; // CPU side queries on the analytic lights
+        BVH::LightSampler lightSampler; // CPU next event estimation over the lights and emissive triangles
 
         // assets
         std::vector<MaterialRaw> materials;
         std::vector<Material> materialDatas;
+        std::vector<ShadingMaterial> shadingMaterials; // cpu bsdf side of materialDatas, same indices
         std::vector<Texture *> textures;
         std::vector<unsigned char> textureMapsData;
+        TextureCache textureCache; // CPU side lookups on textureMapsData
         std::vector<Mesh *> meshes; // pointers to mesh because mesh is a heavy object
         std::vector<Light> lights;
+        EnvironmentMap envMap;
 
         // meshes data
         std::vector<glm::vec3> sceneVertices;
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace scTracer::Core
+{
+    class MipmappedTexture
+    { // RGBA8 mip pyramid, every level cut into square tiles whose texels are stored in Morton order
+    public:
+        static const int tileLog = 5;
+        static const int tileSize = 1 << tileLog;
+        static const int tileTexels = tileSize * tileSize;
+
+        void build(const unsigned char *rgba, int width, int height);
+
+        inline int numLevels() const { return int(mLevels.size()); }
+        inline int width(int level) const { return mLevels[level].width; }
+        inline int height(int level) const { return mLevels[level].height; }
+        inline int tilesX(int level) const { return mLevels[level].tilesX; }
+        inline const uint32_t *tile(int level, int tileIndex) const { return &mTexels[mLevels[level].offset + size_t(tileIndex) * tileTexels]; }
+
+        // position of texel (x, y) inside its tile
+        static inline int mortonIndex(int x, int y)
+        {
+            int index = 0;
+            for (int bit = 0; bit < tileLog; bit++)
+                index |= ((x >> bit) & 1) << (2 * bit) | ((y >> bit) & 1) << (2 * bit + 1);
+            return index;
+        }
+
+    private:
+        struct Level
+        {
+            int width, height;
+            int tilesX, tilesY;
+            size_t offset; // first texel in mTexels
+        };
+        std::vector<Level> mLevels;
+        std::vector<uint32_t> mTexels; // RGBA8, R in the low byte
+    };
+
+    // CPU lookups on Scene::textureMapsData. Tiles are decoded into a small per thread LRU cache,
+    // so the texels a bounce touches stay in cache as long as the lod keeps the footprint small
+    class TextureCache
+    {
+    public:
+        void build(const unsigned char *rgba, int numTextures, int width, int height);
+        void clear();
+
+        inline bool empty() const { return mTextures.empty(); }
+        inline int numTextures() const { return int(mTextures.size()); }
+        inline int width(int texID) const { return mTextures[texID].width(0); }
+        inline int height(int texID) const { return mTextures[texID].height(0); }
+
+        // trilinear lookup with repeat wrapping, lod 0 is the full resolution level
+        glm::vec4 sample(int texID, glm::vec2 uv, float lod) const;
+        // lod matching the uv footprint of a pixel, duvdx and duvdy in uv units
+        float lod(int texID, glm::vec2 duvdx, glm::vec2 duvdy) const;
+
+    private:
+        std::vector<MipmappedTexture> mTextures;
+        uint32_t mID{0}; // tells the thread caches apart from tiles of a previous build
+
+        glm::vec4 __bilinear(int texID, int level, glm::vec2 uv) const;
+        glm::vec4 __texel(int texID, int level, int x, int y) const;
+        // decoded tile from the calling thread's cache, valid until its next lookup
+        const glm::vec4 *__tile(int texID, int level, int tileIndex) const;
+    };
+}
@@ -2,6 +2,11 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <GL/gl3w.h>
 #include <glfw/glfw3.h>
 // imgui
@@ -16,67 +21,111 @@
 #include <utils.hpp>
 
 #include <cpu/integrator.hpp>
+#include <cpu/rendersession.hpp>
+#include <cpu/denoiser.hpp>
 namespace scTracer::CPU
 {
     class CPURenderer
     {
     public:
-        ~CPURenderer()
-        {
-            if (mHasCanvas)
-            {
-                delete[] mCanvas;
-            }
-        }
+        ~CPURenderer() { stopAsync(); }
 
+        // renders on the calling thread and shows the result, for offline use
         void render2Canvas(Core::Scene &scene)
         {
-            // prepare canvas
-
             if (!mHasCanvas)
             {
-                mCanvas = new float[scene.settings.image_width * scene.settings.image_height * 4];
-                mCanvasAccumulated = new float[scene.settings.image_width * scene.settings.image_height * 4];
                 std::cout << " New Canvas Created!" << std::endl;
                 mHasCanvas = true;
             }
-            else if (mCanvasHeight != scene.settings.image_height || mCanvasWidth != scene.settings.image_width)
-            {
-                assert("Canvas size mismatch" && false);
-            }
-            mCanvasHeight = scene.settings.image_height;
-            mCanvasWidth = scene.settings.image_width;
-            numOfSamples = scene.settings.maxSamples;
-
             mScene = &scene;
 
-            // render
-            mIntegrator = new Integrator(scene, mCanvas);
-            mIntegrator->render();
+            // render, the session restarts itself when the scene is dirty
+            mSession.render(scene, mSamplesPerCall, mTimeBudget);
 
-            // accumulate
+            // show the accumulated image
+            mCanvas = mShowVarianceMap ? mSession.getVarianceMap() : mSession.getImage();
+            mCanvasHeight = mSession.getHeight();
+            mCanvasWidth = mSession.getWidth();
+            if (mDenoise && !mShowVarianceMap)
+            { // filtered copy, the accumulation itself stays unbiased
+                mDenoised.resize(size_t(mCanvasWidth) * mCanvasHeight * 4);
+                mDenoiser.denoise(mSession.getImage(), mSession.getAov(), mSession.getMeanVariance(), mCanvasWidth, mCanvasHeight,
+                                  mDenoised.data(), mSession.getThreadPool());
+                mCanvas = mDenoised.data();
+            }
+            mCanvasAov = mSession.getAov();
+        }
 
-            // dump2File("output.ppm");
-            // dump to file if frame is max
-            // if (frameCounter == numOfSamples)
-            // {
-            //     dump2File("output.ppm");
-            //     frameCounter = 1;
-            // }
-            // else
+        // Asynchronous mode: a render thread accumulates passes while the UI thread shows the latest one it
+        // finished. The UI edits the scene with lockScene() held, which the render thread only waits for at the
+        // start of a pass, and calls renderAsync before letting go of it. An edit that dirties the scene cancels
+        // the pass in flight, so the next one starts from the edited scene right away
+        inline std::unique_lock<std::mutex> lockScene() { return std::unique_lock<std::mutex>(mSceneMutex); }
 
-            // store to accumulated buffer
-            float newRatio = 1.0 / frameCounter;
-            float oldRatio = 1 - newRatio;
-            for (int i = 0; i < mCanvasWidth * mCanvasHeight; ++i)
+        // with lockScene() held: keeps the render thread going on scene, starting it if needed
+        void renderAsync(Core::Scene &scene)
+        {
+            mScene = &scene;
+            if (scene.dirty)
+                mCancel = true;
+            mRefresh = mRefresh || mShowVarianceMap != mShownVarianceMap || mDenoise != mShownDenoise ||
+                       (mDenoise && (mDenoiser.iterations != mFilter.iterations || mDenoiser.colorSigma != mFilter.colorSigma ||
+                                     mDenoiser.depthSigma != mFilter.depthSigma));
+            if (!mRenderThread.joinable())
             {
-                mCanvasAccumulated[i * 4 + 0] = newRatio * mCanvas[i * 4 + 0] + oldRatio * mCanvasAccumulated[i * 4 + 0];
-                mCanvasAccumulated[i * 4 + 1] = newRatio * mCanvas[i * 4 + 1] + oldRatio * mCanvasAccumulated[i * 4 + 1];
-                mCanvasAccumulated[i * 4 + 2] = newRatio * mCanvas[i * 4 + 2] + oldRatio * mCanvasAccumulated[i * 4 + 2];
+                mSession.setCancelFlag(&mCancel);
+                mStopThread = false;
+                mIdle = false;
+                mRenderThread = std::thread(&CPURenderer::__renderLoop, this);
             }
+            mWakeUp.notify_one();
+        }
+
+        // with lockScene() held: waits for the pass in flight to stop, the scene may then change in any way, even
+        // be freed, until the lock goes. Pass renderAsync the new scene if it was swapped
+        void interruptAsync()
+        {
+            mCancel = true;
+            std::lock_guard<std::mutex> pass(mPassMutex);
+        }
+
+        // without lockScene() held
+        void stopAsync()
+        {
+            if (!mRenderThread.joinable())
+                return;
             {
-                frameCounter++;
+                std::lock_guard<std::mutex> lock(mSceneMutex);
+                mStopThread = true;
+                mCancel = true;
             }
+            mWakeUp.notify_one();
+            mRenderThread.join();
+        }
+
+        // idle while a pass is not running: in asynchronous mode once interruptAsync returned
+        inline Utils::ThreadPool *getThreadPool() { return mSession.getThreadPool(); }
+
+        // points mCanvas at the latest image the render thread finished, true if it is one not shown before
+        bool acquireFrame()
+        {
+            std::lock_guard<std::mutex> lock(mFrameMutex);
+            bool fresh = mFreshFrame;
+            if (fresh)
+            {
+                std::swap(mFront, mReady);
+                mFreshFrame = false;
+            }
+            Frame &frame = mFrames[mFront];
+            if (frame.image.empty())
+                return false;
+            mHasCanvas = true;
+            mCanvas = frame.image.data();
+            mCanvasAov = frame.aov.data();
+            mCanvasWidth = frame.width;
+            mCanvasHeight = frame.height;
+            return fresh;
         }
 
         void dump2File(std::string filename)
@@ -102,13 +151,96 @@ namespace scTracer::CPU
 
         // Scene
         Core::Scene *mScene{nullptr};
-        // canvas( a 2D array of pixels)
+        // canvas( a 2D array of pixels), owned by the session, or by the frame shown in asynchronous mode
         bool mHasCanvas{false};
         float *mCanvas{nullptr};
-        float *mCanvasAccumulated{nullptr};
+        const float *mCanvasAov{nullptr}; // AOV_CHANNELS per pixel, of the same samples
         int mCanvasWidth{0}, mCanvasHeight{0};
-        // integrator
-        Integrator *mIntegrator;
-        int numOfSamples{1}, frameCounter{1};
+        // session: integrator, workers, accumulation
+        RenderSession mSession;
+        int mSamplesPerCall{1};
+        double mTimeBudget{0.0}; // seconds per call, overrides mSamplesPerCall when > 0
+        bool mShowVarianceMap{false};
+        // denoise: filters what is shown, guided by the albedo, normal and depth of the first hits
+        bool mDenoise{false};
+        Denoiser mDenoiser;
+        std::vector<float> mDenoised;
+
+    private:
+        struct Frame
+        {
+            std::vector<float> image, aov;
+            int width{0}, height{0};
+        };
+
+        // render thread
+        std::thread mRenderThread;
+        std::mutex mSceneMutex; // held by the UI while it edits the scene, by the render thread while it reads it
+        std::mutex mPassMutex;  // held by the render thread while a pass runs
+        std::condition_variable mWakeUp;
+        std::atomic<bool> mCancel{false};
+        bool mStopThread{false}; // the rest is guarded by mSceneMutex
+        bool mRefresh{false};    // the display settings changed, the image is to be published again
+        bool mShownVarianceMap{false}, mShownDenoise{false};
+        bool mIdle{false};  // render thread only: converged, nothing to do until an edit
+        Denoiser mFilter;   // render thread only, with the settings of mDenoiser when the pass started
+        // triple buffer, the render thread fills mBack and swaps it with mReady, the UI shows mFront
+        Frame mFrames[3];
+        int mBack{0}, mReady{1}, mFront{2};
+        bool mFreshFrame{false}; // mReady holds a frame mFront has not had yet
+        std::mutex mFrameMutex;
+
+        void __renderLoop()
+        {
+            std::unique_lock<std::mutex> lock(mSceneMutex);
+            while (true)
+            {
+                mWakeUp.wait(lock, [&]
+                             { return mStopThread || !mIdle || mScene->dirty || mRefresh; });
+                if (mStopThread)
+                    break;
+                mCancel = false;
+                mRefresh = false;
+                mSession.prepare(*mScene);
+                mShownVarianceMap = mShowVarianceMap;
+                mShownDenoise = mDenoise;
+                mFilter.iterations = mDenoiser.iterations;
+                mFilter.colorSigma = mDenoiser.colorSigma;
+                mFilter.depthSigma = mDenoiser.depthSigma;
+                std::unique_lock<std::mutex> pass(mPassMutex);
+                lock.unlock();
+
+                mSession.renderPasses(mSamplesPerCall, mTimeBudget);
+                bool cancelled = mCancel;
+                if (!cancelled)
+                    __publishFrame();
+                mIdle = !cancelled && mSession.isConverged();
+
+                pass.unlock();
+                lock.lock();
+            }
+        }
+
+        // what render2Canvas would show, into the back buffer
+        void __publishFrame()
+        {
+            Frame &frame = mFrames[mBack];
+            frame.width = mSession.getWidth();
+            frame.height = mSession.getHeight();
+            size_t numPixels = size_t(frame.width) * frame.height;
+            frame.image.resize(numPixels * 4);
+            frame.aov.assign(mSession.getAov(), mSession.getAov() + numPixels * AOV_CHANNELS);
+            if (mShownVarianceMap)
+                std::copy(mSession.getVarianceMap(), mSession.getVarianceMap() + numPixels * 4, frame.image.begin());
+            else if (mShownDenoise)
+                mFilter.denoise(mSession.getImage(), mSession.getAov(), mSession.getMeanVariance(), frame.width, frame.height,
+                                frame.image.data(), mSession.getThreadPool());
+            else
+                std::copy(mSession.getImage(), mSession.getImage() + numPixels * 4, frame.image.begin());
+
+            std::lock_guard<std::mutex> lock(mFrameMutex);
+            std::swap(mBack, mReady);
+            mFreshFrame = true;
+        }
     };
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <cpu/sampler.hpp>
+#include <core/material.hpp>
 
 namespace scTracer::CPU
 {
@@ -25,15 +27,26 @@ namespace scTracer::CPU
 #define MEDIUM_SCATTER 2
 #define MEDIUM_EMISSIVE 3
 
-    extern glm::uvec4 seed;
-    extern glm::ivec2 pixel;
+#define MAX_SHADOW_RAYS 2 // env map + one light per bounce
+
+    // per thread, so tiles can be traced concurrently
+    extern thread_local glm::uvec4 seed;
+    extern thread_local glm::ivec2 pixel;
+    // sample stream of the current path, rand() walks the dimensions of the active sampler
+    extern thread_local const Sampler *activeSampler;
+    extern thread_local uint32_t sampleIndex;
+    extern thread_local uint32_t sampleDimension;
 
     struct Ray
     {
         glm::vec3 origin;
         glm::vec3 direction;
-        Ray() : origin(0.0f), direction(0.0f) {}
-        Ray(glm::vec3 o, glm::vec3 d) : origin(o), direction(d) {}
+        // rays through the neighbouring pixels in x and y, only camera rays carry them
+        bool hasDifferentials;
+        glm::vec3 rxOrigin, ryOrigin;
+        glm::vec3 rxDirection, ryDirection;
+        Ray() : origin(0.0f), direction(0.0f), hasDifferentials(false) {}
+        Ray(glm::vec3 o, glm::vec3 d) : origin(o), direction(d), hasDifferentials(false) {}
     };
 
     struct Medium
@@ -44,29 +57,6 @@ namespace scTracer::CPU
         float anisotropy;
     };
 
-    struct Material
-    {
-        glm::vec3 baseColor;
-        float opacity;
-        int alphaMode;
-        float alphaCutoff;
-        glm::vec3 emission;
-        float anisotropic;
-        float metallic;
-        float roughness;
-        float subsurface;
-        float specularTint;
-        float sheen;
-        float sheenTint;
-        float clearcoat;
-        float clearcoatRoughness;
-        float specTrans;
-        float ior;
-        float ax;
-        float ay;
-        Medium medium;
-    };
-
     struct Camera
     {
         glm::vec3 up;
@@ -90,6 +80,15 @@ namespace scTracer::CPU
         
     };
 
+    struct SphericalRect
+    { // a quad light as seen from a point, in the frame of the quad with the point at the origin. Urena et al. 2013
+        glm::vec3 x, y, z; // along u and v, z faces away from the point
+        float z0;          // distance to the plane, negative
+        float x0, x1, y0, y1;
+        float b0, b1, k;
+        float S; // solid angle
+    };
+
     struct State
     {
         int depth;
@@ -101,12 +100,16 @@ namespace scTracer::CPU
         glm::vec3 ffnormal;
         glm::vec3 tangent;
         glm::vec3 bitangent;
+        glm::vec3 dpdu; // world space, unnormalized tangent and bitangent
+        glm::vec3 dpdv;
 
         bool isEmitter;
+        int emitterIndex; // light sampler emitter of the hit, -1 if it does not emit
 
         glm::vec2 texCoord;
         int matID;
-        Material mat;
+        const Core::ShadingMaterial *mat; // baked table entry of matID, set by GetMaterial
+        Core::ShadingMaterial texturedMat; // what mat points to once TextureMaterial applied the texture maps
         Medium medium;
     };
 
@@ -128,11 +131,52 @@ namespace scTracer::CPU
         LightSampleRec() : normal(0.0f), emission(0.0f), direction(0.0f), dist(0.0f), pdf(0.0f) {}
     };
 
+    struct ShadowRay
+    { // next event estimation connection, the contribution counts once the segment is unoccluded
+        Ray ray;
+        float maxDist;
+        glm::vec3 contribution;
+    };
+
+    struct Reservoir;
+    struct GuidingPath;
+    struct CachePath;
+    struct VisiblePoint;
+    struct DeferredSample;
+
+    struct PathAOV
+    { // first hit of the path, what the denoiser tells edges apart by
+        glm::vec3 albedo;
+        float depth; // distance from the camera, 0 where the path missed
+        glm::vec3 normal;
+    };
+    const int AOV_CHANNELS = 8; // floats per pixel of an AOV canvas: albedo, depth, normal, one unused
+
+    struct PathState
+    { // what a path carries from one bounce to the next
+        glm::vec3 radiance;
+        glm::vec3 throughput;
+        ScatterSampleRec scatterSample; // last bsdf sample, its pdf weights the emitter hit next
+        glm::vec3 lightSamplePos;       // where the last bounce sampled a light from
+        glm::vec3 lightSampleNormal;
+        int depth;
+        const Reservoir *reservoir; // ReSTIR mode, holds the light sample of the first bounce
+        GuidingPath *guide;         // path guiding mode, the vertices the SD-tree learns from
+        CachePath *cache;           // radiance cache preview, where the path ends in the cache
+        VisiblePoint *visiblePoint; // photon mapping mode, the camera path records where it gathers photons
+        DeferredSample *deferredSample; // wavefront SIMD mode, the bsdf sample is left to the packet stage
+        PathAOV aov;
+        PathState() : radiance(0.0f), throughput(1.0f), lightSamplePos(0.0f), lightSampleNormal(0.0f), depth(0), reservoir(nullptr), guide(nullptr), cache(nullptr),
+                      visiblePoint(nullptr), deferredSample(nullptr),
+                      aov{glm::vec3(0.0f), 0.0f, glm::vec3(0.0f)} {}
+    };
+
     // RNG from code by Moroz Mykhailo (https://www.shadertoy.com/view/wltcRS)
 
     // internal RNG state
 
-    void InitRNG(glm::vec2 p, int frame);
+    // without a sampler rand() falls back to the sequential pcg4d stream
+    void InitRNG(glm::vec2 p, int frame, const Sampler *sampler = nullptr);
 
     void pcg4d(glm::uvec4 &v);
 
@@ -0,0 +1,35 @@
+#pragma once
+#include <vector>
+
+#include <utils/threadPool.hpp>
+
+namespace scTracer::CPU
+{
+    // Edge-avoiding a-trous wavelet filter, Dammertz et al. 2010, with the luminance weight of SVGF (Schied et al.
+    // 2017) that tolerates differences in proportion to the noise of the pixel. What is filtered is the illumination,
+    // the image divided by the albedo, so textures stay sharp. Normals and depth keep geometric edges.
+    // Rows run on the thread pool, 8 pixels of a row at a time
+    class Denoiser
+    {
+    public:
+        static const int maxIterations = 5;
+        int iterations{5};       // 5x5 passes with holes of 1, 2, 4, ... pixels between the taps
+        float colorSigma{4.0f};  // luminance difference tolerated, in standard deviations of the pixel's noise
+        float depthSigma{0.02f}; // relative depth difference tolerated per pixel of distance
+
+        // image RGBA, aov AOV_CHANNELS per pixel, meanVariance the variance of the mean luminance of every pixel.
+        // Writes RGBA to output, which must not alias image
+        void denoise(const float *image, const float *aov, const float *meanVariance, int width, int height, float *output,
+                     Utils::ThreadPool *threadPool);
+
+    private:
+        // one value per pixel, rows padded on both sides by the widest reach of a tap so the vector loads stay in
+        // bounds. The padding has a zero normal, which gives it no weight
+        int mStride{0}, mPad{0}, mWidth{0};
+        std::vector<float> mIllum[3], mVariance, mNextIllum[3], mNextVariance;
+        std::vector<float> mNormal[3], mDepth;
+        std::vector<float> mAlbedo[3]; // what the illumination was divided by
+
+        void __pass(int step, int width, int height, Utils::ThreadPool *threadPool);
+    };
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cpu/simd.hpp>
+#include <cpu/cpushader.hpp>
+
+namespace scTracer::CPU::SIMD
+{
+    struct ShadingPacket
+    { // 8 shading points stored SoA, one per lane; pad partial packets by repeating a point
+        vec3x8 baseColor;
+        vec3x8 Csheen;
+        vec3x8 specTint;
+        float8 metallic;
+        float8 roughness;
+        float8 subsurface;
+        float8 sheen;
+        float8 clearcoat;
+        float8 clearcoatRoughness;
+        float8 specTrans;
+        float8 ior;
+        float8 ax;
+        float8 ay;
+        float8 dielectricWt;
+        float8 baseLum;
+        float8 eta;
+        vec3x8 N; // shading normal, facing V
+        vec3x8 V; // towards the viewer, world space
+
+        void set(int lane, const State &state, const glm::vec3 &V, const glm::vec3 &N);
+    };
+
+    // 8-wide Integrator::DisneyEval: bsdf * |cos| towards world space L, pdf the solid angle pdf of DisneySample picking L
+    vec3x8 DisneyEval(const ShadingPacket &sp, const vec3x8 &L, float8 &pdf);
+    // 8-wide Integrator::DisneySample, r1 r2 r3 are the three numbers the scalar version draws, in that order
+    vec3x8 DisneySample(const ShadingPacket &sp, float8 r1, float8 r2, float8 r3, vec3x8 &L, float8 &pdf);
+}
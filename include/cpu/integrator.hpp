@@ -2,7 +2,9 @@
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <random>
+#include <memory>
+#include <chrono>
+#include <atomic>
 #include <GL/gl3w.h>
 #include <glfw/glfw3.h>
 // imgui
@@ -17,6 +19,15 @@
 #include <utils.hpp>
 #include <cpu/cpushader.hpp>
 #include <cpu/tonemap.hpp>
+#include <cpu/tilescheduler.hpp>
+#include <cpu/wavefront.hpp>
+#include <cpu/kernelfeatures.hpp>
+#include <cpu/restir.hpp>
+#include <cpu/pathguiding.hpp>
+#include <cpu/radiancecache.hpp>
+#include <cpu/mlt.hpp>
+#include <cpu/sppm.hpp>
+#include <cpu/lookdev.hpp>
 
 namespace scTracer::CPU
 {
@@ -25,6 +36,7 @@ namespace scTracer::CPU
         bool isCameraMoving;
         glm::vec3 randomVector;
         glm::vec2 resolution;
+        Camera camera; // copy of the scene's, which the UI may edit while a pass runs
 
         // sampler2D accumTexture;
         // samplerBuffer BVH;
@@ -40,6 +52,29 @@ namespace scTracer::CPU
         glm::vec3 uniformLightCol;
         int numOfLights;
         int maxDepth;
+        int rrDepth;
+        bool hasEnvMap;
+        float envMapIntensity;
+        bool wavefront;
+        WavefrontSort wavefrontSort;
+        bool wavefrontSimd;
+        bool restir;
+        int restirCandidates;
+        int restirSpatialNeighbors;
+        bool restirTemporal;
+        bool pathGuiding;
+        int guidingIterations;
+        float guidingBsdfFraction;
+        bool radianceCache;
+        int radianceCachePasses;
+        bool mlt;
+        float mltLargeStepProbability;
+        int mltBootstrapSamples;
+        bool sppm;
+        int sppmPhotons;
+        float sppmRadius;
+        LookDevMode lookDev;
+        float aoDistance;
         int topBVHIndex;
         int frameNum;
         float roughnessMollificationAmt;
@@ -47,9 +82,11 @@ namespace scTracer::CPU
 
     class Integrator
     {
+        friend struct SimdCheck; // tests/simdcheck.cpp, the packet kernels against the scalar ones
         // run this in window::renderer, after scene is prepared
     public:
-        Integrator(Core::Scene &scene, float *canvas) : mScene(&scene), mCanvas(canvas)
+        Integrator(Core::Scene &scene, float *canvas, Utils::ThreadPool *threadPool = nullptr, TileScheduler *tileScheduler = nullptr)
+            : mScene(&scene), mCanvas(canvas), mThreadPool(threadPool), mTileScheduler(tileScheduler)
         {
             _init();
         }
@@ -58,14 +95,105 @@ namespace scTracer::CPU
         }
         void render() // sample all pixels for one time
         {
-            for (int y = 0; y < mCanvasHeight; y++)
-                for (int x = 0; x < mCanvasWidth; x++)
-                    renderPixel(x, y);
+            if (uniforms.mlt)
+            {
+                __renderMLT();
+                mFrameNumber++;
+                return;
+            }
+            if (uniforms.sppm)
+            {
+                __renderSPPM();
+                if (!isCancelled()) // the pass count weights the estimates, a cancelled pass added nothing to them
+                    mFrameNumber++;
+                return;
+            }
+            if (uniforms.restir)
+            {
+                __renderRestir();
+                mFrameNumber++;
+                return;
+            }
+            if (uniforms.wavefront)
+            {
+                __renderWavefront();
+                mFrameNumber++;
+                return;
+            }
+
+            // the first radianceCachePasses passes after a reset preview through the cache, then path tracing takes over
+            mCachePreview = uniforms.radianceCache && (uniforms.radianceCachePasses <= 0 || mFrameNumber < uniforms.radianceCachePasses);
+            if (uniforms.radianceCache && mFrameNumber > 0 && mFrameNumber == uniforms.radianceCachePasses)
+                mRestartAccumulation = true;
+            if (mCachePreview)
+                __cacheBeginPass();
+            else if (uniforms.pathGuiding)
+                __guidingBeginPass();
+
+            // pixels only depend on (x, y, frame), so the tile order and thread count do not change the image.
+            // Preview passes are the exception, a pixel reads what the cache learned from the pixels before it
+            TileScheduler localScheduler;
+            TileScheduler &scheduler = mTileScheduler ? *mTileScheduler : localScheduler;
+            int numWorkers = mThreadPool ? mThreadPool->size() : 1;
+            scheduler.beginPass(mCanvasWidth, mCanvasHeight, Config::cpu_tile_size, numWorkers);
+
+            auto runWorker = [&](int worker, int)
+            {
+                Tile tile;
+                while (!isCancelled() && scheduler.next(worker, tile))
+                {
+                    auto begin = std::chrono::steady_clock::now();
+                    for (int y = tile.y0; y < tile.y1; y++)
+                        for (int x = tile.x0; x < tile.x1; x++)
+                            renderPixel(x, y);
+                    scheduler.reportCost(tile, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+                }
+            };
+            if (mThreadPool)
+                mThreadPool->parallelFor(numWorkers, runWorker);
+            else
+                runWorker(0, 0);
+            if (isCancelled())
+                scheduler.cancelPass();
+            if (mCachePreview)
+                __cacheEndPass();
             mFrameNumber++;
         }
         void renderPixel(int x, int y)
         {
-            __renderPixel(x, y);
+            int index = y * mCanvasWidth + x;
+            if (mPixelActive && !mPixelActive[index])
+                return;
+            __renderPixel(x, y, mPixelSampleIndices ? mPixelSampleIndices[index] : mFrameNumber);
+        }
+        void reset() // back to the first sample, picks up changed settings
+        {
+            _init();
+            mFrameNumber = 0;
+        }
+        inline void setThreadPool(Utils::ThreadPool *threadPool) { mThreadPool = threadPool; }
+        // AOV_CHANNELS floats per pixel, every pass writes the PathAOV of the pixels it samples there. nullptr skips them
+        inline void setAovCanvas(float *aovCanvas) { mAovCanvas = aovCanvas; }
+        // adaptive sampling: pixels with active[i] == 0 are skipped, the others draw sample sampleIndices[i]
+        inline void setAdaptiveState(const unsigned char *active, const int *sampleIndices)
+        {
+            mPixelActive = active;
+            mPixelSampleIndices = sampleIndices;
+        }
+        // once *cancel is set the pass in flight stops taking work, what it leaves in the canvas is garbage
+        inline void setCancelFlag(const std::atomic<bool> *cancel) { mCancel = cancel; }
+        inline bool isCancelled() const { return mCancel && mCancel->load(std::memory_order_relaxed); }
+        inline int getFrameNumber() const { return mFrameNumber; }
+        inline uint32_t getKernelFeatures() const { return mKernelFeatures; } // feature set of the kernel in use
+        // the canvas holds the estimate of every pass since the reset instead of the one of the last pass
+        inline bool isProgressive() const { return uniforms.sppm; }
+        // true when the last pass was the first one of a better estimate: path tracing after the radiance cache
+        // preview, or sampling a refined path guiding tree. The passes before are worse, the caller may drop them
+        inline bool takeRestart()
+        {
+            bool restart = mRestartAccumulation;
+            mRestartAccumulation = false;
+            return restart;
         }
 
     protected:
@@ -75,137 +203,427 @@ namespace scTracer::CPU
             mCanvasHeight = mScene->settings.image_height;
 
             uniforms.resolution = glm::vec2(mCanvasWidth, mCanvasHeight);
+            const Core::Camera &camera = mScene->camera;
+            uniforms.camera = {camera.mUp, camera.mRight, camera.mFront, camera.mPosition, camera.mFov, camera.mFocalDist, camera.mAperture};
             uniforms.topBVHIndex = mScene->bvhFlattor.topLevelIndex;
-            uniforms.maxDepth = mScene->settings.maxBounceDepth;
+            // look-dev modes trace every pixel in tiles on their own, the other modes only apply to full GI
+            uniforms.lookDev = LookDevMode(mScene->settings.lookDevMode);
+            bool fullGI = uniforms.lookDev == LookDevMode::Off;
+            uniforms.aoDistance = mScene->settings.aoDistance > 0.0f ? mScene->settings.aoDistance : 0.1f * glm::length(mScene->getSceneBounds().extents());
+            uniforms.maxDepth = uniforms.lookDev == LookDevMode::DirectLight ? 1 : mScene->settings.maxBounceDepth; // the bounce only looks for emitters
+            uniforms.rrDepth = mScene->settings.rrDepth;
+            uniforms.hasEnvMap = !mScene->envMap.empty();
+            uniforms.envMapIntensity = mScene->settings.envMapIntensity;
+            uniforms.wavefront = mScene->settings.wavefront && fullGI;
+            uniforms.wavefrontSort = WavefrontSort(mScene->settings.wavefrontSort);
+            uniforms.wavefrontSimd = mScene->settings.wavefrontSimd;
+            uniforms.restir = mScene->settings.restir && fullGI;
+            uniforms.restirCandidates = glm::max(1, mScene->settings.restirCandidates);
+            uniforms.restirSpatialNeighbors = glm::max(0, mScene->settings.restirSpatialNeighbors);
+            uniforms.restirTemporal = mScene->settings.restirTemporal;
+            mRestirHistory = false; // the reservoirs of the previous pass may belong to another view
+            uniforms.mlt = mScene->settings.mlt && fullGI;
+            uniforms.mltLargeStepProbability = glm::clamp(mScene->settings.mltLargeStepProbability, 0.0f, 1.0f);
+            uniforms.mltBootstrapSamples = glm::max(1, mScene->settings.mltBootstrapSamples);
+            mMltChains.clear(); // bootstrapped again for the new scene or view
+            uniforms.sppm = mScene->settings.sppm && fullGI && !uniforms.mlt;
+            uniforms.sppmPhotons = glm::max(1, mScene->settings.sppmPhotons);
+            uniforms.sppmRadius = glm::max(0.0f, mScene->settings.sppmRadius);
+            mSppmPixels.clear(); // radii start over
+            // the chains drive the sampling, photon mapping ends the paths where guiding would learn from
+            uniforms.pathGuiding = mScene->settings.pathGuiding && fullGI && !uniforms.mlt && !uniforms.sppm;
+            uniforms.guidingIterations = glm::max(0, mScene->settings.guidingIterations);
+            uniforms.guidingBsdfFraction = glm::clamp(mScene->settings.guidingBsdfFraction, 0.1f, 1.0f);
+            if (uniforms.pathGuiding)
+                mGuidingTree.reset(mScene->getSceneBounds());
+            mGuidingIteration = 0;
+            mGuidingPasses = 0;
+            mGuidingLearning = uniforms.pathGuiding && uniforms.guidingIterations > 0;
+            uniforms.radianceCache = mScene->settings.radianceCache && fullGI;
+            uniforms.radianceCachePasses = glm::max(0, mScene->settings.radianceCachePasses);
+            mCachePreview = false; // the cache itself is world space and outlives camera moves
+            mRestartAccumulation = false;
+
+            mSampler = createSampler(SamplerType(mScene->settings.samplerType), mScene->settings.maxSamples);
+            _selectKernel(sceneKernelFeatures(*mScene));
+            if (uniforms.lookDev == LookDevMode::AmbientOcclusion)
+                mTraceRayFn = &Integrator::__traceAO;
+            else if (uniforms.lookDev >= LookDevMode::Albedo)
+                mTraceRayFn = &Integrator::__traceFirstHit;
+        }
+
+        // the first instantiated kernel whose feature set covers the scene, the generic one otherwise
+        void _selectKernel(uint32_t features)
+        {
+#define SCTRACER_PICK_KERNEL(F)                                   \
+    if ((features & ~uint32_t(F)) == 0)                           \
+    {                                                             \
+        mTraceRayFn = &Integrator::__traceRay<uint32_t(F)>;       \
+        mShadePathFn = &Integrator::__shadePath<uint32_t(F)>;     \
+        mKernelFeatures = uint32_t(F);                            \
+        return;                                                   \
+    }
+            SCTRACER_KERNEL_FEATURE_SETS(SCTRACER_PICK_KERNEL)
+#undef SCTRACER_PICK_KERNEL
         }
 
     private:
         Core::Scene *mScene;
         UniformVars uniforms;
         float *mCanvas;
+        float *mAovCanvas{nullptr};
+        Utils::ThreadPool *mThreadPool;
+        TileScheduler *mTileScheduler;
+        std::unique_ptr<Sampler> mSampler;
+        const unsigned char *mPixelActive{nullptr};
+        const int *mPixelSampleIndices{nullptr};
+        const std::atomic<bool> *mCancel{nullptr};
         int mCanvasWidth, mCanvasHeight;
         int mFrameNumber{0};
+        // wavefront mode, kept between passes so the queues are allocated once
+        WavefrontPaths mPaths;
+        RayQueue mRayQueue, mNextRayQueue, mShadowQueue;
+        std::vector<int> mShadeOrder;
+        std::vector<int> mDeferredSlots; // paths whose bsdf sample the packet stage takes
+        std::vector<int> mActivePixels;
+        // ReSTIR mode, per pixel
+        std::vector<RestirSurface> mRestirSurfaces;
+        std::vector<RestirGeometry> mRestirPrevGeometry;
+        std::vector<Reservoir> mReservoirs, mPrevReservoirs, mSpatialReservoirs;
+        bool mRestirHistory{false}; // mPrevReservoirs hold the previous pass of the same view
+        // path guiding mode, learned over iterations of doubling length
+        SDTree mGuidingTree;
+        int mGuidingIteration{0};
+        int mGuidingPasses{0}; // passes of the current iteration so far
+        bool mGuidingLearning{false};
+        // radiance cache preview, shared by every pixel and kept across resets
+        RadianceCache mRadianceCache;
+        bool mCachePreview{false}; // the pass being rendered ends its paths in the cache
+        bool mRestartAccumulation{false};
+        // Metropolis mode, the chains carry on from one pass to the next
+        std::vector<MarkovChain> mMltChains;
+        std::unique_ptr<std::atomic<float>[]> mMltFilm; // RGB per pixel, what the chains splat in a pass
+        size_t mMltFilmSize{0};
+        float mMltNormalization{0.0f}; // mean luminance of the image, from the bootstrap paths and the large steps
+        double mMltLuminanceSum{0.0};
+        long long mMltLuminanceCount{0};
+        // photon mapping mode, per pixel estimates refined pass after pass
+        std::vector<SPPMPixel> mSppmPixels;
+        std::vector<std::vector<Photon>> mSppmJobPhotons; // what every job of the photon pass traced
+        std::vector<Photon> mSppmPhotons;
+        PhotonGrid mPhotonGrid;
+        std::vector<float> mSppmEmitterCdf; // by power, the environment map last
+        // kernel specialized to the scene's features, picked by _selectKernel
+        using TraceRayFn = glm::vec4 (Integrator::*)(Ray, PathAOV &);
+        using ShadePathFn = bool (Integrator::*)(bool, Ray &, State &, const LightSampleRec &, PathState &, ShadowRay *, int &);
+        TraceRayFn mTraceRayFn;
+        ShadePathFn mShadePathFn;
+        uint32_t mKernelFeatures{FeatureAll};
+
+        void __renderPixel(int x, int y, int sampleIndex)
+        {
+            // prepare RNG, dimensions 0-1 go to the pixel footprint and 2-3 to the lens
+            InitRNG(glm::vec2(x, y), sampleIndex, mSampler.get());
+
+            PathAOV aov;
+            glm::vec4 pixelColor = (this->*mTraceRayFn)(__generateCameraRay(x, y), aov);
+            // glm::vec4 pixelColor {0.1,0.0,1,1};
+
+            glm::vec4 color = pixelColor;
+
+            {
+                // color = CPU::toneMap(color);
+                mCanvas[(y * mCanvasWidth + x) * 4 + 0] = color.r;
+                mCanvas[(y * mCanvasWidth + x) * 4 + 1] = color.g;
+                mCanvas[(y * mCanvasWidth + x) * 4 + 2] = color.b;
+                mCanvas[(y * mCanvasWidth + x) * 4 + 3] = 1.0f;
+            }
+            __writeAov(y * mCanvasWidth + x, aov);
+        }
 
-        void __renderPixel(int x, int y)
+        inline void __writeAov(int index, const PathAOV &aov)
         {
-            // prepare RNG
-            uint32_t seed = static_cast<uint32_t>(y * mCanvasWidth + x) + mFrameNumber * 0x213;
-            std::mt19937 pixel_rng(seed);
-            std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+            if (!mAovCanvas)
+                return;
+            float *texel = &mAovCanvas[size_t(index) * AOV_CHANNELS];
+            texel[0] = aov.albedo.r;
+            texel[1] = aov.albedo.g;
+            texel[2] = aov.albedo.b;
+            texel[3] = aov.depth;
+            texel[4] = aov.normal.x;
+            texel[5] = aov.normal.y;
+            texel[6] = aov.normal.z;
+            texel[7] = 0.0f;
+        }
 
-            // prepare ray
+        Ray __generateCameraRay(int x, int y) // draws the first four dimensions of the rng set up by InitRNG
+        {
             glm::vec2 coords = glm::vec2(
                 (float)x / mCanvasWidth,
                 (float)y / mCanvasHeight);
 
-            float r1 = 2.0 * dist(pixel_rng);
-            float r2 = 2.0 * dist(pixel_rng);
+            float r1 = 2.0 * rand();
+            float r2 = 2.0 * rand();
             glm::vec2 jitter;
             jitter.x = r1 < 1.0 ? sqrtf(r1) - 1.0 : 1.0 - sqrtf(2.0 - r1);
             jitter.y = r2 < 1.0 ? sqrtf(r2) - 1.0 : 1.0 - sqrtf(2.0 - r2);
             jitter /= uniforms.resolution * 0.5f;
-            glm::vec2 d = (coords * 2.0f - 1.0f);
+            glm::vec2 d = (coords + 0.5f / uniforms.resolution) * 2.0f - 1.0f + jitter; // tent filter around the pixel center
 
-            float scale = tan(mScene->camera.mFov * 0.5f);
+            float scale = tan(uniforms.camera.fov * 0.5f);
 
             d.y *= uniforms.resolution.y / uniforms.resolution.x * scale;
             d.x *= scale;
-            glm::vec3 rayDir = glm::normalize(d.x * mScene->camera.mRight + d.y * mScene->camera.mUp + mScene->camera.mFront);
+            auto pixelDir = [&](glm::vec2 d)
+            { return glm::normalize(d.x * uniforms.camera.right + d.y * uniforms.camera.up + uniforms.camera.forward); };
+            glm::vec3 rayDir = pixelDir(d);
 
-            glm::vec3 focalPoint = mScene->camera.mFocalDist * rayDir;
+            glm::vec3 focalPoint = uniforms.camera.focalDist * rayDir;
             float cam_r1 = rand() * TWO_PI;
-            float cam_r2 = rand() * mScene->camera.mAperture;
-            glm::vec3 randomAperturePos = (cos(cam_r1) * mScene->camera.mRight + sin(cam_r1) * mScene->camera.mUp) * sqrt(cam_r2);
+            float cam_r2 = rand() * uniforms.camera.aperture;
+            glm::vec3 randomAperturePos = (cos(cam_r1) * uniforms.camera.right + sin(cam_r1) * uniforms.camera.up) * sqrt(cam_r2);
             glm::vec3 finalRayDir = glm::normalize(focalPoint - randomAperturePos);
 
-            Ray ray = Ray(mScene->camera.mPosition, finalRayDir);
-
-            glm::vec4 pixelColor = __traceRay(ray);
-            // glm::vec4 pixelColor {0.1,0.0,1,1};
-
-            glm::vec4 color = pixelColor;
-
-            {
-                // color = CPU::toneMap(color);
-                mCanvas[(y * mCanvasWidth + x) * 4 + 0] = color.r;
-                mCanvas[(y * mCanvasWidth + x) * 4 + 1] = color.g;
-                mCanvas[(y * mCanvasWidth + x) * 4 + 2] = color.b;
-                mCanvas[(y * mCanvasWidth + x) * 4 + 3] = 1.0f;
-            }
+            Ray ray(uniforms.camera.position, finalRayDir);
+            // the same lens sample and jitter through the next pixel in x and y, for the texture lod
+            float pixelSize = 2.0f * scale / uniforms.resolution.x;
+            ray.hasDifferentials = true;
+            ray.rxOrigin = ray.ryOrigin = ray.origin;
+            ray.rxDirection = glm::normalize(uniforms.camera.focalDist * pixelDir(d + glm::vec2(pixelSize, 0.0f)) - randomAperturePos);
+            ray.ryDirection = glm::normalize(uniforms.camera.focalDist * pixelDir(d + glm::vec2(0.0f, pixelSize)) - randomAperturePos);
+            return ray;
         }
 
-        glm::vec4 __traceRay(Ray ray)
+        template <uint32_t kFeatures>
+        glm::vec4 __traceRay(Ray ray, PathAOV &aov)
         {
-            glm::vec3 radiance = glm::vec3(0.0f);
-            float alpha = 1.0f;
-            glm::vec3 throughput = glm::vec3(1.0f);
-
+            PathState path;
             CPU::State state;
             CPU::LightSampleRec lightSample;
-            CPU::ScatterSampleRec scatterSample;
-
-            bool inMedium = false;
-            bool mediumSampled = false;
-            bool surfaceScatter = false;
-
+            ShadowRay shadowRays[MAX_SHADOW_RAYS];
             glm::vec3 debuger = glm::vec3(0.0f);
+            GuidingPath guide;
+            CachePath cache;
+            if (mCachePreview)
+                path.cache = &cache;
+            else if (uniforms.pathGuiding)
+            {
+                guide.learning = mGuidingLearning;
+                path.guide = &guide;
+            }
 
-            for (state.depth = 0;; state.depth++)
+            for (;;)
             {
                 bool hit = ClosestHit(ray, state, lightSample, debuger);
-                if (!hit)
-                {
-                    {
-                    }
+                int numShadowRays;
+                bool alive = __shadePath<kFeatures>(hit, ray, state, lightSample, path, shadowRays, numShadowRays);
+                for (int i = 0; i < numShadowRays; i++)
+                    if (!AnyHit(shadowRays[i].ray, shadowRays[i].maxDist))
+                        path.radiance += shadowRays[i].contribution;
+                if (path.guide)
+                    guide.close(path.radiance);
+                if (!alive)
                     break;
+            }
+            if (guide.numVertices > 0)
+                RecordGuidingPath(guide, path.radiance);
+            aov = path.aov;
+            if (path.cache)
+                return glm::vec4(FinishCachePath(cache, path.radiance), 1.0f);
+            return glm::vec4(path.radiance, 1.0f);
+        }
+
+        // one bounce at the closest hit of ray (or its miss): emission, next event estimation and the bsdf sample.
+        // The shadow rays come back unresolved so the megakernel and the wavefront stages share this code,
+        // returns false once the path ends, otherwise ray is its continuation.
+        // kFeatures is a KernelFeature mask, code for the features it lacks is compiled out
+        template <uint32_t kFeatures>
+        bool __shadePath(bool hit, Ray &ray, State &state, const LightSampleRec &lightSample, PathState &path, ShadowRay *shadowRays, int &numShadowRays)
+        {
+            numShadowRays = 0;
+            state.depth = path.depth;
+            if (!hit)
+            {
+                if ((kFeatures & FeatureEnvMap) != 0 && uniforms.hasEnvMap)
+                {
+                    float misWeight = 1.0f;
+                    if (state.depth > 0)
+                        misWeight = PowerHeuristic(path.scatterSample.pdf, mScene->envMap.pdf(ray.direction));
+                    glm::vec3 Le = mScene->envMap.eval(ray.direction) * uniforms.envMapIntensity;
+                    path.radiance += misWeight * Le * path.throughput;
+                    if (path.guide)
+                        path.guide->addExtra(state.depth, (1.0f - misWeight) * Le * path.throughput);
                 }
-                GetMaterial(state, ray);
+                return false;
+            }
 
-                if (state.isEmitter)
+            if ((kFeatures & FeatureAnalyticLights) != 0 && state.isEmitter)
+            {
+                float misWeight = 1.0;
+                if (state.depth > 0) // nothing once the reservoir of the first bounce accounted for it
+                    misWeight = path.reservoir && state.depth == 1 ? 0.0f : PowerHeuristic(path.scatterSample.pdf, lightSample.pdf * mScene->lightSampler.pmf(path.lightSamplePos, path.lightSampleNormal, state.emitterIndex));
+                path.radiance += misWeight * lightSample.emission * path.throughput; // direct light from the emitter
+                if (path.guide)
+                    path.guide->addExtra(state.depth, (1.0f - misWeight) * lightSample.emission * path.throughput);
+                if (state.depth == 0)
+                    path.aov = {glm::vec3(1.0f), state.hitDist, -ray.direction};
+                return false;
+            }
+            GetMaterial(state, ray); // analytic lights carry no material
+            if constexpr ((kFeatures & FeatureTextures) != 0)
+                TextureMaterial(state, ray);
+            if (state.depth == 0)
+                path.aov = {state.mat->baseColor, state.hitDist, state.ffnormal};
+
+            if ((kFeatures & FeatureEmissiveTriangles) != 0 && state.emitterIndex >= 0)
+            { // emissive triangle, emits on the side of its normals and keeps scattering
+                const BVH::EmissiveTriangle &tri = mScene->lightSampler.triangle(state.emitterIndex);
+                float cosTheta = glm::dot(-ray.direction, tri.normal);
+                if (cosTheta > 0.0f)
                 {
                     float misWeight = 1.0;
                     if (state.depth > 0)
-                        misWeight = PowerHeuristic(scatterSample.pdf, lightSample.pdf);
-                    radiance += misWeight * lightSample.emission * throughput; // direct light from the emitter
-                    break;
+                    {
+                        float lightPdf = state.hitDist * state.hitDist / (tri.area * cosTheta);
+                        misWeight = path.reservoir && state.depth == 1 ? 0.0f : PowerHeuristic(path.scatterSample.pdf, lightPdf * mScene->lightSampler.pmf(path.lightSamplePos, path.lightSampleNormal, state.emitterIndex));
+                    }
+                    path.radiance += misWeight * state.mat->emission * path.throughput;
+                    if (path.guide)
+                        path.guide->addExtra(state.depth, (1.0f - misWeight) * state.mat->emission * path.throughput);
                 }
+            }
 
-                if (state.depth == uniforms.maxDepth)
-                    break;
+            if (path.visiblePoint && VisiblePointVertex(state, ray, path))
+                return false;
+            if (path.cache && CacheVertex(state, path))
+                return false;
+            if (state.depth == uniforms.maxDepth)
+                return false;
 
-                {
-                    surfaceScatter = true;
-                    radiance += DirectLight(ray, state, true) * throughput;
-                    scatterSample.f = DisneySample(state, -ray.direction, state.ffnormal, scatterSample.L, scatterSample.pdf);
-                    if (scatterSample.pdf > 0.0)
-                        throughput *= scatterSample.f / scatterSample.pdf;
-                    else
-                        break;
+            {
+                if (path.guide)
+                    GuideBounce(state, *path.guide);
+                numShadowRays = DirectLight<kFeatures>(ray, state, true, shadowRays, state.depth == 0 ? path.reservoir : nullptr, path.guide);
+                for (int i = 0; i < numShadowRays; i++)
+                    shadowRays[i].contribution *= path.throughput;
+                path.lightSamplePos = state.fhp + float(EPS) * state.ffnormal;
+                path.lightSampleNormal = state.ffnormal;
+                if (path.guide)
+                    path.scatterSample.f = GuidedSample<kFeatures>(state, -ray.direction, *path.guide, path.scatterSample.L, path.scatterSample.pdf);
+                else if (path.deferredSample)
+                { // the packet stage samples the bsdf from the numbers DisneySample would draw, then calls __continuePath
+                    path.deferredSample->pending = true;
+                    path.deferredSample->r1 = rand();
+                    path.deferredSample->r2 = rand();
+                    path.deferredSample->r3 = rand();
+                    return true;
                 }
+                else
+                    path.scatterSample.f = DisneySample<kFeatures>(state, -ray.direction, state.ffnormal, path.scatterSample.L, path.scatterSample.pdf);
+            }
+            return __continuePath(ray, state, path);
+        }
 
-                ray.direction = scatterSample.L;
-                ray.origin = state.fhp + ray.direction * float(EPS);
+        // rest of the bounce once path.scatterSample holds the bsdf sample: throughput, russian roulette
+        // and the continuation ray
+        bool __continuePath(Ray &ray, const State &state, PathState &path)
+        {
+            if (path.scatterSample.pdf > 0.0)
+                path.throughput *= path.scatterSample.f / path.scatterSample.pdf;
+            else
+                return false;
+
+            // Russian roulette, the throughput already carries the albedo of the sampled lobe
+            if (uniforms.rrDepth >= 0 && state.depth >= uniforms.rrDepth)
+            {
+                float q = glm::min(glm::max(path.throughput.x, glm::max(path.throughput.y, path.throughput.z)) + 0.001f, 0.95f);
+                if (rand() > q)
+                    return false;
+                path.throughput /= q;
             }
-            return glm::vec4(radiance, alpha);
+
+            if (path.guide)
+                path.guide->push(state.depth, path.scatterSample.L, path.throughput, path.scatterSample.pdf);
+
+            ray.direction = path.scatterSample.L;
+            ray.origin = state.fhp + ray.direction * float(EPS);
+            ray.hasDifferentials = false;
+            path.depth++;
+            return true;
         }
 
-        // directlight.cpp
-        glm::vec3 Integrator::DirectLight(Ray r, State state, bool isSurface);
-        // disney.cpp
+        // wavefront.cpp
+        void Integrator::__renderWavefront();
+        void Integrator::__wavefrontGenerate(int begin, int end);
+        void Integrator::__wavefrontExtend();
+        void Integrator::__wavefrontShade();
+        void Integrator::__wavefrontSampleBsdf();
+        void Integrator::__wavefrontShadowConnect();
+        void Integrator::__wavefrontCompact();
+        // restir.cpp
+        void Integrator::__renderRestir();
+        void Integrator::__restirCandidates();
+        void Integrator::__restirTemporal();
+        void Integrator::__restirSpatial();
+        void Integrator::__restirShade();
+        glm::vec3 Integrator::RestirContribution(const State &state, glm::vec3 V, const RestirSample &y, Ray &shadowRay, float &maxDist);
+        float Integrator::RestirTargetPdf(const RestirSurface &surface, const RestirSample &y);
+        // pathguiding.cpp
+        void Integrator::__guidingBeginPass();
+        void Integrator::GuideBounce(const State &state, GuidingPath &guide);
+        float Integrator::GuidedPdf(const GuidingPath &guide, glm::vec3 L, float bsdfPdf);
+        void Integrator::RecordGuidingPath(const GuidingPath &guide, glm::vec3 radiance);
+        // GuidedSample instantiated for SCTRACER_KERNEL_FEATURE_SETS
+        template <uint32_t kFeatures = FeatureAll>
+        glm::vec3 GuidedSample(State state, glm::vec3 V, GuidingPath &guide, glm::vec3 &L, float &pdf);
+        // radiancecache.cpp
+        void Integrator::__cacheBeginPass();
+        void Integrator::__cacheEndPass();
+        bool Integrator::CacheVertex(const State &state, PathState &path);
+        glm::vec3 Integrator::FinishCachePath(const CachePath &cache, glm::vec3 radiance);
+        // mlt.cpp
+        void Integrator::__renderMLT();
+        void Integrator::__mltBootstrap();
+        void Integrator::__mltAovPass();
+        glm::vec3 Integrator::MLTPath(MLTSampler &sampler, glm::ivec2 &pixel);
+        // sppm.cpp
+        void Integrator::__renderSPPM();
+        void Integrator::__sppmEmitters();
+        void Integrator::__sppmCameraPass();
+        void Integrator::__sppmPhotonPass();
+        void Integrator::__sppmGather();
+        bool Integrator::VisiblePointVertex(const State &state, const Ray &ray, PathState &path);
+        bool Integrator::EmitPhoton(Ray &ray, glm::vec3 &power);
+        // lookdev.cpp
+        glm::vec4 Integrator::__traceAO(Ray ray, PathAOV &aov);
+        glm::vec4 Integrator::__traceFirstHit(Ray ray, PathAOV &aov);
+        bool Integrator::LookDevHit(Ray ray, State &state, PathAOV &aov);
+        // directlight.cpp, instantiated for SCTRACER_KERNEL_FEATURE_SETS
+        template <uint32_t kFeatures = FeatureAll>
+        bool SampleEmitter(glm::vec3 scatterPos, glm::vec3 normal, LightSampleRec &lightSample, float &lightArea);
+        template <uint32_t kFeatures = FeatureAll>
+        int DirectLight(Ray r, State state, bool isSurface, ShadowRay *shadowRays, const Reservoir *reservoir = nullptr, const GuidingPath *guide = nullptr);
+        // disney.cpp, DisneyEval and DisneySample instantiated for SCTRACER_KERNEL_FEATURE_SETS
+        template <uint32_t kFeatures = FeatureAll>
+        glm::vec3 DisneyEval(State state, glm::vec3 V, glm::vec3 N, glm::vec3 L, float &pdf);
+        template <uint32_t kFeatures = FeatureAll>
+        glm::vec3 DisneySample(State state, glm::vec3 V, glm::vec3 N, glm::vec3 &L, float &pdf);
         glm::vec3 Integrator::ToLocal(glm::vec3 X, glm::vec3 Y, glm::vec3 Z, glm::vec3 V);
-        glm::vec3 Integrator::DisneyEval(State state, glm::vec3 V, glm::vec3 N, glm::vec3 L, float &pdf);
-        void Integrator::TintColors(Material mat, float eta, float F0, glm::vec3 &Csheen, glm::vec3 &Cspec0);
-        glm::vec3 Integrator::EvalDisneyDiffuse(Material mat, glm::vec3 Csheen, glm::vec3 V, glm::vec3 L, glm::vec3 H, float &pdf);
-        glm::vec3 Integrator::DisneySample(State state, glm::vec3 V, glm::vec3 N, glm::vec3 &L, float &pdf);
-        glm::vec3 Integrator::EvalMicrofacetReflection(Material mat, glm::vec3 V, glm::vec3 L, glm::vec3 H, glm::vec3 F, float &pdf);
-        glm::vec3 Integrator::EvalMicrofacetRefraction(Material mat, float eta, glm::vec3 V, glm::vec3 L, glm::vec3 H, glm::vec3 F, float &pdf);
+        void Integrator::TintColors(const Core::ShadingMaterial &mat, float eta, float &F0, glm::vec3 &Csheen, glm::vec3 &Cspec0);
+        glm::vec3 Integrator::EvalDisneyDiffuse(const Core::ShadingMaterial &mat, glm::vec3 Csheen, glm::vec3 V, glm::vec3 L, glm::vec3 H, float &pdf);
+        glm::vec3 Integrator::EvalMicrofacetReflection(const Core::ShadingMaterial &mat, glm::vec3 V, glm::vec3 L, glm::vec3 H, glm::vec3 F, float &pdf);
+        glm::vec3 Integrator::EvalMicrofacetRefraction(const Core::ShadingMaterial &mat, float eta, glm::vec3 V, glm::vec3 L, glm::vec3 H, glm::vec3 F, float &pdf);
         glm::vec3 Integrator::ToWorld(glm::vec3 X, glm::vec3 Y, glm::vec3 Z, glm::vec3 V);
-        glm::vec3 Integrator::EvalClearcoat(Material mat, glm::vec3 V, glm::vec3 L, glm::vec3 H, float &pdf);
+        glm::vec3 Integrator::EvalClearcoat(const Core::ShadingMaterial &mat, glm::vec3 V, glm::vec3 L, glm::vec3 H, float &pdf);
         // hit.cpp
         void Integrator::GetMaterial(State &state, Ray r);
+        void Integrator::TextureMaterial(State &state, Ray r);
+        void Integrator::TexCoordDifferentials(const State &state, Ray r, glm::vec2 &duvdx, glm::vec2 &duvdy);
         bool Integrator::AnyHit(Ray r, float maxDist);
 
         bool Integrator::ClosestHit(Ray r, State &state, LightSampleRec &lightSample, glm::vec3 &debugger);
+        float Integrator::IntersectEmitters(Ray r, State &state, LightSampleRec &lightSample);
+        bool Integrator::FillHitState(Ray r, const BVH::QueryHit &hit, float t, State &state);
         // intersection.cpp
         float Integrator::SphereIntersect(float rad, glm::vec3 pos, Ray r);
         float Integrator::AABBIntersect(glm::vec3 minCorner, glm::vec3 maxCorner, Ray r);
@@ -213,10 +631,15 @@ namespace scTracer::CPU
         // sampling.cpp
         float Integrator::SchlickWeight(float u);
         glm::vec3 Integrator::UniformSampleHemisphere(float r1, float r2);
-        void Integrator::Onb(glm::vec3 N, glm::vec3 &T, glm::vec3 B);
+        void Integrator::Onb(glm::vec3 N, glm::vec3 &T, glm::vec3 &B);
         void Integrator::SampleRectLight(Light light, glm::vec3 scatterPos, LightSampleRec &lightSample);
         void Integrator::SampleSphereLight(Light light, glm::vec3 scatterPos, LightSampleRec &lightSample);
+        float Integrator::RectLightPdf(glm::vec3 position, glm::vec3 u, glm::vec3 v, float area, glm::vec3 scatterPos, float distSq, float cosTheta);
+        float Integrator::SphereLightPdf(glm::vec3 center, float radius, float area, glm::vec3 scatterPos, float distSq, float cosTheta);
+        bool Integrator::SphericalRectInit(glm::vec3 position, glm::vec3 u, glm::vec3 v, glm::vec3 scatterPos, SphericalRect &rect);
+        glm::vec3 Integrator::SampleSphericalRect(const SphericalRect &rect, float r1, float r2);
         void Integrator::SampleDistantLight(Light light, glm::vec3 scatterPos, LightSampleRec &lightSample);
+        void Integrator::SampleTriangleLight(const BVH::EmissiveTriangle &tri, glm::vec3 scatterPos, LightSampleRec &lightSample);
         glm::vec3 Integrator::SampleHG(glm::vec3 V, float g, float r1, float r2);
         float Integrator::PhaseHG(float cosTheta, float g);
         void Integrator::SampleOneLight(Light light, glm::vec3 scatterPos, LightSampleRec &lightSample);
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+
+#include <core/scene.hpp>
+
+namespace scTracer::CPU
+{
+    // What a scene asks of the integrator. A kernel compiled without a feature drops its code,
+    // which is only valid because a scene lacking the feature never reaches that code anyway
+    enum KernelFeature : uint32_t
+    {
+        FeatureRectLight = 1 << 0,
+        FeatureSphereLight = 1 << 1,
+        FeatureDistantLight = 1 << 2,
+        FeatureEmissiveTriangles = 1 << 3,
+        FeatureEnvMap = 1 << 4,
+        FeatureMetal = 1 << 5,     // metallic > 0
+        FeatureGlass = 1 << 6,     // specTrans > 0 on a not fully metallic material
+        FeatureClearcoat = 1 << 7, // clearcoat > 0
+        FeatureTextures = 1 << 8,  // some material uses a texture map
+
+        FeatureAnalyticLights = FeatureRectLight | FeatureSphereLight | FeatureDistantLight,
+        FeatureAll = (1 << 9) - 1,
+    };
+
+// The instantiated kernels, a scene runs the first one covering its features.
+// FeatureAll is the generic kernel and has to stay last, it catches everything
+#define SCTRACER_KERNEL_FEATURE_SETS(X)                                                                  \
+    X(FeatureRectLight)                                                                                  \
+    X(FeatureRectLight | FeatureMetal)                                                                   \
+    X(FeatureRectLight | FeatureEmissiveTriangles | FeatureEnvMap | FeatureMetal)                        \
+    X(FeatureAnalyticLights | FeatureEmissiveTriangles | FeatureEnvMap | FeatureMetal | FeatureTextures) \
+    X(FeatureAll)
+
+    uint32_t sceneKernelFeatures(const Core::Scene &scene);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace scTracer::CPU
+{
+    enum class LookDevMode
+    { // lightweight integrators for blocking and camera work, traced in tiles like the path tracer
+        Off,              // full global illumination
+        AmbientOcclusion, // one cosine weighted occlusion ray of limited length
+        DirectLight,      // emitters and next event estimation at the first hit, no bounces
+        Albedo,           // first hit only, textured base color
+        Normal,           // first hit only, world space shading normal
+        MaterialId,       // first hit only, a color per material
+    };
+
+    const std::vector<std::string> lookDevModeStrings{
+        "Off",
+        "Ambient occlusion",
+        "Direct light",
+        "Albedo",
+        "Normals",
+        "Material ID"};
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <cpu/sampler.hpp>
+
+namespace scTracer::CPU
+{
+    // Primary sample space of a Markov chain, Kelemen et al. 2002 as in pbrt-v3. Unlike the other samplers it
+    // is stateful: the dimensions a path draws are the coordinates of the chain's current state, mutated lazily
+    // the first time an iteration reads them. One chain per sampler, used by one thread at a time
+    class MLTSampler : public Sampler
+    {
+    public:
+        MLTSampler() = default;
+        // the same seed gives the same first state, so a chain can start from a bootstrap path
+        MLTSampler(uint32_t seed, float sigma, float largeStepProbability);
+
+        // pixel and sample index are ignored, the state is the sample
+        float get1D(glm::ivec2 pixel, uint32_t sampleIndex, uint32_t dimension) const override;
+
+        // proposes the next state, a large step draws every dimension afresh, a small one perturbs them
+        void startIteration();
+        void accept();
+        void reject(); // back to the state before startIteration
+        float uniform() const; // from the chain's own stream, for the acceptance test
+        inline bool isLargeStep() const { return mLargeStep; }
+
+    private:
+        struct PrimarySample
+        {
+            float value{0.0f};
+            int64_t lastModification{0}; // iteration that last set value
+            float valueBackup{0.0f};
+            int64_t modificationBackup{0};
+        };
+        // get1D mutates on demand, the const of the interface is only towards the caller
+        mutable std::vector<PrimarySample> mX;
+        mutable glm::uvec4 mRng{0u};
+        float mSigma{0.01f};
+        float mLargeStepProbability{0.3f};
+        int64_t mIteration{0};
+        int64_t mLastLargeStep{0};
+        bool mLargeStep{true}; // the first state is a large step from nothing
+
+        void __ensureReady(uint32_t dimension) const;
+    };
+
+    struct MarkovChain
+    {
+        MLTSampler sampler;
+        glm::vec3 radiance{0.0f}; // of the current state
+        glm::ivec2 pixel{0};      // where the current state lands
+        // large steps are independent paths, they refine the normalization of the bootstrap. Summed per pass
+        double largeStepLuminance{0.0};
+        long long largeSteps{0};
+    };
+}
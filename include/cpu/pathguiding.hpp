@@ -0,0 +1,50 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <cpu/sdtree.hpp>
+
+namespace scTracer::CPU
+{
+    const int MAX_GUIDING_VERTICES = 32;
+
+    struct GuidingVertex
+    { // a scattering event whose outgoing direction the SD-tree learns from
+        int leaf;              // SDTree leaf of the hit
+        int depth;             // bounce it was sampled at
+        glm::vec3 direction;   // sampled direction
+        glm::vec3 throughput;  // path throughput past the sample, what later radiance is divided by
+        float pdf;             // mixture pdf direction was drawn with
+        glm::vec3 radianceStart; // path radiance before anything seen along direction arrived
+        glm::vec3 extraRadiance; // emission hit along direction that MIS gave to the light sample instead
+    };
+
+    struct GuidingPath
+    { // the vertices of one path, recorded into the building trees once the path ends
+        GuidingVertex vertices[MAX_GUIDING_VERTICES];
+        int numVertices{0};
+        int numClosed{0};   // vertices whose radianceStart is set
+        int leaf{-1};       // leaf of the bounce being shaded
+        float bsdfFraction{1.0f}; // its share of bsdf samples, 1 where nothing was learned yet
+        bool learning{false};
+
+        inline void push(int depth, glm::vec3 direction, glm::vec3 throughput, float pdf)
+        {
+            if (!learning || leaf < 0 || numVertices == MAX_GUIDING_VERTICES)
+                return;
+            vertices[numVertices++] = {leaf, depth, direction, throughput, pdf, glm::vec3(0.0f), glm::vec3(0.0f)};
+        }
+        // called once the shadow rays of a bounce are resolved, they do not arrive along its sampled direction
+        inline void close(glm::vec3 radiance)
+        {
+            for (; numClosed < numVertices; numClosed++)
+                vertices[numClosed].radianceStart = radiance;
+        }
+        // what an emitter hit at bounce depth contributes beyond its MIS weighted share, for the vertex
+        // whose direction led there
+        inline void addExtra(int depth, glm::vec3 radiance)
+        {
+            if (numVertices > 0 && vertices[numVertices - 1].depth == depth - 1)
+                vertices[numVertices - 1].extraRadiance += radiance;
+        }
+    };
+}
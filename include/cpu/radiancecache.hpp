@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include <glm/glm.hpp>
+
+namespace scTracer::CPU
+{
+    // World space hash grid of outgoing radiance, Binder et al. 2019. Cells grow with the distance to the camera
+    // so they cover about the same number of pixels, and are split by the dominant axis of the normal so the two
+    // sides of a wall do not mix. Every render thread inserts and updates cells without locks
+    class RadianceCache
+    {
+    public:
+        // drops every cell, sized by Config::cpu_radiance_cache_cells
+        void reset();
+        // cells cover about pixelsPerCell pixels at their distance from camera, for a camera of horizontal
+        // field of view fov rendering width columns
+        void setView(glm::vec3 camera, float fov, int width, float pixelsPerCell);
+
+        // the mean radiance recorded in the cell of position, false while nothing was recorded there
+        bool query(glm::vec3 position, glm::vec3 normal, glm::vec3 &radiance) const;
+        // safe from any thread
+        void update(glm::vec3 position, glm::vec3 normal, glm::vec3 radiance);
+        // end of a pass: cells keep at most maxSamples worth of history, so the cache follows a changing scene,
+        // and the ones left unused for a while are freed
+        void endPass(float maxSamples);
+
+        inline bool empty() const { return !mCells; }
+        inline uint32_t numCells() const { return mNumCells; }
+
+    private:
+        struct Cell
+        {
+            std::atomic<uint32_t> checksum; // 0 for a free cell
+            std::atomic<float> sum[3];
+            std::atomic<float> count;
+            std::atomic<uint32_t> lastPass; // pass of the last update
+        };
+        std::unique_ptr<Cell[]> mCells;
+        uint32_t mNumCells{0};
+        glm::vec3 mCamera{0.0f};
+        float mCellScale{1.0f}; // cell size per unit of distance from the camera
+        uint32_t mPass{0};
+
+        // slot of the cell holding position, inserting it when insert is set, -1 when it is not there (or the
+        // probe sequence is full)
+        int __find(glm::vec3 position, glm::vec3 normal, bool insert) const;
+    };
+
+    struct CachePath
+    { // preview mode: the path ends in the cache at the hit after its first diffuse bounce
+        bool afterDiffuse{false}; // the last bounce scattered off a rough surface
+        bool training{false};     // past the cached hit, tracing one more bounce to update it with
+        bool hasCached{false};    // the cached hit had a value to show
+        glm::vec3 position;       // cached hit
+        glm::vec3 normal;
+        glm::vec3 cached;         // its value in the cache
+        glm::vec3 radiance;       // what the path gathered up to the cached hit
+        glm::vec3 throughput;     // path throughput at the cached hit
+    };
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <core/scene.hpp>
+#include <utils/threadPool.hpp>
+#include <cpu/integrator.hpp>
+#include <cpu/tilescheduler.hpp>
+
+namespace scTracer::CPU
+{
+    class RenderSession
+    { // owns everything that must survive between frames of the cpu renderer
+    public:
+        RenderSession() = default;
+        ~RenderSession() = default;
+
+        // Spends `samples` spp worth of pixel samples, or keeps sampling until `timeBudget` seconds are spent when it is > 0.
+        // With adaptive sampling on, converged pixels drop out and their share goes to the noisy ones.
+        // Restarts the accumulation first when the scene is dirty, was swapped or resized.
+        void render(Core::Scene &scene, int samples = 1, double timeBudget = 0.0);
+        // render() in two steps, for a caller that renders while another thread may edit the scene: prepare reads
+        // the scene and must not overlap the edits, renderPasses only reads what the edits leave alone
+        void prepare(Core::Scene &scene);
+        void renderPasses(int samples = 1, double timeBudget = 0.0);
+        // a pass cancelled through it is dropped and the next prepare restarts the accumulation
+        void setCancelFlag(const std::atomic<bool> *cancel);
+        // Drops the accumulated samples, buffers and workers are kept
+        void reset();
+
+        // average spp over the image
+        inline int getSampleCount() const { return mWidth * mHeight > 0 ? int(mSpentSamples / (long long)(mWidth * mHeight)) : 0; }
+        inline int getPassCount() const { return mPasses; }
+        inline int getActivePixels() const { return mActivePixels; }
+        inline bool isConverged() const
+        {
+            return mActivePixels == 0 || (mMaxSamples != -1 && mSpentSamples >= (long long)mMaxSamples * mWidth * mHeight);
+        }
+        inline int getWidth() const { return mWidth; }
+        inline int getHeight() const { return mHeight; }
+        // RGBA, mean of all samples so far
+        inline float *getImage() { return mImage.data(); }
+        // AOV_CHANNELS per pixel, PathAOV of the first hits averaged like the image
+        inline const float *getAov() const { return mAov.data(); }
+        // per pixel, variance of the mean luminance of the image
+        inline const float *getMeanVariance() const { return mMeanVariance.data(); }
+        // RGBA, r: relative error, g: spp / maxSamples, b: 1 once converged. Only filled while adaptive sampling is on
+        inline float *getVarianceMap() { return mVarianceMap.data(); }
+        inline TileScheduler &getTileScheduler() { return mTileScheduler; }
+        inline Utils::ThreadPool *getThreadPool() { return mThreadPool.get(); }
+
+    private:
+        Core::Scene *mScene{nullptr};
+        int mWidth{0}, mHeight{0};
+        int mMaxSamples{-1};
+        int mPasses{0};
+        long long mSpentSamples{0}; // pixel samples since the last reset
+        int mActivePixels{0};
+        float mAdaptiveThreshold{0.0f};
+        int mAdaptiveMinSamples{16};
+        const std::atomic<bool> *mCancel{nullptr};
+        bool mStale{false}; // a pass was cancelled, the integrator's state is of no use
+
+        std::unique_ptr<Utils::ThreadPool> mThreadPool;
+        TileScheduler mTileScheduler;
+        std::unique_ptr<Integrator> mIntegrator;
+
+        std::vector<float> mSample; // scratch, the integrator writes one spp here
+        std::vector<float> mAccum;  // running sum
+        std::vector<float> mImage;  // mAccum / mSampleCounts
+        std::vector<float> mAovSample, mAovAccum, mAov; // the same for the AOVs
+
+        // adaptive sampling, per pixel
+        std::vector<int> mSampleCounts;
+        std::vector<unsigned char> mActive;
+        std::vector<float> mLumMean, mLumM2; // Welford running mean / M2 of the luminance
+        std::vector<float> mError;           // relative standard error of the mean
+        std::vector<float> mMeanVariance;    // its variance, what the denoiser scales its luminance weight by
+        std::vector<float> mVarianceMap;
+
+        void __prepare(Core::Scene &scene);
+        void __clearAccumulation();
+        void __accumulate();
+        void __updateActivePixels();
+    };
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <cpu/cpushader.hpp>
+
+namespace scTracer::CPU
+{
+    struct RestirSample
+    { // a point on an emitter, stored in area measure so other pixels can evaluate it
+        glm::vec3 position; // for distant lights the direction towards the light
+        glm::vec3 normal;
+        glm::vec3 emission;
+        bool distant;
+    };
+
+    struct Reservoir
+    { // weighted reservoir sampling over light samples, Bitterli et al. 2020
+        RestirSample y;
+        float wSum{0.0f};
+        float M{0.0f};         // number of candidates seen, the merged ones included
+        float W{0.0f};         // unbiased contribution weight of y
+        float targetPdf{0.0f}; // luminance of the unshadowed contribution of y at the owner
+
+        // streams in a candidate of resampling weight w standing for count candidates, u uniform in [0, 1)
+        inline bool add(const RestirSample &sample, float w, float count, float u, float samplePdf)
+        {
+            wSum += w;
+            M += count;
+            if (w > 0.0f && u * wSum < w)
+            {
+                y = sample;
+                targetPdf = samplePdf;
+                return true;
+            }
+            return false;
+        }
+        inline void finalize() { W = targetPdf > 0.0f ? wSum / (M * targetPdf) : 0.0f; }
+    };
+
+    struct RestirSurface
+    { // the first hit of a pixel, what the target pdf needs to be evaluated there
+        Core::ShadingMaterial mat; // textures applied
+        glm::vec3 position;
+        float eta;
+        glm::vec3 normal; // ffnormal
+        float depth;      // distance from the camera
+        glm::vec3 V;
+        uint32_t dimension; // sampler dimension the pixel's path continues from
+        bool valid;         // a surface was hit, emitters and misses are not
+    };
+
+    struct RestirGeometry
+    { // what the next pass compares against before reusing a reservoir of this pass
+        glm::vec3 normal;
+        float depth;
+    };
+}
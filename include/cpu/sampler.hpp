@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace scTracer::CPU
+{
+    enum class SamplerType
+    {
+        PCG,   // independent hashed random numbers
+        Sobol, // Owen scrambled Sobol, Burley 2020
+        CMJ,   // correlated multi-jittered, Kensler 2013
+    };
+
+    const std::vector<std::string> samplerTypeStrings{
+        "PCG",
+        "Sobol",
+        "CMJ"};
+
+    class Sampler
+    { // stateless, a value only depends on (pixel, sample index, dimension) so any thread can draw any sample
+    public:
+        virtual ~Sampler() = default;
+        virtual float get1D(glm::ivec2 pixel, uint32_t sampleIndex, uint32_t dimension) const = 0;
+        // dimension and dimension + 1 of the same stratified 2D pattern
+        virtual glm::vec2 get2D(glm::ivec2 pixel, uint32_t sampleIndex, uint32_t dimension) const
+        {
+            return glm::vec2(get1D(pixel, sampleIndex, dimension), get1D(pixel, sampleIndex, dimension + 1));
+        }
+    };
+
+    class PCGSampler : public Sampler
+    {
+    public:
+        float get1D(glm::ivec2 pixel, uint32_t sampleIndex, uint32_t dimension) const override;
+    };
+
+    class SobolSampler : public Sampler
+    { // 2D Sobol per pair of dimensions, decorrelated between pairs by shuffling the index (padding)
+    public:
+        float get1D(glm::ivec2 pixel, uint32_t sampleIndex, uint32_t dimension) const override;
+    };
+
+    class CMJSampler : public Sampler
+    { // m x n multi-jittered pattern per pair of dimensions, sized for the expected spp
+    public:
+        explicit CMJSampler(int samplesPerPixel);
+        float get1D(glm::ivec2 pixel, uint32_t sampleIndex, uint32_t dimension) const override;
+        glm::vec2 get2D(glm::ivec2 pixel, uint32_t sampleIndex, uint32_t dimension) const override;
+
+    private:
+        uint32_t mM, mN;
+    };
+
+    std::unique_ptr<Sampler> createSampler(SamplerType type, int samplesPerPixel);
+}
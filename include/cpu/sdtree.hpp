@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <bvh/bb.hpp>
+#include <utils/atomicUtils.hpp>
+
+namespace scTracer::CPU
+{
+    // Directional distribution of a region of space, Mueller et al. 2017. A quadtree over the square of
+    // cylindrical coordinates (cos theta, phi) of the sphere, every node splits its cell into four quadrants
+    // and keeps the energy recorded in each. The mapping preserves area, so the leaves are sampled uniformly
+    class DTree
+    {
+    public:
+        DTree() : mNodes(1) {}
+        DTree(const DTree &other) : mNodes(other.mNodes), mWeight(other.mWeight.load(std::memory_order_relaxed)) {}
+        DTree &operator=(const DTree &other);
+
+        // adds radiance / pdf of a sample towards direction, safe from any thread
+        void record(glm::vec3 direction, float value);
+        inline void addWeight(float weight) { Utils::atomicAdd(mWeight, weight); }
+        inline float weight() const { return mWeight.load(std::memory_order_relaxed); } // records seen
+        inline void scaleWeight(float scale) { mWeight.store(weight() * scale, std::memory_order_relaxed); }
+        float energy() const;
+
+        // solid angle pdf, only valid when energy() > 0
+        float pdf(glm::vec3 direction) const;
+        glm::vec3 sample(glm::vec2 u) const;
+
+        // this tree's structure, quadrants holding more than threshold of the energy split and the ones
+        // holding less merged, with every value zeroed to record the next iteration in
+        DTree refined(float threshold, int maxDepth) const;
+        inline int numNodes() const { return int(mNodes.size()); }
+
+    private:
+        struct Node
+        {
+            std::atomic<float> sums[4]; // quadrant i covers x >= 0.5 when i & 1, y >= 0.5 when i & 2
+            uint32_t children[4];       // 0 for a leaf quadrant, the root is nobody's child
+            Node();
+            Node(const Node &other);
+            Node &operator=(const Node &other);
+            float sum() const;
+        };
+        std::vector<Node> mNodes; // mNodes[0] is the root
+        std::atomic<float> mWeight{0.0f};
+    };
+
+    // Binary tree over the scene bounds, split along x, y, z in turn, every leaf holding the DTree
+    // being sampled this iteration and the one the iteration records into
+    class SDTree
+    {
+    public:
+        void reset(const BVH::BoundingBox &bounds);
+
+        int leafIndex(glm::vec3 position) const;
+        inline const DTree &sampling(int leaf) const { return mLeaves[leaf].sampling; }
+        inline DTree &building(int leaf) { return mLeaves[leaf].building; }
+        inline int numLeaves() const { return int(mLeaves.size()); }
+
+        // end of a learning iteration: leaves that took many records split, then what every leaf recorded
+        // becomes its sampling distribution and the building one starts over on a refined structure
+        void refine(int iteration);
+
+    private:
+        struct Node
+        {
+            uint32_t children[2]; // unused on leaves
+            int leaf;             // index into mLeaves, -1 for an inner node
+        };
+        struct Leaf
+        {
+            DTree sampling, building;
+        };
+        std::vector<Node> mNodes;
+        std::vector<Leaf> mLeaves;
+        glm::vec3 mOrigin{0.0f};
+        float mSize{1.0f}; // the tree covers a cube, so splits keep the cells from getting thin
+    };
+}
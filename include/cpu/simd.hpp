@@ -0,0 +1,260 @@
+#pragma once
+#include <cmath>
+#include <glm/glm.hpp>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// 8-wide float abstraction for the batched cpu kernels, AVX2 when the compiler targets it
+// (SCTRACER_AVX2 in CMake), otherwise plain arrays the compiler may still auto-vectorize.
+// Kernels are written once against float8 / mask8 and compile for both.
+namespace scTracer::CPU::SIMD
+{
+    constexpr int width = 8;
+
+#if defined(__AVX2__)
+    struct mask8
+    {
+        __m256 v;
+        mask8() = default;
+        explicit mask8(__m256 v) : v(v) {}
+    };
+
+    struct alignas(32) float8
+    {
+        __m256 v;
+        float8() = default;
+        float8(float s) : v(_mm256_set1_ps(s)) {}
+        explicit float8(__m256 v) : v(v) {}
+
+        static inline float8 load(const float *p) { return float8(_mm256_load_ps(p)); } // 32-byte aligned
+        static inline float8 loadu(const float *p) { return float8(_mm256_loadu_ps(p)); }
+        inline void store(float *p) const { _mm256_store_ps(p, v); }
+        inline void storeu(float *p) const { _mm256_storeu_ps(p, v); }
+        inline float operator[](int lane) const
+        {
+            alignas(32) float t[width];
+            store(t);
+            return t[lane];
+        }
+        inline void insert(int lane, float s)
+        {
+            alignas(32) float t[width];
+            store(t);
+            t[lane] = s;
+            v = _mm256_load_ps(t);
+        }
+    };
+
+    inline float8 operator+(float8 a, float8 b) { return float8(_mm256_add_ps(a.v, b.v)); }
+    inline float8 operator-(float8 a, float8 b) { return float8(_mm256_sub_ps(a.v, b.v)); }
+    inline float8 operator*(float8 a, float8 b) { return float8(_mm256_mul_ps(a.v, b.v)); }
+    inline float8 operator/(float8 a, float8 b) { return float8(_mm256_div_ps(a.v, b.v)); }
+    inline float8 operator-(float8 a) { return float8(_mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f))); }
+
+    inline mask8 operator<(float8 a, float8 b) { return mask8(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+    inline mask8 operator<=(float8 a, float8 b) { return mask8(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)); }
+    inline mask8 operator>(float8 a, float8 b) { return mask8(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+    inline mask8 operator>=(float8 a, float8 b) { return mask8(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)); }
+    inline mask8 operator==(float8 a, float8 b) { return mask8(_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)); }
+
+    inline mask8 operator&(mask8 a, mask8 b) { return mask8(_mm256_and_ps(a.v, b.v)); }
+    inline mask8 operator|(mask8 a, mask8 b) { return mask8(_mm256_or_ps(a.v, b.v)); }
+    inline mask8 operator!(mask8 a) { return mask8(_mm256_xor_ps(a.v, _mm256_castsi256_ps(_mm256_set1_epi32(-1)))); }
+    inline bool any(mask8 m) { return _mm256_movemask_ps(m.v) != 0; }
+    inline bool all(mask8 m) { return _mm256_movemask_ps(m.v) == 0xff; }
+
+    // lanes of a where m is set, of b elsewhere
+    inline float8 select(mask8 m, float8 a, float8 b) { return float8(_mm256_blendv_ps(b.v, a.v, m.v)); }
+
+    inline float8 min(float8 a, float8 b) { return float8(_mm256_min_ps(a.v, b.v)); }
+    inline float8 max(float8 a, float8 b) { return float8(_mm256_max_ps(a.v, b.v)); }
+    inline float8 abs(float8 a) { return float8(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)); }
+    inline float8 sqrt(float8 a) { return float8(_mm256_sqrt_ps(a.v)); }
+    inline float8 floor(float8 a) { return float8(_mm256_floor_ps(a.v)); }
+
+    // exp for the image filters, Cephes' polynomial scaled by a power of two built in the exponent bits.
+    // Inputs below -87 flush to about 1e-38
+    inline float8 expFast(float8 x)
+    {
+        x = min(max(x, float8(-87.0f)), float8(88.0f));
+        float8 n = floor(x * float8(1.44269504088896341f) + float8(0.5f));
+        float8 r = x - n * float8(0.693359375f) + n * float8(2.12194440e-4f);
+        float8 p = float8(1.9875691500e-4f);
+        p = p * r + float8(1.3981999507e-3f);
+        p = p * r + float8(8.3334519073e-3f);
+        p = p * r + float8(4.1665795894e-2f);
+        p = p * r + float8(1.6666665459e-1f);
+        p = p * r + float8(5.0000001201e-1f);
+        p = p * r * r + r + float8(1.0f);
+        __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127)), 23);
+        return p * float8(_mm256_castsi256_ps(e));
+    }
+#else
+    struct mask8
+    {
+        bool v[8];
+    };
+
+    struct alignas(32) float8
+    {
+        float v[8];
+        float8() = default;
+        float8(float s)
+        {
+            for (int i = 0; i < width; i++)
+                v[i] = s;
+        }
+
+        static inline float8 load(const float *p)
+        {
+            float8 r;
+            for (int i = 0; i < width; i++)
+                r.v[i] = p[i];
+            return r;
+        }
+        static inline float8 loadu(const float *p) { return load(p); }
+        inline void store(float *p) const
+        {
+            for (int i = 0; i < width; i++)
+                p[i] = v[i];
+        }
+        inline void storeu(float *p) const { store(p); }
+        inline float operator[](int lane) const { return v[lane]; }
+        inline void insert(int lane, float s) { v[lane] = s; }
+    };
+
+#define SCTRACER_SIMD_LANES(expr)      \
+    for (int i = 0; i < width; i++) \
+        r.v[i] = expr;              \
+    return r;
+
+    inline float8 operator+(float8 a, float8 b) { float8 r; SCTRACER_SIMD_LANES(a.v[i] + b.v[i]) }
+    inline float8 operator-(float8 a, float8 b) { float8 r; SCTRACER_SIMD_LANES(a.v[i] - b.v[i]) }
+    inline float8 operator*(float8 a, float8 b) { float8 r; SCTRACER_SIMD_LANES(a.v[i] * b.v[i]) }
+    inline float8 operator/(float8 a, float8 b) { float8 r; SCTRACER_SIMD_LANES(a.v[i] / b.v[i]) }
+    inline float8 operator-(float8 a) { float8 r; SCTRACER_SIMD_LANES(-a.v[i]) }
+
+    inline mask8 operator<(float8 a, float8 b) { mask8 r; SCTRACER_SIMD_LANES(a.v[i] < b.v[i]) }
+    inline mask8 operator<=(float8 a, float8 b) { mask8 r; SCTRACER_SIMD_LANES(a.v[i] <= b.v[i]) }
+    inline mask8 operator>(float8 a, float8 b) { mask8 r; SCTRACER_SIMD_LANES(a.v[i] > b.v[i]) }
+    inline mask8 operator>=(float8 a, float8 b) { mask8 r; SCTRACER_SIMD_LANES(a.v[i] >= b.v[i]) }
+    inline mask8 operator==(float8 a, float8 b) { mask8 r; SCTRACER_SIMD_LANES(a.v[i] == b.v[i]) }
+
+    inline mask8 operator&(mask8 a, mask8 b) { mask8 r; SCTRACER_SIMD_LANES(a.v[i] && b.v[i]) }
+    inline mask8 operator|(mask8 a, mask8 b) { mask8 r; SCTRACER_SIMD_LANES(a.v[i] || b.v[i]) }
+    inline mask8 operator!(mask8 a) { mask8 r; SCTRACER_SIMD_LANES(!a.v[i]) }
+    inline bool any(mask8 m)
+    {
+        for (int i = 0; i < width; i++)
+            if (m.v[i])
+                return true;
+        return false;
+    }
+    inline bool all(mask8 m)
+    {
+        for (int i = 0; i < width; i++)
+            if (!m.v[i])
+                return false;
+        return true;
+    }
+
+    // lanes of a where m is set, of b elsewhere
+    inline float8 select(mask8 m, float8 a, float8 b) { float8 r; SCTRACER_SIMD_LANES(m.v[i] ? a.v[i] : b.v[i]) }
+
+    inline float8 min(float8 a, float8 b) { float8 r; SCTRACER_SIMD_LANES(a.v[i] < b.v[i] ? a.v[i] : b.v[i]) }
+    inline float8 max(float8 a, float8 b) { float8 r; SCTRACER_SIMD_LANES(a.v[i] > b.v[i] ? a.v[i] : b.v[i]) }
+    inline float8 abs(float8 a) { float8 r; SCTRACER_SIMD_LANES(std::fabs(a.v[i])) }
+    inline float8 sqrt(float8 a) { float8 r; SCTRACER_SIMD_LANES(std::sqrt(a.v[i])) }
+    inline float8 floor(float8 a) { float8 r; SCTRACER_SIMD_LANES(std::floor(a.v[i])) }
+    inline float8 expFast(float8 a) { float8 r; SCTRACER_SIMD_LANES(std::exp(a.v[i])) }
+
+#undef SCTRACER_SIMD_LANES
+#endif
+
+    inline float8 &operator+=(float8 &a, float8 b) { return a = a + b; }
+    inline float8 &operator-=(float8 &a, float8 b) { return a = a - b; }
+    inline float8 &operator*=(float8 &a, float8 b) { return a = a * b; }
+    inline float8 &operator/=(float8 &a, float8 b) { return a = a / b; }
+
+    inline float8 clamp(float8 x, float8 lo, float8 hi) { return min(max(x, lo), hi); }
+    inline float8 mix(float8 a, float8 b, float8 t) { return a * (1.0f - t) + b * t; } // same rounding as glm::mix
+
+    // lane by lane through the C library, only the rarely taken clearcoat lobe needs them
+    inline float8 log(float8 a)
+    {
+        float8 r = a;
+        for (int i = 0; i < width; i++)
+            r.insert(i, std::log(a[i]));
+        return r;
+    }
+    inline float8 exp(float8 a)
+    {
+        float8 r = a;
+        for (int i = 0; i < width; i++)
+            r.insert(i, std::exp(a[i]));
+        return r;
+    }
+
+    // Cephes style: reduce to [-pi/4, pi/4] around a multiple of pi/2, polynomials there, swap by quadrant
+    inline void sincos(float8 x, float8 &s, float8 &c)
+    {
+        float8 q = floor(x * 0.63661977236758134f + 0.5f); // x / (pi / 2), rounded
+        float8 r = ((x - q * 1.5703125f) - q * 4.837512969970703125e-4f) - q * 7.54978995489188216e-8f;
+        float8 r2 = r * r;
+        float8 sr = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+        float8 cr = 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+
+        float8 quadrant = q - 4.0f * floor(q * 0.25f);
+        mask8 swap = (quadrant == 1.0f) | (quadrant == 3.0f);
+        s = select(swap, cr, sr);
+        c = select(swap, sr, cr);
+        s = select(quadrant >= 2.0f, -s, s);
+        c = select((quadrant == 1.0f) | (quadrant == 2.0f), -c, c);
+    }
+
+    struct vec3x8
+    { // 8 vectors, one per lane
+        float8 x, y, z;
+        vec3x8() = default;
+        vec3x8(float8 s) : x(s), y(s), z(s) {}
+        vec3x8(float8 x, float8 y, float8 z) : x(x), y(y), z(z) {}
+
+        inline glm::vec3 operator[](int lane) const { return glm::vec3(x[lane], y[lane], z[lane]); }
+        inline void insert(int lane, const glm::vec3 &v)
+        {
+            x.insert(lane, v.x);
+            y.insert(lane, v.y);
+            z.insert(lane, v.z);
+        }
+    };
+
+    inline vec3x8 operator+(const vec3x8 &a, const vec3x8 &b) { return vec3x8(a.x + b.x, a.y + b.y, a.z + b.z); }
+    inline vec3x8 operator-(const vec3x8 &a, const vec3x8 &b) { return vec3x8(a.x - b.x, a.y - b.y, a.z - b.z); }
+    inline vec3x8 operator*(const vec3x8 &a, const vec3x8 &b) { return vec3x8(a.x * b.x, a.y * b.y, a.z * b.z); }
+    inline vec3x8 operator*(const vec3x8 &a, float8 s) { return vec3x8(a.x * s, a.y * s, a.z * s); }
+    inline vec3x8 operator*(float8 s, const vec3x8 &a) { return a * s; }
+    inline vec3x8 operator/(const vec3x8 &a, float8 s) { return vec3x8(a.x / s, a.y / s, a.z / s); }
+    inline vec3x8 operator-(const vec3x8 &a) { return vec3x8(-a.x, -a.y, -a.z); }
+    inline vec3x8 &operator+=(vec3x8 &a, const vec3x8 &b) { return a = a + b; }
+
+    inline float8 dot(const vec3x8 &a, const vec3x8 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline vec3x8 cross(const vec3x8 &a, const vec3x8 &b)
+    {
+        return vec3x8(a.y * b.z - b.y * a.z, a.z * b.x - b.z * a.x, a.x * b.y - b.x * a.y);
+    }
+    inline vec3x8 normalize(const vec3x8 &a) { return a / sqrt(dot(a, a)); }
+    inline vec3x8 select(mask8 m, const vec3x8 &a, const vec3x8 &b)
+    {
+        return vec3x8(select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z));
+    }
+    inline vec3x8 mix(const vec3x8 &a, const vec3x8 &b, float8 t) { return vec3x8(mix(a.x, b.x, t), mix(a.y, b.y, t), mix(a.z, b.z, t)); }
+    inline vec3x8 reflect(const vec3x8 &I, const vec3x8 &N) { return I - N * (2.0f * dot(N, I)); }
+    inline vec3x8 refract(const vec3x8 &I, const vec3x8 &N, float8 eta)
+    { // zero on total internal reflection, like glm::refract
+        float8 d = dot(N, I);
+        float8 k = 1.0f - eta * eta * (1.0f - d * d);
+        vec3x8 t = I * eta - N * (eta * d + sqrt(max(k, 0.0f)));
+        return select(k >= 0.0f, t, vec3x8(0.0f));
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include <core/material.hpp>
+#include <utils/threadPool.hpp>
+
+namespace scTracer::CPU
+{
+    struct VisiblePoint
+    { // where the camera path of a pixel left the specular surfaces behind, what photons are gathered at
+        Core::ShadingMaterial mat; // textures applied
+        glm::vec3 position;
+        float eta;
+        glm::vec3 normal; // ffnormal
+        glm::vec3 V;
+        glm::vec3 throughput; // of the camera path up to here
+        bool valid;           // the path reached a rough surface
+    };
+
+    struct Photon
+    {
+        glm::vec3 position;
+        glm::vec3 wi; // towards where it came from
+        glm::vec3 power;
+    };
+
+    struct SPPMPixel
+    { // progressive estimate of a pixel, Hachisuka and Jensen 2009
+        float radius;
+        float N;        // photons kept so far, after the progressive reduction
+        glm::vec3 tau;  // flux gathered, scaled to the current radius
+        glm::vec3 Ld;   // sum of what the camera paths found on their own
+        glm::vec3 passLd; // what the camera path of the current pass found, goes into Ld once the pass completes
+        VisiblePoint vp; // of the current pass
+    };
+
+    // Uniform grid of photons hashed into a table with about one bucket per photon. Rebuilt every pass by a
+    // counting sort over the buckets, so the photons of a bucket are contiguous and a query reads them in one go
+    class PhotonGrid
+    {
+    public:
+        // the order photons come in is kept inside a bucket, so the build does not depend on the thread count
+        void build(const std::vector<Photon> &photons, float cellSize, Utils::ThreadPool *threadPool);
+
+        // calls visit(photon) for every photon of the cells within radius of position, at most half the cell size
+        // so that is 2x2x2 cells. Photons outside the radius are visited too, the caller tests the distance
+        template <typename Visit>
+        void query(glm::vec3 position, float radius, const Visit &visit) const
+        {
+            if (mStart.empty())
+                return;
+            glm::ivec3 lo = __cell(position - radius), hi = __cell(position + radius);
+            uint32_t visited[8];
+            int numVisited = 0;
+            for (int z = lo.z; z <= hi.z; z++)
+                for (int y = lo.y; y <= hi.y; y++)
+                    for (int x = lo.x; x <= hi.x; x++)
+                    {
+                        uint32_t bucket = __hash(glm::ivec3(x, y, z));
+                        bool seen = false;
+                        for (int i = 0; i < numVisited; i++)
+                            seen = seen || visited[i] == bucket;
+                        if (seen) // cells that collide share the bucket
+                            continue;
+                        visited[numVisited++] = bucket;
+                        for (uint32_t i = mStart[bucket]; i < mStart[bucket + 1]; i++)
+                            visit(mSorted[i]);
+                    }
+        }
+
+    private:
+        float mInvCellSize{1.0f};
+        uint32_t mMask{0}; // buckets - 1, a power of two
+        std::vector<uint32_t> mStart; // first photon of every bucket, one past the last at the end
+        std::vector<Photon> mSorted;
+        // counting sort scratch
+        std::vector<uint32_t> mBucket, mOrder;
+        std::unique_ptr<std::atomic<uint32_t>[]> mCursor;
+        size_t mCursorSize{0};
+
+        inline glm::ivec3 __cell(glm::vec3 p) const { return glm::ivec3(glm::floor(p * mInvCellSize)); }
+        inline uint32_t __hash(glm::ivec3 c) const
+        {
+            return ((uint32_t(c.x) * 73856093u) ^ (uint32_t(c.y) * 19349663u) ^ (uint32_t(c.z) * 83492791u)) & mMask;
+        }
+    };
+}
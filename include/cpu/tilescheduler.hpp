@@ -0,0 +1,55 @@
+#pragma once
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace scTracer::CPU
+{
+    struct Tile
+    {
+        int x0, y0, x1, y1; // pixel range [x0, x1) x [y0, y1)
+        int baseTile;       // tile of the base grid it was cut from, costs are kept per base tile
+    };
+
+    class TileScheduler
+    { // work stealing over per worker deques, tiles issued center-out in a square spiral
+    public:
+        TileScheduler() = default;
+        ~TileScheduler() = default;
+
+        // Lays out the tiles of the next pass, base tiles that were expensive last pass get split
+        void beginPass(int width, int height, int tileSize, int numWorkers);
+        // Own deque first (front, center-most), then steal from the back of the others
+        bool next(int worker, Tile &tile);
+        void reportCost(const Tile &tile, double seconds);
+        // After the workers stopped: drops the costs of a pass that did not finish, the tiles it skipped would look
+        // cheap. The next pass splits by the costs of the last complete one instead
+        void cancelPass();
+
+        // seconds spent on each base tile (row major, getTilesX() wide) in the latest pass
+        inline const std::vector<double> &getTileCosts() const { return mCosts; }
+        inline int getTilesX() const { return mTilesX; }
+        inline int getTilesY() const { return mTilesY; }
+        inline int getNumTiles() const { return int(mTiles.size()); }
+
+    private:
+        struct WorkerQueue
+        {
+            std::mutex mutex;
+            std::deque<int> tiles;
+        };
+
+        int mWidth{0}, mHeight{0}, mTileSize{0};
+        int mTilesX{0}, mTilesY{0};
+        std::vector<int> mSpiralOrder; // base tiles from the center outwards
+        std::vector<Tile> mTiles;      // tiles of the current pass
+        std::vector<std::unique_ptr<WorkerQueue>> mQueues;
+        std::vector<double> mCosts;     // accumulated by reportCost during the pass
+        std::vector<double> mLastCosts; // previous pass, drives the splitting
+        std::mutex mCostMutex;
+
+        void __resetGrid(int width, int height, int tileSize);
+        void __pushTile(std::vector<Tile> &tiles, int baseTile, int levels) const;
+    };
+}
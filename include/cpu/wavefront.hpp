@@ -0,0 +1,166 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include <bvh/rayquery.hpp>
+#include <cpu/cpushader.hpp>
+#include <utils/threadPool.hpp>
+
+namespace scTracer::CPU
+{
+    enum class WavefrontSort
+    {
+        None,
+        Direction, // queued rays by direction octant before traversal
+        Material,  // hits by material before shading
+    };
+
+    const std::vector<std::string> wavefrontSortStrings{
+        "None",
+        "Direction",
+        "Material"};
+
+    const int wavefrontChunkSize = 256; // queue entries per thread pool job
+
+    // runs batch(begin, end) over [0, count) in chunks on the pool or inline without one,
+    // for the stages that hand a whole chunk to a batched query
+    template <typename Batch>
+    void forEachBatch(Utils::ThreadPool *threadPool, int count, const Batch &batch)
+    {
+        int jobCount = (count + wavefrontChunkSize - 1) / wavefrontChunkSize;
+        auto task = [&](int, int job)
+        { batch(job * wavefrontChunkSize, std::min(count, (job + 1) * wavefrontChunkSize)); };
+        if (threadPool && jobCount > 1)
+            threadPool->parallelFor(jobCount, task);
+        else
+            for (int job = 0; job < jobCount; job++)
+                task(0, job);
+    }
+
+    // runs stage(i) for every i in [0, count), in chunks on the pool or inline without one.
+    // The image wide passes (wavefront stages, ReSTIR) all go through it
+    template <typename Stage>
+    void forEachChunk(Utils::ThreadPool *threadPool, int count, const Stage &stage)
+    {
+        forEachBatch(threadPool, count, [&](int begin, int end)
+                     {
+            for (int i = begin; i < end; i++)
+                stage(i); });
+    }
+
+    struct RayQueue
+    { // structure of arrays, so a stage can stream each component linearly
+        std::vector<float> ox, oy, oz;
+        std::vector<float> dx, dy, dz;
+        std::vector<float> tMax;
+        std::vector<int> slot; // path slot the ray belongs to, or path slot * MAX_SHADOW_RAYS + i for shadow rays
+        int size{0};
+
+        void reserve(int capacity)
+        {
+            for (auto *v : {&ox, &oy, &oz, &dx, &dy, &dz, &tMax})
+                v->resize(capacity);
+            slot.resize(capacity);
+            size = 0;
+        }
+        inline void clear() { size = 0; }
+        inline void set(int i, const Ray &ray, float maxDist, int raySlot)
+        {
+            ox[i] = ray.origin.x, oy[i] = ray.origin.y, oz[i] = ray.origin.z;
+            dx[i] = ray.direction.x, dy[i] = ray.direction.y, dz[i] = ray.direction.z;
+            tMax[i] = maxDist;
+            slot[i] = raySlot;
+        }
+        inline void push(const Ray &ray, float maxDist, int raySlot) { set(size++, ray, maxDist, raySlot); }
+        inline Ray ray(int i) const { return Ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i])); }
+        inline int octant(int i) const { return (dx[i] < 0.0f) | (dy[i] < 0.0f) << 1 | (dz[i] < 0.0f) << 2; }
+
+        // stable counting sort by direction octant, scratch receives the old order and is swapped in
+        void sortByOctant(RayQueue &scratch)
+        {
+            int offsets[9] = {0};
+            for (int i = 0; i < size; i++)
+                offsets[octant(i) + 1]++;
+            for (int o = 0; o < 8; o++)
+                offsets[o + 1] += offsets[o];
+            scratch.size = size;
+            for (int i = 0; i < size; i++)
+            {
+                int j = offsets[octant(i)]++;
+                scratch.ox[j] = ox[i], scratch.oy[j] = oy[i], scratch.oz[j] = oz[i];
+                scratch.dx[j] = dx[i], scratch.dy[j] = dy[i], scratch.dz[j] = dz[i];
+                scratch.tMax[j] = tMax[i];
+                scratch.slot[j] = slot[i];
+            }
+            swap(scratch);
+        }
+        void swap(RayQueue &other)
+        {
+            ox.swap(other.ox), oy.swap(other.oy), oz.swap(other.oz);
+            dx.swap(other.dx), dy.swap(other.dy), dz.swap(other.dz);
+            tMax.swap(other.tMax);
+            slot.swap(other.slot);
+            std::swap(size, other.size);
+        }
+    };
+
+    struct DeferredSample
+    { // what the shade stage leaves to the packet stage, the three numbers DisneySample draws
+        bool pending;
+        float r1, r2, r3;
+    };
+
+    struct WavefrontPaths
+    { // everything indexed by path slot, slots stay put while the queues compact around them
+        std::vector<PathState> state;
+        std::vector<int> pixel; // y * width + x
+        std::vector<uint32_t> sampleIndex;
+        std::vector<uint32_t> dimension; // next sampler dimension, the rest of the rng state is (pixel, sampleIndex)
+
+        // extend -> shade
+        std::vector<unsigned char> hit;
+        std::vector<State> hitState;
+        std::vector<LightSampleRec> hitLight;
+
+        // shade -> shadow connect and compaction
+        std::vector<unsigned char> alive;
+        std::vector<Ray> nextRay; // also the full Ray of what the queue holds, until shade replaces it
+        std::vector<DeferredSample> deferred;
+        std::vector<unsigned char> numShadowRays;
+        std::vector<ShadowRay> shadowRays; // MAX_SHADOW_RAYS per slot
+        std::vector<unsigned char> visible;
+
+        // batched scene queries, by queue position rather than slot: the chunk [begin, end) of a queue uses
+        // [begin, end), so the workers share them without allocating per chunk
+        std::vector<BVH::QueryRay> queryRays; // MAX_SHADOW_RAYS per slot, the shadow queue is the longer one
+        std::vector<BVH::QueryHit> queryHits;
+        std::vector<int> queryIndex;          // queue entry of each shadow query, the ones no analytic light blocked
+        std::unique_ptr<bool[]> queryOccluded;
+
+        void resize(int capacity)
+        {
+            state.resize(capacity);
+            pixel.resize(capacity);
+            sampleIndex.resize(capacity);
+            dimension.resize(capacity);
+            hit.resize(capacity);
+            hitState.resize(capacity);
+            hitLight.resize(capacity);
+            alive.resize(capacity);
+            nextRay.resize(capacity);
+            deferred.resize(capacity);
+            numShadowRays.resize(capacity);
+            shadowRays.resize(size_t(capacity) * MAX_SHADOW_RAYS);
+            visible.resize(size_t(capacity) * MAX_SHADOW_RAYS);
+            queryRays.resize(size_t(capacity) * MAX_SHADOW_RAYS);
+            queryHits.resize(capacity);
+            queryIndex.resize(size_t(capacity) * MAX_SHADOW_RAYS);
+            queryOccluded.reset(new bool[size_t(capacity) * MAX_SHADOW_RAYS]);
+        }
+    };
+}
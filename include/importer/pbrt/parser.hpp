@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <fstream>
+#include <filesystem>
 #include <iostream>
 #include <vector>
 #include <cassert>
@@ -25,6 +26,7 @@ namespace scTracer::Importer::Pbrt
             "Shape",
             "AttributeBegin",
             "AttributeEnd",
+            "LightSource",
             "Unsupported"};
         enum class BlockType
         {
@@ -39,6 +41,7 @@ namespace scTracer::Importer::Pbrt
             Shape,
             AttributeBegin,
             AttributeEnd,
+            LightSource,
             Unsupported
         };
         BlockType mBType;
@@ -95,6 +98,10 @@ namespace scTracer::Importer::Pbrt
             {
                 return BlockType::Sampler;
             }
+            if (firstLine.find("LightSource") != std::string::npos)
+            {
+                return BlockType::LightSource;
+            }
             return BlockType::Unsupported;
         }
         std::vector<std::string> mContent;
@@ -214,6 +221,33 @@ namespace scTracer::Importer::Pbrt
             return materialName;
         }
 
+        // LightSource "infinite" "string filename" [ "sky.exr" ] "float scale" [ 1 ], empty for other light sources
+        std::string getEnvMap(float &scale)
+        {
+            assert(mBType == BlockType::LightSource);
+            std::string content;
+            for (auto &line : mContent)
+                content += line + " ";
+            scale = 1.0f;
+            if (content.find("\"infinite\"") == std::string::npos)
+                return "";
+            std::string filename;
+            size_t pos = content.find("string filename");
+            if (pos != std::string::npos)
+            {
+                size_t begin = content.find("\"", content.find("\"", pos) + 1) + 1;
+                filename = content.substr(begin, content.find("\"", begin) - begin);
+            }
+            pos = content.find("float scale");
+            if (pos != std::string::npos)
+            {
+                std::string scaleString = content.substr(content.find("\"", pos) + 1);
+                scaleString = scaleString.substr(scaleString.find_first_not_of(" ["));
+                scale = std::stof(scaleString);
+            }
+            return filename;
+        }
+
         Core::Mesh *getMeshFromFile()
         {
             assert(mBType == BlockType::Shape);
@@ -723,6 +757,8 @@ namespace scTracer::Importer::Pbrt
             std::vector<Core::Mesh *> meshes;
             std::vector<Core::Instance> instances;
             std::vector<Core::Light> lights;
+            std::string envMapFile;
+            float envMapScale{1.0f};
             int currentMaterialIndex{-1};
             bool attribute_begin{false};
             for (auto &block : blocks)
@@ -779,6 +815,13 @@ namespace scTracer::Importer::Pbrt
                     attribute_begin = false;
                     break;
                 }
+                case pbrtSceneBlock::BlockType::LightSource:
+                {
+                    std::string filename = block.getEnvMap(envMapScale);
+                    if (!filename.empty())
+                        envMapFile = std::filesystem::path(filename).is_absolute() ? filename : (std::filesystem::path(path).parent_path() / filename).string();
+                    break;
+                }
                 default:
                     break;
                 }
@@ -799,6 +842,11 @@ namespace scTracer::Importer::Pbrt
             }
             for (auto &light : lights)
                 scene->lights.push_back(light);
+            if (!envMapFile.empty())
+            {
+                scene->settings.envMapIntensity = envMapScale;
+                scene->loadEnvMap(envMapFile);
+            }
             std::cerr << Config::LOG_GREEN << "Done!" << Config::LOG_RESET << std::endl;
             // scene->printDebugInfo();
             return scene;
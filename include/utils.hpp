@@ -1,4 +1,7 @@
 #pragma once
 #include <utils/glUtils.hpp>
 #include <utils/mathUtils.hpp>
-#include <utils/objUtils.hpp>
\ No newline at end of file
+#include <utils/objUtils.hpp>
+#include <utils/threadPool.hpp>
+#include <utils/aliasTable.hpp>
+#include <utils/atomicUtils.hpp>
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+
+namespace scTracer::Utils
+{
+    class AliasTable
+    { // Walker / Vose alias method, O(1) sampling of a discrete distribution
+    public:
+        AliasTable() = default;
+        explicit AliasTable(const std::vector<float> &weights) { build(weights); }
+
+        // weights do not need to be normalized, all zero weights give an empty table
+        void build(const std::vector<float> &weights);
+
+        // Picks an index for u in [0, 1). pmf receives its probability, uRemapped a fresh uniform number for reuse
+        int sample(float u, float *pmf = nullptr, float *uRemapped = nullptr) const;
+
+        inline float pmf(int index) const { return mBins[index].p; }
+        inline int size() const { return int(mBins.size()); }
+        inline bool empty() const { return mBins.empty(); }
+
+    private:
+        struct Bin
+        {
+            float q;   // probability of keeping the bin rather than jumping to alias
+            float p;   // normalized probability of the index
+            int alias;
+        };
+        std::vector<Bin> mBins;
+    };
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <atomic>
+
+namespace scTracer::Utils
+{
+    // std::atomic<float> has no fetch_add before C++20: retry until no other thread added in between.
+    // Relaxed, a sum orders nothing else
+    inline void atomicAdd(std::atomic<float> &target, float value)
+    {
+        float current = target.load(std::memory_order_relaxed);
+        while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+            ;
+    }
+}
@@ -1,25 +1,45 @@
 #pragma once
-
+#include <cstdint>
+#include <glm/glm.hpp>
 
 namespace scTracer::Utils {
     struct mathUtils {
     public:
         static inline float degToRad(float deg) {
-            return deg * M_PI / 180.0f;
+            return deg * pi / 180.0f;
         }
 
         static inline float radToDeg(float rad) {
-            return rad * 180.0f / M_PI;
+            return rad * 180.0f / pi;
         }
 
         static inline float radians2degrees(float radians) {
-            return radians * 180.0f / M_PI;
+            return radians * 180.0f / pi;
         }
 
         static inline float degrees2radians(float degrees) {
-            return degrees * M_PI / 180.0f;
+            return degrees * pi / 180.0f;
+        }
+
+        // Rec. 709 luminance of linear rgb
+        static inline float luminance(float r, float g, float b) {
+            return 0.212671f * r + 0.715160f * g + 0.072169f * b;
+        }
+
+        static inline float luminance(const glm::vec3 &c) {
+            return luminance(c.x, c.y, c.z);
+        }
+
+        // lowbias32, Chris Wellons
+        static inline uint32_t hash(uint32_t x) {
+            x ^= x >> 16;
+            x *= 0x7feb352du;
+            x ^= x >> 15;
+            x *= 0x846ca68bu;
+            x ^= x >> 16;
+            return x;
         }
 
-        static float M_PI;
+        static float pi; // not M_PI, <cmath> defines that as a macro
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace scTracer::Utils
+{
+    class ThreadPool
+    { // persistent workers, one parallelFor at a time
+    public:
+        explicit ThreadPool(int numThreads = 0); // 0: one worker per hardware thread
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        // Runs task(workerIndex, jobIndex) for every jobIndex in [0, jobCount) and blocks until all are done.
+        // The calling thread works as worker 0, so workerIndex is in [0, size()).
+        void parallelFor(int jobCount, const std::function<void(int, int)> &task);
+
+        inline int size() const { return mNumThreads; }
+
+        static int hardwareThreads();
+
+    private:
+        int mNumThreads;
+        std::vector<std::thread> mWorkers;
+
+        std::mutex mMutex;
+        std::condition_variable mWakeUp;
+        std::condition_variable mDone;
+        bool mStop{false};
+        unsigned long long mGeneration{0}; // bumped for every parallelFor
+        int mBusyWorkers{0};
+
+        const std::function<void(int, int)> *mTask{nullptr};
+        int mJobCount{0};
+        std::atomic<int> mNextJob{0};
+
+        void __workerLoop(int workerIndex);
+        void __runJobs(int workerIndex);
+    };
+}
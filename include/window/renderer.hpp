@@ -174,7 +174,8 @@ namespace scTracer::Window
         void showCPU(CPU::CPURenderer *cpuRenderer);
         void update();
         void saveImage(std::string filename);
-        void saveEXR(std::string filename);
+        // in CPU mode pass the CPU renderer, its image is written with the albedo, depth and normal channels
+        void saveEXR(std::string filename, const CPU::CPURenderer *cpuRenderer = nullptr);
 
         Core::Scene *mScene{nullptr};
         bool shaderNeedReload{false};
@@ -203,6 +204,7 @@ namespace scTracer::Window
         void __loadScene(std::string sceneName);
         void __loadShaders();
         void __initGPUDateBuffers();
+        void __uploadEnvMap();
         void __initFBOs();
         void __captureFrame(unsigned char *buffer);
         void __captureFrame(float *buffer);
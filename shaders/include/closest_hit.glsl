@@ -46,6 +46,7 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSample,inout
                 continue;
             
             vec4 plane = vec4(normal, dot(normal, position));
+            vec3 edgeU = u, edgeV = v;
             u *= 1.0f / dot(u, u);
             v *= 1.0f / dot(v, v);
 
@@ -56,7 +57,7 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSample,inout
             {
                 t = d;
                 float cosTheta = dot(-r.direction, normal);
-                lightSample.pdf = (t * t) / (area * cosTheta);
+                lightSample.pdf = RectLightPdf(position, edgeU, edgeV, area, r.origin, t * t, cosTheta);
                 lightSample.emission = emission;
                 state.isEmitter = true;
             }
@@ -73,7 +74,7 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSample,inout
                 t = d;
                 vec3 hitPt = r.origin + t * r.direction;
                 float cosTheta = dot(-r.direction, normalize(hitPt - position));
-                lightSample.pdf = (t * t) / (area * cosTheta * 0.5);
+                lightSample.pdf = SphereLightPdf(position, radius, area, r.origin, t * t, cosTheta);
                 lightSample.emission = emission;
                 state.isEmitter = true;
             }
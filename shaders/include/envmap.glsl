@@ -0,0 +1,70 @@
+// Equirectangular environment map, +Y up, same mapping and tables as Core::EnvironmentMap.
+// envMapCDFTex is (width + 1) x height: texel (x, y) holds P(X <= x | y), the last column the marginal P(Y <= y)
+
+float EnvMapCDF(int x, int y)
+{
+    return (x < 0 || y < 0) ? 0.0 : texelFetch(envMapCDFTex, ivec2(x, y), 0).r;
+}
+
+float EnvMapPdf(vec2 uv, int x, int y)
+{
+    int w = int(envMapRes.x);
+    float pmfY = EnvMapCDF(w, y) - EnvMapCDF(w, y - 1);
+    float pmfX = EnvMapCDF(x, y) - EnvMapCDF(x - 1, y);
+    // piecewise constant over uv, then to solid angle: dw = 2 pi^2 sin(theta) du dv
+    float sinTheta = sin(uv.y * PI);
+    return sinTheta > 0.0 ? pmfY * envMapRes.y * pmfX * envMapRes.x / (2.0 * PI * PI * sinTheta) : 0.0;
+}
+
+// rgb: radiance from direction dir, a: solid angle pdf of SampleEnvMap picking it
+vec4 EvalEnvMap(vec3 dir)
+{
+    vec2 uv = vec2((PI + atan(dir.z, dir.x)) * INV_TWO_PI, acos(clamp(dir.y, -1.0, 1.0)) * INV_PI);
+    int x = clamp(int(uv.x * envMapRes.x), 0, int(envMapRes.x) - 1);
+    int y = clamp(int(uv.y * envMapRes.y), 0, int(envMapRes.y) - 1);
+    return vec4(texture(envMapTex, uv).rgb * envMapIntensity, EnvMapPdf(uv, x, y));
+}
+
+// picks a direction proportional to the luminance, rgb: its radiance, a: its solid angle pdf
+vec4 SampleEnvMap(float r1, float r2, out vec3 dir)
+{
+    int w = int(envMapRes.x), h = int(envMapRes.y);
+
+    // first row whose marginal is above r1
+    int lo = 0, hi = h - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) >> 1;
+        if (EnvMapCDF(w, mid) > r1)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    int y = lo;
+    float prev = EnvMapCDF(w, y - 1);
+    float pmf = EnvMapCDF(w, y) - prev;
+    float dv = pmf > 0.0 ? clamp((r1 - prev) / pmf, 0.0, 1.0) : 0.5;
+
+    // then the column inside that row
+    lo = 0;
+    hi = w - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) >> 1;
+        if (EnvMapCDF(mid, y) > r2)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    int x = lo;
+    prev = EnvMapCDF(x - 1, y);
+    pmf = EnvMapCDF(x, y) - prev;
+    float du = pmf > 0.0 ? clamp((r2 - prev) / pmf, 0.0, 1.0) : 0.5;
+
+    vec2 uv = vec2((float(x) + du) / envMapRes.x, (float(y) + dv) / envMapRes.y);
+    float phi = uv.x * TWO_PI - PI;
+    float theta = uv.y * PI;
+    dir = vec3(cos(phi) * sin(theta), cos(theta), sin(phi) * sin(theta));
+
+    return vec4(texture(envMapTex, uv).rgb * envMapIntensity, EnvMapPdf(uv, x, y));
+}
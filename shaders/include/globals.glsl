@@ -116,6 +116,15 @@ struct Light
     float type;
 };
 
+struct SphericalRect
+{ // a quad light as seen from a point, in the frame of the quad with the point at the origin. Urena et al. 2013
+    vec3 x, y, z; // along u and v, z faces away from the point
+    float z0;     // distance to the plane, negative
+    float x0, x1, y0, y1;
+    float b0, b1, k;
+    float S; // solid angle
+};
+
 struct State
 {
     int depth;
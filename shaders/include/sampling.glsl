@@ -183,47 +183,163 @@ void Onb(in vec3 N, inout vec3 T, inout vec3 B)
     B = cross(N, T);
 }
 
+// smaller spherical rectangles lose precision in float, those quads are sampled by area. pbrt-v4
+const float MIN_SPHERICAL_RECT_SOLID_ANGLE = 3e-4;
+// sin^2 of 1.5 degrees, narrower sphere light cones are sampled with the small angle expansion
+const float SMALL_CONE_SIN2 = 0.00068523;
+
+// solid angle pdf of SampleSphereLight towards a point of the sphere distSq away whose normal makes cosTheta
+// with the direction, from scatterPos
+float SphereLightPdf(vec3 center, float radius, float area, vec3 scatterPos, float distSq, float cosTheta)
+{
+    vec3 toCenter = center - scatterPos;
+    float sin2ThetaMax = radius * radius / dot(toCenter, toCenter);
+    if (sin2ThetaMax >= 1.0) // inside, sampled by area
+        return distSq / (area * abs(cosTheta));
+    float oneMinusCosThetaMax = sin2ThetaMax < SMALL_CONE_SIN2 ? 0.5 * sin2ThetaMax : 1.0 - sqrt(1.0 - sin2ThetaMax);
+    return 1.0 / (TWO_PI * oneMinusCosThetaMax);
+}
+
+// uniform over the cone of directions that see the sphere, which is all of them from inside where it falls
+// back to uniform by area
 void SampleSphereLight(in Light light, in vec3 scatterPos, inout LightSampleRec lightSample)
 {
     float r1 = rand();
     float r2 = rand();
 
-    vec3 sphereCentertoSurface = scatterPos - light.position;
-    float distToSphereCenter = length(sphereCentertoSurface);
-    vec3 sampledDir;
-
-    // TODO: Fix this. Currently assumes the light will be hit only from the outside
-    sphereCentertoSurface /= distToSphereCenter;
-    sampledDir = UniformSampleHemisphere(r1, r2);
-    vec3 T, B;
-    Onb(sphereCentertoSurface, T, B);
-    sampledDir = T * sampledDir.x + B * sampledDir.y + sphereCentertoSurface * sampledDir.z;
+    vec3 toCenter = light.position - scatterPos;
+    float distSqToCenter = dot(toCenter, toCenter);
+    float sin2ThetaMax = light.radius * light.radius / distSqToCenter;
+    bool inside = sin2ThetaMax >= 1.0;
+    vec3 normal;
+    if (!inside)
+    {
+        float sin2Theta, cosTheta;
+        if (sin2ThetaMax < SMALL_CONE_SIN2)
+        { // 1 - cos loses its digits in float, use its expansion
+            sin2Theta = sin2ThetaMax * r1;
+            cosTheta = sqrt(1.0 - sin2Theta);
+        }
+        else
+        {
+            cosTheta = 1.0 - r1 * (1.0 - sqrt(1.0 - sin2ThetaMax));
+            sin2Theta = 1.0 - cosTheta * cosTheta;
+        }
+        // angle at the center between scatterPos and the point the sampled direction sees first, pbrt-v4
+        float cosAlpha = sin2Theta / sqrt(sin2ThetaMax) + cosTheta * sqrt(max(0.0, 1.0 - sin2Theta / sin2ThetaMax));
+        float sinAlpha = sqrt(max(0.0, 1.0 - cosAlpha * cosAlpha));
+        float phi = TWO_PI * r2;
+
+        vec3 wc = toCenter / sqrt(distSqToCenter);
+        vec3 T, B;
+        Onb(wc, T, B);
+        normal = -(sinAlpha * cos(phi) * T + sinAlpha * sin(phi) * B + cosAlpha * wc);
+    }
+    else
+        normal = UniformSampleSphere(r1, r2);
 
-    vec3 lightSurfacePos = light.position + sampledDir * light.radius;
+    vec3 lightSurfacePos = light.position + normal * light.radius;
 
     lightSample.direction = lightSurfacePos - scatterPos;
     lightSample.dist = length(lightSample.direction);
     float distSq = lightSample.dist * lightSample.dist;
 
     lightSample.direction /= lightSample.dist;
-    lightSample.normal = normalize(lightSurfacePos - light.position);
+    lightSample.normal = inside ? -normal : normal; // towards scatterPos, the sphere emits on both sides
     lightSample.emission = light.emission * float(numOfLights);
-    lightSample.pdf = distSq / (light.area * 0.5 * abs(dot(lightSample.normal, lightSample.direction)));
+    lightSample.pdf = SphereLightPdf(light.position, light.radius, light.area, scatterPos, distSq, dot(lightSample.normal, lightSample.direction));
+}
+
+// false when the quad is too small or too close to edge on to sample by solid angle, or not a rectangle
+bool SphericalRectInit(vec3 position, vec3 u, vec3 v, vec3 scatterPos, out SphericalRect rect)
+{
+    float lu = length(u);
+    float lv = length(v);
+    rect.x = u / lu;
+    rect.y = v / lv;
+    rect.z = cross(rect.x, rect.y);
+
+    vec3 d = position - scatterPos;
+    rect.z0 = dot(d, rect.z);
+    if (rect.z0 > 0.0)
+    {
+        rect.z = -rect.z;
+        rect.z0 = -rect.z0;
+    }
+    rect.x0 = dot(d, rect.x);
+    rect.y0 = dot(d, rect.y);
+    rect.x1 = rect.x0 + lu;
+    rect.y1 = rect.y0 + lv;
+
+    // the corners and the normals of the planes through scatterPos and the edges
+    vec3 v00 = vec3(rect.x0, rect.y0, rect.z0);
+    vec3 v01 = vec3(rect.x0, rect.y1, rect.z0);
+    vec3 v10 = vec3(rect.x1, rect.y0, rect.z0);
+    vec3 v11 = vec3(rect.x1, rect.y1, rect.z0);
+    vec3 n0 = normalize(cross(v00, v10));
+    vec3 n1 = normalize(cross(v10, v11));
+    vec3 n2 = normalize(cross(v11, v01));
+    vec3 n3 = normalize(cross(v01, v00));
+    // the inner angles of the spherical rectangle
+    float g0 = acos(clamp(-dot(n0, n1), -1.0, 1.0));
+    float g1 = acos(clamp(-dot(n1, n2), -1.0, 1.0));
+    float g2 = acos(clamp(-dot(n2, n3), -1.0, 1.0));
+    float g3 = acos(clamp(-dot(n3, n0), -1.0, 1.0));
+
+    rect.b0 = n0.z;
+    rect.b1 = n2.z;
+    rect.k = TWO_PI - g2 - g3;
+    rect.S = g0 + g1 - rect.k;
+    return abs(dot(rect.x, rect.y)) <= 1e-3 && rect.S > MIN_SPHERICAL_RECT_SOLID_ANGLE; // false for NaN too
+}
+
+// a direction uniform in the solid angle of rect, returned as the offset from its origin to the quad
+vec3 SampleSphericalRect(in SphericalRect rect, float r1, float r2)
+{
+    // the x where the part of the solid angle left of it is r1 of the whole
+    float au = r1 * rect.S + rect.k;
+    float fu = (cos(au) * rect.b0 - rect.b1) / sin(au);
+    float cu = clamp((fu > 0.0 ? 1.0 : -1.0) / sqrt(fu * fu + rect.b0 * rect.b0), -1.0, 1.0);
+    float xu = -(cu * rect.z0) / sqrt(max(1.0 - cu * cu, 1e-12));
+    xu = clamp(xu, rect.x0, rect.x1);
+
+    // and along y at that x
+    float d = sqrt(xu * xu + rect.z0 * rect.z0);
+    float h0 = rect.y0 / sqrt(d * d + rect.y0 * rect.y0);
+    float h1 = rect.y1 / sqrt(d * d + rect.y1 * rect.y1);
+    float hv = h0 + r2 * (h1 - h0);
+    float hv2 = hv * hv;
+    float yv = hv2 < 1.0 - 1e-6 ? (hv * d) / sqrt(1.0 - hv2) : rect.y1;
+
+    return xu * rect.x + yv * rect.y + rect.z0 * rect.z;
+}
+
+// solid angle pdf of SampleRectLight towards a point of the quad distSq away whose normal makes cosTheta
+// with the direction, from scatterPos
+float RectLightPdf(vec3 position, vec3 u, vec3 v, float area, vec3 scatterPos, float distSq, float cosTheta)
+{
+    SphericalRect rect;
+    if (SphericalRectInit(position, u, v, scatterPos, rect))
+        return 1.0 / rect.S;
+    return distSq / (area * abs(cosTheta));
 }
 
+// uniform in the solid angle the quad subtends, by area where that is ill conditioned
 void SampleRectLight(in Light light, in vec3 scatterPos, inout LightSampleRec lightSample)
 {
     float r1 = rand();
     float r2 = rand();
 
-    vec3 lightSurfacePos = light.position + light.u * r1 + light.v * r2;
+    SphericalRect rect;
+    bool solidAngle = SphericalRectInit(light.position, light.u, light.v, scatterPos, rect);
+    vec3 lightSurfacePos = solidAngle ? scatterPos + SampleSphericalRect(rect, r1, r2) : light.position + light.u * r1 + light.v * r2;
     lightSample.direction = lightSurfacePos - scatterPos;
     lightSample.dist = length(lightSample.direction);
     float distSq = lightSample.dist * lightSample.dist;
     lightSample.direction /= lightSample.dist;
     lightSample.normal = normalize(cross(light.u, light.v));
     lightSample.emission = light.emission * float(numOfLights);
-    lightSample.pdf = distSq / (light.area * abs(dot(lightSample.normal, lightSample.direction)));
+    lightSample.pdf = solidAngle ? 1.0 / rect.S : distSq / (light.area * abs(dot(lightSample.normal, lightSample.direction)));
 }
 
 void SampleDistantLight(in Light light, in vec3 scatterPos, inout LightSampleRec lightSample)
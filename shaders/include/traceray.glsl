@@ -118,7 +118,26 @@ vec3 DirectLight(in Ray r, in State state, bool isSurface)
 
     ScatterSampleRec scatterSample;
 
+    // Environment map, sampled on its own and weighted against the bsdf sample hitting the background
+    if (enableEnvMap)
+    {
+        vec3 lightDir;
+        float r1 = rand();
+        float r2 = rand();
+        vec4 envMapColPdf = SampleEnvMap(r1, r2, lightDir);
+        Li = envMapColPdf.rgb;
+        float lightPdf = envMapColPdf.w;
+
+        if (lightPdf > 0.0 && !AnyHit(Ray(scatterPos, lightDir), INF))
+        {
+            scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightDir, scatterSample.pdf);
+            if (scatterSample.pdf > 0.0)
+                Ld += PowerHeuristic(lightPdf, scatterSample.pdf) * Li * scatterSample.f / lightPdf;
+        }
+    }
+
     // Analytic Lights
+    if (numOfLights > 0)
     {
         LightSampleRec lightSample;
         Light light;
@@ -190,8 +209,13 @@ vec4 traceRay(Ray r){
         bool hit = ClosestHit(r , state, lightSample, debugger);
         if(!hit)
         {
-            // BACKGROUND here
+            if (enableEnvMap)
             {
+                vec4 envMapColPdf = EvalEnvMap(r.direction);
+                float misWeight = 1.0;
+                if (state.depth > 0)
+                    misWeight = PowerHeuristic(scatterSample.pdf, envMapColPdf.w);
+                radiance += misWeight * envMapColPdf.rgb * throughput;
             }
             break;
         }
@@ -229,6 +253,15 @@ vec4 traceRay(Ray r){
                 break;
         }
 
+        // Russian roulette, the throughput already carries the albedo of the sampled lobe
+        if (rrDepth >= 0 && state.depth >= rrDepth)
+        {
+            float q = min(max(throughput.x, max(throughput.y, throughput.z)) + 0.001, 0.95);
+            if (rand() > q)
+                break;
+            throughput /= q;
+        }
+
         r.direction = scatterSample.L;
         r.origin = state.fhp + r.direction * EPS;
        
@@ -12,11 +12,17 @@ uniform sampler2D materialsTex;
 uniform sampler2D transformsTex;
 uniform sampler2D lightsTex;
 uniform sampler2DArray textureMapsArrayTex;
+uniform sampler2D envMapTex;
+uniform sampler2D envMapCDFTex;
 
 
 uniform vec3 uniformLightCol;
 uniform int numOfLights;
 uniform int maxDepth;
+uniform int rrDepth;
 uniform int topBVHIndex;
 uniform int frameNum;
-uniform float roughnessMollificationAmt;
\ No newline at end of file
+uniform float roughnessMollificationAmt;
+uniform bool enableEnvMap;
+uniform vec2 envMapRes;
+uniform float envMapIntensity;
\ No newline at end of file
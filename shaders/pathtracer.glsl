@@ -3,6 +3,7 @@
 #include "include/uniforms.glsl"
 #include "include/globals.glsl"
 #include "include/sampling.glsl"
+#include "include/envmap.glsl"
 #include "include/intersection.glsl"
 #include "include/disney.glsl"
 #include "include/anyhit.glsl"
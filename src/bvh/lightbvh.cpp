@@ -0,0 +1,112 @@
+#include <bvh/lightbvh.hpp>
+
+namespace scTracer::BVH
+{
+    void LightBVH::build(const std::vector<Core::Light> &lights)
+    {
+        mEmitters.clear();
+        mNodes.clear();
+        mSlotOfLight.assign(lights.size(), -1);
+
+        std::vector<int> lightIndices;
+        std::vector<BoundingBox> bounds;
+        for (int i = 0; i < lights.size(); i++)
+        {
+            const Core::Light &light = lights[i];
+            BoundingBox bb;
+            if (int(light.type) == Core::LightType::RectLight)
+            {
+                bb.grow(light.position);
+                bb.grow(light.position + light.u);
+                bb.grow(light.position + light.v);
+                bb.grow(light.position + light.u + light.v);
+            }
+            else if (int(light.type) == Core::LightType::SphereLight)
+            {
+                bb.grow(light.position - glm::vec3(light.radius));
+                bb.grow(light.position + glm::vec3(light.radius));
+            }
+            else
+                continue;
+            // quads are flat, keep the slabs from degenerating
+            bb.grow(bb.pmin - glm::vec3(LIGHT_INTERSECTION_EPS));
+            bb.grow(bb.pmax + glm::vec3(LIGHT_INTERSECTION_EPS));
+            bounds.push_back(bb);
+            lightIndices.push_back(i);
+        }
+        if (bounds.empty())
+            return;
+
+        BvhStructure bvh;
+        bvh.build(&bounds[0], bounds.size());
+
+        // store the emitters in leaf order so a leaf range maps straight to mEmitters
+        mEmitters.resize(bvh.getNumIndices());
+        for (int slot = 0; slot < bvh.getNumIndices(); slot++)
+        {
+            int lightIndex = lightIndices[bvh.mPackedIndices[slot]];
+            const Core::Light &light = lights[lightIndex];
+            EmitterData &e = mEmitters[slot];
+            e.position = light.position;
+            e.type = light.type;
+            e.radius = light.radius;
+            e.lightIndex = lightIndex;
+            e.normal = glm::vec3(0.0f);
+            e.planeD = 0.0f;
+            e.invU = glm::vec3(0.0f);
+            e.invV = glm::vec3(0.0f);
+            if (int(light.type) == Core::LightType::RectLight)
+            {
+                e.normal = glm::normalize(glm::cross(light.u, light.v));
+                e.planeD = glm::dot(e.normal, light.position);
+                e.invU = light.u * (1.0f / glm::dot(light.u, light.u));
+                e.invV = light.v * (1.0f / glm::dot(light.v, light.v));
+            }
+            mSlotOfLight[lightIndex] = slot;
+        }
+
+        mNodes.resize(bvh.mNodeCount);
+        mCurrentNodeIndex = 0;
+        _flattenNode(bvh.getRoot());
+    }
+
+    int LightBVH::_flattenNode(const BvhStructure::Node *node)
+    {
+        int index = mCurrentNodeIndex;
+        mNodes[index].boundsmin = node->bb.pmin;
+        mNodes[index].boundsmax = node->bb.pmax;
+        mNodes[index].LeftRightLeaf.z = 0;
+        if (node->type == BvhStructure::NodeType::kLeaf)
+        {
+            mNodes[index].LeftRightLeaf.z = 1;
+            mNodes[index].LeftRightLeaf.x = node->startIndex;
+            mNodes[index].LeftRightLeaf.y = node->primsNum;
+        }
+        else
+        {
+            mCurrentNodeIndex++;
+            mNodes[index].LeftRightLeaf.x = _flattenNode(node->leftChild);
+            mCurrentNodeIndex++;
+            mNodes[index].LeftRightLeaf.y = _flattenNode(node->rightChild);
+        }
+        return index;
+    }
+
+    bool LightBVH::intersect1(const QueryRay &ray, QueryHit &hit) const
+    {
+        hit = QueryHit();
+        if (mNodes.empty())
+            return false;
+        EmitterPrimitives<true> prims{mEmitters.data()};
+        return traverse<QueryType::Closest, false, false>(mNodes.data(), 0, prims, nullptr, AlphaTest(), ray, hit);
+    }
+
+    bool LightBVH::occluded1(const QueryRay &ray) const
+    {
+        if (mNodes.empty())
+            return false;
+        QueryHit hit;
+        EmitterPrimitives<false> prims{mEmitters.data()};
+        return traverse<QueryType::Any, false, false>(mNodes.data(), 0, prims, nullptr, AlphaTest(), ray, hit);
+    }
+}
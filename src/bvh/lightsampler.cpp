@@ -0,0 +1,435 @@
+#include <bvh/lightsampler.hpp>
+#include <core/scene.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include <utils/mathUtils.hpp>
+
+namespace scTracer::BVH
+{
+    namespace
+    {
+        const int kMaxAliasEmitters = 16; // above this the light tree takes over
+        const int kSplitBuckets = 12;
+        const int kMaxTreeDepth = 32; // trails are 64 bit, median splits below this depth stay well within
+        const float kPi = 3.14159265358979323f;
+        const float kOneMinusEpsilon = 0.99999994f;
+
+        inline float safeSqrt(float x) { return std::sqrt(std::max(x, 0.0f)); }
+        inline float safeAcos(float x) { return std::acos(glm::clamp(x, -1.0f, 1.0f)); }
+
+        // cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+        inline float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+        {
+            return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+        }
+        inline float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+        {
+            return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+        }
+
+        // cosine of the cone around the box center that holds the whole box as seen from p
+        inline float boundSubtendedCos(const BoundingBox &bounds, const glm::vec3 &p)
+        {
+            glm::vec3 center = 0.5f * (bounds.pmin + bounds.pmax);
+            float radius2 = 0.25f * glm::dot(bounds.pmax - bounds.pmin, bounds.pmax - bounds.pmin);
+            float dist2 = glm::dot(p - center, p - center);
+            if (dist2 < radius2)
+                return -1.0f;
+            return safeSqrt(1.0f - radius2 / dist2);
+        }
+
+        inline glm::vec3 rotate(const glm::vec3 &v, const glm::vec3 &axis, float theta)
+        { // Rodrigues
+            float s = std::sin(theta), c = std::cos(theta);
+            return v * c + glm::cross(axis, v) * s + axis * glm::dot(axis, v) * (1.0f - c);
+        }
+
+        LightBounds unionBounds(const LightBounds &a, const LightBounds &b)
+        {
+            if (a.phi == 0.0f)
+                return b;
+            if (b.phi == 0.0f)
+                return a;
+
+            LightBounds result;
+            result.bounds = a.bounds;
+            result.bounds.grow(b.bounds);
+            result.phi = a.phi + b.phi;
+            result.cosTheta_e = std::min(a.cosTheta_e, b.cosTheta_e);
+
+            // smallest cone holding both normal cones
+            float thetaA = safeAcos(a.cosTheta_o), thetaB = safeAcos(b.cosTheta_o);
+            float thetaD = safeAcos(glm::dot(a.w, b.w));
+            if (std::min(thetaD + thetaB, kPi) <= thetaA)
+            {
+                result.w = a.w;
+                result.cosTheta_o = a.cosTheta_o;
+                return result;
+            }
+            if (std::min(thetaD + thetaA, kPi) <= thetaB)
+            {
+                result.w = b.w;
+                result.cosTheta_o = b.cosTheta_o;
+                return result;
+            }
+            float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+            glm::vec3 axis = glm::cross(a.w, b.w);
+            if (thetaO >= kPi || glm::dot(axis, axis) == 0.0f)
+            {
+                result.w = a.w;
+                result.cosTheta_o = -1.0f;
+                return result;
+            }
+            result.w = glm::normalize(rotate(a.w, glm::normalize(axis), thetaO - thetaA));
+            result.cosTheta_o = std::cos(thetaO);
+            return result;
+        }
+
+        // SAOH cost of a candidate child, Conty Estevez and Kulla 2018
+        float splitCost(const LightBounds &b, const BoundingBox &parent, int dim)
+        {
+            float thetaO = safeAcos(b.cosTheta_o), thetaE = safeAcos(b.cosTheta_e);
+            float thetaW = std::min(thetaO + thetaE, kPi);
+            float sinThetaO = safeSqrt(1.0f - b.cosTheta_o * b.cosTheta_o);
+            float mOmega = 2.0f * kPi * (1.0f - b.cosTheta_o) +
+                           0.5f * kPi * (2.0f * thetaW * sinThetaO - std::cos(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + b.cosTheta_o);
+            glm::vec3 extent = parent.pmax - parent.pmin;
+            float kr = std::max(extent.x, std::max(extent.y, extent.z)) / std::max(extent[dim], 1e-6f);
+            glm::vec3 d = b.bounds.pmax - b.bounds.pmin;
+            float area = 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+            return b.phi * mOmega * kr * area;
+        }
+    }
+
+    float LightBounds::importance(const glm::vec3 &p, const glm::vec3 &n) const
+    {
+        if (phi == 0.0f)
+            return 0.0f;
+
+        glm::vec3 center = 0.5f * (bounds.pmin + bounds.pmax);
+        glm::vec3 toP = p - center;
+        float dist2 = glm::dot(toP, toP);
+        glm::vec3 wi = dist2 > 0.0f ? toP / std::sqrt(dist2) : w;
+        dist2 = std::max(dist2, 0.5f * glm::length(bounds.pmax - bounds.pmin));
+
+        // angle between the cone axis and the direction to p, minus the cone and the box extent
+        float cosTheta_w = glm::dot(w, wi);
+        float sinTheta_w = safeSqrt(1.0f - cosTheta_w * cosTheta_w);
+        float cosTheta_b = boundSubtendedCos(bounds, p);
+        float sinTheta_b = safeSqrt(1.0f - cosTheta_b * cosTheta_b);
+        float sinTheta_o = safeSqrt(1.0f - cosTheta_o * cosTheta_o);
+        float cosTheta_x = cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+        float sinTheta_x = sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+        float cosTheta_p = cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+        if (cosTheta_p <= cosTheta_e)
+            return 0.0f;
+
+        float result = phi * cosTheta_p / dist2;
+        if (glm::dot(n, n) > 0.0f)
+        { // bound the cosine at the receiver
+            float cosTheta_i = std::abs(glm::dot(wi, n));
+            float sinTheta_i = safeSqrt(1.0f - cosTheta_i * cosTheta_i);
+            result *= cosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b);
+        }
+        return std::max(result, 0.0f);
+    }
+
+    void LightSampler::build(const Core::Scene &scene)
+    {
+        const std::vector<Core::Light> &lights = scene.lights;
+        mNumLights = int(lights.size());
+        mTriangles.clear();
+        mInfinite.clear();
+        mBounded.clear();
+        mNodes.clear();
+        mTrail.clear();
+        mAlias = Utils::AliasTable();
+
+        std::vector<std::pair<int, LightBounds>> items;
+        for (int i = 0; i < mNumLights; i++)
+        {
+            const Core::Light &light = lights[i];
+            LightBounds lb;
+            float radiance = Utils::mathUtils::luminance(light.emission);
+            if (int(light.type) == Core::LightType::RectLight)
+            {
+                lb.bounds.grow(light.position);
+                lb.bounds.grow(light.position + light.u);
+                lb.bounds.grow(light.position + light.v);
+                lb.bounds.grow(light.position + light.u + light.v);
+                lb.w = glm::normalize(glm::cross(light.u, light.v));
+                lb.phi = radiance * light.area * kPi;
+            }
+            else if (int(light.type) == Core::LightType::SphereLight)
+            {
+                lb.bounds.grow(light.position - glm::vec3(light.radius));
+                lb.bounds.grow(light.position + glm::vec3(light.radius));
+                lb.cosTheta_o = -1.0f; // normals in every direction
+                lb.phi = radiance * light.area * kPi;
+            }
+            else
+            {
+                mInfinite.push_back(i);
+                continue;
+            }
+            items.push_back({i, lb});
+        }
+
+        // emissive triangles, in the primitive order of the ray query so a hit maps straight to its emitter
+        int numInstances = int(scene.instances.size());
+        std::vector<int> meshPrimOffset(scene.meshes.size() + 1, 0);
+        for (int i = 0; i < scene.meshes.size(); i++)
+            meshPrimOffset[i + 1] = meshPrimOffset[i] + int(scene.meshes[i]->bvh->getNumIndices());
+        mInstanceEmitterOffset.assign(numInstances, -1);
+        mInstancePrimOffset.assign(numInstances, 0);
+        for (int inst = 0; inst < numInstances; inst++)
+        {
+            const Core::Instance &instance = scene.instances[inst];
+            if (!instance.mActived || instance.mMaterialIndex < 0 || instance.mMaterialIndex >= scene.materialDatas.size())
+                continue;
+            glm::vec3 emission = scene.materialDatas[instance.mMaterialIndex].emission;
+            if (Utils::mathUtils::luminance(emission) <= 0.0f)
+                continue;
+
+            const glm::mat4 &transform = scene.transforms[inst];
+            glm::mat3 normalTransform = glm::transpose(glm::inverse(glm::mat3(transform)));
+            int primBegin = meshPrimOffset[instance.mMeshIndex], primEnd = meshPrimOffset[instance.mMeshIndex + 1];
+            mInstanceEmitterOffset[inst] = mNumLights + int(mTriangles.size());
+            mInstancePrimOffset[inst] = primBegin;
+            for (int prim = primBegin; prim < primEnd; prim++)
+            {
+                int i0 = scene.sceneTriIndices[prim * 3 + 0];
+                int i1 = scene.sceneTriIndices[prim * 3 + 1];
+                int i2 = scene.sceneTriIndices[prim * 3 + 2];
+                glm::vec3 v0 = glm::vec3(transform * glm::vec4(scene.sceneVertices[i0], 1.0f));
+                glm::vec3 v1 = glm::vec3(transform * glm::vec4(scene.sceneVertices[i1], 1.0f));
+                glm::vec3 v2 = glm::vec3(transform * glm::vec4(scene.sceneVertices[i2], 1.0f));
+
+                EmissiveTriangle tri;
+                tri.v0 = v0;
+                tri.e1 = v1 - v0;
+                tri.e2 = v2 - v0;
+                tri.emission = emission;
+                glm::vec3 cross = glm::cross(tri.e1, tri.e2);
+                tri.area = 0.5f * glm::length(cross);
+                tri.normal = tri.area > 0.0f ? glm::normalize(cross) : glm::vec3(0.0f, 0.0f, 1.0f);
+                // emit on the side of the shading normals, whatever the winding
+                glm::vec3 shadingNormal = normalTransform * (scene.sceneNormals[i0] + scene.sceneNormals[i1] + scene.sceneNormals[i2]);
+                if (glm::dot(tri.normal, shadingNormal) < 0.0f)
+                    tri.normal = -tri.normal;
+
+                LightBounds lb;
+                lb.bounds.grow(v0);
+                lb.bounds.grow(v1);
+                lb.bounds.grow(v2);
+                lb.w = tri.normal;
+                lb.phi = Utils::mathUtils::luminance(emission) * tri.area * kPi;
+                items.push_back({mNumLights + int(mTriangles.size()), lb});
+                mTriangles.push_back(tri);
+            }
+        }
+
+        // drop what can never be picked, the slot table still covers every emitter
+        items.erase(std::remove_if(items.begin(), items.end(), [](const std::pair<int, LightBounds> &item)
+                                   { return !(item.second.phi > 0.0f); }),
+                    items.end());
+        mSlot.assign(getNumEmitters(), -1);
+        mInfiniteProb = mInfinite.empty() ? 0.0f : float(mInfinite.size()) / float(mInfinite.size() + (items.empty() ? 0 : 1));
+        if (items.empty())
+            return;
+
+        if (items.size() <= kMaxAliasEmitters)
+        {
+            std::vector<float> power;
+            for (auto &item : items)
+            {
+                mSlot[item.first] = int(mBounded.size());
+                mBounded.push_back(item.first);
+                power.push_back(item.second.phi);
+            }
+            mAlias.build(power);
+            return;
+        }
+
+        mNodes.reserve(2 * items.size());
+        mTrail.assign(items.size(), 0);
+        __buildTree(items, 0, int(items.size()), 0, 0);
+    }
+
+    int LightSampler::__buildTree(std::vector<std::pair<int, LightBounds>> &items, int begin, int end, uint64_t trail, int depth)
+    {
+        if (end - begin == 1)
+        {
+            int nodeIndex = int(mNodes.size());
+            int emitter = items[begin].first;
+            mNodes.push_back({items[begin].second, emitter, 1});
+            mSlot[emitter] = int(mBounded.size());
+            mBounded.push_back(emitter);
+            mTrail[mSlot[emitter]] = trail;
+            return nodeIndex;
+        }
+
+        BoundingBox bounds, centroidBounds;
+        for (int i = begin; i < end; i++)
+        {
+            bounds.grow(items[i].second.bounds);
+            centroidBounds.grow(items[i].second.bounds.centroid());
+        }
+
+        // bucketed SAOH along every axis
+        float minCost = std::numeric_limits<float>::infinity();
+        int minBucket = -1, minDim = -1;
+        for (int dim = 0; dim < 3 && depth < kMaxTreeDepth; dim++)
+        {
+            float cmin = centroidBounds.pmin[dim], cmax = centroidBounds.pmax[dim];
+            if (cmax == cmin)
+                continue;
+            LightBounds buckets[kSplitBuckets];
+            for (int i = begin; i < end; i++)
+            {
+                int b = std::min(int(kSplitBuckets * (items[i].second.bounds.centroid()[dim] - cmin) / (cmax - cmin)), kSplitBuckets - 1);
+                buckets[b] = unionBounds(buckets[b], items[i].second);
+            }
+            for (int split = 0; split < kSplitBuckets - 1; split++)
+            {
+                LightBounds below, above;
+                for (int b = 0; b <= split; b++)
+                    below = unionBounds(below, buckets[b]);
+                for (int b = split + 1; b < kSplitBuckets; b++)
+                    above = unionBounds(above, buckets[b]);
+                if (below.phi == 0.0f || above.phi == 0.0f)
+                    continue;
+                float cost = splitCost(below, bounds, dim) + splitCost(above, bounds, dim);
+                if (cost < minCost)
+                {
+                    minCost = cost;
+                    minBucket = split;
+                    minDim = dim;
+                }
+            }
+        }
+
+        int mid;
+        if (minDim == -1)
+            mid = (begin + end) / 2; // coincident centroids or too deep
+        else
+        {
+            float cmin = centroidBounds.pmin[minDim], cmax = centroidBounds.pmax[minDim];
+            auto midIter = std::partition(items.begin() + begin, items.begin() + end, [&](const std::pair<int, LightBounds> &item)
+                                          { return std::min(int(kSplitBuckets * (item.second.bounds.centroid()[minDim] - cmin) / (cmax - cmin)), kSplitBuckets - 1) <= minBucket; });
+            mid = int(midIter - items.begin());
+            if (mid == begin || mid == end)
+                mid = (begin + end) / 2;
+        }
+
+        int nodeIndex = int(mNodes.size());
+        mNodes.push_back({LightBounds(), -1, 0});
+        __buildTree(items, begin, mid, trail, depth + 1); // first child right after its parent
+        int second = __buildTree(items, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+        mNodes[nodeIndex].lightBounds = unionBounds(mNodes[nodeIndex + 1].lightBounds, mNodes[second].lightBounds);
+        mNodes[nodeIndex].childOrEmitter = second;
+        return nodeIndex;
+    }
+
+    int LightSampler::sample(const glm::vec3 &p, const glm::vec3 &n, float u, float &pmf) const
+    {
+        pmf = 0.0f;
+        if (u < mInfiniteProb)
+        {
+            u = std::min(u / mInfiniteProb, kOneMinusEpsilon);
+            int index = std::min(int(u * mInfinite.size()), int(mInfinite.size()) - 1);
+            pmf = mInfiniteProb / mInfinite.size();
+            return mInfinite[index];
+        }
+        if (mBounded.empty())
+            return -1;
+        u = std::min((u - mInfiniteProb) / (1.0f - mInfiniteProb), kOneMinusEpsilon);
+
+        if (mNodes.empty())
+        {
+            int slot = mAlias.sample(u, &pmf);
+            pmf *= 1.0f - mInfiniteProb;
+            return mBounded[slot];
+        }
+
+        // walk down the tree, splitting u at every level
+        int nodeIndex = 0;
+        float nodePmf = 1.0f - mInfiniteProb;
+        while (true)
+        {
+            const Node &node = mNodes[nodeIndex];
+            if (node.isLeaf)
+            {
+                if (nodeIndex > 0 || node.lightBounds.importance(p, n) > 0.0f)
+                {
+                    pmf = nodePmf;
+                    return node.childOrEmitter;
+                }
+                return -1;
+            }
+            float c0 = mNodes[nodeIndex + 1].lightBounds.importance(p, n);
+            float c1 = mNodes[node.childOrEmitter].lightBounds.importance(p, n);
+            if (c0 == 0.0f && c1 == 0.0f)
+                return -1;
+            float p0 = c0 / (c0 + c1);
+            if (u < p0)
+            {
+                u = std::min(u / p0, kOneMinusEpsilon);
+                nodePmf *= p0;
+                nodeIndex = nodeIndex + 1;
+            }
+            else
+            {
+                u = std::min((u - p0) / (1.0f - p0), kOneMinusEpsilon);
+                nodePmf *= 1.0f - p0;
+                nodeIndex = node.childOrEmitter;
+            }
+        }
+    }
+
+    float LightSampler::pmf(const glm::vec3 &p, const glm::vec3 &n, int emitter) const
+    {
+        if (emitter < 0 || emitter >= mSlot.size())
+            return 0.0f;
+        int slot = mSlot[emitter];
+        if (slot < 0)
+        { // distant light or an emitter without power
+            for (int light : mInfinite)
+                if (light == emitter)
+                    return mInfiniteProb / mInfinite.size();
+            return 0.0f;
+        }
+        if (mNodes.empty())
+            return (1.0f - mInfiniteProb) * mAlias.pmf(slot);
+
+        // replay the choices that lead to the emitter
+        uint64_t trail = mTrail[slot];
+        int nodeIndex = 0;
+        float result = 1.0f - mInfiniteProb;
+        while (!mNodes[nodeIndex].isLeaf)
+        {
+            const Node &node = mNodes[nodeIndex];
+            float c0 = mNodes[nodeIndex + 1].lightBounds.importance(p, n);
+            float c1 = mNodes[node.childOrEmitter].lightBounds.importance(p, n);
+            if (c0 == 0.0f && c1 == 0.0f)
+                return 0.0f;
+            if (trail & 1)
+            {
+                result *= c1 / (c0 + c1);
+                nodeIndex = node.childOrEmitter;
+            }
+            else
+            {
+                result *= c0 / (c0 + c1);
+                nodeIndex = nodeIndex + 1;
+            }
+            trail >>= 1;
+        }
+        if (nodeIndex == 0 && mNodes[0].lightBounds.importance(p, n) == 0.0f)
+            return 0.0f;
+        return result;
+    }
+}
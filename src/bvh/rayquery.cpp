@@ -0,0 +1,102 @@
+#include <bvh/rayquery.hpp>
+
+namespace scTracer::BVH
+{
+    void RayQuery::build(const BVHFlattor &flattor, const std::vector<int> &triIndices, const std::vector<glm::vec3> &vertices, const std::vector<glm::mat4> &transforms)
+    {
+        mFlattor = &flattor;
+        mTriIndices = triIndices.data();
+        mVertices = vertices.data();
+        mTopLevelIndex = flattor.topLevelIndex;
+        updateTransforms(transforms);
+    }
+
+    void RayQuery::updateTransforms(const std::vector<glm::mat4> &transforms)
+    {
+        // the traversal only needs world to object space, invert once here instead of per TLAS leaf
+        mInvTransforms.resize(transforms.size());
+        mInstancing = false;
+        for (int i = 0; i < transforms.size(); i++)
+        {
+            mInvTransforms[i] = glm::inverse(transforms[i]);
+            if (transforms[i] != glm::mat4(1.0f))
+                mInstancing = true;
+        }
+        _selectKernels();
+    }
+
+    void RayQuery::setAlphaTest(bool (*fn)(const void *user, const QueryHit &candidate), const void *user)
+    {
+        mAlphaTest.fn = fn;
+        mAlphaTest.user = user;
+        _selectKernels();
+    }
+
+    template <QueryType kQuery, bool kInstancing, bool kAlphaTest>
+    bool RayQuery::_traverse(const QueryRay &ray, QueryHit &hit) const
+    {
+        TrianglePrimitives prims{mTriIndices, mVertices};
+        return traverse<kQuery, kInstancing, kAlphaTest>(mFlattor->flattenedNodes.data(), mTopLevelIndex, prims,
+                                                          mInvTransforms.data(), mAlphaTest, ray, hit);
+    }
+
+    template <QueryType kQuery>
+    RayQuery::KernelFn RayQuery::_pickKernel() const
+    {
+        if (mInstancing)
+            return mAlphaTest.enabled() ? &RayQuery::_traverse<kQuery, true, true> : &RayQuery::_traverse<kQuery, true, false>;
+        return mAlphaTest.enabled() ? &RayQuery::_traverse<kQuery, false, true> : &RayQuery::_traverse<kQuery, false, false>;
+    }
+
+    void RayQuery::_selectKernels()
+    {
+        mIntersectFn = _pickKernel<QueryType::Closest>();
+        mOccludedFn = _pickKernel<QueryType::Any>();
+    }
+
+    bool RayQuery::intersect1(const QueryRay &ray, QueryHit &hit) const
+    {
+        hit = QueryHit();
+        return (this->*mIntersectFn)(ray, hit);
+    }
+
+    bool RayQuery::occluded1(const QueryRay &ray) const
+    {
+        QueryHit hit;
+        return (this->*mOccludedFn)(ray, hit);
+    }
+
+    void RayQuery::_sortByOctant(const QueryRay *rays, int count, std::vector<int> &order) const
+    {
+        // counting sort on the direction octant, rays in the same octant visit the nodes in the same order
+        int offsets[9] = {0};
+        std::vector<unsigned char> octants(count);
+        for (int i = 0; i < count; i++)
+        {
+            const glm::vec3 &d = rays[i].direction;
+            octants[i] = (d.x < 0.0f ? 1 : 0) | (d.y < 0.0f ? 2 : 0) | (d.z < 0.0f ? 4 : 0);
+            offsets[octants[i] + 1]++;
+        }
+        for (int i = 1; i < 9; i++)
+            offsets[i] += offsets[i - 1];
+        order.resize(count);
+        for (int i = 0; i < count; i++)
+            order[offsets[octants[i]]++] = i;
+    }
+
+    void RayQuery::intersect(const QueryRay *rays, QueryHit *hits, int count) const
+    {
+        std::vector<int> order;
+        _sortByOctant(rays, count, order);
+        for (int i : order)
+            intersect1(rays[i], hits[i]);
+    }
+
+    void RayQuery::occluded(const QueryRay *rays, bool *occluded, int count) const
+    {
+        std::vector<int> order;
+        _sortByOctant(rays, count, order);
+        for (int i : order)
+            occluded[i] = occluded1(rays[i]);
+    }
+}
@@ -5,6 +5,10 @@ namespace scTracer::Config
     const int default_height = 500;
     const int default_texture_width = 2048;
     const int default_texutre_height = 2048;
+    const int cpu_tile_size = 16;
+    const int cpu_wavefront_size = 1 << 16; // paths in flight per wavefront batch
+    const int cpu_texture_cache_tiles = 64; // decoded texture tiles per render thread, 16KB each
+    const int cpu_radiance_cache_cells = 1 << 20; // hash grid cells of the cpu preview, 24 bytes each
     const std::string shaderFolder = "shaders/";
     const std::string sceneFolder = "assets/";
     const std::string outputFolder = "./";
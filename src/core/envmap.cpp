@@ -0,0 +1,194 @@
+#include <core/envmap.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <glm/gtc/constants.hpp>
+#include <tinyexr.h>
+#include <stb_image.h>
+
+#include <config.hpp>
+#include <utils/mathUtils.hpp>
+#include <utils/threadPool.hpp>
+
+namespace scTracer::Core
+{
+    bool EnvironmentMap::load(const std::string &filename, Utils::ThreadPool *threadPool)
+    {
+        clear();
+        std::string ext = filename.substr(filename.find_last_of('.') + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext == "exr")
+        {
+            float *rgba = nullptr;
+            const char *err = nullptr;
+            if (LoadEXR(&rgba, &mWidth, &mHeight, filename.c_str(), &err) != TINYEXR_SUCCESS)
+            {
+                std::cerr << Config::LOG_RED << "Failed to load env map [" << filename << "]: " << (err ? err : "") << Config::LOG_RESET << std::endl;
+                FreeEXRErrorMessage(err);
+                mWidth = mHeight = 0;
+                return false;
+            }
+            mData.resize(size_t(mWidth) * mHeight * 3);
+            for (size_t i = 0; i < size_t(mWidth) * mHeight; i++)
+                for (int c = 0; c < 3; c++)
+                    mData[i * 3 + c] = rgba[i * 4 + c];
+            free(rgba);
+        }
+        else
+        {
+            float *rgb = stbi_loadf(filename.c_str(), &mWidth, &mHeight, NULL, 3);
+            if (rgb == nullptr)
+            {
+                std::cerr << Config::LOG_RED << "Failed to load env map [" << filename << "]: " << stbi_failure_reason() << Config::LOG_RESET << std::endl;
+                mWidth = mHeight = 0;
+                return false;
+            }
+            mData.assign(rgb, rgb + size_t(mWidth) * mHeight * 3);
+            stbi_image_free(rgb);
+        }
+        for (auto &value : mData) // NaN and negative texels would poison the tables
+            if (!(value >= 0.0f))
+                value = 0.0f;
+        name = filename;
+        __buildCDF(threadPool);
+        return true;
+    }
+
+    void EnvironmentMap::clear()
+    {
+        mWidth = mHeight = 0;
+        mData.clear();
+        mCDF.clear();
+        name.clear();
+    }
+
+    void EnvironmentMap::__buildCDF(Utils::ThreadPool *threadPool)
+    {
+        int width = mWidth, height = mHeight, stride = mWidth + 1;
+        mCDF.assign(size_t(stride) * height, 0.0f);
+        std::vector<double> rowSums(height, 0.0);
+
+        // conditional tables are independent per row, the marginal one is a prefix sum over the row sums
+        auto buildRow = [&](int, int y)
+        {
+            float sinTheta = std::sin(glm::pi<float>() * (y + 0.5f) / height); // solid angle of the row
+            float *row = &mCDF[size_t(y) * stride];
+            double sum = 0.0;
+            for (int x = 0; x < width; x++)
+            {
+                const float *rgb = &mData[(size_t(y) * width + x) * 3];
+                sum += Utils::mathUtils::luminance(rgb[0], rgb[1], rgb[2]) * sinTheta;
+                row[x] = float(sum);
+            }
+            rowSums[y] = sum;
+            for (int x = 0; x < width; x++)
+                row[x] = sum > 0.0 ? float(row[x] / sum) : float(x + 1) / width;
+            row[width - 1] = 1.0f;
+        };
+        if (threadPool)
+            threadPool->parallelFor(height, buildRow);
+        else
+            for (int y = 0; y < height; y++)
+                buildRow(0, y);
+
+        double total = 0.0;
+        for (int y = 0; y < height; y++)
+        {
+            total += rowSums[y];
+            mCDF[size_t(y) * stride + width] = float(total);
+        }
+        for (int y = 0; y < height; y++)
+        {
+            float &marginal = mCDF[size_t(y) * stride + width];
+            marginal = total > 0.0 ? float(marginal / total) : float(y + 1) / height;
+        }
+        mCDF[size_t(height - 1) * stride + width] = 1.0f;
+    }
+
+    glm::vec2 EnvironmentMap::dirToUV(const glm::vec3 &dir)
+    {
+        float u = (glm::pi<float>() + std::atan2(dir.z, dir.x)) * (0.5f / glm::pi<float>());
+        float v = std::acos(glm::clamp(dir.y, -1.0f, 1.0f)) / glm::pi<float>();
+        return glm::vec2(u, v);
+    }
+
+    glm::vec3 EnvironmentMap::uvToDir(const glm::vec2 &uv)
+    {
+        float phi = uv.x * 2.0f * glm::pi<float>() - glm::pi<float>();
+        float theta = uv.y * glm::pi<float>();
+        float sinTheta = std::sin(theta);
+        return glm::vec3(std::cos(phi) * sinTheta, std::cos(theta), std::sin(phi) * sinTheta);
+    }
+
+    glm::vec3 EnvironmentMap::eval(const glm::vec3 &dir) const
+    { // bilinear, wraps around in u like the GL_REPEAT texture
+        glm::vec2 uv = dirToUV(dir);
+        float fx = uv.x * mWidth - 0.5f, fy = uv.y * mHeight - 0.5f;
+        int x0 = int(std::floor(fx)), y0 = int(std::floor(fy));
+        float tx = fx - x0, ty = fy - y0;
+        auto texel = [&](int x, int y)
+        {
+            x = (x % mWidth + mWidth) % mWidth;
+            y = glm::clamp(y, 0, mHeight - 1);
+            const float *p = &mData[(size_t(y) * mWidth + x) * 3];
+            return glm::vec3(p[0], p[1], p[2]);
+        };
+        return glm::mix(glm::mix(texel(x0, y0), texel(x0 + 1, y0), tx),
+                        glm::mix(texel(x0, y0 + 1), texel(x0 + 1, y0 + 1), tx), ty);
+    }
+
+    int EnvironmentMap::__sampleRow(float u, float &du, float &pmf) const
+    {
+        int stride = mWidth + 1;
+        int lo = 0, hi = mHeight - 1; // first row whose marginal is above u
+        while (lo < hi)
+        {
+            int mid = (lo + hi) >> 1;
+            if (mCDF[size_t(mid) * stride + mWidth] > u)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        float prev = lo > 0 ? mCDF[size_t(lo - 1) * stride + mWidth] : 0.0f;
+        pmf = mCDF[size_t(lo) * stride + mWidth] - prev;
+        du = pmf > 0.0f ? glm::clamp((u - prev) / pmf, 0.0f, 1.0f) : 0.5f;
+        return lo;
+    }
+
+    int EnvironmentMap::__sampleColumn(int y, float u, float &du, float &pmf) const
+    {
+        const float *row = &mCDF[size_t(y) * (mWidth + 1)];
+        int x = int(std::upper_bound(row, row + mWidth - 1, u) - row);
+        float prev = x > 0 ? row[x - 1] : 0.0f;
+        pmf = row[x] - prev;
+        du = pmf > 0.0f ? glm::clamp((u - prev) / pmf, 0.0f, 1.0f) : 0.5f;
+        return x;
+    }
+
+    glm::vec3 EnvironmentMap::sample(float r1, float r2, glm::vec3 &dir, float &pdf) const
+    {
+        float dv, du, pmfY, pmfX;
+        int y = __sampleRow(r1, dv, pmfY);
+        int x = __sampleColumn(y, r2, du, pmfX);
+        glm::vec2 uv((x + du) / mWidth, (y + dv) / mHeight);
+        dir = uvToDir(uv);
+
+        // piecewise constant pdf over uv, then to solid angle: dw = 2 pi^2 sin(theta) du dv
+        float sinTheta = std::sin(uv.y * glm::pi<float>());
+        pdf = sinTheta > 0.0f ? pmfY * mHeight * pmfX * mWidth / (2.0f * glm::pi<float>() * glm::pi<float>() * sinTheta) : 0.0f;
+        return eval(dir);
+    }
+
+    float EnvironmentMap::pdf(const glm::vec3 &dir) const
+    {
+        glm::vec2 uv = dirToUV(dir);
+        int x = glm::clamp(int(uv.x * mWidth), 0, mWidth - 1);
+        int y = glm::clamp(int(uv.y * mHeight), 0, mHeight - 1);
+        int stride = mWidth + 1;
+        float pmfY = mCDF[size_t(y) * stride + mWidth] - (y > 0 ? mCDF[size_t(y - 1) * stride + mWidth] : 0.0f);
+        float pmfX = mCDF[size_t(y) * stride + x] - (x > 0 ? mCDF[size_t(y) * stride + x - 1] : 0.0f);
+        float sinTheta = std::sin(uv.y * glm::pi<float>());
+        return sinTheta > 0.0f ? pmfY * mHeight * pmfX * mWidth / (2.0f * glm::pi<float>() * glm::pi<float>() * sinTheta) : 0.0f;
+    }
+}
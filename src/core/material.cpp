@@ -1,4 +1,7 @@
 #include <core/material.hpp>
+#include <cmath>
+
+#include <utils/mathUtils.hpp>
 
 
 namespace scTracer::Core {
@@ -9,4 +12,30 @@ namespace scTracer::Core {
             return MaterialType::Conductor;
         return MaterialType::Diffuse;
     }
+
+    ShadingMaterial ShadingMaterial::bake(const Material &mat)
+    {
+        ShadingMaterial baked;
+        baked.baseColor = mat.baseColor;
+        baked.metallic = mat.metallic;
+        baked.emission = mat.emission;
+        baked.roughness = glm::max(mat.roughness, 0.001f);
+        baked.sheen = mat.sheen;
+        baked.subsurface = mat.subsurface;
+        baked.clearcoat = mat.clearcoat;
+        baked.clearcoatRoughness = glm::mix(0.1f, 0.001f, mat.clearcoatGloss); // Remapping from gloss to roughness
+        baked.specTrans = mat.specTrans;
+        baked.ior = mat.ior;
+
+        float aspect = std::sqrt(1.0f - mat.anisotropic * 0.9f);
+        baked.ax = glm::max(0.001f, baked.roughness / aspect);
+        baked.ay = glm::max(0.001f, baked.roughness * aspect);
+
+        baked.baseLum = Utils::mathUtils::luminance(mat.baseColor);
+        glm::vec3 ctint = baked.baseLum > 0.0f ? mat.baseColor / baked.baseLum : glm::vec3(1.0f);
+        baked.specTint = glm::mix(glm::vec3(1.0f), ctint, mat.specularTint);
+        baked.Csheen = glm::mix(glm::vec3(1.0f), ctint, mat.sheenTint);
+        baked.dielectricWt = (1.0f - mat.metallic) * (1.0f - mat.specTrans);
+        return baked;
+    }
 }
\ No newline at end of file
@@ -1,14 +1,76 @@
+#include <cstring>
 #include <core/scene.hpp>
+#include <utils/mathUtils.hpp>
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include <stb_image_resize2.h>
 namespace scTracer::Core
 {
+    namespace
+    {
+        // CPU side of the OPT_ALPHA_TEST block in anyhit.glsl, only installed when a material is not opaque
+        bool alphaTestFilter(const void *user, const BVH::QueryHit &candidate)
+        {
+            const Scene *scene = static_cast<const Scene *>(user);
+            const Material &mat = scene->materialDatas[candidate.materialIndex];
+            int alphaMode = int(mat.alphaMode);
+            if (alphaMode == AlphaOpaque)
+                return true;
+
+            float opacity = mat.opacity;
+            int texID = int(mat.baseColorTexId);
+            if (texID >= 0 && !scene->sceneMeshUvs.empty())
+            {
+                glm::vec2 texCoord = scene->sceneMeshUvs[candidate.vertIndices.x] * candidate.bary.x +
+                                     scene->sceneMeshUvs[candidate.vertIndices.y] * candidate.bary.y +
+                                     scene->sceneMeshUvs[candidate.vertIndices.z] * candidate.bary.z;
+                int w = Config::default_texture_width, h = Config::default_texutre_height;
+                int x = glm::clamp(int((texCoord.x - glm::floor(texCoord.x)) * w), 0, w - 1);
+                int y = glm::clamp(int((texCoord.y - glm::floor(texCoord.y)) * h), 0, h - 1);
+                opacity *= scene->textureMapsData[(size_t(texID) * w * h + size_t(y) * w + x) * 4 + 3] / 255.0f;
+            }
+
+            if (alphaMode == AlphaMask)
+                return opacity >= mat.alphaCutoff;
+
+            // Blend: stochastic transparency, hashed on the candidate so the filter stays stateless
+            unsigned int bits;
+            std::memcpy(&bits, &candidate.t, sizeof(bits));
+            unsigned int h = Utils::mathUtils::hash(bits ^ (unsigned int)(candidate.primIndex * 0x9E3779B9u));
+            return float(h) * (1.0f / 4294967296.0f) <= opacity;
+        }
+    }
+
     void SceneSettings::printDebugInfo()
     {
         std::cout << "SceneSettings:" << std::endl;
         std::cout << "image_width: " << image_width << std::endl;
         std::cout << "image_height: " << image_height << std::endl;
         std::cout << "maxBounceDepth: " << maxBounceDepth << std::endl;
+        std::cout << "rrDepth: " << rrDepth << std::endl;
+        std::cout << "renderThreads: " << renderThreads << std::endl;
+        std::cout << "samplerType: " << samplerType << std::endl;
+        std::cout << "wavefront: " << wavefront << std::endl;
+        std::cout << "wavefrontSort: " << wavefrontSort << std::endl;
+        std::cout << "wavefrontSimd: " << wavefrontSimd << std::endl;
+        std::cout << "restir: " << restir << std::endl;
+        std::cout << "restirCandidates: " << restirCandidates << std::endl;
+        std::cout << "restirSpatialNeighbors: " << restirSpatialNeighbors << std::endl;
+        std::cout << "restirTemporal: " << restirTemporal << std::endl;
+        std::cout << "pathGuiding: " << pathGuiding << std::endl;
+        std::cout << "guidingIterations: " << guidingIterations << std::endl;
+        std::cout << "guidingBsdfFraction: " << guidingBsdfFraction << std::endl;
+        std::cout << "radianceCache: " << radianceCache << std::endl;
+        std::cout << "radianceCachePasses: " << radianceCachePasses << std::endl;
+        std::cout << "mlt: " << mlt << std::endl;
+        std::cout << "mltLargeStepProbability: " << mltLargeStepProbability << std::endl;
+        std::cout << "mltBootstrapSamples: " << mltBootstrapSamples << std::endl;
+        std::cout << "sppm: " << sppm << std::endl;
+        std::cout << "sppmPhotons: " << sppmPhotons << std::endl;
+        std::cout << "sppmRadius: " << sppmRadius << std::endl;
+        std::cout << "lookDevMode: " << lookDevMode << std::endl;
+        std::cout << "aoDistance: " << aoDistance << std::endl;
+        std::cout << "adaptiveThreshold: " << adaptiveThreshold << std::endl;
+        std::cout << "envMapIntensity: " << envMapIntensity << std::endl;
     }
 
     Scene::Scene(const Camera &camera, const SceneSettings &settings) : camera(camera), settings(settings)
@@ -39,6 +101,7 @@ namespace scTracer::Core
         {
             Material material = materials[i].getMaterial();
             materialDatas.push_back(material);
+            shadingMaterials.push_back(ShadingMaterial::bake(material));
         }
         std::cerr << "Done!" << std::endl;
 
@@ -84,6 +147,18 @@ namespace scTracer::Core
             transforms[i] = instances[i].getTransform();
         std::cerr << "Done!" << std::endl;
 
+        std::cerr << "Preparing ray queries ...";
+        rayQuery.build(bvhFlattor, sceneTriIndices, sceneVertices, transforms);
+        for (auto &material : materialDatas)
+            if (int(material.alphaMode) != AlphaOpaque)
+            {
+                rayQuery.setAlphaTest(&alphaTestFilter, this);
+                break;
+            }
+        lightBVH.build(lights);
+        lightSampler.build(*this);
+        std::cerr << "Done!" << std::endl;
+
         // prepare texture data
         std::cerr << "Preparing textures data ...";
         int defaultWidth = Config::default_texture_width;
@@ -104,11 +179,29 @@ namespace scTracer::Core
             else
                 std::copy(textures[i]->data.begin(), textures[i]->data.end(), &textureMapsData[i * bytesOfOneTexture]);
         }
+        textureCache.build(textureMapsData.data(), int(textures.size()), defaultWidth, defaultHeight);
         std::cerr << "Done!" << std::endl;
 
         initialized = true;
     }
 
+    bool Scene::loadEnvMap(const std::string &filename, Utils::ThreadPool *threadPool)
+    {
+        bool loaded = true;
+        if (filename.empty())
+            envMap.clear();
+        else
+        {
+            std::cerr << "Loading env map [" << filename << "] ...";
+            loaded = envMap.load(filename, threadPool);
+            if (loaded)
+                std::cerr << "Done! " << envMap.mWidth << "x" << envMap.mHeight << std::endl;
+        }
+        envMapDirty = true;
+        dirty = true;
+        return loaded;
+    }
+
     void Scene::deleteMeshes()
     {
         for (auto &mesh : meshes)
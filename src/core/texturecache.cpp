@@ -0,0 +1,201 @@
+#include <core/texturecache.hpp>
+#include <config.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace scTracer::Core
+{
+    namespace
+    {
+        const int cacheWays = 4; // tiles per set, the least recently used one is replaced
+        std::atomic<uint32_t> nextCacheID{1};
+
+        struct TileCache
+        {
+            struct Entry
+            {
+                uint64_t key;
+                uint32_t lastUse;
+            };
+            uint32_t owner{0}; // TextureCache::mID the tiles were decoded from
+            uint32_t clock{0};
+            std::vector<Entry> entries;
+            std::vector<glm::vec4> texels; // MipmappedTexture::tileTexels per entry
+            // the tile hit last, bilinear footprints mostly stay inside one
+            uint64_t lastKey{~0ull};
+            const glm::vec4 *lastTile{nullptr};
+
+            void reset(uint32_t id)
+            {
+                int numEntries = std::max(cacheWays, Config::cpu_texture_cache_tiles / cacheWays * cacheWays);
+                owner = id;
+                clock = 0;
+                entries.assign(numEntries, Entry{~0ull, 0});
+                texels.resize(size_t(numEntries) * MipmappedTexture::tileTexels);
+                lastKey = ~0ull;
+                lastTile = nullptr;
+            }
+        };
+        thread_local TileCache tileCache;
+
+        inline int wrap(int i, int n)
+        {
+            i %= n;
+            return i < 0 ? i + n : i;
+        }
+    }
+
+    void MipmappedTexture::build(const unsigned char *rgba, int width, int height)
+    {
+        mLevels.clear();
+        mTexels.clear();
+
+        std::vector<uint32_t> image(size_t(width) * height);
+        for (size_t i = 0; i < image.size(); i++)
+            image[i] = uint32_t(rgba[i * 4]) | uint32_t(rgba[i * 4 + 1]) << 8 | uint32_t(rgba[i * 4 + 2]) << 16 | uint32_t(rgba[i * 4 + 3]) << 24;
+
+        for (;;)
+        {
+            Level level;
+            level.width = width;
+            level.height = height;
+            level.tilesX = (width + tileSize - 1) >> tileLog;
+            level.tilesY = (height + tileSize - 1) >> tileLog;
+            level.offset = mTexels.size();
+            mTexels.resize(level.offset + size_t(level.tilesX) * level.tilesY * tileTexels, 0);
+            for (int y = 0; y < height; y++)
+                for (int x = 0; x < width; x++)
+                {
+                    size_t tileIndex = size_t(y >> tileLog) * level.tilesX + (x >> tileLog);
+                    mTexels[level.offset + tileIndex * tileTexels + mortonIndex(x & (tileSize - 1), y & (tileSize - 1))] = image[size_t(y) * width + x];
+                }
+            mLevels.push_back(level);
+            if (width == 1 && height == 1)
+                break;
+
+            // 2x2 box filter, the last row / column is repeated on odd sizes
+            int nextWidth = std::max(1, width / 2), nextHeight = std::max(1, height / 2);
+            std::vector<uint32_t> next(size_t(nextWidth) * nextHeight);
+            for (int y = 0; y < nextHeight; y++)
+                for (int x = 0; x < nextWidth; x++)
+                {
+                    int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                    int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+                    uint32_t texels[4] = {image[size_t(y0) * width + x0], image[size_t(y0) * width + x1],
+                                          image[size_t(y1) * width + x0], image[size_t(y1) * width + x1]};
+                    uint32_t texel = 0;
+                    for (int c = 0; c < 4; c++)
+                    {
+                        uint32_t sum = 2;
+                        for (uint32_t t : texels)
+                            sum += (t >> (8 * c)) & 0xff;
+                        texel |= (sum >> 2) << (8 * c);
+                    }
+                    next[size_t(y) * nextWidth + x] = texel;
+                }
+            image.swap(next);
+            width = nextWidth;
+            height = nextHeight;
+        }
+    }
+
+    void TextureCache::build(const unsigned char *rgba, int numTextures, int width, int height)
+    {
+        mTextures.resize(numTextures);
+        for (int i = 0; i < numTextures; i++)
+            mTextures[i].build(rgba + size_t(i) * width * height * 4, width, height);
+        mID = nextCacheID++;
+    }
+
+    void TextureCache::clear()
+    {
+        mTextures.clear();
+        mID = nextCacheID++;
+    }
+
+    glm::vec4 TextureCache::sample(int texID, glm::vec2 uv, float lod) const
+    {
+        const MipmappedTexture &tex = mTextures[texID];
+        if (!std::isfinite(uv.x) || !std::isfinite(uv.y))
+            uv = glm::vec2(0.0f);
+        lod = std::isfinite(lod) ? glm::clamp(lod, 0.0f, float(tex.numLevels() - 1)) : 0.0f;
+
+        int level = int(lod);
+        float t = lod - float(level);
+        glm::vec4 color = __bilinear(texID, level, uv);
+        if (t > 0.0f)
+            color = glm::mix(color, __bilinear(texID, level + 1, uv), t);
+        return color;
+    }
+
+    float TextureCache::lod(int texID, glm::vec2 duvdx, glm::vec2 duvdy) const
+    {
+        glm::vec2 size(width(texID), height(texID));
+        float footprint = std::max(glm::length(duvdx * size), glm::length(duvdy * size));
+        return footprint > 0.0f && std::isfinite(footprint) ? std::log2(footprint) : 0.0f;
+    }
+
+    glm::vec4 TextureCache::__bilinear(int texID, int level, glm::vec2 uv) const
+    {
+        const MipmappedTexture &tex = mTextures[texID];
+        int w = tex.width(level), h = tex.height(level);
+        float x = uv.x * w - 0.5f, y = uv.y * h - 0.5f; // texel centers sit at +0.5
+        float fx = std::floor(x), fy = std::floor(y);
+        float tx = x - fx, ty = y - fy;
+        int x0 = wrap(int(fx), w), y0 = wrap(int(fy), h);
+        int x1 = x0 + 1 == w ? 0 : x0 + 1, y1 = y0 + 1 == h ? 0 : y0 + 1;
+
+        glm::vec4 top = glm::mix(__texel(texID, level, x0, y0), __texel(texID, level, x1, y0), tx);
+        glm::vec4 bottom = glm::mix(__texel(texID, level, x0, y1), __texel(texID, level, x1, y1), tx);
+        return glm::mix(top, bottom, ty);
+    }
+
+    glm::vec4 TextureCache::__texel(int texID, int level, int x, int y) const
+    {
+        const int mask = MipmappedTexture::tileSize - 1;
+        int tileIndex = (y >> MipmappedTexture::tileLog) * mTextures[texID].tilesX(level) + (x >> MipmappedTexture::tileLog);
+        return __tile(texID, level, tileIndex)[MipmappedTexture::mortonIndex(x & mask, y & mask)];
+    }
+
+    const glm::vec4 *TextureCache::__tile(int texID, int level, int tileIndex) const
+    {
+        TileCache &cache = tileCache;
+        if (cache.owner != mID)
+            cache.reset(mID);
+
+        uint64_t key = uint64_t(texID) << 32 | uint64_t(level) << 24 | uint64_t(tileIndex);
+        if (key == cache.lastKey)
+            return cache.lastTile;
+
+        int numSets = int(cache.entries.size()) / cacheWays;
+        int set = int(((key * 0x9E3779B97F4A7C15ull) >> 32) % uint64_t(numSets));
+        TileCache::Entry *ways = &cache.entries[size_t(set) * cacheWays];
+        cache.clock++;
+
+        int way = 0;
+        for (int w = 0; w < cacheWays; w++)
+        {
+            if (ways[w].key == key)
+            {
+                way = w;
+                break;
+            }
+            if (ways[w].lastUse < ways[way].lastUse)
+                way = w;
+        }
+
+        glm::vec4 *texels = &cache.texels[(size_t(set) * cacheWays + way) * MipmappedTexture::tileTexels];
+        if (ways[way].key != key)
+        { // miss, decode the tile over the least recently used one
+            const uint32_t *src = mTextures[texID].tile(level, tileIndex);
+            for (int i = 0; i < MipmappedTexture::tileTexels; i++)
+                texels[i] = glm::vec4(src[i] & 0xff, (src[i] >> 8) & 0xff, (src[i] >> 16) & 0xff, src[i] >> 24) * (1.0f / 255.0f);
+            ways[way].key = key;
+        }
+        ways[way].lastUse = cache.clock;
+        cache.lastKey = key;
+        cache.lastTile = texels;
+        return texels;
+    }
+}
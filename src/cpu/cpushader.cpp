@@ -1,13 +1,20 @@
 #include <cpu/cpushader.hpp>
+#include <utils/mathUtils.hpp>
 namespace scTracer::CPU
 {
-    glm::uvec4 seed;
-    glm::ivec2 pixel;
+    thread_local glm::uvec4 seed;
+    thread_local glm::ivec2 pixel;
+    thread_local const Sampler *activeSampler{nullptr};
+    thread_local uint32_t sampleIndex{0};
+    thread_local uint32_t sampleDimension{0};
 
-        void InitRNG(glm::vec2 p, int frame)
+    void InitRNG(glm::vec2 p, int frame, const Sampler *sampler)
     {
         pixel = glm::ivec2(p);
         seed = glm::uvec4(p.x, p.y, uint32_t(frame), uint32_t(p.x) + uint32_t(p.y));
+        activeSampler = sampler;
+        sampleIndex = uint32_t(frame);
+        sampleDimension = 0;
     }
 
     void pcg4d(glm::uvec4 &v)
@@ -26,6 +33,8 @@ namespace scTracer::CPU
 
     float rand()
     {
+        if (activeSampler)
+            return activeSampler->get1D(pixel, sampleIndex, sampleDimension++);
         pcg4d(seed);
         return float(seed.x) / float(0xffffffffu);
     }
@@ -37,6 +46,6 @@ namespace scTracer::CPU
 
     float Luminance(glm::vec3 c)
     {
-        return 0.212671 * c.x + 0.715160 * c.y + 0.072169 * c.z;
+        return Utils::mathUtils::luminance(c);
     }
 }
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include <cpu/denoiser.hpp>
+#include <cpu/cpushader.hpp>
+#include <cpu/simd.hpp>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include <utils/mathUtils.hpp>
+
+namespace scTracer::CPU
+{
+    using namespace SIMD;
+
+    namespace
+    {
+        const float kernel[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f}; // B3 spline, by distance from the center tap
+        const float minAlbedo = 0.01f;                                     // darker channels are not divided by
+        // weights are cut to 0 well before they turn denormal, which would slow the filter down many times over
+        const float minCosine = 0.75f;     // 0.75^128 ~ 1e-16
+        const float maxExponent = 40.0f;   // e^-40 ~ 4e-18
+        const float minWeight = 1e-18f;    // squared for the variance
+
+        inline float8 luminance(float8 r, float8 g, float8 b)
+        {
+            return float8(0.212671f) * r + float8(0.715160f) * g + float8(0.072169f) * b;
+        }
+    }
+
+    void Denoiser::denoise(const float *image, const float *aov, const float *meanVariance, int width, int height, float *output,
+                           Utils::ThreadPool *threadPool)
+    {
+        int numIterations = std::clamp(iterations, 0, maxIterations);
+        mPad = 2 << (maxIterations - 1); // two taps of the widest hole
+        int stride = mPad + (width + SIMD::width - 1) / SIMD::width * SIMD::width + mPad;
+        if (width != mWidth || stride != mStride || mDepth.size() != size_t(stride) * height)
+        { // the padding is only ever written here, that includes the columns rounding width up to the vector width
+            mWidth = width;
+            mStride = stride;
+            size_t size = size_t(mStride) * height;
+            for (int c = 0; c < 3; c++)
+            {
+                mIllum[c].assign(size, 0.0f);
+                mNextIllum[c].assign(size, 0.0f);
+                mNormal[c].assign(size, 0.0f);
+                mAlbedo[c].assign(size, 0.0f);
+            }
+            mVariance.assign(size, 0.0f);
+            mNextVariance.assign(size, 0.0f);
+            mDepth.assign(size, 0.0f);
+        }
+
+        auto rows = [&](const std::function<void(int)> &row)
+        {
+            if (threadPool)
+                threadPool->parallelFor(height, [&](int, int y)
+                                        { row(y); });
+            else
+                for (int y = 0; y < height; y++)
+                    row(y);
+        };
+
+        // demodulate, the variance of the illumination is the one of the image scaled the same way
+        rows([&](int y)
+             {
+            for (int x = 0; x < width; x++)
+            {
+                int i = y * width + x;
+                size_t p = size_t(y) * mStride + mPad + x;
+                const float *pixelAov = &aov[size_t(i) * AOV_CHANNELS];
+                glm::vec3 normal(pixelAov[4], pixelAov[5], pixelAov[6]);
+                float length = glm::length(normal);
+                normal = length > 0.0f ? normal / length : glm::vec3(0.0f);
+                float divisor[3];
+                for (int c = 0; c < 3; c++)
+                {
+                    divisor[c] = pixelAov[c] > minAlbedo ? pixelAov[c] : 1.0f;
+                    mAlbedo[c][p] = divisor[c];
+                    mIllum[c][p] = image[size_t(i) * 4 + c] / divisor[c];
+                    mNormal[c][p] = normal[c];
+                }
+                float scale = Utils::mathUtils::luminance(divisor[0], divisor[1], divisor[2]);
+                mVariance[p] = meanVariance[i] / std::max(scale * scale, minAlbedo * minAlbedo);
+                mDepth[p] = pixelAov[3];
+            } });
+
+        for (int i = 0; i < numIterations; i++)
+            __pass(1 << i, width, height, threadPool);
+
+        rows([&](int y)
+             {
+            for (int x = 0; x < width; x++)
+            {
+                size_t i = size_t(y) * width + x;
+                size_t p = size_t(y) * mStride + mPad + x;
+                for (int c = 0; c < 3; c++)
+                    output[i * 4 + c] = mIllum[c][p] * mAlbedo[c][p];
+                output[i * 4 + 3] = image[i * 4 + 3];
+            } });
+    }
+
+    void Denoiser::__pass(int step, int width, int height, Utils::ThreadPool *threadPool)
+    {
+        auto row = [&](int, int y)
+        {
+            for (int x = 0; x < width; x += SIMD::width)
+            {
+                size_t p = size_t(y) * mStride + mPad + x;
+                float8 illumP[3] = {float8::loadu(&mIllum[0][p]), float8::loadu(&mIllum[1][p]), float8::loadu(&mIllum[2][p])};
+                float8 nx = float8::loadu(&mNormal[0][p]), ny = float8::loadu(&mNormal[1][p]), nz = float8::loadu(&mNormal[2][p]);
+                float8 depthP = float8::loadu(&mDepth[p]);
+                float8 varianceP = float8::loadu(&mVariance[p]);
+                float8 lumP = luminance(illumP[0], illumP[1], illumP[2]);
+                float8 invSigmaLum = float8(1.0f) / (float8(colorSigma) * sqrt(max(varianceP, float8(0.0f))) + float8(1e-10f));
+                float8 invSigmaDepth = float8(1.0f) / (float8(depthSigma * float(step)) * depthP + float8(1e-10f));
+
+                // the center tap has full weight, the others what the edge stopping functions leave of it
+                float8 centerWeight(kernel[0] * kernel[0]);
+                float8 sum[3] = {illumP[0] * centerWeight, illumP[1] * centerWeight, illumP[2] * centerWeight};
+                float8 weightSum = centerWeight;
+                float8 varianceSum = varianceP * centerWeight * centerWeight;
+                for (int dy = -2; dy <= 2; dy++)
+                {
+                    int qy = y + dy * step;
+                    if (qy < 0 || qy >= height)
+                        continue;
+                    for (int dx = -2; dx <= 2; dx++)
+                    {
+                        if (dx == 0 && dy == 0)
+                            continue;
+                        size_t q = size_t(qy) * mStride + mPad + x + dx * step;
+                        float8 illumQ[3] = {float8::loadu(&mIllum[0][q]), float8::loadu(&mIllum[1][q]), float8::loadu(&mIllum[2][q])};
+                        float8 cosine = nx * float8::loadu(&mNormal[0][q]) + ny * float8::loadu(&mNormal[1][q]) + nz * float8::loadu(&mNormal[2][q]);
+                        float8 normalWeight = select(cosine > float8(minCosine), cosine, float8(0.0f));
+                        for (int k = 0; k < 7; k++) // cosine^128
+                            normalWeight = normalWeight * normalWeight;
+                        float8 lumQ = luminance(illumQ[0], illumQ[1], illumQ[2]);
+                        float8 depthQ = float8::loadu(&mDepth[q]);
+                        float8 exponent = abs(lumP - lumQ) * invSigmaLum + abs(depthP - depthQ) * invSigmaDepth * float8(1.0f / std::sqrt(float(dx * dx + dy * dy)));
+                        float8 weight = float8(kernel[std::abs(dx)] * kernel[std::abs(dy)]) * normalWeight * expFast(-min(exponent, float8(maxExponent)));
+                        weight = select(weight > float8(minWeight), weight, float8(0.0f));
+
+                        for (int c = 0; c < 3; c++)
+                            sum[c] += weight * illumQ[c];
+                        weightSum += weight;
+                        varianceSum += weight * weight * float8::loadu(&mVariance[q]);
+                    }
+                }
+
+                float8 invWeightSum = float8(1.0f) / weightSum;
+                for (int c = 0; c < 3; c++)
+                    (sum[c] * invWeightSum).storeu(&mNextIllum[c][p]);
+                (varianceSum * invWeightSum * invWeightSum).storeu(&mNextVariance[p]);
+            }
+        };
+        if (threadPool)
+            threadPool->parallelFor(height, row);
+        else
+            for (int y = 0; y < height; y++)
+                row(0, y);
+
+        for (int c = 0; c < 3; c++)
+            mIllum[c].swap(mNextIllum[c]);
+        mVariance.swap(mNextVariance);
+    }
+}
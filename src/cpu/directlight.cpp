@@ -2,22 +2,26 @@
 
 namespace scTracer::CPU
 {
-    glm::vec3 Integrator::DirectLight(Ray r, State state, bool isSurface)
+    // picks an emitter with the light sampler and samples a point on it, lightSample.pdf is the solid angle pdf
+    // of both steps. lightArea is 0 for distant lights, false when there is nothing to sample
+    template <uint32_t kFeatures>
+    bool Integrator::SampleEmitter(glm::vec3 scatterPos, glm::vec3 normal, LightSampleRec &lightSample, float &lightArea)
     {
-        glm::vec3 Ld{0.0f};
-        glm::vec3 Li{0.0f};
-        glm::vec3 scatterPos = state.fhp + float(EPS) * state.ffnormal;
+        Light light;
 
-        ScatterSampleRec scatterSample;
+        // Pick an emitter proportional to its estimated contribution
+        float lightPmf = 0.0f;
+        int index = mScene->lightSampler.sample(scatterPos, normal, rand(), lightPmf);
+        if (index < 0 || lightPmf <= 0.0f)
+            return false;
 
-        // Analytic Lights
+        if ((kFeatures & FeatureEmissiveTriangles) != 0 && mScene->lightSampler.isTriangle(index))
+        {
+            SampleTriangleLight(mScene->lightSampler.triangle(index), scatterPos, lightSample);
+            light.area = mScene->lightSampler.triangle(index).area;
+        }
+        else
         {
-            LightSampleRec lightSample;
-            Light light;
-
-            // Pick a light to sample
-            int index = int(rand() * float(mScene->lights.size())) * 5;
-
             // Fetch light Data
             light.position = mScene->lights[index].position;
             light.emission = mScene->lights[index].emission;
@@ -27,32 +31,86 @@ namespace scTracer::CPU
             light.area = mScene->lights[index].area;
             light.type = mScene->lights[index].type; // 0->Rect, 1->Sphere, 2->Distant
 
-            SampleOneLight(light, scatterPos, lightSample);
-            Li = lightSample.emission;
+            if constexpr ((kFeatures & FeatureAnalyticLights) == FeatureRectLight)
+                SampleRectLight(light, scatterPos, lightSample);
+            else
+                SampleOneLight(light, scatterPos, lightSample);
+        }
+        lightSample.pdf *= lightPmf; // solid angle pdf of the whole strategy
+        lightArea = light.area;
+        return true;
+    }
 
-            if (dot(lightSample.direction, lightSample.normal) < 0.0) // Required for quad lights with single sided emission
+    // fills shadowRays with the unoccluded contributions of this bounce, the caller resolves the occlusion.
+    // With a reservoir the light sample is the one ReSTIR resampled, the environment map is sampled as usual.
+    // With a guide the MIS weights account for the guided directions
+    template <uint32_t kFeatures>
+    int Integrator::DirectLight(Ray r, State state, bool isSurface, ShadowRay *shadowRays, const Reservoir *reservoir, const GuidingPath *guide)
+    {
+        int numShadowRays = 0;
+        glm::vec3 Li{0.0f};
+        glm::vec3 scatterPos = state.fhp + float(EPS) * state.ffnormal;
+
+        ScatterSampleRec scatterSample;
+
+        // Environment map, sampled on its own and weighted against the bsdf sample hitting the background
+        if ((kFeatures & FeatureEnvMap) != 0 && uniforms.hasEnvMap)
+        {
+            glm::vec3 lightDir;
+            float lightPdf;
+            float r1 = rand();
+            float r2 = rand();
+            Li = mScene->envMap.sample(r1, r2, lightDir, lightPdf) * uniforms.envMapIntensity;
+
+            if (lightPdf > 0.0f)
             {
-                Ray shadowRay = Ray(scatterPos, lightSample.direction);
+                scatterSample.f = DisneyEval<kFeatures>(state, -r.direction, state.ffnormal, lightDir, scatterSample.pdf);
+                if (scatterSample.pdf > 0.0)
+                    shadowRays[numShadowRays++] = {Ray(scatterPos, lightDir), INF, PowerHeuristic(lightPdf, guide ? GuidedPdf(*guide, lightDir, scatterSample.pdf) : scatterSample.pdf) * Li * scatterSample.f / lightPdf};
+            }
+        }
 
-                // If there are volumes in the scene then evaluate transmittance rather than a binary anyhit test
+        if (reservoir)
+        {
+            if (reservoir->W > 0.0f)
+            {
+                Ray shadowRay;
+                float maxDist;
+                Li = RestirContribution(state, -r.direction, reservoir->y, shadowRay, maxDist);
+                if (Li != glm::vec3(0.0f))
+                    shadowRays[numShadowRays++] = {shadowRay, maxDist, Li * reservoir->W};
+            }
+            return numShadowRays;
+        }
 
-                // If there are no volumes in the scene then use a simple binary hit test
-                bool inShadow = AnyHit(shadowRay, lightSample.dist - EPS);
+        // Lights and emissive triangles, picked by the light sampler
+        {
+            LightSampleRec lightSample;
+            float lightArea;
+            if (!SampleEmitter<kFeatures>(scatterPos, state.ffnormal, lightSample, lightArea))
+                return numShadowRays;
+            Li = lightSample.emission;
 
-                if (!inShadow)
-                {
-                    scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightSample.direction, scatterSample.pdf);
+            if (dot(lightSample.direction, lightSample.normal) < 0.0) // Required for quad lights with single sided emission
+            {
+                scatterSample.f = DisneyEval<kFeatures>(state, -r.direction, state.ffnormal, lightSample.direction, scatterSample.pdf);
 
-                    float misWeight = 1.0;
-                    if (light.area > 0.0) // No MIS for distant light
-                        misWeight = PowerHeuristic(lightSample.pdf, scatterSample.pdf);
+                float misWeight = 1.0;
+                if (lightArea > 0.0) // No MIS for distant light
+                    misWeight = PowerHeuristic(lightSample.pdf, guide ? GuidedPdf(*guide, lightSample.direction, scatterSample.pdf) : scatterSample.pdf);
 
-                    if (scatterSample.pdf > 0.0)
-                        Ld += misWeight * Li * scatterSample.f / lightSample.pdf;
-                }
+                // If there are no volumes in the scene then a binary anyhit test on the shadow ray is enough
+                if (scatterSample.pdf > 0.0)
+                    shadowRays[numShadowRays++] = {Ray(scatterPos, lightSample.direction), lightSample.dist - float(EPS), misWeight * Li * scatterSample.f / lightSample.pdf};
             }
         }
 
-        return Ld;
+        return numShadowRays;
     }
-}
\ No newline at end of file
+
+#define SCTRACER_INSTANTIATE_DIRECTLIGHT(F)                                                                        \
+    template bool Integrator::SampleEmitter<uint32_t(F)>(glm::vec3, glm::vec3, LightSampleRec &, float &);          \
+    template int Integrator::DirectLight<uint32_t(F)>(Ray, State, bool, ShadowRay *, const Reservoir *, const GuidingPath *);
+    SCTRACER_KERNEL_FEATURE_SETS(SCTRACER_INSTANTIATE_DIRECTLIGHT)
+#undef SCTRACER_INSTANTIATE_DIRECTLIGHT
+}
@@ -12,19 +12,17 @@ namespace scTracer::CPU
         return glm::vec3(glm::dot(V, X), glm::dot(V, Y), glm::dot(V, Z));
     }
 
-    void Integrator::TintColors(Material mat, float eta, float F0, glm::vec3 &Csheen, glm::vec3 &Cspec0)
+    void Integrator::TintColors(const Core::ShadingMaterial &mat, float eta, float &F0, glm::vec3 &Csheen, glm::vec3 &Cspec0)
     {
-        float lum = Luminance(mat.baseColor);
-        glm::vec3 ctint = lum > 0.0 ? mat.baseColor / lum : glm::vec3(1.0);
-
+        // the tints are baked into the material, only F0 depends on the side of the surface
         F0 = (1.0 - eta) / (1.0 + eta);
         F0 *= F0;
 
-        Cspec0 = F0 * glm::mix(glm::vec3(1.0), ctint, mat.specularTint);
-        Csheen = glm::mix(glm::vec3(1.0), ctint, mat.sheenTint);
+        Cspec0 = F0 * mat.specTint;
+        Csheen = mat.Csheen;
     }
 
-    glm::vec3 Integrator::EvalDisneyDiffuse(Material mat, glm::vec3 Csheen, glm::vec3 V, glm::vec3 L, glm::vec3 H, float &pdf)
+    glm::vec3 Integrator::EvalDisneyDiffuse(const Core::ShadingMaterial &mat, glm::vec3 Csheen, glm::vec3 V, glm::vec3 L, glm::vec3 H, float &pdf)
     {
         pdf = 0.0;
         if (L.z <= 0.0)
@@ -53,7 +51,7 @@ namespace scTracer::CPU
         return float(INV_PI) * mat.baseColor * glm::mix(Fd + Fretro, ss, mat.subsurface) + Fsheen;
     }
 
-    glm::vec3 Integrator::EvalMicrofacetReflection(Material mat, glm::vec3 V, glm::vec3 L, glm::vec3 H, glm::vec3 F, float &pdf)
+    glm::vec3 Integrator::EvalMicrofacetReflection(const Core::ShadingMaterial &mat, glm::vec3 V, glm::vec3 L, glm::vec3 H, glm::vec3 F, float &pdf)
     {
         pdf = 0.0;
         if (L.z <= 0.0)
@@ -67,6 +65,7 @@ namespace scTracer::CPU
         return F * D * G2 / (4.0f * L.z * V.z);
     }
 
+    template <uint32_t kFeatures>
     glm::vec3 Integrator::DisneyEval(State state, glm::vec3 V, glm::vec3 N, glm::vec3 L, float &pdf)
     {
         pdf = 0.0;
@@ -92,21 +91,21 @@ namespace scTracer::CPU
         // Tint colors
         glm::vec3 Csheen, Cspec0;
         float F0(0.0);
-        TintColors(state.mat, state.eta, F0, Csheen, Cspec0);
+        TintColors(*state.mat, state.eta, F0, Csheen, Cspec0);
 
-        // Model weights
-        float dielectricWt = (1.0 - state.mat.metallic) * (1.0 - state.mat.specTrans);
-        float metalWt = state.mat.metallic;
-        float glassWt = (1.0 - state.mat.metallic) * state.mat.specTrans;
+        // Model weights, lobes the kernel is compiled without have zero weight in every material of the scene
+        float dielectricWt = state.mat->dielectricWt;
+        float metalWt = (kFeatures & FeatureMetal) ? state.mat->metallic : 0.0f;
+        float glassWt = (kFeatures & FeatureGlass) ? (1.0 - state.mat->metallic) * state.mat->specTrans : 0.0f;
 
         // Lobe probabilities
         float schlickWt = SchlickWeight(V.z);
 
-        float diffPr = dielectricWt * Luminance(state.mat.baseColor);
+        float diffPr = dielectricWt * state.mat->baseLum;
         float dielectricPr = dielectricWt * Luminance(glm::mix(Cspec0, glm::vec3(1.0), schlickWt));
-        float metalPr = metalWt * Luminance(glm::mix(state.mat.baseColor, glm::vec3(1.0), schlickWt));
+        float metalPr = (kFeatures & FeatureMetal) ? metalWt * Luminance(glm::mix(state.mat->baseColor, glm::vec3(1.0), schlickWt)) : 0.0f;
         float glassPr = glassWt;
-        float clearCtPr = 0.25 * state.mat.clearcoat;
+        float clearCtPr = (kFeatures & FeatureClearcoat) ? 0.25 * state.mat->clearcoat : 0.0f;
 
         // Normalize probabilities
         float invTotalWt = 1.0 / (diffPr + dielectricPr + metalPr + glassPr + clearCtPr);
@@ -124,7 +123,7 @@ namespace scTracer::CPU
         // Diffuse
         if (diffPr > 0.0 && reflect)
         {
-            f += EvalDisneyDiffuse(state.mat, Csheen, V, L, H, tmpPdf) * dielectricWt;
+            f += EvalDisneyDiffuse(*state.mat, Csheen, V, L, H, tmpPdf) * dielectricWt;
             pdf += tmpPdf * diffPr;
         }
 
@@ -132,50 +131,51 @@ namespace scTracer::CPU
         if (dielectricPr > 0.0 && reflect)
         {
             // Normalize for interpolating based on Cspec0
-            float F = (DielectricFresnel(VDotH, 1.0 / state.mat.ior) - F0) / (1.0 - F0);
+            float F = (DielectricFresnel(VDotH, 1.0 / state.mat->ior) - F0) / (1.0 - F0);
 
-            f += EvalMicrofacetReflection(state.mat, V, L, H, glm::mix(Cspec0, glm::vec3(1.0f), F), tmpPdf) * dielectricWt;
+            f += EvalMicrofacetReflection(*state.mat, V, L, H, glm::mix(Cspec0, glm::vec3(1.0f), F), tmpPdf) * dielectricWt;
             pdf += tmpPdf * dielectricPr;
         }
 
         // Metallic Reflection
-        if (metalPr > 0.0 && reflect)
+        if ((kFeatures & FeatureMetal) != 0 && metalPr > 0.0 && reflect)
         {
             // Tinted to base color
-            glm::vec3 F = glm::mix(state.mat.baseColor, glm::vec3(1.0), SchlickWeight(VDotH));
+            glm::vec3 F = glm::mix(state.mat->baseColor, glm::vec3(1.0), SchlickWeight(VDotH));
 
-            f += EvalMicrofacetReflection(state.mat, V, L, H, F, tmpPdf) * metalWt;
+            f += EvalMicrofacetReflection(*state.mat, V, L, H, F, tmpPdf) * metalWt;
             pdf += tmpPdf * metalPr;
         }
 
         // Glass/Specular BSDF
-        if (glassPr > 0.0)
+        if ((kFeatures & FeatureGlass) != 0 && glassPr > 0.0)
         {
             // Dielectric fresnel (achromatic)
             float F = DielectricFresnel(VDotH, state.eta);
 
             if (reflect)
             {
-                f += EvalMicrofacetReflection(state.mat, V, L, H, glm::vec3(F), tmpPdf) * glassWt;
+                f += EvalMicrofacetReflection(*state.mat, V, L, H, glm::vec3(F), tmpPdf) * glassWt;
                 pdf += tmpPdf * glassPr * F;
             }
             else
             {
-                f += EvalMicrofacetRefraction(state.mat, state.eta, V, L, H, glm::vec3(F), tmpPdf) * glassWt;
+                f += EvalMicrofacetRefraction(*state.mat, state.eta, V, L, H, glm::vec3(F), tmpPdf) * glassWt;
                 pdf += tmpPdf * glassPr * (1.0 - F);
             }
         }
 
         // Clearcoat
-        if (clearCtPr > 0.0 && reflect)
+        if ((kFeatures & FeatureClearcoat) != 0 && clearCtPr > 0.0 && reflect)
         {
-            f += EvalClearcoat(state.mat, V, L, H, tmpPdf) * 0.25f * state.mat.clearcoat;
+            f += EvalClearcoat(*state.mat, V, L, H, tmpPdf) * 0.25f * state.mat->clearcoat;
             pdf += tmpPdf * clearCtPr;
         }
 
         return f * abs(L.z);
     }
 
+    template <uint32_t kFeatures>
     glm::vec3 Integrator::DisneySample(State state, glm::vec3 V, glm::vec3 N, glm::vec3 &L, float &pdf)
     {
         pdf = 0.0;
@@ -193,21 +193,21 @@ namespace scTracer::CPU
         // Tint colors
         glm::vec3 Csheen, Cspec0;
         float F0(0.0f);
-        TintColors(state.mat, state.eta, F0, Csheen, Cspec0);
+        TintColors(*state.mat, state.eta, F0, Csheen, Cspec0);
 
-        // Model weights
-        float dielectricWt = (1.0 - state.mat.metallic) * (1.0 - state.mat.specTrans);
-        float metalWt = state.mat.metallic;
-        float glassWt = (1.0 - state.mat.metallic) * state.mat.specTrans;
+        // Model weights, lobes the kernel is compiled without have zero weight in every material of the scene
+        float dielectricWt = state.mat->dielectricWt;
+        float metalWt = (kFeatures & FeatureMetal) ? state.mat->metallic : 0.0f;
+        float glassWt = (kFeatures & FeatureGlass) ? (1.0 - state.mat->metallic) * state.mat->specTrans : 0.0f;
 
         // Lobe probabilities
         float schlickWt = SchlickWeight(V.z);
 
-        float diffPr = dielectricWt * Luminance(state.mat.baseColor);
+        float diffPr = dielectricWt * state.mat->baseLum;
         float dielectricPr = dielectricWt * Luminance(glm::mix(Cspec0, glm::vec3(1.0), schlickWt));
-        float metalPr = metalWt * Luminance(glm::mix(state.mat.baseColor, glm::vec3(1.0), schlickWt));
+        float metalPr = (kFeatures & FeatureMetal) ? metalWt * Luminance(glm::mix(state.mat->baseColor, glm::vec3(1.0), schlickWt)) : 0.0f;
         float glassPr = glassWt;
-        float clearCtPr = 0.25 * state.mat.clearcoat;
+        float clearCtPr = (kFeatures & FeatureClearcoat) ? 0.25 * state.mat->clearcoat : 0.0f;
 
         // Normalize probabilities
         float invTotalWt = 1.0 / (diffPr + dielectricPr + metalPr + glassPr + clearCtPr);
@@ -234,16 +234,16 @@ namespace scTracer::CPU
         }
         else if (r3 < cdf[2]) // Dielectric + Metallic reflection
         {
-            glm::vec3 H = SampleGGXVNDF(V, state.mat.ax, state.mat.ay, r1, r2);
+            glm::vec3 H = SampleGGXVNDF(V, state.mat->ax, state.mat->ay, r1, r2);
 
             if (H.z < 0.0)
                 H = -H;
 
             L = glm::normalize(reflect(-V, H));
         }
-        else if (r3 < cdf[3]) // Glass
+        else if ((kFeatures & FeatureGlass) != 0 && r3 < cdf[3]) // Glass
         {
-            glm::vec3 H = SampleGGXVNDF(V, state.mat.ax, state.mat.ay, r1, r2);
+            glm::vec3 H = SampleGGXVNDF(V, state.mat->ax, state.mat->ay, r1, r2);
             float F = DielectricFresnel(abs(glm::dot(V, H)), state.eta);
 
             if (H.z < 0.0)
@@ -264,7 +264,7 @@ namespace scTracer::CPU
         }
         else // Clearcoat
         {
-            glm::vec3 H = SampleGTR1(state.mat.clearcoatRoughness, r1, r2);
+            glm::vec3 H = SampleGTR1(state.mat->clearcoatRoughness, r1, r2);
 
             if (H.z < 0.0)
                 H = -H;
@@ -275,10 +275,10 @@ namespace scTracer::CPU
         L = ToWorld(T, B, N, L);
         V = ToWorld(T, B, N, V);
 
-        return DisneyEval(state, V, N, L, pdf);
+        return DisneyEval<kFeatures>(state, V, N, L, pdf);
     }
 
-    glm::vec3 Integrator::EvalMicrofacetRefraction(Material mat, float eta, glm::vec3 V, glm::vec3 L, glm::vec3 H, glm::vec3 F, float &pdf)
+    glm::vec3 Integrator::EvalMicrofacetRefraction(const Core::ShadingMaterial &mat, float eta, glm::vec3 V, glm::vec3 L, glm::vec3 H, glm::vec3 F, float &pdf)
     {
         pdf = 0.0;
         if (L.z >= 0.0)
@@ -299,7 +299,7 @@ namespace scTracer::CPU
         return glm::pow(mat.baseColor, glm::vec3(0.5f)) * (1.0f - F) * D * G2 * abs(VDotH) * jacobian * eta2 / abs(L.z * V.z);
     }
 
-    glm::vec3 Integrator::EvalClearcoat(Material mat, glm::vec3 V, glm::vec3 L, glm::vec3 H, float &pdf)
+    glm::vec3 Integrator::EvalClearcoat(const Core::ShadingMaterial &mat, glm::vec3 V, glm::vec3 L, glm::vec3 H, float &pdf)
     {
         pdf = 0.0;
         if (L.z <= 0.0)
@@ -315,4 +315,10 @@ namespace scTracer::CPU
         pdf = D * H.z * jacobian;
         return glm::vec3(F) * D * G;
     }
-}
\ No newline at end of file
+
+#define SCTRACER_INSTANTIATE_DISNEY(F)                                                                                 \
+    template glm::vec3 Integrator::DisneyEval<uint32_t(F)>(State, glm::vec3, glm::vec3, glm::vec3, float &);  \
+    template glm::vec3 Integrator::DisneySample<uint32_t(F)>(State, glm::vec3, glm::vec3, glm::vec3 &, float &);
+    SCTRACER_KERNEL_FEATURE_SETS(SCTRACER_INSTANTIATE_DISNEY)
+#undef SCTRACER_INSTANTIATE_DISNEY
+}
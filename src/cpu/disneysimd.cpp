@@ -0,0 +1,333 @@
+#include <cpu/disneysimd.hpp>
+
+// Lane-parallel port of disney.cpp. Branches become masks: every lobe a lane may need is evaluated
+// and blended in with select, whole lobes are skipped only when no lane of the packet uses them.
+namespace scTracer::CPU::SIMD
+{
+    namespace
+    {
+        struct Lobes
+        { // per packet terms shared by eval and sample
+            vec3x8 Cspec0;
+            float8 F0;
+            float8 dielectricWt, metalWt, glassWt;
+            float8 diffPr, dielectricPr, metalPr, glassPr, clearCtPr;
+        };
+
+        inline float8 Luminance(const vec3x8 &c) { return 0.212671f * c.x + 0.715160f * c.y + 0.072169f * c.z; }
+
+        inline float8 SchlickWeight(float8 u)
+        {
+            float8 m = clamp(1.0f - u, 0.0f, 1.0f);
+            float8 m2 = m * m;
+            return m2 * m2 * m;
+        }
+
+        inline void Onb(const vec3x8 &N, vec3x8 &T, vec3x8 &B)
+        {
+            vec3x8 up = select(abs(N.z) < 0.9999999f, vec3x8(0.0f, 0.0f, 1.0f), vec3x8(1.0f, 0.0f, 0.0f));
+            T = normalize(cross(up, N));
+            B = cross(N, T);
+        }
+
+        inline vec3x8 ToLocal(const vec3x8 &X, const vec3x8 &Y, const vec3x8 &Z, const vec3x8 &V) { return vec3x8(dot(V, X), dot(V, Y), dot(V, Z)); }
+        inline vec3x8 ToWorld(const vec3x8 &X, const vec3x8 &Y, const vec3x8 &Z, const vec3x8 &V) { return X * V.x + Y * V.y + Z * V.z; }
+
+        inline float8 DielectricFresnel(float8 cosThetaI, float8 eta)
+        {
+            float8 sinThetaTSq = eta * eta * (1.0f - cosThetaI * cosThetaI);
+            float8 cosThetaT = sqrt(max(1.0f - sinThetaTSq, 0.0f));
+            float8 rs = (eta * cosThetaT - cosThetaI) / (eta * cosThetaT + cosThetaI);
+            float8 rp = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+            return select(sinThetaTSq > 1.0f, 1.0f, 0.5f * (rs * rs + rp * rp)); // total internal reflection
+        }
+
+        inline float8 GTR2Aniso(float8 NDotH, float8 HDotX, float8 HDotY, float8 ax, float8 ay)
+        {
+            float8 a = HDotX / ax;
+            float8 b = HDotY / ay;
+            float8 c = a * a + b * b + NDotH * NDotH;
+            return 1.0f / (float(PI) * ax * ay * c * c);
+        }
+
+        inline float8 SmithGAniso(float8 NDotV, float8 VDotX, float8 VDotY, float8 ax, float8 ay)
+        {
+            float8 a = VDotX * ax;
+            float8 b = VDotY * ay;
+            return (2.0f * NDotV) / (NDotV + sqrt(a * a + b * b + NDotV * NDotV));
+        }
+
+        inline float8 SmithG(float8 NDotV, float alphaG)
+        {
+            float a = alphaG * alphaG;
+            float8 b = NDotV * NDotV;
+            return (2.0f * NDotV) / (NDotV + sqrt(a + b - a * b));
+        }
+
+        inline float8 GTR1(float8 NDotH, float8 a)
+        {
+            float8 a2 = a * a;
+            float8 t = 1.0f + (a2 - 1.0f) * NDotH * NDotH;
+            return select(a >= 1.0f, float(INV_PI), (a2 - 1.0f) / (float(PI) * log(a2) * t));
+        }
+
+        inline vec3x8 CosineSampleHemisphere(float8 r1, float8 r2)
+        {
+            float8 s, c;
+            sincos(float(TWO_PI) * r2, s, c);
+            float8 r = sqrt(r1);
+            vec3x8 dir(r * c, r * s, 0.0f);
+            dir.z = sqrt(max(1.0f - dir.x * dir.x - dir.y * dir.y, 0.0f));
+            return dir;
+        }
+
+        inline vec3x8 SampleGGXVNDF(const vec3x8 &V, float8 ax, float8 ay, float8 r1, float8 r2)
+        {
+            vec3x8 Vh = normalize(vec3x8(ax * V.x, ay * V.y, V.z));
+
+            float8 lensq = Vh.x * Vh.x + Vh.y * Vh.y;
+            vec3x8 T1 = select(lensq > 0.0f, vec3x8(-Vh.y, Vh.x, 0.0f) / sqrt(lensq), vec3x8(1.0f, 0.0f, 0.0f));
+            vec3x8 T2 = cross(Vh, T1);
+
+            float8 s, c;
+            sincos(float(TWO_PI) * r2, s, c);
+            float8 r = sqrt(r1);
+            float8 t1 = r * c;
+            float8 t2 = r * s;
+            float8 blend = 0.5f * (1.0f + Vh.z);
+            t2 = (1.0f - blend) * sqrt(1.0f - t1 * t1) + blend * t2;
+
+            vec3x8 Nh = T1 * t1 + T2 * t2 + Vh * sqrt(max(1.0f - t1 * t1 - t2 * t2, 0.0f));
+            return normalize(vec3x8(ax * Nh.x, ay * Nh.y, max(Nh.z, 0.0f)));
+        }
+
+        inline vec3x8 SampleGTR1(float8 rgh, float8 r1, float8 r2)
+        {
+            float8 a = max(rgh, 0.001f);
+            float8 a2 = a * a;
+
+            float8 sinPhi, cosPhi;
+            sincos(float(TWO_PI) * r1, sinPhi, cosPhi);
+
+            float8 cosTheta = sqrt((1.0f - exp((1.0f - r2) * log(a2))) / (1.0f - a2));
+            float8 sinTheta = clamp(sqrt(1.0f - cosTheta * cosTheta), 0.0f, 1.0f);
+            return vec3x8(sinTheta * cosPhi, sinTheta * sinPhi, cosTheta);
+        }
+
+        Lobes ModelWeights(const ShadingPacket &sp, const vec3x8 &V)
+        {
+            Lobes lobes;
+
+            // Tint colors, baked but for F0
+            lobes.F0 = (1.0f - sp.eta) / (1.0f + sp.eta);
+            lobes.F0 *= lobes.F0;
+            lobes.Cspec0 = lobes.F0 * sp.specTint;
+
+            // Model weights
+            lobes.dielectricWt = sp.dielectricWt;
+            lobes.metalWt = sp.metallic;
+            lobes.glassWt = (1.0f - sp.metallic) * sp.specTrans;
+
+            // Lobe probabilities
+            float8 schlickWt = SchlickWeight(V.z);
+            lobes.diffPr = lobes.dielectricWt * sp.baseLum;
+            lobes.dielectricPr = lobes.dielectricWt * Luminance(mix(lobes.Cspec0, vec3x8(1.0f), schlickWt));
+            lobes.metalPr = lobes.metalWt * Luminance(mix(sp.baseColor, vec3x8(1.0f), schlickWt));
+            lobes.glassPr = lobes.glassWt;
+            lobes.clearCtPr = 0.25f * sp.clearcoat;
+
+            // Normalize probabilities
+            float8 invTotalWt = 1.0f / (lobes.diffPr + lobes.dielectricPr + lobes.metalPr + lobes.glassPr + lobes.clearCtPr);
+            lobes.diffPr *= invTotalWt;
+            lobes.dielectricPr *= invTotalWt;
+            lobes.metalPr *= invTotalWt;
+            lobes.glassPr *= invTotalWt;
+            lobes.clearCtPr *= invTotalWt;
+            return lobes;
+        }
+
+        // DisneyEval in shading space (NDotL = L.z; NDotV = V.z; NDotH = H.z)
+        vec3x8 EvalLocal(const ShadingPacket &sp, const Lobes &lobes, const vec3x8 &V, const vec3x8 &L, float8 &pdf)
+        {
+            vec3x8 f(0.0f);
+            pdf = 0.0f;
+
+            vec3x8 H = select(L.z > 0.0f, normalize(L + V), normalize(L + V * sp.eta));
+            H = select(H.z < 0.0f, -H, H);
+
+            mask8 reflect = L.z * V.z > 0.0f;
+            mask8 above = L.z > 0.0f; // the reflection lobes are zero below the surface
+            float8 VDotH = abs(dot(V, H));
+            float8 LDotH = dot(L, H);
+
+            // Diffuse
+            mask8 diffuse = (lobes.diffPr > 0.0f) & reflect & above;
+            if (any(diffuse))
+            {
+                float8 Rr = 2.0f * sp.roughness * LDotH * LDotH;
+
+                float8 FL = SchlickWeight(L.z);
+                float8 FV = SchlickWeight(V.z);
+                float8 Fretro = Rr * (FL + FV + FL * FV * (Rr - 1.0f));
+                float8 Fd = (1.0f - 0.5f * FL) * (1.0f - 0.5f * FV);
+
+                // Fake subsurface
+                float8 Fss90 = 0.5f * Rr;
+                float8 Fss = mix(1.0f, Fss90, FL) * mix(1.0f, Fss90, FV);
+                float8 ss = 1.25f * (Fss * (1.0f / (L.z + V.z) - 0.5f) + 0.5f);
+
+                // Sheen
+                float8 FH = SchlickWeight(LDotH);
+                vec3x8 Fsheen = sp.Csheen * (FH * sp.sheen);
+
+                vec3x8 value = sp.baseColor * (float(INV_PI) * mix(Fd + Fretro, ss, sp.subsurface)) + Fsheen;
+                f += select(diffuse, value * lobes.dielectricWt, vec3x8(0.0f));
+                pdf += select(diffuse, L.z * float(INV_PI) * lobes.diffPr, 0.0f);
+            }
+
+            // Microfacet reflection, D and G are shared by the dielectric, metal and glass lobes
+            mask8 dielectric = (lobes.dielectricPr > 0.0f) & reflect & above;
+            mask8 metal = (lobes.metalPr > 0.0f) & reflect & above;
+            mask8 glass = lobes.glassPr > 0.0f;
+            if (any(dielectric | metal | glass))
+            {
+                float8 D = GTR2Aniso(H.z, H.x, H.y, sp.ax, sp.ay);
+                float8 G1 = SmithGAniso(abs(V.z), V.x, V.y, sp.ax, sp.ay);
+                float8 G2 = G1 * SmithGAniso(abs(L.z), L.x, L.y, sp.ax, sp.ay);
+                float8 reflectF = D * G2 / (4.0f * L.z * V.z); // times the fresnel term
+                float8 reflectPdf = G1 * D / (4.0f * V.z);
+
+                if (any(dielectric))
+                {
+                    // Normalize for interpolating based on Cspec0
+                    float8 F = (DielectricFresnel(VDotH, 1.0f / sp.ior) - lobes.F0) / (1.0f - lobes.F0);
+                    f += select(dielectric, mix(lobes.Cspec0, vec3x8(1.0f), F) * (reflectF * lobes.dielectricWt), vec3x8(0.0f));
+                    pdf += select(dielectric, reflectPdf * lobes.dielectricPr, 0.0f);
+                }
+
+                if (any(metal))
+                {
+                    // Tinted to base color
+                    vec3x8 F = mix(sp.baseColor, vec3x8(1.0f), SchlickWeight(VDotH));
+                    f += select(metal, F * (reflectF * lobes.metalWt), vec3x8(0.0f));
+                    pdf += select(metal, reflectPdf * lobes.metalPr, 0.0f);
+                }
+
+                if (any(glass))
+                {
+                    // Dielectric fresnel (achromatic)
+                    float8 F = DielectricFresnel(VDotH, sp.eta);
+
+                    mask8 glassReflect = glass & reflect & above;
+                    f += select(glassReflect, vec3x8(F * reflectF * lobes.glassWt), vec3x8(0.0f));
+                    pdf += select(glassReflect, reflectPdf * lobes.glassPr * F, 0.0f);
+
+                    mask8 glassRefract = glass & !reflect & (L.z < 0.0f);
+                    if (any(glassRefract))
+                    {
+                        float8 denom = LDotH + dot(V, H) * sp.eta;
+                        denom *= denom;
+                        float8 jacobian = abs(LDotH) / denom;
+                        float8 refractPdf = G1 * max(dot(V, H), 0.0f) * D * jacobian / V.z;
+                        vec3x8 tint(sqrt(sp.baseColor.x), sqrt(sp.baseColor.y), sqrt(sp.baseColor.z));
+                        vec3x8 value = tint * ((1.0f - F) * D * G2 * VDotH * jacobian * sp.eta * sp.eta / abs(L.z * V.z));
+                        f += select(glassRefract, value * lobes.glassWt, vec3x8(0.0f));
+                        pdf += select(glassRefract, refractPdf * lobes.glassPr * (1.0f - F), 0.0f);
+                    }
+                }
+            }
+
+            // Clearcoat
+            mask8 clearcoat = (lobes.clearCtPr > 0.0f) & reflect & above;
+            if (any(clearcoat))
+            {
+                float8 F = mix(0.04f, 1.0f, SchlickWeight(dot(V, H)));
+                float8 D = GTR1(H.z, sp.clearcoatRoughness);
+                float8 G = SmithG(L.z, 0.25f) * SmithG(V.z, 0.25f);
+                float8 jacobian = 1.0f / (4.0f * dot(V, H));
+                f += select(clearcoat, vec3x8(F * D * G * 0.25f * sp.clearcoat), vec3x8(0.0f));
+                pdf += select(clearcoat, D * H.z * jacobian * lobes.clearCtPr, 0.0f);
+            }
+
+            return f * abs(L.z);
+        }
+    }
+
+    void ShadingPacket::set(int lane, const State &state, const glm::vec3 &V, const glm::vec3 &N)
+    {
+        const Core::ShadingMaterial &mat = *state.mat;
+        baseColor.insert(lane, mat.baseColor);
+        Csheen.insert(lane, mat.Csheen);
+        specTint.insert(lane, mat.specTint);
+        metallic.insert(lane, mat.metallic);
+        roughness.insert(lane, mat.roughness);
+        subsurface.insert(lane, mat.subsurface);
+        sheen.insert(lane, mat.sheen);
+        clearcoat.insert(lane, mat.clearcoat);
+        clearcoatRoughness.insert(lane, mat.clearcoatRoughness);
+        specTrans.insert(lane, mat.specTrans);
+        ior.insert(lane, mat.ior);
+        ax.insert(lane, mat.ax);
+        ay.insert(lane, mat.ay);
+        dielectricWt.insert(lane, mat.dielectricWt);
+        baseLum.insert(lane, mat.baseLum);
+        eta.insert(lane, state.eta);
+        this->N.insert(lane, N);
+        this->V.insert(lane, V);
+    }
+
+    vec3x8 DisneyEval(const ShadingPacket &sp, const vec3x8 &L, float8 &pdf)
+    {
+        vec3x8 T, B;
+        Onb(sp.N, T, B);
+        vec3x8 V = ToLocal(T, B, sp.N, sp.V);
+        return EvalLocal(sp, ModelWeights(sp, V), V, ToLocal(T, B, sp.N, L), pdf);
+    }
+
+    vec3x8 DisneySample(const ShadingPacket &sp, float8 r1, float8 r2, float8 r3, vec3x8 &L, float8 &pdf)
+    {
+        vec3x8 T, B;
+        Onb(sp.N, T, B);
+        vec3x8 V = ToLocal(T, B, sp.N, sp.V);
+        Lobes lobes = ModelWeights(sp, V);
+
+        // CDF of the sampling probabilities
+        float8 cdf0 = lobes.diffPr;
+        float8 cdf2 = cdf0 + lobes.dielectricPr + lobes.metalPr;
+        float8 cdf3 = cdf2 + lobes.glassPr;
+
+        // Sample a lobe based on its importance, then a direction from it
+        mask8 diffuse = r3 < cdf0;
+        mask8 microfacet = (!diffuse) & (r3 < cdf3);
+        mask8 clearcoat = (!diffuse) & !(r3 < cdf3);
+
+        vec3x8 Lh(0.0f, 0.0f, 1.0f);
+        if (any(diffuse))
+            Lh = select(diffuse, CosineSampleHemisphere(r1, r2), Lh);
+
+        if (any(microfacet)) // Dielectric + Metallic reflection and Glass
+        {
+            vec3x8 H = SampleGGXVNDF(V, sp.ax, sp.ay, r1, r2);
+            float8 F = DielectricFresnel(abs(dot(V, H)), sp.eta);
+            H = select(H.z < 0.0f, -H, H);
+
+            // Rescale random number for reuse
+            mask8 glass = r3 >= cdf2;
+            float8 rg = (r3 - cdf2) / (cdf3 - cdf2);
+            mask8 refract = glass & !(rg < F);
+
+            vec3x8 Lr = select(refract, normalize(SIMD::refract(-V, H, sp.eta)), normalize(reflect(-V, H)));
+            Lh = select(microfacet, Lr, Lh);
+        }
+
+        if (any(clearcoat))
+        {
+            vec3x8 H = SampleGTR1(sp.clearcoatRoughness, r1, r2);
+            H = select(H.z < 0.0f, -H, H);
+            Lh = select(clearcoat, normalize(reflect(-V, H)), Lh);
+        }
+
+        L = ToWorld(T, B, sp.N, Lh);
+        return EvalLocal(sp, lobes, V, Lh, pdf);
+    }
+}
@@ -1,355 +1,149 @@
 #include <cpu/integrator.hpp>
+#include <cmath>
 
 namespace scTracer::CPU
 {
     void Integrator::GetMaterial(State &state, Ray r)
     {
-        int index = state.matID;
-        Core::Material mat;
-        mat = mScene->materialDatas[index];
-        state.mat.baseColor = mat.baseColor;
-        state.mat.ior = mat.ior;
-        state.mat.metallic = mat.metallic;
-        state.mat.roughness = mat.roughness;
-        state.mat.subsurface = mat.subsurface;
-        state.mat.specularTint = mat.specularTint;
-        state.mat.sheen = mat.sheen;
-        state.mat.emission = mat.emission;
-        state.eta = glm::dot(r.direction, state.normal) > 0.0 ? mat.ior : 1.0f / mat.ior;
+        state.mat = &mScene->shadingMaterials[state.matID];
+        state.eta = glm::dot(r.direction, state.normal) > 0.0 ? state.mat->ior : 1.0f / state.mat->ior;
     }
 
-    bool Integrator::AnyHit(Ray r, float maxDist)
+    // uv footprint of a pixel at the hit. Camera rays bring their differentials, later bounces use the ones
+    // a camera ray straight to the hit would have, pbrt-v4's approximation, which keeps secondary lookups off lod 0
+    void Integrator::TexCoordDifferentials(const State &state, Ray r, glm::vec2 &duvdx, glm::vec2 &duvdy)
     {
-        // Intersect Emitters
-        for (int i = 0; i < mScene->lights.size(); i++)
+        duvdx = duvdy = glm::vec2(0.0f);
+        if (!r.hasDifferentials)
         {
-            // Fetch light Data
-            glm::vec3 position = mScene->lights[i].position;
-            glm::vec3 emission = mScene->lights[i].emission;
-            glm::vec3 u = mScene->lights[i].u;
-            glm::vec3 v = mScene->lights[i].v;
-            float radius = mScene->lights[i].radius;
-            float area = mScene->lights[i].area;
-            float type = mScene->lights[i].type;
-
-            // Intersect rectangular area light
-            if (type == QUAD_LIGHT)
-            {
-                glm::vec3 normal = glm::normalize(glm::cross(u, v));
-                glm::vec4 plane = glm::vec4(normal, glm::dot(normal, position));
-                u *= 1.0f / glm::dot(u, u);
-                v *= 1.0f / glm::dot(v, v);
-
-                float d = RectIntersect(position, u, v, plane, r);
-                if (d > 0.0 && d < maxDist)
-                    return true;
-            }
-
-            // Intersect spherical area light
-            if (type == SPHERE_LIGHT)
-            {
-                float d = SphereIntersect(radius, position, r);
-                if (d > 0.0 && d < maxDist)
-                    return true;
-            }
+            const Camera &camera = uniforms.camera;
+            float pixelSpread = 2.0f * tan(camera.fov * 0.5f) / mCanvasWidth;
+            r.rxOrigin = r.ryOrigin = camera.position;
+            glm::vec3 dir = glm::normalize(state.fhp - camera.position);
+            r.rxDirection = dir + pixelSpread * camera.right;
+            r.ryDirection = dir + pixelSpread * camera.up;
         }
 
-        // Intersect BVH and tris
-        int stack[64];
-        int ptr = 0;
-        stack[ptr++] = -1;
-
-        int index = uniforms.topBVHIndex;
-        float leftHit = 0.0;
-        float rightHit = 0.0;
-
-        bool BLAS = false;
-
-        Ray rTrans;
-        rTrans.origin = r.origin;
-        rTrans.direction = r.direction;
-
-        while (index != -1)
+        // where the offset rays meet the tangent plane of the hit
+        glm::vec3 n = state.normal;
+        float dx = glm::dot(n, r.rxDirection), dy = glm::dot(n, r.ryDirection);
+        if (dx == 0.0f || dy == 0.0f)
+            return;
+        glm::vec3 dpdx = r.rxOrigin + glm::dot(n, state.fhp - r.rxOrigin) / dx * r.rxDirection - state.fhp;
+        glm::vec3 dpdy = r.ryOrigin + glm::dot(n, state.fhp - r.ryOrigin) / dy * r.ryDirection - state.fhp;
+
+        // least squares for dp = dpdu * du + dpdv * dv
+        float a = glm::dot(state.dpdu, state.dpdu), b = glm::dot(state.dpdu, state.dpdv), c = glm::dot(state.dpdv, state.dpdv);
+        float det = a * c - b * b;
+        if (!std::isfinite(det) || glm::abs(det) < 1e-20f)
+            return;
+        float invDet = 1.0f / det;
+        auto solve = [&](glm::vec3 dp)
         {
-            glm::ivec3 LRLeaf = mScene->bvhFlattor.flattenedNodes[index].LeftRightLeaf;
-
-            int leftIndex = int(LRLeaf.x);
-            int rightIndex = int(LRLeaf.y);
-            int leaf = int(LRLeaf.z);
-
-            if (leaf > 0) // Leaf node of BLAS
-            {
-                for (int i = 0; i < rightIndex; i++) // Loop through tris
-                {
-                    glm::ivec3 vertIndices = glm::ivec3(mScene->sceneTriIndices[(leftIndex + i) * 3 + 0],
-                                                        mScene->sceneTriIndices[(leftIndex + i) * 3 + 1],
-                                                        mScene->sceneTriIndices[(leftIndex + i) * 3 + 2]);
-                    glm::vec4 v0 = glm::vec4(mScene->sceneVertices[vertIndices.x], mScene->sceneMeshUvs[vertIndices.x].x);
-                    glm::vec4 v1 = glm::vec4(mScene->sceneVertices[vertIndices.y], mScene->sceneMeshUvs[vertIndices.y].x);
-                    glm::vec4 v2 = glm::vec4(mScene->sceneVertices[vertIndices.z], mScene->sceneMeshUvs[vertIndices.z].x);
-
-                    glm::vec3 v0xyz = glm::vec3(v0.x, v0.y, v0.z);
-                    glm::vec3 v1xyz = glm::vec3(v1.x, v1.y, v1.z);
-                    glm::vec3 v2xyz = glm::vec3(v2.x, v2.y, v2.z);
-                    glm::vec3 e0 = v1xyz - v0xyz;
-                    glm::vec3 e1 = v2xyz - v0xyz;
-                    glm::vec3 pv = glm::cross(rTrans.direction, e1);
-                    float det = glm::dot(e0, pv);
-
-                    glm::vec3 tv = rTrans.origin - v0xyz;
-                    glm::vec3 qv = glm::cross(tv, e0);
-
-                    glm::vec4 uvt;
-                    uvt.x = glm::dot(tv, pv);
-                    uvt.y = glm::dot(rTrans.direction, qv);
-                    uvt.z = glm::dot(e1, qv);
-                    glm::vec3 uvt3 = glm::vec3(uvt.x, uvt.y, uvt.z);
-                    uvt.x = uvt.x / det;
-                    uvt.y = uvt.y / det;
-                    uvt.z = uvt.z / det;
-                    uvt.w = 1.0 - uvt.x - uvt.y;
-
-                    if (glm::all(glm::greaterThanEqual(uvt, glm::vec4(0.0))) && uvt.z < maxDist)
-                        return true;
-                }
-            }
-            else if (leaf < 0) // Leaf node of TLAS
-            {
-                glm::mat4 transform = mScene->transforms[(-leaf - 1)];
-
-                rTrans.origin = glm::vec3(inverse(transform) * glm::vec4(r.origin, 1.0));
-                rTrans.direction = glm::vec3(inverse(transform) * glm::vec4(r.direction, 0.0));
-
-                // Add a marker. We'll return to this spot after we've traversed the entire BLAS
-                stack[ptr++] = -1;
-
-                index = leftIndex;
-                BLAS = true;
-                // #if defined(OPT_ALPHA_TEST) && !defined(OPT_MEDIUM)
-                //             currMatID = rightIndex;
-                // #endif
-                continue;
-            }
-            else
-            {
-                leftHit = AABBIntersect(mScene->bvhFlattor.flattenedNodes[leftIndex].boundsmin, mScene->bvhFlattor.flattenedNodes[leftIndex].boundsmax, rTrans);
-                rightHit = AABBIntersect(mScene->bvhFlattor.flattenedNodes[rightIndex].boundsmin, mScene->bvhFlattor.flattenedNodes[rightIndex].boundsmax, rTrans);
-
-                if (leftHit > 0.0 && rightHit > 0.0)
-                {
-                    int deferred = -1;
-                    if (leftHit > rightHit)
-                    {
-                        index = rightIndex;
-                        deferred = leftIndex;
-                    }
-                    else
-                    {
-                        index = leftIndex;
-                        deferred = rightIndex;
-                    }
-
-                    stack[ptr++] = deferred;
-                    continue;
-                }
-                else if (leftHit > 0.)
-                {
-                    index = leftIndex;
-                    continue;
-                }
-                else if (rightHit > 0.)
-                {
-                    index = rightIndex;
-                    continue;
-                }
-            }
-            index = stack[--ptr];
-
-            // If we've traversed the entire BLAS then switch to back to TLAS and resume where we left off
-            if (BLAS && index == -1)
-            {
-                BLAS = false;
-
-                index = stack[--ptr];
-
-                rTrans.origin = r.origin;
-                rTrans.direction = r.direction;
-            }
-        }
-
-        return false;
+            float pu = glm::dot(state.dpdu, dp), pv = glm::dot(state.dpdv, dp);
+            return glm::vec2(c * pu - b * pv, a * pv - b * pu) * invDet;
+        };
+        duvdx = solve(dpdx);
+        duvdy = solve(dpdy);
     }
 
-    bool Integrator::ClosestHit(Ray r, State &state, LightSampleRec &lightSample, glm::vec3 &debugger)
+    // CPU side of the texture maps in GetMaterial (traceray.glsl), lod picked from the pixel footprint
+    void Integrator::TextureMaterial(State &state, Ray r)
     {
-        float t = INF;
-        float d;
-        // hit the light
-        for (int i = 0; i < mScene->lights.size(); i++)
+        const Core::Material &material = mScene->materialDatas[state.matID];
+        const Core::TextureCache &textures = mScene->textureCache;
+        auto valid = [&](float texID)
+        { return texID >= 0.0f && int(texID) < textures.numTextures(); };
+        if (!valid(material.baseColorTexId) && !valid(material.metallicRoughnessTexID) &&
+            !valid(material.normalmapTexID) && !valid(material.emissionmapTexID))
+            return;
+
+        glm::vec2 duvdx, duvdy;
+        TexCoordDifferentials(state, r, duvdx, duvdy);
+        auto fetch = [&](float texID)
+        { return textures.sample(int(texID), state.texCoord, textures.lod(int(texID), duvdx, duvdy)); };
+
+        Core::Material mat = material;
+        // opacity is left to the alpha test of the traversal
+        if (valid(material.baseColorTexId))
+            mat.baseColor = glm::vec3(fetch(material.baseColorTexId));
+
+        if (valid(material.metallicRoughnessTexID))
         {
-            glm::vec3 position = mScene->lights[i].position;
-            glm::vec3 emission = mScene->lights[i].emission;
-            glm::vec3 u = mScene->lights[i].u;
-            glm::vec3 v = mScene->lights[i].v;
-            float area = mScene->lights[i].area;
-            float;
-            if (int(mScene->lights[i].type) == Core::LightType::RectLight)
-            {
-                glm::vec3 normal = glm::normalize(glm::cross(u, v));
-                if (glm::dot(normal, r.direction) > 0.) // Hide backfacing quad light
-                    continue;
-
-                glm::vec4 plane = glm::vec4(normal, glm::dot(normal, position));
-                u *= 1.0f / dot(u, u);
-                v *= 1.0f / dot(v, v);
-
-                d = RectIntersect(position, u, v, plane, r);
-                if (d < 0.)
-                    d = INF;
-                if (d < t)
-                {
-                    t = d;
-                    float cosTheta = glm::dot(-r.direction, normal);
-                    lightSample.pdf = (t * t) / (area * cosTheta);
-                    lightSample.emission = emission;
-                    state.isEmitter = true;
-                }
-            }
+            glm::vec4 matRgh = fetch(material.metallicRoughnessTexID);
+            mat.metallic = matRgh.b;
+            mat.roughness = glm::max(matRgh.g * matRgh.g, 0.001f);
         }
-        // intersect with BVH
-        int stack[64];
-        int ptr = 0;
-        stack[ptr++] = -1;
-        int index = uniforms.topBVHIndex;
-        float leftHit = 0.0f, rightHit = 0.0f;
-
-        int currMatID = 0;
-        bool BLAS = false;
 
-        glm::ivec3 triID = glm::ivec3(-1);
-        glm::mat4 transMat;
-        glm::mat4 transform;
-        glm::vec3 bary;
-        glm::vec4 vert0, vert1, vert2;
-
-        Ray rTrans;
-        rTrans.origin = r.origin;
-        rTrans.direction = r.direction;
-
-        while (index != -1)
+        if (valid(material.normalmapTexID))
         {
-            glm::ivec3 LRLeaf = mScene->bvhFlattor.flattenedNodes[index].LeftRightLeaf;
+            glm::vec3 texNormal = glm::normalize(glm::vec3(fetch(material.normalmapTexID)) * 2.0f - 1.0f);
+            glm::vec3 origNormal = state.normal;
+            state.normal = glm::normalize(state.tangent * texNormal.x + state.bitangent * texNormal.y + state.normal * texNormal.z);
+            state.ffnormal = glm::dot(origNormal, r.direction) <= 0.0 ? state.normal : -state.normal;
+        }
 
-            int leftIndex = LRLeaf.x;
-            int rightIndex = LRLeaf.y;
-            int leaf = LRLeaf.z;
+        if (valid(material.emissionmapTexID))
+            mat.emission = glm::pow(glm::vec3(fetch(material.emissionmapTexID)), glm::vec3(2.2f));
 
-            if (leaf > 0) // Leaf node of BLAS
-            {
-                for (int i = 0; i < rightIndex; i++) // Loop through tris
-                {
-                    glm::ivec3 vertIndices = glm::ivec3(mScene->sceneTriIndices[(leftIndex + i) * 3 + 0],
-                                                        mScene->sceneTriIndices[(leftIndex + i) * 3 + 1],
-                                                        mScene->sceneTriIndices[(leftIndex + i) * 3 + 2]);
-                    glm::vec4 v0 = glm::vec4(mScene->sceneVertices[vertIndices.x], mScene->sceneMeshUvs[vertIndices.x].x);
-                    glm::vec4 v1 = glm::vec4(mScene->sceneVertices[vertIndices.y], mScene->sceneMeshUvs[vertIndices.y].x);
-                    glm::vec4 v2 = glm::vec4(mScene->sceneVertices[vertIndices.z], mScene->sceneMeshUvs[vertIndices.z].x);
+        state.texturedMat = Core::ShadingMaterial::bake(mat);
+        state.mat = &state.texturedMat;
+        state.eta = glm::dot(r.direction, state.normal) > 0.0 ? state.mat->ior : 1.0f / state.mat->ior;
+    }
 
-                    glm::vec3 v0xyz = glm::vec3(v0.x, v0.y, v0.z);
-                    glm::vec3 v1xyz = glm::vec3(v1.x, v1.y, v1.z);
-                    glm::vec3 v2xyz = glm::vec3(v2.x, v2.y, v2.z);
-                    glm::vec3 e0 = v1xyz - v0xyz;
-                    glm::vec3 e1 = v2xyz - v0xyz;
-                    glm::vec3 pv = glm::cross(rTrans.direction, e1);
-                    float det = glm::dot(e0, pv);
+    bool Integrator::AnyHit(Ray r, float maxDist)
+    {
+        // Intersect Emitters
+        if (mScene->lightBVH.occluded1(BVH::QueryRay(r.origin, r.direction, maxDist)))
+            return true;
 
-                    glm::vec3 tv = rTrans.origin - v0xyz;
-                    glm::vec3 qv = glm::cross(tv, e0);
+        // Intersect BVH and tris
+        return mScene->rayQuery.occluded1(BVH::QueryRay(r.origin, r.direction, maxDist));
+    }
 
-                    glm::vec4 uvt;
-                    uvt.x = glm::dot(tv, pv);
-                    uvt.y = glm::dot(rTrans.direction, qv);
-                    uvt.z = glm::dot(e1, qv);
-                    glm::vec3 uvt3 = glm::vec3(uvt.x, uvt.y, uvt.z);
-                    uvt.x = uvt.x / det;
-                    uvt.y = uvt.y / det;
-                    uvt.z = uvt.z / det;
-                    uvt.w = 1.0 - uvt.x - uvt.y;
+    bool Integrator::ClosestHit(Ray r, State &state, LightSampleRec &lightSample, glm::vec3 &debugger)
+    {
+        float t = IntersectEmitters(r, state, lightSample);
+        // intersect with BVH
+        BVH::QueryHit hit;
+        if (mScene->rayQuery.intersect1(BVH::QueryRay(r.origin, r.direction, t), hit))
+            t = hit.t;
+        return FillHitState(r, hit, t, state);
+    }
 
-                    if (glm::all(glm::greaterThanEqual(uvt, glm::vec4(0.0))) && uvt.z < t)
-                    {
-                        t = uvt.z;
-                        triID = vertIndices;
-                        state.matID = currMatID;
-                        // bary = uvt.wxy;
-                        bary = glm::vec3(uvt.w, uvt.x, uvt.y);
-                        vert0 = v0, vert1 = v1, vert2 = v2;
-                        transform = transMat;
-                    }
-                }
-            }
-            else if (leaf < 0) // Leaf node of TLAS
+    // closest analytic light along r, state and lightSample get its side of the hit. Returns its distance, INF without one
+    float Integrator::IntersectEmitters(Ray r, State &state, LightSampleRec &lightSample)
+    {
+        float t = INF;
+        // hit the light
+        BVH::QueryHit lightHit;
+        if (mScene->lightBVH.intersect1(BVH::QueryRay(r.origin, r.direction, t), lightHit))
+        {
+            t = lightHit.t;
+            const Core::Light &light = mScene->lights[lightHit.primIndex];
+            float cosTheta;
+            if (int(light.type) == Core::LightType::RectLight)
             {
-                glm::mat4 transform = mScene->transforms[(-leaf - 1)];
-
-                transMat = transform;
-
-                rTrans.origin = glm::vec3(glm::inverse(transMat) * glm::vec4(r.origin, 1.0));
-                rTrans.direction = glm::vec3(glm::inverse(transMat) * glm::vec4(r.direction, 0.0));
-
-                // Add a marker. We'll return to this spot after we've traversed the entire BLAS
-                stack[ptr++] = -1;
-                index = leftIndex;
-                BLAS = true;
-                currMatID = rightIndex;
-                continue;
+                cosTheta = glm::dot(-r.direction, mScene->lightBVH.emitter(lightHit.primIndex).normal);
+                lightSample.pdf = RectLightPdf(light.position, light.u, light.v, light.area, r.origin, t * t, cosTheta);
             }
             else
             {
-                leftHit = AABBIntersect(mScene->bvhFlattor.flattenedNodes[leftIndex].boundsmin, mScene->bvhFlattor.flattenedNodes[leftIndex].boundsmax, rTrans);
-                rightHit = AABBIntersect(mScene->bvhFlattor.flattenedNodes[rightIndex].boundsmin, mScene->bvhFlattor.flattenedNodes[rightIndex].boundsmax, rTrans);
-
-                if (leftHit > 0.0 && rightHit > 0.0)
-                {
-                    int deferred = -1;
-                    if (leftHit > rightHit)
-                    {
-                        index = rightIndex;
-                        deferred = leftIndex;
-                    }
-                    else
-                    {
-                        index = leftIndex;
-                        deferred = rightIndex;
-                    }
-
-                    stack[ptr++] = deferred;
-                    continue;
-                }
-                else if (leftHit > 0.)
-                {
-                    index = leftIndex;
-                    continue;
-                }
-                else if (rightHit > 0.)
-                {
-                    index = rightIndex;
-                    continue;
-                }
-            }
-            index = stack[--ptr];
-
-            // If we've traversed the entire BLAS then switch to back to TLAS and resume where we left off
-            if (BLAS && index == -1)
-            {
-                BLAS = false;
-
-                index = stack[--ptr];
-
-                rTrans.origin = r.origin;
-                rTrans.direction = r.direction;
+                glm::vec3 hitPt = r.origin + t * r.direction;
+                cosTheta = glm::dot(-r.direction, glm::normalize(hitPt - light.position));
+                lightSample.pdf = SphereLightPdf(light.position, light.radius, light.area, r.origin, t * t, cosTheta);
             }
+            lightSample.emission = light.emission;
+            state.isEmitter = true;
+            state.emitterIndex = lightHit.primIndex;
         }
+        return t;
+    }
+
+    // the rest of ClosestHit once the scene query ran up to the emitter distance: t is the closest of both,
+    // hit the triangle if it was one. False when nothing was hit
+    bool Integrator::FillHitState(Ray r, const BVH::QueryHit &hit, float t, State &state)
+    {
         if (t == INF)
             return false;
 
@@ -357,27 +151,28 @@ namespace scTracer::CPU
         state.fhp = r.origin + r.direction * t;
 
         // Ray hit a triangle and not a light source
-        if (triID.x != -1)
+        if (hit.valid())
         {
             state.isEmitter = false;
+            state.emitterIndex = mScene->lightSampler.triangleEmitter(hit.instanceIndex, hit.primIndex);
+            state.matID = hit.materialIndex;
+
+            glm::ivec3 triID = hit.vertIndices;
+            glm::vec3 bary = hit.bary;
+            glm::mat4 transform = mScene->transforms[hit.instanceIndex];
 
+            // Positions
+            glm::vec3 v0 = mScene->sceneVertices[triID.x];
+            glm::vec3 v1 = mScene->sceneVertices[triID.y];
+            glm::vec3 v2 = mScene->sceneVertices[triID.z];
             // Normals
             glm::vec3 n0_3 = mScene->sceneNormals[triID.x];
             glm::vec3 n1_3 = mScene->sceneNormals[triID.y];
             glm::vec3 n2_3 = mScene->sceneNormals[triID.z];
-            // UVs
-            glm::vec2 n0uv = mScene->sceneMeshUvs[triID.x];
-            glm::vec2 n1uv = mScene->sceneMeshUvs[triID.y];
-            glm::vec2 n2uv = mScene->sceneMeshUvs[triID.z];
-
-            glm::vec4 n0 = glm::vec4(n0_3, n0uv.y);
-            glm::vec4 n1 = glm::vec4(n1_3, n1uv.y);
-            glm::vec4 n2 = glm::vec4(n2_3, n2uv.y);
-
-            // Get texcoords from w coord of vertices and normals
-            glm::vec2 t0 = glm::vec2(vert0.w, n0.w);
-            glm::vec2 t1 = glm::vec2(vert1.w, n1.w);
-            glm::vec2 t2 = glm::vec2(vert2.w, n2.w);
+            // Texcoords
+            glm::vec2 t0 = mScene->sceneMeshUvs[triID.x];
+            glm::vec2 t1 = mScene->sceneMeshUvs[triID.y];
+            glm::vec2 t2 = mScene->sceneMeshUvs[triID.z];
 
             // Interpolate texture coords and normals using barycentric coords
             state.texCoord = t0 * bary.x + t1 * bary.y + t2 * bary.z;
@@ -387,19 +182,19 @@ namespace scTracer::CPU
             state.ffnormal = dot(state.normal, r.direction) <= 0.0 ? state.normal : -state.normal;
 
             // Calculate tangent and bitangent
-            glm::vec3 deltaPos1 = glm::vec3(vert1.x, vert1.y, vert1.z) - glm::vec3(vert0.x, vert0.y, vert0.z);
-            glm::vec3 deltaPos2 = glm::vec3(vert2.x, vert2.y, vert2.z) - glm::vec3(vert0.x, vert0.y, vert0.z);
+            glm::vec3 deltaPos1 = v1 - v0;
+            glm::vec3 deltaPos2 = v2 - v0;
 
             glm::vec2 deltaUV1 = t1 - t0;
             glm::vec2 deltaUV2 = t2 - t0;
 
             float invdet = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
 
-            state.tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * invdet;
-            state.bitangent = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * invdet;
+            state.dpdu = glm::mat3(transform) * ((deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * invdet);
+            state.dpdv = glm::mat3(transform) * ((deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * invdet);
 
-            state.tangent = glm::normalize(glm::mat3(transform) * state.tangent);
-            state.bitangent = glm::normalize(glm::mat3(transform) * state.bitangent);
+            state.tangent = glm::normalize(state.dpdu);
+            state.bitangent = glm::normalize(state.dpdv);
         }
         return true;
     }
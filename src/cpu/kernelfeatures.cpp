@@ -0,0 +1,42 @@
+#include <cpu/kernelfeatures.hpp>
+
+namespace scTracer::CPU
+{
+    uint32_t sceneKernelFeatures(const Core::Scene &scene)
+    {
+        uint32_t features = 0;
+        for (const auto &light : scene.lights)
+        {
+            if (int(light.type) == Core::LightType::RectLight)
+                features |= FeatureRectLight;
+            else if (int(light.type) == Core::LightType::SphereLight)
+                features |= FeatureSphereLight;
+            else
+                features |= FeatureDistantLight;
+        }
+        if (scene.lightSampler.getNumEmitters() > int(scene.lights.size()))
+            features |= FeatureEmissiveTriangles;
+        if (!scene.envMap.empty())
+            features |= FeatureEnvMap;
+
+        if (!scene.textureCache.empty())
+            for (const auto &mat : scene.materialDatas)
+            {
+                if (mat.baseColorTexId >= 0.0f || mat.metallicRoughnessTexID >= 0.0f || mat.normalmapTexID >= 0.0f || mat.emissionmapTexID >= 0.0f)
+                    features |= FeatureTextures;
+                if (mat.metallicRoughnessTexID >= 0.0f) // the map overrides metallic
+                    features |= FeatureMetal;
+            }
+
+        for (const auto &mat : scene.shadingMaterials)
+        {
+            if (mat.metallic > 0.0f)
+                features |= FeatureMetal;
+            if ((1.0f - mat.metallic) * mat.specTrans > 0.0f)
+                features |= FeatureGlass;
+            if (mat.clearcoat > 0.0f)
+                features |= FeatureClearcoat;
+        }
+        return features;
+    }
+}
@@ -0,0 +1,52 @@
+#include <cpu/integrator.hpp>
+
+namespace scTracer::CPU
+{
+    // the first hit of ray with its material, false for a miss or an analytic light. aov is filled either way
+    bool Integrator::LookDevHit(Ray ray, State &state, PathAOV &aov)
+    {
+        LightSampleRec lightSample;
+        glm::vec3 debugger(0.0f);
+        aov = {glm::vec3(0.0f), 0.0f, glm::vec3(0.0f)};
+        if (!ClosestHit(ray, state, lightSample, debugger))
+            return false;
+        if (state.isEmitter)
+        {
+            aov = {glm::vec3(1.0f), state.hitDist, -ray.direction};
+            return false;
+        }
+        GetMaterial(state, ray);
+        TextureMaterial(state, ray);
+        aov = {state.mat->baseColor, state.hitDist, state.ffnormal};
+        return true;
+    }
+
+    // ambient occlusion, the fraction of the cosine weighted hemisphere that is open up to aoDistance.
+    // The background and the lights count as open
+    glm::vec4 Integrator::__traceAO(Ray ray, PathAOV &aov)
+    {
+        State state;
+        if (!LookDevHit(ray, state, aov))
+            return glm::vec4(1.0f);
+        glm::vec3 T, B;
+        Onb(state.ffnormal, T, B);
+        float r1 = rand(), r2 = rand();
+        glm::vec3 local = CosineSampleHemisphere(r1, r2);
+        Ray occlusion(state.fhp + float(EPS) * state.ffnormal, local.x * T + local.y * B + local.z * state.ffnormal);
+        return glm::vec4(glm::vec3(AnyHit(occlusion, uniforms.aoDistance) ? 0.0f : 1.0f), 1.0f);
+    }
+
+    // albedo, normal or material id of the first hit, emitters show white and the background black
+    glm::vec4 Integrator::__traceFirstHit(Ray ray, PathAOV &aov)
+    {
+        State state;
+        if (!LookDevHit(ray, state, aov))
+            return glm::vec4(glm::vec3(aov.depth > 0.0f ? 1.0f : 0.0f), 1.0f); // only emitters have a depth then
+        if (uniforms.lookDev == LookDevMode::Albedo)
+            return glm::vec4(state.mat->baseColor, 1.0f);
+        if (uniforms.lookDev == LookDevMode::Normal)
+            return glm::vec4(state.normal * 0.5f + 0.5f, 1.0f);
+        uint32_t h = Utils::mathUtils::hash(uint32_t(state.matID) + 1u);
+        return glm::vec4(glm::vec3(h & 0xff, (h >> 8) & 0xff, (h >> 16) & 0xff) / 255.0f, 1.0f);
+    }
+}
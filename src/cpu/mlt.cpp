@@ -0,0 +1,262 @@
+#include <cpu/integrator.hpp>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace scTracer::CPU
+{
+    namespace
+    {
+        const float smallStepSigma = 0.01f; // standard deviation of a small step in primary sample space
+        const int chainsPerThread = 8;       // independent chains, one job of the pool each
+        const int bootstrapBatch = 256;     // bootstrap paths per job
+    }
+
+    MLTSampler::MLTSampler(uint32_t seed, float sigma, float largeStepProbability)
+        : mRng(seed, ~seed, 0x9e3779b9u, 0x85ebca6bu), mSigma(sigma), mLargeStepProbability(largeStepProbability)
+    {
+    }
+
+    float MLTSampler::uniform() const
+    {
+        pcg4d(mRng);
+        return float(mRng.x >> 8) * (1.0f / 16777216.0f); // 24 bits, strictly below 1
+    }
+
+    float MLTSampler::get1D(glm::ivec2, uint32_t, uint32_t dimension) const
+    {
+        __ensureReady(dimension);
+        return mX[dimension].value;
+    }
+
+    // brings a dimension up to the current iteration: the large steps it missed since it was last read redraw
+    // it, the small steps add up to one gaussian step of sigma * sqrt(steps)
+    void MLTSampler::__ensureReady(uint32_t dimension) const
+    {
+        if (dimension >= mX.size())
+            mX.resize(dimension + 1);
+        PrimarySample &x = mX[dimension];
+        if (x.lastModification < mLastLargeStep)
+        {
+            x.value = uniform();
+            x.lastModification = mLastLargeStep;
+        }
+
+        x.valueBackup = x.value;
+        x.modificationBackup = x.lastModification;
+        if (mLargeStep)
+            x.value = uniform();
+        else
+        {
+            float steps = float(mIteration - x.lastModification);
+            float u1 = uniform(), u2 = uniform();
+            float normal = std::sqrt(-2.0f * std::log(1.0f - u1)) * std::cos(TWO_PI * u2); // Box-Muller
+            x.value += normal * mSigma * std::sqrt(steps);
+            x.value = std::min(x.value - std::floor(x.value), std::nextafter(1.0f, 0.0f)); // wraps around
+        }
+        x.lastModification = mIteration;
+    }
+
+    void MLTSampler::startIteration()
+    {
+        mIteration++;
+        mLargeStep = uniform() < mLargeStepProbability;
+    }
+
+    void MLTSampler::accept()
+    {
+        if (mLargeStep)
+            mLastLargeStep = mIteration;
+    }
+
+    void MLTSampler::reject()
+    {
+        for (PrimarySample &x : mX)
+            if (x.lastModification == mIteration)
+            {
+                x.value = x.valueBackup;
+                x.lastModification = x.modificationBackup;
+            }
+        mIteration--;
+    }
+
+    // Primary sample space MLT, Kelemen et al. 2002: Markov chains walk the random numbers the path tracer
+    // draws, so paths that carry much light are mutated into their neighbours instead of being found again by
+    // chance. Both the proposal and the current state are splatted, weighted by how likely each is to be the
+    // next state (Veach's expected values). Every pass runs one mutation per pixel on average and writes its
+    // own estimate, the session averages the passes like any others
+    void Integrator::__renderMLT()
+    {
+        if (mMltChains.empty())
+            __mltBootstrap();
+
+        size_t numPixels = size_t(mCanvasWidth) * mCanvasHeight;
+        if (mMltFilmSize != numPixels * 3)
+        {
+            mMltFilmSize = numPixels * 3;
+            mMltFilm.reset(new std::atomic<float>[mMltFilmSize]);
+        }
+        for (size_t i = 0; i < mMltFilmSize; i++)
+            mMltFilm[i].store(0.0f, std::memory_order_relaxed);
+
+        int numChains = int(mMltChains.size());
+        long long mutationsPerChain = ((long long)numPixels + numChains - 1) / numChains;
+        auto splat = [&](glm::ivec2 pixel, glm::vec3 value)
+        {
+            std::atomic<float> *texel = &mMltFilm[(size_t(pixel.y) * mCanvasWidth + pixel.x) * 3];
+            for (int c = 0; c < 3; c++)
+                Utils::atomicAdd(texel[c], value[c]);
+        };
+        auto runChain = [&](int, int index)
+        {
+            MarkovChain &chain = mMltChains[index];
+            float currentLuminance = Luminance(chain.radiance);
+            for (long long i = 0; i < mutationsPerChain && !isCancelled(); i++)
+            {
+                chain.sampler.startIteration();
+                glm::ivec2 pixel;
+                glm::vec3 proposed = MLTPath(chain.sampler, pixel);
+                float proposedLuminance = Luminance(proposed);
+                if (chain.sampler.isLargeStep())
+                {
+                    chain.largeStepLuminance += proposedLuminance;
+                    chain.largeSteps++;
+                }
+                float acceptance = currentLuminance > 0.0f ? glm::min(1.0f, proposedLuminance / currentLuminance) : 1.0f;
+
+                if (acceptance > 0.0f && proposedLuminance > 0.0f)
+                    splat(pixel, proposed * (acceptance / proposedLuminance));
+                if (acceptance < 1.0f)
+                    splat(chain.pixel, chain.radiance * ((1.0f - acceptance) / currentLuminance));
+
+                if (chain.sampler.uniform() < acceptance)
+                {
+                    chain.sampler.accept();
+                    chain.radiance = proposed;
+                    chain.pixel = pixel;
+                    currentLuminance = proposedLuminance;
+                }
+                else
+                    chain.sampler.reject();
+            }
+        };
+        if (mThreadPool)
+            mThreadPool->parallelFor(numChains, runChain);
+        else
+            for (int i = 0; i < numChains; i++)
+                runChain(0, i);
+
+        for (MarkovChain &chain : mMltChains)
+        {
+            mMltLuminanceSum += chain.largeStepLuminance;
+            mMltLuminanceCount += chain.largeSteps;
+            chain.largeStepLuminance = 0.0;
+            chain.largeSteps = 0;
+        }
+        mMltNormalization = float(mMltLuminanceSum / double(glm::max(mMltLuminanceCount, 1LL)));
+
+        // a splat of luminance 1 per mutation stands for the mean luminance of the image
+        float scale = float(double(mMltNormalization) * double(numPixels) / double(mutationsPerChain * numChains));
+        for (size_t i = 0; i < numPixels; i++)
+        {
+            for (int c = 0; c < 3; c++)
+                mCanvas[i * 4 + c] = mMltFilm[i * 3 + c].load(std::memory_order_relaxed) * scale;
+            mCanvas[i * 4 + 3] = 1.0f;
+        }
+        if (mAovCanvas)
+            __mltAovPass();
+    }
+
+    // independent paths estimate the mean luminance of the image, which the chains cannot, and give the chains
+    // their first states, picked in proportion to their luminance so no chain starts in a black region
+    void Integrator::__mltBootstrap()
+    {
+        int numSamples = glm::max(1, uniforms.mltBootstrapSamples);
+        std::vector<float> luminances(numSamples);
+        int numJobs = (numSamples + bootstrapBatch - 1) / bootstrapBatch;
+        auto runJob = [&](int, int job)
+        {
+            for (int i = job * bootstrapBatch; i < glm::min(numSamples, (job + 1) * bootstrapBatch); i++)
+            {
+                MLTSampler sampler(uint32_t(i), smallStepSigma, uniforms.mltLargeStepProbability);
+                glm::ivec2 pixel;
+                luminances[i] = Luminance(MLTPath(sampler, pixel));
+            }
+        };
+        if (mThreadPool)
+            mThreadPool->parallelFor(numJobs, runJob);
+        else
+            for (int i = 0; i < numJobs; i++)
+                runJob(0, i);
+
+        std::vector<double> cdf(numSamples);
+        std::partial_sum(luminances.begin(), luminances.end(), cdf.begin(), [](double a, float b)
+                         { return a + double(b); });
+        double sum = cdf.back();
+        mMltLuminanceSum = sum;
+        mMltLuminanceCount = numSamples;
+
+        int numChains = (mThreadPool ? mThreadPool->size() : 1) * chainsPerThread;
+        mMltChains.assign(numChains, MarkovChain());
+        auto startChain = [&](int, int index)
+        { // the sampler of the picked bootstrap path traces it again, its state is the first of the chain
+            MarkovChain &chain = mMltChains[index];
+            double u = (index + 0.5) / numChains * sum;
+            int picked = sum > 0.0 ? int(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) : index % numSamples;
+            chain.sampler = MLTSampler(uint32_t(glm::min(picked, numSamples - 1)), smallStepSigma, uniforms.mltLargeStepProbability);
+            chain.radiance = MLTPath(chain.sampler, chain.pixel);
+        };
+        if (mThreadPool)
+            mThreadPool->parallelFor(numChains, startChain);
+        else
+            for (int i = 0; i < numChains; i++)
+                startChain(0, i);
+    }
+
+    glm::vec3 Integrator::MLTPath(MLTSampler &sampler, glm::ivec2 &pixel)
+    {
+        // dimensions 0-1 pick the pixel, the camera ray and the path draw the following ones as usual
+        InitRNG(glm::vec2(0.0f), 0, &sampler);
+        pixel.x = glm::min(int(rand() * mCanvasWidth), mCanvasWidth - 1);
+        pixel.y = glm::min(int(rand() * mCanvasHeight), mCanvasHeight - 1);
+        PathAOV aov;
+        glm::vec3 radiance = glm::vec3((this->*mTraceRayFn)(__generateCameraRay(pixel.x, pixel.y), aov));
+        return std::isfinite(radiance.x + radiance.y + radiance.z) ? radiance : glm::vec3(0.0f);
+    }
+
+    // the chains land anywhere, the denoiser gets the first hit of one camera ray per pixel instead,
+    // recorded the way __shadePath does
+    void Integrator::__mltAovPass()
+    {
+        auto row = [&](int, int y)
+        {
+            for (int x = 0; x < mCanvasWidth; x++)
+            {
+                InitRNG(glm::vec2(x, y), mFrameNumber, mSampler.get());
+                Ray ray = __generateCameraRay(x, y);
+                State state;
+                state.depth = 0;
+                LightSampleRec lightSample;
+                glm::vec3 debugger(0.0f);
+                PathAOV aov{glm::vec3(0.0f), 0.0f, glm::vec3(0.0f)};
+                if (ClosestHit(ray, state, lightSample, debugger))
+                {
+                    if (state.isEmitter)
+                        aov = {glm::vec3(1.0f), state.hitDist, -ray.direction};
+                    else
+                    {
+                        GetMaterial(state, ray);
+                        TextureMaterial(state, ray);
+                        aov = {state.mat->baseColor, state.hitDist, state.ffnormal};
+                    }
+                }
+                __writeAov(y * mCanvasWidth + x, aov);
+            }
+        };
+        if (mThreadPool)
+            mThreadPool->parallelFor(mCanvasHeight, row);
+        else
+            for (int y = 0; y < mCanvasHeight; y++)
+                row(0, y);
+    }
+}
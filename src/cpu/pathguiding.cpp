@@ -0,0 +1,89 @@
+#include <cpu/integrator.hpp>
+
+namespace scTracer::CPU
+{
+    // Practical path guiding, Mueller et al. 2017. Learning runs in iterations of 1, 2, 4, ... passes,
+    // each one records into the building trees while sampling the trees the previous iteration learned.
+    // After uniforms.guidingIterations of them the tree is frozen and the passes only sample it
+    void Integrator::__guidingBeginPass()
+    {
+        if (!mGuidingLearning || mGuidingPasses < (1 << mGuidingIteration))
+        {
+            mGuidingPasses++;
+            return;
+        }
+        mGuidingTree.refine(mGuidingIteration);
+        mGuidingIteration++;
+        mGuidingPasses = 1;
+        mGuidingLearning = mGuidingIteration < uniforms.guidingIterations;
+        mRestartAccumulation = true;
+    }
+
+    // looks up the leaf of the hit, before the bounce samples anything
+    void Integrator::GuideBounce(const State &state, GuidingPath &guide)
+    {
+        guide.leaf = mGuidingTree.leafIndex(state.fhp);
+        // the first iteration has nothing learned yet
+        guide.bsdfFraction = mGuidingTree.sampling(guide.leaf).energy() > 0.0f ? uniforms.guidingBsdfFraction : 1.0f;
+    }
+
+    // pdf of the bounce's sampling strategy towards L, the mixture of the bsdf's and the learned one
+    float Integrator::GuidedPdf(const GuidingPath &guide, glm::vec3 L, float bsdfPdf)
+    {
+        if (guide.bsdfFraction >= 1.0f)
+            return bsdfPdf;
+        return guide.bsdfFraction * bsdfPdf + (1.0f - guide.bsdfFraction) * mGuidingTree.sampling(guide.leaf).pdf(L);
+    }
+
+    // one sample MIS between the bsdf and the leaf's learned distribution, pdf is the mixture of both
+    template <uint32_t kFeatures>
+    glm::vec3 Integrator::GuidedSample(State state, glm::vec3 V, GuidingPath &guide, glm::vec3 &L, float &pdf)
+    {
+        glm::vec3 f;
+        float bsdfPdf;
+        if (guide.bsdfFraction >= 1.0f || rand() < guide.bsdfFraction)
+        {
+            f = DisneySample<kFeatures>(state, V, state.ffnormal, L, bsdfPdf);
+            if (!(bsdfPdf > 0.0f))
+            {
+                pdf = 0.0f;
+                return f;
+            }
+        }
+        else
+        {
+            L = mGuidingTree.sampling(guide.leaf).sample(glm::vec2(rand(), rand()));
+            f = DisneyEval<kFeatures>(state, V, state.ffnormal, L, bsdfPdf);
+            if (f == glm::vec3(0.0f))
+            { // below the surface or outside every lobe, the path would carry nothing
+                pdf = 0.0f;
+                return f;
+            }
+        }
+        pdf = GuidedPdf(guide, L, bsdfPdf);
+        return f;
+    }
+
+    // incident radiance along every vertex's sampled direction, as an estimate of its integral over the
+    // quadtree cell it falls in
+    void Integrator::RecordGuidingPath(const GuidingPath &guide, glm::vec3 radiance)
+    {
+        for (int i = 0; i < guide.numClosed; i++)
+        {
+            const GuidingVertex &vertex = guide.vertices[i];
+            glm::vec3 incident = radiance - vertex.radianceStart + vertex.extraRadiance;
+            for (int c = 0; c < 3; c++)
+                incident[c] = vertex.throughput[c] > 0.0f ? incident[c] / vertex.throughput[c] : 0.0f;
+
+            DTree &dTree = mGuidingTree.building(vertex.leaf);
+            dTree.addWeight(1.0f);
+            if (vertex.pdf > 0.0f)
+                dTree.record(vertex.direction, Luminance(incident) / vertex.pdf);
+        }
+    }
+
+#define SCTRACER_INSTANTIATE_GUIDING(F) \
+    template glm::vec3 Integrator::GuidedSample<uint32_t(F)>(State, glm::vec3, GuidingPath &, glm::vec3 &, float &);
+    SCTRACER_KERNEL_FEATURE_SETS(SCTRACER_INSTANTIATE_GUIDING)
+#undef SCTRACER_INSTANTIATE_GUIDING
+}
@@ -0,0 +1,175 @@
+#include <cpu/integrator.hpp>
+#include <cmath>
+
+namespace scTracer::CPU
+{
+    namespace
+    {
+        const int maxProbes = 8;                 // cells of the probe sequence of a key
+        const float cellPixels = 8.0f;           // pixels a cell covers at its distance from the camera
+        const float historySamples = 256.0f;     // samples a cell averages over at most
+        const float diffuseRoughness = 0.25f;    // rougher bounces hide the cells, the path may end at the next hit
+        const uint32_t evictionPasses = 64;      // passes a cell survives without updates
+    }
+
+    void RadianceCache::reset()
+    {
+        mNumCells = uint32_t(Config::cpu_radiance_cache_cells);
+        mCells.reset(new Cell[mNumCells]);
+        for (uint32_t i = 0; i < mNumCells; i++)
+        {
+            Cell &cell = mCells[i];
+            cell.checksum.store(0, std::memory_order_relaxed);
+            for (int c = 0; c < 3; c++)
+                cell.sum[c].store(0.0f, std::memory_order_relaxed);
+            cell.count.store(0.0f, std::memory_order_relaxed);
+            cell.lastPass.store(0, std::memory_order_relaxed);
+        }
+        mPass = 0;
+    }
+
+    void RadianceCache::setView(glm::vec3 camera, float fov, int width, float pixelsPerCell)
+    {
+        mCamera = camera;
+        mCellScale = 2.0f * std::tan(fov * 0.5f) / float(glm::max(width, 1)) * pixelsPerCell;
+    }
+
+    int RadianceCache::__find(glm::vec3 position, glm::vec3 normal, bool insert) const
+    {
+        // cell size, a power of two so the cells of one level nest in the ones of the next
+        float footprint = glm::max(glm::length(position - mCamera) * mCellScale, 1e-6f);
+        int level = int(std::ceil(std::log2(footprint)));
+        glm::ivec3 cell = glm::ivec3(glm::floor(position * std::exp2(float(-level))));
+        glm::vec3 a = glm::abs(normal);
+        int axis = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+        uint32_t side = uint32_t(axis * 2 + (normal[axis] < 0.0f ? 1 : 0));
+
+        uint32_t key = Utils::mathUtils::hash(uint32_t(level) * 6u + side);
+        for (int c = 2; c >= 0; c--)
+            key = Utils::mathUtils::hash(uint32_t(cell[c]) + key);
+        uint32_t checksum = glm::max(Utils::mathUtils::hash(key ^ 0x9e3779b9u), 1u);
+        for (int i = 0; i < maxProbes; i++)
+        {
+            int slot = int((key + uint32_t(i)) % mNumCells);
+            std::atomic<uint32_t> &cellChecksum = mCells[slot].checksum;
+            uint32_t current = cellChecksum.load(std::memory_order_relaxed);
+            if (current == checksum)
+                return slot;
+            if (current == 0 && insert)
+            { // claim the free cell, unless another thread just did
+                if (cellChecksum.compare_exchange_strong(current, checksum, std::memory_order_relaxed) || current == checksum)
+                    return slot;
+            }
+        }
+        return -1;
+    }
+
+    bool RadianceCache::query(glm::vec3 position, glm::vec3 normal, glm::vec3 &radiance) const
+    {
+        int slot = __find(position, normal, false);
+        if (slot < 0)
+            return false;
+        const Cell &cell = mCells[slot];
+        float count = cell.count.load(std::memory_order_relaxed);
+        if (!(count > 0.0f))
+            return false;
+        radiance = glm::vec3(cell.sum[0].load(std::memory_order_relaxed),
+                             cell.sum[1].load(std::memory_order_relaxed),
+                             cell.sum[2].load(std::memory_order_relaxed)) /
+                   count;
+        return true;
+    }
+
+    void RadianceCache::update(glm::vec3 position, glm::vec3 normal, glm::vec3 radiance)
+    {
+        if (!std::isfinite(radiance.x + radiance.y + radiance.z))
+            return;
+        int slot = __find(position, normal, true);
+        if (slot < 0)
+            return;
+        Cell &cell = mCells[slot];
+        for (int c = 0; c < 3; c++)
+            Utils::atomicAdd(cell.sum[c], radiance[c]);
+        Utils::atomicAdd(cell.count, 1.0f);
+        cell.lastPass.store(mPass, std::memory_order_relaxed);
+    }
+
+    void RadianceCache::endPass(float maxSamples)
+    { // between passes, no thread updates the cells while they are rescaled or freed
+        for (uint32_t i = 0; i < mNumCells; i++)
+        {
+            Cell &cell = mCells[i];
+            if (cell.checksum.load(std::memory_order_relaxed) == 0)
+                continue;
+            if (mPass - cell.lastPass.load(std::memory_order_relaxed) > evictionPasses)
+            { // out of view for a while, make room for the cells of the new view
+                cell.checksum.store(0, std::memory_order_relaxed);
+                for (int c = 0; c < 3; c++)
+                    cell.sum[c].store(0.0f, std::memory_order_relaxed);
+                cell.count.store(0.0f, std::memory_order_relaxed);
+                continue;
+            }
+            float count = cell.count.load(std::memory_order_relaxed);
+            if (count > maxSamples)
+            {
+                float scale = maxSamples / count;
+                for (int c = 0; c < 3; c++)
+                    cell.sum[c].store(cell.sum[c].load(std::memory_order_relaxed) * scale, std::memory_order_relaxed);
+                cell.count.store(maxSamples, std::memory_order_relaxed);
+            }
+        }
+        mPass++;
+    }
+
+    void Integrator::__cacheBeginPass()
+    {
+        if (mRadianceCache.empty())
+            mRadianceCache.reset();
+        mRadianceCache.setView(uniforms.camera.position, uniforms.camera.fov, mCanvasWidth, cellPixels);
+    }
+
+    void Integrator::__cacheEndPass()
+    {
+        mRadianceCache.endPass(historySamples);
+    }
+
+    // A preview path ends at the hit after its first diffuse bounce, with what the cache holds there standing
+    // for everything past it. To keep the cache filled it traces one more bounce from that hit first, whose
+    // own end in the cache carries the bounces the cache learned in earlier passes
+    bool Integrator::CacheVertex(const State &state, PathState &path)
+    {
+        CachePath &cache = *path.cache;
+        bool ends = cache.afterDiffuse;
+        cache.afterDiffuse = state.mat->roughness >= diffuseRoughness;
+        if (!ends)
+            return false;
+
+        glm::vec3 cached;
+        if (cache.training) // a miss keeps tracing, so a cold cache falls back to path tracing
+        {
+            if (!mRadianceCache.query(state.fhp, state.ffnormal, cached))
+                return false;
+            path.radiance += path.throughput * cached;
+            return true;
+        }
+
+        // the radiance leaving the cached hit is gathered from here on, its emission was already counted
+        cache.training = true;
+        cache.position = state.fhp;
+        cache.normal = state.ffnormal;
+        cache.hasCached = mRadianceCache.query(state.fhp, state.ffnormal, cache.cached);
+        cache.radiance = path.radiance;
+        cache.throughput = path.throughput;
+        path.radiance = glm::vec3(0.0f);
+        path.throughput = glm::vec3(1.0f);
+        return false;
+    }
+
+    glm::vec3 Integrator::FinishCachePath(const CachePath &cache, glm::vec3 radiance)
+    {
+        if (!cache.training) // no diffuse bounce, the path was traced in full
+            return radiance;
+        mRadianceCache.update(cache.position, cache.normal, radiance);
+        return cache.radiance + cache.throughput * (cache.hasCached ? cache.cached : radiance);
+    }
+}
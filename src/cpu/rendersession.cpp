@@ -0,0 +1,222 @@
+#include <cpu/rendersession.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace scTracer::CPU
+{
+    namespace
+    {
+        const int kMaxSampleScale = 8; // a noisy pixel may take up to this many times maxSamples
+        const float kErrorLuminanceFloor = 0.01f;
+    }
+
+    void RenderSession::reset()
+    {
+        __clearAccumulation();
+        mActivePixels = mWidth * mHeight;
+        std::fill(mActive.begin(), mActive.end(), 1);
+        if (mIntegrator)
+            mIntegrator->reset();
+    }
+
+    // the pixels active in the pass being rendered stay so, they are the ones it wrote
+    void RenderSession::__clearAccumulation()
+    {
+        mPasses = 0;
+        mSpentSamples = 0;
+        std::fill(mAccum.begin(), mAccum.end(), 0.0f);
+        std::fill(mImage.begin(), mImage.end(), 0.0f);
+        std::fill(mAovAccum.begin(), mAovAccum.end(), 0.0f);
+        std::fill(mAov.begin(), mAov.end(), 0.0f);
+        std::fill(mLumMean.begin(), mLumMean.end(), 0.0f);
+        std::fill(mLumM2.begin(), mLumM2.end(), 0.0f);
+        std::fill(mError.begin(), mError.end(), 0.0f);
+        std::fill(mMeanVariance.begin(), mMeanVariance.end(), 0.0f);
+        std::fill(mVarianceMap.begin(), mVarianceMap.end(), 0.0f);
+        std::fill(mSampleCounts.begin(), mSampleCounts.end(), 0);
+    }
+
+    void RenderSession::__prepare(Core::Scene &scene)
+    {
+        int numThreads = scene.settings.renderThreads > 0 ? scene.settings.renderThreads : Utils::ThreadPool::hardwareThreads();
+        if (!mThreadPool || mThreadPool->size() != numThreads)
+            mThreadPool = std::make_unique<Utils::ThreadPool>(numThreads);
+
+        int width = scene.settings.image_width, height = scene.settings.image_height;
+        if (&scene != mScene || width != mWidth || height != mHeight)
+        {
+            mScene = &scene;
+            mWidth = width;
+            mHeight = height;
+            size_t numPixels = size_t(width) * height;
+            mSample.assign(numPixels * 4, 0.0f);
+            mAccum.assign(numPixels * 4, 0.0f);
+            mImage.assign(numPixels * 4, 0.0f);
+            mAovSample.assign(numPixels * AOV_CHANNELS, 0.0f);
+            mAovAccum.assign(numPixels * AOV_CHANNELS, 0.0f);
+            mAov.assign(numPixels * AOV_CHANNELS, 0.0f);
+            mLumMean.assign(numPixels, 0.0f);
+            mLumM2.assign(numPixels, 0.0f);
+            mError.assign(numPixels, 0.0f);
+            mMeanVariance.assign(numPixels, 0.0f);
+            mVarianceMap.assign(numPixels * 4, 0.0f);
+            mSampleCounts.assign(numPixels, 0);
+            mActive.assign(numPixels, 1);
+            mIntegrator = std::make_unique<Integrator>(scene, mSample.data(), mThreadPool.get(), &mTileScheduler);
+            mIntegrator->setAovCanvas(mAovSample.data());
+            reset();
+        }
+        mIntegrator->setThreadPool(mThreadPool.get());
+        mIntegrator->setCancelFlag(mCancel);
+
+        // camera moved, settings or assets edited: the cpu path is the one consuming the flag in cpu mode
+        if (scene.dirty || mStale)
+        {
+            reset();
+            scene.dirty = false;
+            mStale = false;
+        }
+        mMaxSamples = scene.settings.maxSamples;
+        // the chains splat anywhere and photons land anywhere, no pixel can drop out
+        bool splatting = (scene.settings.mlt || scene.settings.sppm) && scene.settings.lookDevMode == 0;
+        mAdaptiveThreshold = splatting ? 0.0f : scene.settings.adaptiveThreshold;
+        mAdaptiveMinSamples = std::max(2, scene.settings.adaptiveMinSamples);
+        bool adaptive = mAdaptiveThreshold > 0.0f;
+        mIntegrator->setAdaptiveState(adaptive ? mActive.data() : nullptr, mSampleCounts.data());
+        if (!adaptive && mActivePixels != mWidth * mHeight)
+        { // switched off mid render, every pixel takes samples again
+            std::fill(mActive.begin(), mActive.end(), 1);
+            mActivePixels = mWidth * mHeight;
+        }
+    }
+
+    void RenderSession::__accumulate()
+    {
+        int width = mWidth;
+        bool progressive = mIntegrator->isProgressive();
+        mThreadPool->parallelFor(mHeight, [&](int, int y)
+                                 {
+            for (int i = y * width; i < (y + 1) * width; i++)
+            {
+                if (!mActive[i])
+                    continue;
+                int n = ++mSampleCounts[i];
+                float invCount = 1.0f / n;
+                for (int c = 0; c < 4; c++)
+                {
+                    mAccum[i * 4 + c] += mSample[i * 4 + c];
+                    // a progressive integrator already averaged its passes, in its own way
+                    mImage[i * 4 + c] = progressive ? mSample[i * 4 + c] : mAccum[i * 4 + c] * invCount;
+                }
+                for (int c = i * AOV_CHANNELS; c < (i + 1) * AOV_CHANNELS; c++)
+                {
+                    mAovAccum[c] += mAovSample[c];
+                    mAov[c] = mAovAccum[c] * invCount;
+                }
+
+                // Welford on the luminance of the samples
+                const float *rgb = &mSample[i * 4];
+                float lum = Utils::mathUtils::luminance(rgb[0], rgb[1], rgb[2]);
+                float delta = lum - mLumMean[i];
+                mLumMean[i] += delta * invCount;
+                mLumM2[i] += delta * (lum - mLumMean[i]);
+
+                // relative standard error of the pixel mean
+                float variance = n > 1 ? mLumM2[i] / (n - 1) : 0.0f;
+                mMeanVariance[i] = variance * invCount;
+                mError[i] = std::sqrt(mMeanVariance[i]) / (std::abs(mLumMean[i]) + kErrorLuminanceFloor);
+            } });
+        mSpentSamples += mActivePixels;
+        mPasses++;
+    }
+
+    void RenderSession::__updateActivePixels()
+    {
+        // a pixel stops once the worst error in its 3x3 neighbourhood is below the threshold,
+        // so lone lucky pixels inside noisy regions keep sampling
+        int maxPerPixel = mMaxSamples > 0 ? mMaxSamples * kMaxSampleScale : 0;
+        int width = mWidth, height = mHeight;
+        std::vector<int> activeRows(height, 0);
+        mThreadPool->parallelFor(height, [&](int, int y)
+                                 {
+            for (int x = 0; x < width; x++)
+            {
+                int i = y * width + x;
+                float error = 0.0f;
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        int nx = std::clamp(x + dx, 0, width - 1), ny = std::clamp(y + dy, 0, height - 1);
+                        error = std::max(error, mError[ny * width + nx]);
+                    }
+                bool active = mSampleCounts[i] < mAdaptiveMinSamples || error > mAdaptiveThreshold;
+                if (maxPerPixel > 0 && mSampleCounts[i] >= maxPerPixel)
+                    active = false;
+                mActive[i] = active ? 1 : 0;
+                activeRows[y] += active ? 1 : 0;
+
+                // variance map: relative error in red, sample count (relative to maxSamples) in green
+                mVarianceMap[i * 4 + 0] = mError[i];
+                mVarianceMap[i * 4 + 1] = mMaxSamples > 0 ? float(mSampleCounts[i]) / mMaxSamples : 0.0f;
+                mVarianceMap[i * 4 + 2] = active ? 0.0f : 1.0f;
+                mVarianceMap[i * 4 + 3] = 1.0f;
+            } });
+        mActivePixels = 0;
+        for (int count : activeRows)
+            mActivePixels += count;
+    }
+
+    void RenderSession::render(Core::Scene &scene, int samples, double timeBudget)
+    {
+        __prepare(scene);
+        renderPasses(samples, timeBudget);
+    }
+
+    void RenderSession::prepare(Core::Scene &scene)
+    {
+        __prepare(scene);
+    }
+
+    void RenderSession::setCancelFlag(const std::atomic<bool> *cancel)
+    {
+        mCancel = cancel;
+        if (mIntegrator)
+            mIntegrator->setCancelFlag(cancel);
+    }
+
+    void RenderSession::renderPasses(int samples, double timeBudget)
+    {
+        if (!mIntegrator || mStale)
+            return;
+
+        // budget in pixel samples, the samples converged pixels skip are spent on the noisy ones
+        long long budget = (long long)samples * mWidth * mHeight;
+        long long spent = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; !isConverged(); i++)
+        {
+            if (timeBudget > 0.0)
+            {
+                if (i > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() >= timeBudget)
+                    break;
+            }
+            else if (spent >= budget)
+                break;
+
+            spent += mActivePixels;
+            mIntegrator->render();
+            if (mIntegrator->isCancelled())
+            { // part of the image, and whatever the integrator carries between passes, is left half updated
+                mStale = true;
+                break;
+            }
+            // the preview ended or path guiding refined its distribution, what came before is only noise or bias
+            if (mIntegrator->takeRestart())
+                __clearAccumulation();
+            __accumulate();
+            if (mAdaptiveThreshold > 0.0f)
+                __updateActivePixels();
+        }
+    }
+}
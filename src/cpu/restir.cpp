@@ -0,0 +1,258 @@
+#include <cpu/integrator.hpp>
+#include <algorithm>
+
+namespace scTracer::CPU
+{
+    namespace
+    {
+        const float temporalMaxM = 20.0f;    // history is capped at this many times the fresh candidates
+        const float spatialRadius = 30.0f;   // pixels
+        const float normalThreshold = 0.906f; // cos 25 degrees
+        const float depthThreshold = 0.1f;   // relative
+
+        inline bool similar(const RestirSurface &surface, const RestirGeometry &other)
+        {
+            return other.depth > 0.0f && glm::dot(surface.normal, other.normal) > normalThreshold &&
+                   glm::abs(other.depth - surface.depth) < depthThreshold * surface.depth;
+        }
+    }
+
+    // ReSTIR DI for the first bounce: every pixel resamples light candidates into a reservoir, drops it when
+    // the chosen sample is occluded, merges the reservoir it had in the previous pass and then those of a few
+    // neighbours. The path is traced as usual with the surviving sample as its first light sample.
+    // Reuse is weighted like the biased variant of the paper, similar() rejects neighbours on other surfaces
+    void Integrator::__renderRestir()
+    {
+        size_t numPixels = size_t(mCanvasWidth) * mCanvasHeight;
+        if (mRestirSurfaces.size() != numPixels)
+        {
+            mRestirSurfaces.resize(numPixels);
+            mRestirPrevGeometry.assign(numPixels, RestirGeometry{glm::vec3(0.0f), 0.0f});
+            mReservoirs.resize(numPixels);
+            mPrevReservoirs.resize(numPixels);
+            mSpatialReservoirs.resize(numPixels);
+            mRestirHistory = false;
+        }
+
+        __restirCandidates();
+        if (isCancelled())
+            return;
+        if (uniforms.restirTemporal && mRestirHistory)
+            __restirTemporal();
+        if (uniforms.restirSpatialNeighbors > 0)
+            __restirSpatial();
+        else
+            mSpatialReservoirs.swap(mReservoirs);
+        __restirShade();
+
+        // what the next pass reuses
+        mPrevReservoirs.swap(mSpatialReservoirs);
+        forEachChunk(mThreadPool, int(numPixels), [&](int i)
+                     {
+            const RestirSurface &surface = mRestirSurfaces[i];
+            mRestirPrevGeometry[i] = {surface.normal, surface.valid ? surface.depth : 0.0f}; });
+        mRestirHistory = true;
+    }
+
+    void Integrator::__restirCandidates()
+    {
+        forEachChunk(mThreadPool, mCanvasWidth * mCanvasHeight, [&](int i)
+                     {
+            RestirSurface &surface = mRestirSurfaces[i];
+            Reservoir &reservoir = mReservoirs[i];
+            surface.valid = false;
+            reservoir = Reservoir();
+            if (mPixelActive && !mPixelActive[i])
+                return;
+
+            int x = i % mCanvasWidth, y = i / mCanvasWidth;
+            InitRNG(glm::vec2(x, y), mPixelSampleIndices ? mPixelSampleIndices[i] : mFrameNumber, mSampler.get());
+            Ray ray = __generateCameraRay(x, y);
+            State state;
+            LightSampleRec lightSample;
+            glm::vec3 debugger(0.0f);
+            if (ClosestHit(ray, state, lightSample, debugger) && !state.isEmitter)
+            {
+                GetMaterial(state, ray);
+                if ((mKernelFeatures & FeatureTextures) != 0)
+                    TextureMaterial(state, ray);
+                surface.mat = *state.mat;
+                surface.position = state.fhp;
+                surface.eta = state.eta;
+                surface.normal = state.ffnormal;
+                surface.depth = state.hitDist;
+                surface.V = -ray.direction;
+                surface.valid = true;
+
+                // resampled importance sampling over the light sampler's candidates
+                glm::vec3 scatterPos = state.fhp + float(EPS) * state.ffnormal;
+                for (int c = 0; c < uniforms.restirCandidates; c++)
+                {
+                    LightSampleRec candidate;
+                    float lightArea;
+                    if (!SampleEmitter(scatterPos, state.ffnormal, candidate, lightArea))
+                        break;
+                    RestirSample sample;
+                    sample.distant = !(lightArea > 0.0f);
+                    sample.position = sample.distant ? candidate.direction : scatterPos + candidate.direction * candidate.dist;
+                    sample.normal = candidate.normal;
+                    sample.emission = candidate.emission;
+
+                    // source pdf in the measure the sample is stored in, area for everything but distant lights
+                    float sourcePdf = candidate.pdf;
+                    if (!sample.distant)
+                        sourcePdf *= glm::abs(glm::dot(candidate.normal, candidate.direction)) / (candidate.dist * candidate.dist);
+                    float targetPdf = RestirTargetPdf(surface, sample);
+                    reservoir.add(sample, sourcePdf > 0.0f ? targetPdf / sourcePdf : 0.0f, 1.0f, rand(), targetPdf);
+                }
+                reservoir.finalize();
+
+                // visibility reuse, an occluded sample is not worth spreading to the neighbours
+                if (reservoir.W > 0.0f)
+                {
+                    Ray shadowRay;
+                    float maxDist;
+                    RestirContribution(state, surface.V, reservoir.y, shadowRay, maxDist);
+                    if (AnyHit(shadowRay, maxDist))
+                        reservoir.W = 0.0f;
+                }
+            }
+            surface.dimension = sampleDimension; });
+    }
+
+    void Integrator::__restirTemporal()
+    {
+        forEachChunk(mThreadPool, mCanvasWidth * mCanvasHeight, [&](int i)
+                     {
+            RestirSurface &surface = mRestirSurfaces[i];
+            const Reservoir &previous = mPrevReservoirs[i];
+            if (!surface.valid || previous.M <= 0.0f || !similar(surface, mRestirPrevGeometry[i]))
+                return;
+
+            InitRNG(glm::vec2(i % mCanvasWidth, i / mCanvasWidth), mPixelSampleIndices ? mPixelSampleIndices[i] : mFrameNumber, mSampler.get());
+            sampleDimension = surface.dimension;
+
+            Reservoir &current = mReservoirs[i];
+            Reservoir merged;
+            merged.add(current.y, current.targetPdf * current.W * current.M, current.M, rand(), current.targetPdf);
+            float M = glm::min(previous.M, temporalMaxM * current.M);
+            float targetPdf = RestirTargetPdf(surface, previous.y);
+            merged.add(previous.y, targetPdf * previous.W * M, M, rand(), targetPdf);
+            merged.finalize();
+            current = merged;
+            surface.dimension = sampleDimension; });
+    }
+
+    void Integrator::__restirSpatial()
+    {
+        forEachChunk(mThreadPool, mCanvasWidth * mCanvasHeight, [&](int i)
+                     {
+            RestirSurface &surface = mRestirSurfaces[i];
+            const Reservoir &current = mReservoirs[i];
+            Reservoir &merged = mSpatialReservoirs[i];
+            merged = current;
+            if (!surface.valid)
+                return;
+
+            int x = i % mCanvasWidth, y = i / mCanvasWidth;
+            InitRNG(glm::vec2(x, y), mPixelSampleIndices ? mPixelSampleIndices[i] : mFrameNumber, mSampler.get());
+            sampleDimension = surface.dimension;
+
+            merged = Reservoir();
+            merged.add(current.y, current.targetPdf * current.W * current.M, current.M, rand(), current.targetPdf);
+            for (int k = 0; k < uniforms.restirSpatialNeighbors; k++)
+            {
+                glm::vec2 offset = (glm::vec2(rand(), rand()) * 2.0f - 1.0f) * spatialRadius;
+                int nx = glm::clamp(x + int(offset.x), 0, mCanvasWidth - 1), ny = glm::clamp(y + int(offset.y), 0, mCanvasHeight - 1);
+                int j = ny * mCanvasWidth + nx;
+                const RestirSurface &neighbourSurface = mRestirSurfaces[j];
+                if (j == i || !neighbourSurface.valid || !similar(surface, RestirGeometry{neighbourSurface.normal, neighbourSurface.depth}))
+                    continue;
+                const Reservoir &neighbour = mReservoirs[j];
+                float targetPdf = RestirTargetPdf(surface, neighbour.y);
+                merged.add(neighbour.y, targetPdf * neighbour.W * neighbour.M, neighbour.M, rand(), targetPdf);
+            }
+            merged.finalize();
+            surface.dimension = sampleDimension; });
+    }
+
+    void Integrator::__restirShade()
+    {
+        forEachChunk(mThreadPool, mCanvasWidth * mCanvasHeight, [&](int i)
+                     {
+            if (mPixelActive && !mPixelActive[i])
+                return;
+            int x = i % mCanvasWidth, y = i / mCanvasWidth;
+            InitRNG(glm::vec2(x, y), mPixelSampleIndices ? mPixelSampleIndices[i] : mFrameNumber, mSampler.get());
+            Ray ray = __generateCameraRay(x, y);
+            sampleDimension = mRestirSurfaces[i].dimension;
+
+            PathState path;
+            path.reservoir = &mSpatialReservoirs[i];
+            State state;
+            LightSampleRec lightSample;
+            ShadowRay shadowRays[MAX_SHADOW_RAYS];
+            glm::vec3 debugger(0.0f);
+            for (;;)
+            {
+                bool hit = ClosestHit(ray, state, lightSample, debugger);
+                int numShadowRays;
+                bool alive = (this->*mShadePathFn)(hit, ray, state, lightSample, path, shadowRays, numShadowRays);
+                for (int s = 0; s < numShadowRays; s++)
+                    if (!AnyHit(shadowRays[s].ray, shadowRays[s].maxDist))
+                        path.radiance += shadowRays[s].contribution;
+                if (!alive)
+                    break;
+            }
+
+            float *texel = &mCanvas[size_t(i) * 4];
+            texel[0] = path.radiance.r;
+            texel[1] = path.radiance.g;
+            texel[2] = path.radiance.b;
+            texel[3] = 1.0f;
+            __writeAov(i, path.aov); });
+    }
+
+    // unshadowed f * Le * G of the light sample y seen from the hit, and the shadow ray towards it
+    glm::vec3 Integrator::RestirContribution(const State &state, glm::vec3 V, const RestirSample &y, Ray &shadowRay, float &maxDist)
+    {
+        glm::vec3 scatterPos = state.fhp + float(EPS) * state.ffnormal;
+        glm::vec3 L;
+        float G = 1.0f;
+        if (y.distant)
+        {
+            L = y.position;
+            maxDist = INF;
+        }
+        else
+        {
+            L = y.position - scatterPos;
+            float dist = glm::length(L);
+            L /= dist;
+            float cosLight = -glm::dot(L, y.normal);
+            if (!(cosLight > 0.0f)) // single sided emitters
+                return glm::vec3(0.0f);
+            G = cosLight / (dist * dist);
+            maxDist = dist - float(EPS);
+        }
+        shadowRay = Ray(scatterPos, L);
+
+        float pdf;
+        glm::vec3 f = DisneyEval(state, V, state.ffnormal, L, pdf);
+        if (!(pdf > 0.0f))
+            return glm::vec3(0.0f);
+        return f * y.emission * G;
+    }
+
+    float Integrator::RestirTargetPdf(const RestirSurface &surface, const RestirSample &y)
+    {
+        State state;
+        state.fhp = surface.position;
+        state.ffnormal = surface.normal;
+        state.eta = surface.eta;
+        state.mat = &surface.mat;
+        Ray shadowRay;
+        float maxDist;
+        return Luminance(RestirContribution(state, surface.V, y, shadowRay, maxDist));
+    }
+}
@@ -0,0 +1,178 @@
+#include <cpu/sampler.hpp>
+#include <cmath>
+
+#include <utils/mathUtils.hpp>
+
+namespace scTracer::CPU
+{
+    namespace
+    {
+        inline float toUnitFloat(uint32_t x)
+        {
+            return float(x >> 8) * (1.0f / 16777216.0f); // 24 bits, strictly below 1
+        }
+
+        inline uint32_t reverseBits(uint32_t x)
+        {
+            x = (x << 16) | (x >> 16);
+            x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+            x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+            x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+            x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+            return x;
+        }
+
+        inline uint32_t hashCombine(uint32_t seed, uint32_t v)
+        {
+            return seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+        }
+
+        inline uint32_t pixelSeed(glm::ivec2 pixel, uint32_t dimension)
+        {
+            return Utils::mathUtils::hash(hashCombine(hashCombine(Utils::mathUtils::hash(uint32_t(pixel.x)), uint32_t(pixel.y)), dimension));
+        }
+
+        // Owen scrambling as a hash, Burley "Practical Hash-based Owen Scrambling"
+        inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+        {
+            x += seed;
+            x ^= x * 0x6c50b47cu;
+            x ^= x * 0xb82f1e52u;
+            x ^= x * 0xc7afe638u;
+            x ^= x * 0x8d22f6e6u;
+            return x;
+        }
+
+        inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+        {
+            return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+        }
+
+        inline uint32_t sobol(uint32_t index, uint32_t dim)
+        {
+            // dim 0 is van der Corput, dim 1 uses the primitive polynomial x + 1
+            uint32_t x = 0;
+            for (uint32_t v = 1u << 31; index; index >>= 1)
+            {
+                if (index & 1u)
+                    x ^= v;
+                v = dim == 0 ? v >> 1 : v ^ (v >> 1);
+            }
+            return x;
+        }
+
+        // Kensler, "Correlated Multi-Jittered Sampling"
+        inline uint32_t permute(uint32_t i, uint32_t l, uint32_t p)
+        {
+            uint32_t w = l - 1;
+            w |= w >> 1;
+            w |= w >> 2;
+            w |= w >> 4;
+            w |= w >> 8;
+            w |= w >> 16;
+            do
+            {
+                i ^= p;
+                i *= 0xe170893du;
+                i ^= p >> 16;
+                i ^= (i & w) >> 4;
+                i ^= p >> 8;
+                i *= 0x0929eb3fu;
+                i ^= p >> 23;
+                i ^= (i & w) >> 1;
+                i *= 1u | p >> 27;
+                i *= 0x6935fa69u;
+                i ^= (i & w) >> 11;
+                i *= 0x74dcb303u;
+                i ^= (i & w) >> 2;
+                i *= 0x9e501cc3u;
+                i ^= (i & w) >> 2;
+                i *= 0xc860a3dfu;
+                i &= w;
+                i ^= i >> 5;
+            } while (i >= l);
+            return (i + p) % l;
+        }
+
+        inline float randFloat(uint32_t i, uint32_t p)
+        {
+            i ^= p;
+            i ^= i >> 17;
+            i ^= i >> 10;
+            i *= 0xb36534e5u;
+            i ^= i >> 12;
+            i ^= i >> 21;
+            i *= 0x93fc4795u;
+            i ^= 0xdf6e307fu;
+            i ^= i >> 17;
+            i *= 1u | p >> 18;
+            return toUnitFloat(i);
+        }
+    }
+
+    float PCGSampler::get1D(glm::ivec2 pixel, uint32_t sampleIndex, uint32_t dimension) const
+    {
+        // one round of pcg4d on the full coordinate
+        glm::uvec4 v = glm::uvec4(uint32_t(pixel.x), uint32_t(pixel.y), sampleIndex, dimension);
+        v = v * 1664525u + 1013904223u;
+        v.x += v.y * v.w;
+        v.y += v.z * v.x;
+        v.z += v.x * v.y;
+        v.w += v.y * v.z;
+        v = v ^ (v >> 16u);
+        v.x += v.y * v.w;
+        v.y += v.z * v.x;
+        v.z += v.x * v.y;
+        v.w += v.y * v.z;
+        return toUnitFloat(v.x);
+    }
+
+    float SobolSampler::get1D(glm::ivec2 pixel, uint32_t sampleIndex, uint32_t dimension) const
+    {
+        uint32_t seed = pixelSeed(pixel, dimension >> 1);
+        uint32_t shuffled = nestedUniformScramble(sampleIndex, seed);
+        uint32_t x = sobol(shuffled, dimension & 1u);
+        return toUnitFloat(nestedUniformScramble(x, hashCombine(seed, dimension & 1u)));
+    }
+
+    CMJSampler::CMJSampler(int samplesPerPixel)
+    {
+        uint32_t count = uint32_t(samplesPerPixel > 0 ? samplesPerPixel : 64);
+        mM = uint32_t(std::ceil(std::sqrt(float(count))));
+        mN = (count + mM - 1) / mM;
+    }
+
+    glm::vec2 CMJSampler::get2D(glm::ivec2 pixel, uint32_t sampleIndex, uint32_t dimension) const
+    {
+        // past the pattern size start a new, independently permuted pattern
+        uint32_t count = mM * mN;
+        uint32_t p = hashCombine(pixelSeed(pixel, dimension >> 1), sampleIndex / count);
+        uint32_t s = permute(sampleIndex % count, count, p * 0x51633e2du);
+        uint32_t sx = permute(s % mM, mM, p * 0xa511e9b3u);
+        uint32_t sy = permute(s / mM, mN, p * 0x63d83595u);
+        float jx = randFloat(s, p * 0xa399d265u);
+        float jy = randFloat(s, p * 0x711ad6a5u);
+        glm::vec2 r((s % mM + (sy + jx) / mN) / mM, (s / mM + (sx + jy) / mM) / mN);
+        return glm::min(r, glm::vec2(0.99999994f));
+    }
+
+    float CMJSampler::get1D(glm::ivec2 pixel, uint32_t sampleIndex, uint32_t dimension) const
+    {
+        glm::vec2 r = get2D(pixel, sampleIndex, dimension & ~1u);
+        return (dimension & 1u) ? r.y : r.x;
+    }
+
+    std::unique_ptr<Sampler> createSampler(SamplerType type, int samplesPerPixel)
+    {
+        switch (type)
+        {
+        case SamplerType::PCG:
+            return std::make_unique<PCGSampler>();
+        case SamplerType::CMJ:
+            return std::make_unique<CMJSampler>(samplesPerPixel);
+        case SamplerType::Sobol:
+        default:
+            return std::make_unique<SobolSampler>();
+        }
+    }
+}
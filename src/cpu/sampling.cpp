@@ -2,6 +2,14 @@
 
 namespace scTracer::CPU
 {
+    namespace
+    {
+        // smaller spherical rectangles lose precision in float, those quads are sampled by area. pbrt-v4
+        const float kMinSphericalRectSolidAngle = 3e-4f;
+        // sin^2 of 1.5 degrees, narrower sphere light cones are sampled with the small angle expansion
+        const float kSmallConeSin2 = 0.00068523f;
+    }
+
     glm::vec3 Integrator::UniformSampleHemisphere(float r1, float r2)
     {
         float r = sqrt(glm::max(0.0, 1.0 - r1 * r1));
@@ -15,65 +23,197 @@ namespace scTracer::CPU
         return t / (b * b + t);
     }
 
-    void Integrator::Onb(glm::vec3 N, glm::vec3 &T, glm::vec3 B)
+    void Integrator::Onb(glm::vec3 N, glm::vec3 &T, glm::vec3 &B)
     {
         glm::vec3 up = glm::abs(N.z) < 0.9999999 ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
         T = glm::normalize(cross(up, N));
         B = glm::cross(N, T);
     }
 
+    // solid angle pdf of SampleSphereLight towards a point of the sphere distSq away whose normal makes cosTheta
+    // with the direction, from scatterPos
+    float Integrator::SphereLightPdf(glm::vec3 center, float radius, float area, glm::vec3 scatterPos, float distSq, float cosTheta)
+    {
+        glm::vec3 toCenter = center - scatterPos;
+        float sin2ThetaMax = radius * radius / glm::dot(toCenter, toCenter);
+        if (sin2ThetaMax >= 1.0f) // inside, sampled by area
+            return distSq / (area * glm::abs(cosTheta));
+        float oneMinusCosThetaMax = sin2ThetaMax < kSmallConeSin2 ? 0.5f * sin2ThetaMax : 1.0f - sqrt(1.0f - sin2ThetaMax);
+        return 1.0f / (float(TWO_PI) * oneMinusCosThetaMax);
+    }
+
+    // uniform over the cone of directions that see the sphere, which is all of them from inside where it falls
+    // back to uniform by area
     void Integrator::SampleSphereLight(Light light, glm::vec3 scatterPos, LightSampleRec &lightSample)
     {
         float r1 = rand();
         float r2 = rand();
 
-        glm::vec3 sphereCentertoSurface = scatterPos - light.position;
-        float distToSphereCenter = glm::length(sphereCentertoSurface);
-        glm::vec3 sampledDir;
-
-        // TODO: Fix this. Currently assumes the light will be hit only from the outside
-        sphereCentertoSurface /= distToSphereCenter;
-        sampledDir = UniformSampleHemisphere(r1, r2);
-        glm::vec3 T{0.f}, B{0.f};
-        Onb(sphereCentertoSurface, T, B);
-        sampledDir = T * sampledDir.x + B * sampledDir.y + sphereCentertoSurface * sampledDir.z;
+        glm::vec3 toCenter = light.position - scatterPos;
+        float distSqToCenter = glm::dot(toCenter, toCenter);
+        float sin2ThetaMax = light.radius * light.radius / distSqToCenter;
+        bool inside = sin2ThetaMax >= 1.0f;
+        glm::vec3 normal;
+        if (!inside)
+        {
+            float sin2Theta, cosTheta;
+            if (sin2ThetaMax < kSmallConeSin2)
+            { // 1 - cos loses its digits in float, use its expansion
+                sin2Theta = sin2ThetaMax * r1;
+                cosTheta = sqrt(1.0f - sin2Theta);
+            }
+            else
+            {
+                cosTheta = 1.0f - r1 * (1.0f - sqrt(1.0f - sin2ThetaMax));
+                sin2Theta = 1.0f - cosTheta * cosTheta;
+            }
+            // angle at the center between scatterPos and the point the sampled direction sees first, pbrt-v4
+            float cosAlpha = sin2Theta / sqrt(sin2ThetaMax) + cosTheta * sqrt(glm::max(0.0f, 1.0f - sin2Theta / sin2ThetaMax));
+            float sinAlpha = sqrt(glm::max(0.0f, 1.0f - cosAlpha * cosAlpha));
+            float phi = TWO_PI * r2;
+
+            glm::vec3 wc = toCenter / sqrt(distSqToCenter);
+            glm::vec3 T{0.f}, B{0.f};
+            Onb(wc, T, B);
+            normal = -(sinAlpha * cos(phi) * T + sinAlpha * sin(phi) * B + cosAlpha * wc);
+        }
+        else
+        {
+            float z = 1.0f - 2.0f * r1;
+            float r = sqrt(glm::max(0.0f, 1.0f - z * z));
+            float phi = TWO_PI * r2;
+            normal = glm::vec3(r * cos(phi), r * sin(phi), z);
+        }
 
-        glm::vec3 lightSurfacePos = light.position + sampledDir * light.radius;
+        glm::vec3 lightSurfacePos = light.position + normal * light.radius;
 
         lightSample.direction = lightSurfacePos - scatterPos;
         lightSample.dist = glm::length(lightSample.direction);
         float distSq = lightSample.dist * lightSample.dist;
 
         lightSample.direction /= lightSample.dist;
-        lightSample.normal = glm::normalize(lightSurfacePos - light.position);
-        lightSample.emission = light.emission * float(mScene->lights.size());
-        lightSample.pdf = distSq / (light.area * 0.5 * abs(dot(lightSample.normal, lightSample.direction)));
+        lightSample.normal = inside ? -normal : normal; // towards scatterPos, the sphere emits on both sides
+        lightSample.emission = light.emission;
+        lightSample.pdf = SphereLightPdf(light.position, light.radius, light.area, scatterPos, distSq, glm::dot(lightSample.normal, lightSample.direction));
+    }
+
+    // false when the quad is too small or too close to edge on to sample by solid angle, or not a rectangle
+    bool Integrator::SphericalRectInit(glm::vec3 position, glm::vec3 u, glm::vec3 v, glm::vec3 scatterPos, SphericalRect &rect)
+    {
+        float lu = glm::length(u), lv = glm::length(v);
+        rect.x = u / lu;
+        rect.y = v / lv;
+        if (glm::abs(glm::dot(rect.x, rect.y)) > 1e-3f)
+            return false;
+        rect.z = glm::cross(rect.x, rect.y);
+
+        glm::vec3 d = position - scatterPos;
+        rect.z0 = glm::dot(d, rect.z);
+        if (rect.z0 > 0.0f)
+        {
+            rect.z = -rect.z;
+            rect.z0 = -rect.z0;
+        }
+        rect.x0 = glm::dot(d, rect.x);
+        rect.y0 = glm::dot(d, rect.y);
+        rect.x1 = rect.x0 + lu;
+        rect.y1 = rect.y0 + lv;
+
+        // the corners and the normals of the planes through scatterPos and the edges
+        glm::vec3 v00(rect.x0, rect.y0, rect.z0), v01(rect.x0, rect.y1, rect.z0);
+        glm::vec3 v10(rect.x1, rect.y0, rect.z0), v11(rect.x1, rect.y1, rect.z0);
+        glm::vec3 n0 = glm::normalize(glm::cross(v00, v10));
+        glm::vec3 n1 = glm::normalize(glm::cross(v10, v11));
+        glm::vec3 n2 = glm::normalize(glm::cross(v11, v01));
+        glm::vec3 n3 = glm::normalize(glm::cross(v01, v00));
+        // the inner angles of the spherical rectangle
+        float g0 = acos(glm::clamp(-glm::dot(n0, n1), -1.0f, 1.0f));
+        float g1 = acos(glm::clamp(-glm::dot(n1, n2), -1.0f, 1.0f));
+        float g2 = acos(glm::clamp(-glm::dot(n2, n3), -1.0f, 1.0f));
+        float g3 = acos(glm::clamp(-glm::dot(n3, n0), -1.0f, 1.0f));
+
+        rect.b0 = n0.z;
+        rect.b1 = n2.z;
+        rect.k = TWO_PI - g2 - g3;
+        rect.S = g0 + g1 - rect.k;
+        return rect.S > kMinSphericalRectSolidAngle; // false for NaN too
     }
 
+    // a direction uniform in the solid angle of rect, returned as the offset from its origin to the quad
+    glm::vec3 Integrator::SampleSphericalRect(const SphericalRect &rect, float r1, float r2)
+    {
+        // the x where the part of the solid angle left of it is r1 of the whole
+        float au = r1 * rect.S + rect.k;
+        float fu = (cos(au) * rect.b0 - rect.b1) / sin(au);
+        float cu = glm::clamp((fu > 0.0f ? 1.0f : -1.0f) / sqrt(fu * fu + rect.b0 * rect.b0), -1.0f, 1.0f);
+        float xu = -(cu * rect.z0) / sqrt(glm::max(1.0f - cu * cu, 1e-12f));
+        xu = glm::clamp(xu, rect.x0, rect.x1);
+
+        // and along y at that x
+        float d = sqrt(xu * xu + rect.z0 * rect.z0);
+        float h0 = rect.y0 / sqrt(d * d + rect.y0 * rect.y0);
+        float h1 = rect.y1 / sqrt(d * d + rect.y1 * rect.y1);
+        float hv = h0 + r2 * (h1 - h0);
+        float hv2 = hv * hv;
+        float yv = hv2 < 1.0f - 1e-6f ? (hv * d) / sqrt(1.0f - hv2) : rect.y1;
+
+        return xu * rect.x + yv * rect.y + rect.z0 * rect.z;
+    }
+
+    // solid angle pdf of SampleRectLight towards a point of the quad distSq away whose normal makes cosTheta
+    // with the direction, from scatterPos
+    float Integrator::RectLightPdf(glm::vec3 position, glm::vec3 u, glm::vec3 v, float area, glm::vec3 scatterPos, float distSq, float cosTheta)
+    {
+        SphericalRect rect;
+        if (SphericalRectInit(position, u, v, scatterPos, rect))
+            return 1.0f / rect.S;
+        return distSq / (area * glm::abs(cosTheta));
+    }
+
+    // uniform in the solid angle the quad subtends, by area where that is ill conditioned
     void Integrator::SampleRectLight(Light light, glm::vec3 scatterPos, LightSampleRec &lightSample)
     {
         float r1 = rand();
         float r2 = rand();
 
-        glm::vec3 lightSurfacePos = light.position + light.u * r1 + light.v * r2;
+        SphericalRect rect;
+        bool solidAngle = SphericalRectInit(light.position, light.u, light.v, scatterPos, rect);
+        glm::vec3 lightSurfacePos = solidAngle ? scatterPos + SampleSphericalRect(rect, r1, r2) : light.position + light.u * r1 + light.v * r2;
         lightSample.direction = lightSurfacePos - scatterPos;
         lightSample.dist = length(lightSample.direction);
         float distSq = lightSample.dist * lightSample.dist;
         lightSample.direction /= lightSample.dist;
         lightSample.normal = normalize(cross(light.u, light.v));
-        lightSample.emission = light.emission * float(mScene->lights.size());
-        lightSample.pdf = distSq / (light.area * abs(dot(lightSample.normal, lightSample.direction)));
+        lightSample.emission = light.emission;
+        lightSample.pdf = solidAngle ? 1.0f / rect.S : distSq / (light.area * abs(dot(lightSample.normal, lightSample.direction)));
     }
 
     void Integrator::SampleDistantLight(Light light, glm::vec3 scatterPos, LightSampleRec &lightSample)
     {
         lightSample.direction = glm::normalize(light.position - glm::vec3(0.0));
         lightSample.normal = glm::normalize(scatterPos - light.position);
-        lightSample.emission = light.emission * float(mScene->lights.size());
+        lightSample.emission = light.emission;
         lightSample.dist = INF;
         lightSample.pdf = 1.0;
     }
 
+    void Integrator::SampleTriangleLight(const BVH::EmissiveTriangle &tri, glm::vec3 scatterPos, LightSampleRec &lightSample)
+    {
+        float r1 = rand();
+        float r2 = rand();
+
+        // uniform by area
+        float su = sqrt(r1);
+        glm::vec3 lightSurfacePos = tri.v0 + tri.e1 * (su * (1.0f - r2)) + tri.e2 * (su * r2);
+        lightSample.direction = lightSurfacePos - scatterPos;
+        lightSample.dist = length(lightSample.direction);
+        float distSq = lightSample.dist * lightSample.dist;
+        lightSample.direction /= lightSample.dist;
+        lightSample.normal = tri.normal;
+        lightSample.emission = tri.emission;
+        lightSample.pdf = distSq / (tri.area * abs(dot(lightSample.normal, lightSample.direction)));
+    }
+
     void Integrator::SampleOneLight(Light light, glm::vec3 scatterPos, LightSampleRec &lightSample)
     {
         int type = int(light.type);
@@ -0,0 +1,265 @@
+#include <cpu/sdtree.hpp>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace scTracer::CPU
+{
+    namespace
+    {
+        const float spatialThreshold = 12000.0f; // records a leaf takes before it splits, times sqrt(2^iteration)
+        const int maxSpatialDepth = 24;
+        const float directionalThreshold = 0.01f; // share of the energy a quadrant needs to be subdivided
+        const int maxDirectionalDepth = 20;
+        const float pi = 3.14159265358979f;
+
+        inline glm::vec2 directionToCanonical(glm::vec3 d)
+        {
+            float cosTheta = glm::clamp(d.z, -1.0f, 1.0f);
+            float phi = std::atan2(d.y, d.x);
+            if (phi < 0.0f)
+                phi += 2.0f * pi;
+            return glm::clamp(glm::vec2((cosTheta + 1.0f) * 0.5f, phi / (2.0f * pi)), glm::vec2(0.0f), glm::vec2(0.99999994f));
+        }
+
+        inline glm::vec3 canonicalToDirection(glm::vec2 p)
+        {
+            float cosTheta = 2.0f * p.x - 1.0f;
+            float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+            float phi = 2.0f * pi * p.y;
+            return glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+        }
+
+        inline int quadrant(glm::vec2 p) { return (p.x >= 0.5f ? 1 : 0) | (p.y >= 0.5f ? 2 : 0); }
+        // p inside the quadrant, rescaled to the whole square
+        inline glm::vec2 intoQuadrant(glm::vec2 p, int q) { return p * 2.0f - glm::vec2(q & 1, q >> 1); }
+    }
+
+    DTree::Node::Node()
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            sums[i].store(0.0f, std::memory_order_relaxed);
+            children[i] = 0;
+        }
+    }
+
+    DTree::Node::Node(const Node &other)
+    {
+        *this = other;
+    }
+
+    DTree::Node &DTree::Node::operator=(const Node &other)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            sums[i].store(other.sums[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            children[i] = other.children[i];
+        }
+        return *this;
+    }
+
+    float DTree::Node::sum() const
+    {
+        return sums[0].load(std::memory_order_relaxed) + sums[1].load(std::memory_order_relaxed) +
+               sums[2].load(std::memory_order_relaxed) + sums[3].load(std::memory_order_relaxed);
+    }
+
+    DTree &DTree::operator=(const DTree &other)
+    {
+        mNodes = other.mNodes;
+        mWeight.store(other.weight(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    float DTree::energy() const
+    {
+        return mNodes[0].sum();
+    }
+
+    void DTree::record(glm::vec3 direction, float value)
+    {
+        if (!(value > 0.0f) || !std::isfinite(value))
+            return;
+        glm::vec2 p = directionToCanonical(direction);
+        uint32_t node = 0;
+        for (;;)
+        { // every level holds the sum of the levels below, sampling walks it top down
+            int q = quadrant(p);
+            Utils::atomicAdd(mNodes[node].sums[q], value);
+            if (mNodes[node].children[q] == 0)
+                break;
+            node = mNodes[node].children[q];
+            p = intoQuadrant(p, q);
+        }
+    }
+
+    float DTree::pdf(glm::vec3 direction) const
+    {
+        glm::vec2 p = directionToCanonical(direction);
+        float pdf = float(1.0 / (4.0 * pi));
+        uint32_t node = 0;
+        for (;;)
+        {
+            float sum = mNodes[node].sum();
+            int q = quadrant(p);
+            float value = mNodes[node].sums[q].load(std::memory_order_relaxed);
+            if (!(sum > 0.0f) || !(value > 0.0f))
+                return 0.0f;
+            pdf *= 4.0f * value / sum;
+            if (mNodes[node].children[q] == 0)
+                return pdf;
+            node = mNodes[node].children[q];
+            p = intoQuadrant(p, q);
+        }
+    }
+
+    glm::vec3 DTree::sample(glm::vec2 u) const
+    {
+        glm::vec2 origin(0.0f);
+        float size = 1.0f;
+        uint32_t node = 0;
+        for (;;)
+        {
+            float s[4];
+            for (int i = 0; i < 4; i++)
+                s[i] = mNodes[node].sums[i].load(std::memory_order_relaxed);
+
+            // the column first, then the quadrant within it, u is rescaled for reuse in the child
+            int q = 0;
+            float left = s[0] + s[2], total = left + s[1] + s[3];
+            float pLeft = total > 0.0f ? left / total : 0.5f;
+            if (u.x < pLeft)
+                u.x /= pLeft;
+            else
+            {
+                u.x = (u.x - pLeft) / (1.0f - pLeft);
+                q |= 1;
+            }
+            float column = s[q] + s[q | 2];
+            float pBottom = column > 0.0f ? s[q] / column : 0.5f;
+            if (u.y < pBottom)
+                u.y /= pBottom;
+            else
+            {
+                u.y = (u.y - pBottom) / (1.0f - pBottom);
+                q |= 2;
+            }
+            u = glm::clamp(u, glm::vec2(0.0f), glm::vec2(0.99999994f));
+
+            size *= 0.5f;
+            origin += glm::vec2(q & 1, q >> 1) * size;
+            if (mNodes[node].children[q] == 0)
+                return canonicalToDirection(origin + u * size);
+            node = mNodes[node].children[q];
+        }
+    }
+
+    DTree DTree::refined(float threshold, int maxDepth) const
+    {
+        DTree tree;
+        float total = energy();
+        if (!(total > 0.0f))
+        { // nothing was recorded, keep the structure rather than starting from scratch
+            tree.mNodes = mNodes;
+            for (Node &node : tree.mNodes)
+                for (int i = 0; i < 4; i++)
+                    node.sums[i].store(0.0f, std::memory_order_relaxed);
+            return tree;
+        }
+
+        struct Entry
+        {
+            uint32_t target; // node in tree
+            int source;      // node in this tree covering the same cell, -1 past its leaves
+            float energy;    // what the source cell holds, a quarter of the parent's where the source ends
+            int depth;
+        };
+        std::vector<Entry> stack{{0, 0, total, 1}};
+        while (!stack.empty())
+        {
+            Entry entry = stack.back();
+            stack.pop_back();
+            for (int q = 0; q < 4; q++)
+            {
+                float energy = entry.source >= 0 ? mNodes[entry.source].sums[q].load(std::memory_order_relaxed) : entry.energy * 0.25f;
+                if (entry.depth >= maxDepth || energy / total <= threshold)
+                    continue;
+                uint32_t child = uint32_t(tree.mNodes.size());
+                tree.mNodes.emplace_back();
+                tree.mNodes[entry.target].children[q] = child;
+                int source = entry.source >= 0 && mNodes[entry.source].children[q] != 0 ? int(mNodes[entry.source].children[q]) : -1;
+                stack.push_back({child, source, energy, entry.depth + 1});
+            }
+        }
+        return tree;
+    }
+
+    void SDTree::reset(const BVH::BoundingBox &bounds)
+    {
+        glm::vec3 extents = bounds.pmax - bounds.pmin;
+        if (!(extents.x >= 0.0f && extents.y >= 0.0f && extents.z >= 0.0f))
+        { // empty scene
+            mOrigin = glm::vec3(-1.0f);
+            mSize = 2.0f;
+        }
+        else
+        {
+            mSize = std::max(std::max(extents.x, extents.y), std::max(extents.z, 1e-3f)) * 1.01f;
+            mOrigin = (bounds.pmin + bounds.pmax) * 0.5f - glm::vec3(mSize * 0.5f);
+        }
+        mNodes.assign(1, Node{{0, 0}, 0});
+        mLeaves.assign(1, Leaf());
+    }
+
+    int SDTree::leafIndex(glm::vec3 position) const
+    {
+        glm::vec3 p = glm::clamp((position - mOrigin) / mSize, glm::vec3(0.0f), glm::vec3(0.99999994f));
+        uint32_t node = 0;
+        for (int axis = 0; mNodes[node].leaf < 0; axis = axis == 2 ? 0 : axis + 1)
+        {
+            int side = p[axis] >= 0.5f ? 1 : 0;
+            p[axis] = p[axis] * 2.0f - float(side);
+            node = mNodes[node].children[side];
+        }
+        return mNodes[node].leaf;
+    }
+
+    void SDTree::refine(int iteration)
+    {
+        // spatial refinement, a split leaf hands a copy of its trees and half its records to each side
+        float threshold = spatialThreshold * std::sqrt(std::pow(2.0f, float(iteration)));
+        std::vector<std::pair<uint32_t, int>> stack{{0u, 0}};
+        while (!stack.empty())
+        {
+            auto [node, depth] = stack.back();
+            stack.pop_back();
+            int leaf = mNodes[node].leaf;
+            if (leaf < 0)
+            {
+                stack.push_back({mNodes[node].children[0], depth + 1});
+                stack.push_back({mNodes[node].children[1], depth + 1});
+                continue;
+            }
+            if (depth >= maxSpatialDepth || mLeaves[leaf].building.weight() <= threshold)
+                continue;
+
+            mLeaves[leaf].building.scaleWeight(0.5f);
+            int otherLeaf = int(mLeaves.size());
+            mLeaves.push_back(mLeaves[leaf]);
+            uint32_t first = uint32_t(mNodes.size());
+            mNodes.push_back(Node{{0, 0}, leaf});
+            mNodes.push_back(Node{{0, 0}, otherLeaf});
+            mNodes[node] = Node{{first, first + 1}, -1};
+            stack.push_back({first, depth + 1});
+            stack.push_back({first + 1, depth + 1});
+        }
+
+        // directional refinement
+        for (Leaf &leaf : mLeaves)
+        {
+            leaf.sampling = leaf.building;
+            leaf.building = leaf.sampling.refined(directionalThreshold, maxDirectionalDepth);
+        }
+    }
+}
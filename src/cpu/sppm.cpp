@@ -0,0 +1,402 @@
+#include <cpu/integrator.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace scTracer::CPU
+{
+    namespace
+    {
+        const float alpha = 2.0f / 3.0f;          // share of the new photons a pixel keeps, Hachisuka and Jensen 2009
+        const float defaultRadius = 0.005f;       // of the scene bounds diagonal, when the settings leave it at 0
+        const float specularRoughness = 0.1f;     // smoother mirrors and glass are followed instead of gathered at
+        const int photonsPerJob = 4096;
+        const int envPowerSamples = 256;          // estimate of the environment map's power, for the emitter pick
+
+        // mostly metal or glass and close to a delta distribution, photons would be gathered in vain
+        inline bool specular(const Core::ShadingMaterial &mat)
+        {
+            return mat.roughness < specularRoughness && mat.dielectricWt < 0.5f;
+        }
+    }
+
+    void PhotonGrid::build(const std::vector<Photon> &photons, float cellSize, Utils::ThreadPool *threadPool)
+    {
+        int numPhotons = int(photons.size());
+        uint32_t numBuckets = 1;
+        while (numBuckets < uint32_t(numPhotons))
+            numBuckets <<= 1;
+        mInvCellSize = 1.0f / cellSize;
+        mMask = numBuckets - 1;
+        if (mCursorSize != numBuckets)
+        {
+            mCursorSize = numBuckets;
+            mCursor.reset(new std::atomic<uint32_t>[mCursorSize]);
+        }
+        for (uint32_t i = 0; i < numBuckets; i++)
+            mCursor[i].store(0, std::memory_order_relaxed);
+        mBucket.resize(numPhotons);
+        mOrder.resize(numPhotons);
+        mSorted.resize(numPhotons);
+
+        // count, then the exclusive prefix sum gives every bucket its range and scattering fills it
+        forEachChunk(threadPool, numPhotons, [&](int i)
+                     {
+            mBucket[i] = __hash(__cell(photons[i].position));
+            mCursor[mBucket[i]].fetch_add(1, std::memory_order_relaxed); });
+        mStart.resize(numBuckets + 1);
+        uint32_t offset = 0;
+        for (uint32_t b = 0; b < numBuckets; b++)
+        {
+            mStart[b] = offset;
+            offset += mCursor[b].load(std::memory_order_relaxed);
+            mCursor[b].store(mStart[b], std::memory_order_relaxed);
+        }
+        mStart[numBuckets] = offset;
+        forEachChunk(threadPool, numPhotons, [&](int i)
+                     { mOrder[mCursor[mBucket[i]].fetch_add(1, std::memory_order_relaxed)] = uint32_t(i); });
+
+        // the scatter order within a bucket depends on the threads, sorting the few photons of each restores it
+        forEachChunk(threadPool, int(numBuckets), [&](int b)
+                     {
+            std::sort(mOrder.begin() + mStart[b], mOrder.begin() + mStart[b + 1]);
+            for (uint32_t i = mStart[b]; i < mStart[b + 1]; i++)
+                mSorted[i] = photons[mOrder[i]]; });
+    }
+
+    // Stochastic progressive photon mapping, Hachisuka and Jensen 2009 as in pbrt-v3. Every pass traces one
+    // camera path per pixel through mirrors and glass to its first rough surface, the visible point, where it
+    // takes direct light like the path tracer does. Photons from the emitters bring the rest: caustics and the
+    // indirect light. The pixels gather them within a radius that shrinks with every pass, so the estimate is
+    // consistent. The canvas holds the estimate of all passes so far, not the one of this pass
+    void Integrator::__renderSPPM()
+    {
+        size_t numPixels = size_t(mCanvasWidth) * mCanvasHeight;
+        if (mSppmPixels.size() != numPixels)
+        {
+            const BVH::BoundingBox &bounds = mScene->getSceneBounds();
+            float radius = uniforms.sppmRadius > 0.0f ? uniforms.sppmRadius : defaultRadius * glm::length(bounds.extents());
+            mSppmPixels.assign(numPixels, SPPMPixel{radius, 0.0f, glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), VisiblePoint()});
+            __sppmEmitters();
+        }
+
+        // a cancelled pass leaves the estimates as they were, only the gather and the loop below update them
+        __sppmCameraPass();
+        if (isCancelled())
+            return;
+        __sppmPhotonPass();
+        if (isCancelled())
+            return;
+        __sppmGather();
+
+        float passes = float(mFrameNumber + 1);
+        float photons = float(uniforms.sppmPhotons);
+        forEachChunk(mThreadPool, int(numPixels), [&](int i)
+                     {
+            SPPMPixel &pixel = mSppmPixels[i];
+            pixel.Ld += pixel.passLd;
+            glm::vec3 L = pixel.Ld / passes + pixel.tau / (passes * photons * float(PI) * pixel.radius * pixel.radius);
+            float *texel = &mCanvas[size_t(i) * 4];
+            texel[0] = L.r;
+            texel[1] = L.g;
+            texel[2] = L.b;
+            texel[3] = 1.0f; });
+    }
+
+    // photons leave the emitters in proportion to their power: the analytic lights, the emissive triangles and
+    // the environment map last, through a disk as wide as the scene
+    void Integrator::__sppmEmitters()
+    {
+        const BVH::BoundingBox &bounds = mScene->getSceneBounds();
+        float sceneRadius = 0.5f * glm::length(bounds.extents());
+        float diskArea = float(PI) * sceneRadius * sceneRadius;
+        int numLights = int(mScene->lights.size());
+        int numEmitters = glm::max(numLights, mScene->lightSampler.getNumEmitters());
+
+        mSppmEmitterCdf.clear();
+        float sum = 0.0f;
+        for (int e = 0; e < numEmitters; e++)
+        {
+            float power;
+            if (e >= numLights)
+            {
+                const BVH::EmissiveTriangle &tri = mScene->lightSampler.triangle(e);
+                power = Luminance(tri.emission) * tri.area * float(PI);
+            }
+            else if (int(mScene->lights[e].type) == Core::LightType::DistantLight)
+                power = Luminance(mScene->lights[e].emission) * diskArea;
+            else
+                power = Luminance(mScene->lights[e].emission) * mScene->lights[e].area * float(PI);
+            sum += power;
+            mSppmEmitterCdf.push_back(sum);
+        }
+        if (uniforms.hasEnvMap)
+        { // the integral of the radiance over the sphere, from a stratified batch of its own samples
+            float integral = 0.0f;
+            for (int i = 0; i < envPowerSamples; i++)
+            {
+                glm::vec3 dir;
+                float pdf;
+                glm::vec3 Le = mScene->envMap.sample((i + 0.5f) / envPowerSamples, float(i * 0.618034f - std::floor(i * 0.618034f)), dir, pdf);
+                if (pdf > 0.0f)
+                    integral += Luminance(Le) / pdf;
+            }
+            sum += integral / envPowerSamples * uniforms.envMapIntensity * diskArea;
+            mSppmEmitterCdf.push_back(sum);
+        }
+        for (float &c : mSppmEmitterCdf)
+            c = sum > 0.0f ? c / sum : 0.0f;
+    }
+
+    void Integrator::__sppmCameraPass()
+    {
+        forEachChunk(mThreadPool, mCanvasWidth * mCanvasHeight, [&](int i)
+                     {
+            int x = i % mCanvasWidth, y = i / mCanvasWidth;
+            InitRNG(glm::vec2(x, y), mFrameNumber, mSampler.get());
+            Ray ray = __generateCameraRay(x, y);
+
+            SPPMPixel &pixel = mSppmPixels[i];
+            pixel.vp.valid = false;
+            PathState path;
+            path.visiblePoint = &pixel.vp;
+            State state;
+            LightSampleRec lightSample;
+            ShadowRay shadowRays[MAX_SHADOW_RAYS];
+            glm::vec3 debugger(0.0f);
+            for (;;)
+            {
+                bool hit = ClosestHit(ray, state, lightSample, debugger);
+                int numShadowRays;
+                bool alive = (this->*mShadePathFn)(hit, ray, state, lightSample, path, shadowRays, numShadowRays);
+                for (int s = 0; s < numShadowRays; s++)
+                    if (!AnyHit(shadowRays[s].ray, shadowRays[s].maxDist))
+                        path.radiance += shadowRays[s].contribution;
+                if (!alive)
+                    break;
+            }
+            pixel.passLd = std::isfinite(path.radiance.x + path.radiance.y + path.radiance.z) ? path.radiance : glm::vec3(0.0f);
+            __writeAov(i, path.aov); });
+    }
+
+    // hook of __shadePath: true ends the path. Past the visible point the path only looks for the emitters its
+    // bsdf sample hits, what comes after is left to the photons
+    bool Integrator::VisiblePointVertex(const State &state, const Ray &ray, PathState &path)
+    {
+        VisiblePoint &vp = *path.visiblePoint;
+        if (vp.valid)
+            return true;
+        if (specular(*state.mat) || state.depth == uniforms.maxDepth)
+            return false;
+        vp = {*state.mat, state.fhp, state.eta, state.ffnormal, -ray.direction, path.throughput, true};
+        return false;
+    }
+
+    // every job traces its photons into a buffer of its own, the buffers are then copied side by side at the
+    // offsets their sizes add up to. Photons are stored from the second hit on, the first one is direct light
+    // the camera paths take care of
+    void Integrator::__sppmPhotonPass()
+    {
+        int numPhotons = glm::max(1, uniforms.sppmPhotons);
+        int numJobs = (numPhotons + photonsPerJob - 1) / photonsPerJob;
+        mSppmJobPhotons.resize(numJobs);
+        auto runJob = [&](int, int job)
+        {
+            std::vector<Photon> &buffer = mSppmJobPhotons[job];
+            buffer.clear();
+            for (int i = job * photonsPerJob; i < glm::min(numPhotons, (job + 1) * photonsPerJob); i++)
+            {
+                // negative frames, streams the camera paths never draw
+                InitRNG(glm::vec2(i & 0xffff, i >> 16), -1 - mFrameNumber);
+                Ray ray;
+                glm::vec3 power;
+                if (!EmitPhoton(ray, power))
+                    continue;
+
+                glm::vec3 beta(1.0f);
+                State state;
+                LightSampleRec lightSample;
+                glm::vec3 debugger(0.0f);
+                for (int depth = 0; depth <= uniforms.maxDepth; depth++)
+                {
+                    if (!ClosestHit(ray, state, lightSample, debugger) || state.isEmitter)
+                        break;
+                    state.depth = depth;
+                    GetMaterial(state, ray);
+                    TextureMaterial(state, ray);
+                    if (depth > 0 && !specular(*state.mat))
+                        buffer.push_back({state.fhp, -ray.direction, power * beta});
+                    if (depth == uniforms.maxDepth)
+                        break;
+
+                    // the bsdf is sampled as for radiance, its asymmetry under refraction is not corrected for
+                    glm::vec3 L;
+                    float pdf;
+                    glm::vec3 f = DisneySample(state, -ray.direction, state.ffnormal, L, pdf);
+                    if (!(pdf > 0.0f))
+                        break;
+                    beta *= f / pdf;
+                    if (uniforms.rrDepth >= 0 && depth >= uniforms.rrDepth)
+                    {
+                        float q = glm::min(glm::max(beta.x, glm::max(beta.y, beta.z)) + 0.001f, 0.95f);
+                        if (rand() > q)
+                            break;
+                        beta /= q;
+                    }
+                    ray = Ray(state.fhp + L * float(EPS), L);
+                }
+            }
+        };
+        if (mThreadPool)
+            mThreadPool->parallelFor(numJobs, runJob);
+        else
+            for (int i = 0; i < numJobs; i++)
+                runJob(0, i);
+
+        std::vector<size_t> offsets(numJobs + 1, 0);
+        for (int job = 0; job < numJobs; job++)
+            offsets[job + 1] = offsets[job] + mSppmJobPhotons[job].size();
+        mSppmPhotons.resize(offsets[numJobs]);
+        auto merge = [&](int, int job)
+        { std::copy(mSppmJobPhotons[job].begin(), mSppmJobPhotons[job].end(), mSppmPhotons.begin() + offsets[job]); };
+        if (mThreadPool)
+            mThreadPool->parallelFor(numJobs, merge);
+        else
+            for (int i = 0; i < numJobs; i++)
+                merge(0, i);
+    }
+
+    // a ray leaving an emitter picked by power, power is its share of the flux of all of them
+    bool Integrator::EmitPhoton(Ray &ray, glm::vec3 &power)
+    {
+        if (mSppmEmitterCdf.empty() || !(mSppmEmitterCdf.back() > 0.0f))
+            return false;
+        float u = rand();
+        int e = int(std::upper_bound(mSppmEmitterCdf.begin(), mSppmEmitterCdf.end(), u) - mSppmEmitterCdf.begin());
+        e = glm::min(e, int(mSppmEmitterCdf.size()) - 1);
+        float pmf = mSppmEmitterCdf[e] - (e > 0 ? mSppmEmitterCdf[e - 1] : 0.0f);
+        if (!(pmf > 0.0f))
+            return false;
+
+        int numLights = int(mScene->lights.size());
+        int numEmitters = glm::max(numLights, mScene->lightSampler.getNumEmitters());
+        float r1 = rand(), r2 = rand(), r3 = rand(), r4 = rand();
+        glm::vec3 T, B;
+        if (e == numEmitters || (e < numLights && int(mScene->lights[e].type) == Core::LightType::DistantLight))
+        { // from a disk facing the light, just outside the scene
+            const BVH::BoundingBox &bounds = mScene->getSceneBounds();
+            glm::vec3 center = bounds.centroid();
+            float sceneRadius = 0.5f * glm::length(bounds.extents());
+            glm::vec3 toLight;
+            if (e == numEmitters)
+            {
+                float pdf;
+                power = mScene->envMap.sample(r1, r2, toLight, pdf) * uniforms.envMapIntensity;
+                if (!(pdf > 0.0f))
+                    return false;
+                power /= pdf;
+            }
+            else
+            {
+                toLight = glm::normalize(mScene->lights[e].position);
+                power = mScene->lights[e].emission;
+            }
+            Onb(toLight, T, B);
+            float r = sceneRadius * std::sqrt(r3), phi = float(TWO_PI) * r4;
+            glm::vec3 origin = center + sceneRadius * toLight + r * (std::cos(phi) * T + std::sin(phi) * B);
+            ray = Ray(origin, -toLight);
+            power *= float(PI) * sceneRadius * sceneRadius / pmf;
+            return true;
+        }
+
+        // area emitters, a uniform point and a cosine weighted direction around the normal
+        glm::vec3 position, normal, emission;
+        float area;
+        if (e >= numLights)
+        {
+            const BVH::EmissiveTriangle &tri = mScene->lightSampler.triangle(e);
+            float su = std::sqrt(r1);
+            position = tri.v0 + tri.e1 * (su * (1.0f - r2)) + tri.e2 * (su * r2);
+            normal = tri.normal;
+            emission = tri.emission;
+            area = tri.area;
+        }
+        else
+        {
+            const Core::Light &light = mScene->lights[e];
+            if (int(light.type) == Core::LightType::RectLight)
+            {
+                position = light.position + light.u * r1 + light.v * r2;
+                normal = glm::normalize(glm::cross(light.u, light.v));
+            }
+            else
+            {
+                float z = 1.0f - 2.0f * r1, s = std::sqrt(glm::max(0.0f, 1.0f - z * z)), phi = float(TWO_PI) * r2;
+                normal = glm::vec3(s * std::cos(phi), s * std::sin(phi), z);
+                position = light.position + normal * light.radius;
+            }
+            emission = light.emission;
+            area = light.area;
+        }
+        Onb(normal, T, B);
+        glm::vec3 local = CosineSampleHemisphere(r3, r4);
+        glm::vec3 direction = local.x * T + local.y * B + local.z * normal;
+        ray = Ray(position + normal * float(EPS), direction);
+        power = emission * area * float(PI) / pmf;
+        return true;
+    }
+
+    // every pixel with a visible point takes the photons within its radius, then keeps alpha of them and shrinks
+    // the radius so the density it has gathered stays the same
+    void Integrator::__sppmGather()
+    {
+        if (mSppmPhotons.empty())
+            return;
+        float maxRadius = 0.0f;
+        for (const SPPMPixel &pixel : mSppmPixels)
+            if (pixel.vp.valid)
+                maxRadius = glm::max(maxRadius, pixel.radius);
+        if (!(maxRadius > 0.0f))
+            return;
+        mPhotonGrid.build(mSppmPhotons, 2.0f * maxRadius, mThreadPool);
+
+        forEachChunk(mThreadPool, int(mSppmPixels.size()), [&](int i)
+                     {
+            SPPMPixel &pixel = mSppmPixels[i];
+            const VisiblePoint &vp = pixel.vp;
+            if (!vp.valid)
+                return;
+            State state;
+            state.fhp = vp.position;
+            state.ffnormal = vp.normal;
+            state.eta = vp.eta;
+            state.mat = &vp.mat;
+            float radiusSq = pixel.radius * pixel.radius;
+            glm::vec3 phi(0.0f);
+            int M = 0;
+            mPhotonGrid.query(vp.position, pixel.radius, [&](const Photon &photon)
+                              {
+                glm::vec3 d = photon.position - vp.position;
+                if (glm::dot(d, d) > radiusSq)
+                    return;
+                // DisneyEval carries the cosine at the photon's side, its power already does
+                float cosTheta = glm::abs(glm::dot(vp.normal, photon.wi));
+                if (cosTheta < 1e-4f)
+                    return;
+                float pdf;
+                glm::vec3 f = DisneyEval(state, vp.V, vp.normal, photon.wi, pdf);
+                phi += f / cosTheta * photon.power;
+                M++; });
+            if (M == 0)
+                return;
+
+            float N = pixel.N + alpha * M;
+            float radius = pixel.radius * std::sqrt(N / (pixel.N + M));
+            glm::vec3 tau = pixel.tau + vp.throughput * phi;
+            if (std::isfinite(tau.x + tau.y + tau.z))
+                pixel.tau = tau * (radius * radius) / radiusSq;
+            else
+                pixel.tau *= (radius * radius) / radiusSq;
+            pixel.N = N;
+            pixel.radius = radius; });
+    }
+}
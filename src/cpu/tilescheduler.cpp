@@ -0,0 +1,128 @@
+#include <cpu/tilescheduler.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace scTracer::CPU
+{
+    namespace
+    {
+        const double kSplitRatio = 4.0; // a base tile this many times the mean cost is cut into 2x2
+        const int kMinTileSize = 4;
+        const int kMaxSplitLevels = 2;
+    }
+
+    void TileScheduler::__resetGrid(int width, int height, int tileSize)
+    {
+        mWidth = width;
+        mHeight = height;
+        mTileSize = tileSize;
+        mTilesX = (width + tileSize - 1) / tileSize;
+        mTilesY = (height + tileSize - 1) / tileSize;
+
+        // square spiral: ring by ring around the center tile, each ring walked by angle
+        float cx = 0.5f * (mTilesX - 1), cy = 0.5f * (mTilesY - 1);
+        std::vector<float> ring(mTilesX * mTilesY), angle(mTilesX * mTilesY);
+        mSpiralOrder.resize(mTilesX * mTilesY);
+        for (int i = 0; i < mTilesX * mTilesY; i++)
+        {
+            float dx = i % mTilesX - cx, dy = i / mTilesX - cy;
+            ring[i] = std::max(std::abs(dx), std::abs(dy));
+            angle[i] = std::atan2(dy, dx);
+            mSpiralOrder[i] = i;
+        }
+        std::stable_sort(mSpiralOrder.begin(), mSpiralOrder.end(), [&](int a, int b)
+                         { return ring[a] != ring[b] ? ring[a] < ring[b] : angle[a] < angle[b]; });
+
+        mCosts.assign(mTilesX * mTilesY, 0.0);
+        mLastCosts.assign(mTilesX * mTilesY, 0.0);
+    }
+
+    void TileScheduler::__pushTile(std::vector<Tile> &tiles, int baseTile, int levels) const
+    {
+        int x0 = (baseTile % mTilesX) * mTileSize, y0 = (baseTile / mTilesX) * mTileSize;
+        int x1 = std::min(x0 + mTileSize, mWidth), y1 = std::min(y0 + mTileSize, mHeight);
+
+        int parts = 1 << levels;
+        while (parts > 1 && mTileSize / parts < kMinTileSize)
+            parts >>= 1;
+        int sub = (mTileSize + parts - 1) / parts;
+        for (int sy = y0; sy < y1; sy += sub)
+            for (int sx = x0; sx < x1; sx += sub)
+                tiles.push_back({sx, sy, std::min(sx + sub, x1), std::min(sy + sub, y1), baseTile});
+    }
+
+    void TileScheduler::beginPass(int width, int height, int tileSize, int numWorkers)
+    {
+        if (width != mWidth || height != mHeight || tileSize != mTileSize)
+            __resetGrid(width, height, tileSize);
+        else
+        {
+            mLastCosts.swap(mCosts);
+            std::fill(mCosts.begin(), mCosts.end(), 0.0);
+        }
+
+        double meanCost = 0.0;
+        for (double cost : mLastCosts)
+            meanCost += cost;
+        meanCost /= std::max<size_t>(1, mLastCosts.size());
+
+        mTiles.clear();
+        for (int baseTile : mSpiralOrder)
+        {
+            int levels = 0;
+            if (meanCost > 0.0)
+                for (double ratio = mLastCosts[baseTile] / meanCost; ratio > kSplitRatio && levels < kMaxSplitLevels; ratio /= kSplitRatio)
+                    levels++;
+            __pushTile(mTiles, baseTile, levels);
+        }
+
+        // deal round robin, every worker starts near the center and thieves take the outer tiles first
+        if (int(mQueues.size()) != numWorkers)
+        {
+            mQueues.clear();
+            for (int i = 0; i < numWorkers; i++)
+                mQueues.push_back(std::make_unique<WorkerQueue>());
+        }
+        for (auto &queue : mQueues)
+            queue->tiles.clear();
+        for (int i = 0; i < mTiles.size(); i++)
+            mQueues[i % numWorkers]->tiles.push_back(i);
+    }
+
+    bool TileScheduler::next(int worker, Tile &tile)
+    {
+        {
+            WorkerQueue &own = *mQueues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tiles.empty())
+            {
+                tile = mTiles[own.tiles.front()];
+                own.tiles.pop_front();
+                return true;
+            }
+        }
+        for (int i = 1; i < mQueues.size(); i++)
+        {
+            WorkerQueue &victim = *mQueues[(worker + i) % mQueues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tiles.empty())
+            {
+                tile = mTiles[victim.tiles.back()];
+                victim.tiles.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void TileScheduler::reportCost(const Tile &tile, double seconds)
+    {
+        std::lock_guard<std::mutex> lock(mCostMutex);
+        mCosts[tile.baseTile] += seconds;
+    }
+
+    void TileScheduler::cancelPass()
+    {
+        mCosts = mLastCosts; // beginPass swaps them back
+    }
+}
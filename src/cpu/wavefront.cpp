@@ -0,0 +1,251 @@
+#include <cpu/integrator.hpp>
+#include <cpu/disneysimd.hpp>
+#include <algorithm>
+
+namespace scTracer::CPU
+{
+    // Same estimator as __traceRay, reorganized into batched stages over queues of rays:
+    // generate -> (sort) -> extend -> shade -> (SIMD bsdf sample) -> shadow connect -> compact, until no path is left.
+    // Each path keeps its own sampler dimension, so the image matches the megakernel one. The SIMD stage draws
+    // the same numbers, its directions and weights differ from the scalar ones by rounding only
+    void Integrator::__renderWavefront()
+    {
+        // pixels this pass samples, adaptive sampling may have retired some
+        mActivePixels.clear();
+        for (int i = 0; i < mCanvasWidth * mCanvasHeight; i++)
+            if (!mPixelActive || mPixelActive[i])
+                mActivePixels.push_back(i);
+        int numPixels = int(mActivePixels.size());
+
+        int capacity = std::max(1, std::min(Config::cpu_wavefront_size, numPixels));
+        if (int(mPaths.state.size()) < capacity)
+        {
+            mPaths.resize(capacity);
+            mRayQueue.reserve(capacity);
+            mNextRayQueue.reserve(capacity);
+            mShadowQueue.reserve(capacity * MAX_SHADOW_RAYS);
+            mShadeOrder.resize(capacity);
+        }
+
+        for (int begin = 0; begin < numPixels && !isCancelled(); begin += capacity)
+        {
+            int end = std::min(begin + capacity, numPixels);
+            __wavefrontGenerate(begin, end);
+            while (mRayQueue.size > 0 && !isCancelled())
+            {
+                if (uniforms.wavefrontSort == WavefrontSort::Direction)
+                    mRayQueue.sortByOctant(mNextRayQueue);
+                __wavefrontExtend();
+                __wavefrontShade();
+                if (uniforms.wavefrontSimd)
+                    __wavefrontSampleBsdf();
+                __wavefrontShadowConnect();
+                __wavefrontCompact();
+            }
+
+            forEachChunk(mThreadPool, end - begin, [&](int slot)
+                         {
+                float *texel = &mCanvas[size_t(mPaths.pixel[slot]) * 4];
+                const glm::vec3 &radiance = mPaths.state[slot].radiance;
+                texel[0] = radiance.r;
+                texel[1] = radiance.g;
+                texel[2] = radiance.b;
+                texel[3] = 1.0f;
+                __writeAov(mPaths.pixel[slot], mPaths.state[slot].aov); });
+        }
+    }
+
+    void Integrator::__wavefrontGenerate(int begin, int end)
+    {
+        mRayQueue.size = end - begin;
+        forEachChunk(mThreadPool, end - begin, [&](int slot)
+                     {
+            int index = mActivePixels[begin + slot];
+            int x = index % mCanvasWidth, y = index / mCanvasWidth;
+            int sample = mPixelSampleIndices ? mPixelSampleIndices[index] : mFrameNumber;
+            InitRNG(glm::vec2(x, y), sample, mSampler.get());
+            mPaths.nextRay[slot] = __generateCameraRay(x, y);
+            mRayQueue.set(slot, mPaths.nextRay[slot], INF, slot);
+
+            mPaths.state[slot] = PathState();
+            if (uniforms.wavefrontSimd)
+                mPaths.state[slot].deferredSample = &mPaths.deferred[slot];
+            mPaths.pixel[slot] = index;
+            mPaths.sampleIndex[slot] = sample;
+            mPaths.dimension[slot] = sampleDimension; });
+    }
+
+    void Integrator::__wavefrontExtend()
+    { // ClosestHit per chunk: the analytic lights bound every ray, then one batched scene query for the chunk
+        forEachBatch(mThreadPool, mRayQueue.size, [&](int begin, int end)
+                     {
+            BVH::QueryRay *rays = &mPaths.queryRays[begin];
+            BVH::QueryHit *hits = &mPaths.queryHits[begin];
+            for (int i = begin; i < end; i++)
+            {
+                int slot = mRayQueue.slot[i];
+                Ray ray = mRayQueue.ray(i);
+                float t = IntersectEmitters(ray, mPaths.hitState[slot], mPaths.hitLight[slot]);
+                rays[i - begin] = BVH::QueryRay(ray.origin, ray.direction, t);
+            }
+            mScene->rayQuery.intersect(rays, hits, end - begin);
+            for (int i = begin; i < end; i++)
+            {
+                const BVH::QueryHit &hit = hits[i - begin];
+                int slot = mRayQueue.slot[i];
+                mPaths.hit[slot] = FillHitState(mRayQueue.ray(i), hit, hit.valid() ? hit.t : rays[i - begin].tmax, mPaths.hitState[slot]);
+            } });
+    }
+
+    void Integrator::__wavefrontShade()
+    {
+        int count = mRayQueue.size;
+        for (int i = 0; i < count; i++)
+            mShadeOrder[i] = i;
+        if (uniforms.wavefrontSort == WavefrontSort::Material)
+        { // stable counting sort, misses first, then emitters, then one run per material
+            auto key = [&](int i)
+            {
+                int slot = mRayQueue.slot[i];
+                if (!mPaths.hit[slot])
+                    return 0;
+                return mPaths.hitState[slot].isEmitter ? 1 : mPaths.hitState[slot].matID + 2;
+            };
+            int numKeys = 0;
+            for (int i = 0; i < count; i++)
+                numKeys = std::max(numKeys, key(i) + 1);
+            std::vector<int> offsets(numKeys + 1, 0);
+            for (int i = 0; i < count; i++)
+                offsets[key(i) + 1]++;
+            for (int k = 0; k < numKeys; k++)
+                offsets[k + 1] += offsets[k];
+            for (int i = 0; i < count; i++)
+                mShadeOrder[offsets[key(i)]++] = i;
+        }
+
+        forEachChunk(mThreadPool, count, [&](int k)
+                     {
+            int i = mShadeOrder[k];
+            int slot = mRayQueue.slot[i];
+
+            // resume the path's rng where its last stage left it
+            int index = mPaths.pixel[slot];
+            InitRNG(glm::vec2(index % mCanvasWidth, index / mCanvasWidth), mPaths.sampleIndex[slot], mSampler.get());
+            sampleDimension = mPaths.dimension[slot];
+
+            Ray ray = mPaths.nextRay[slot]; // the queued ray, with its differentials
+            mPaths.deferred[slot].pending = false;
+            int numShadowRays;
+            mPaths.alive[slot] = (this->*mShadePathFn)(mPaths.hit[slot], ray, mPaths.hitState[slot], mPaths.hitLight[slot], mPaths.state[slot],
+                                                       &mPaths.shadowRays[size_t(slot) * MAX_SHADOW_RAYS], numShadowRays);
+            mPaths.numShadowRays[slot] = numShadowRays;
+            mPaths.nextRay[slot] = ray;
+            mPaths.dimension[slot] = sampleDimension; });
+    }
+
+    void Integrator::__wavefrontSampleBsdf()
+    { // the bsdf samples the shade stage left pending, 8 paths per packet in shading order
+        mDeferredSlots.clear();
+        for (int k = 0; k < mRayQueue.size; k++)
+        {
+            int slot = mRayQueue.slot[mShadeOrder[k]];
+            if (mPaths.deferred[slot].pending)
+                mDeferredSlots.push_back(slot);
+        }
+
+        int count = int(mDeferredSlots.size());
+        forEachChunk(mThreadPool, (count + SIMD::width - 1) / SIMD::width, [&](int packet)
+                     {
+            int begin = packet * SIMD::width;
+            int lanes = std::min(SIMD::width, count - begin);
+
+            // a partial packet repeats its last path in the lanes it does not use
+            SIMD::ShadingPacket sp;
+            SIMD::float8 r1, r2, r3;
+            for (int lane = 0; lane < SIMD::width; lane++)
+            {
+                int slot = mDeferredSlots[begin + std::min(lane, lanes - 1)];
+                const State &state = mPaths.hitState[slot];
+                sp.set(lane, state, -mPaths.nextRay[slot].direction, state.ffnormal);
+                r1.insert(lane, mPaths.deferred[slot].r1);
+                r2.insert(lane, mPaths.deferred[slot].r2);
+                r3.insert(lane, mPaths.deferred[slot].r3);
+            }
+            SIMD::vec3x8 L;
+            SIMD::float8 pdf;
+            SIMD::vec3x8 f = SIMD::DisneySample(sp, r1, r2, r3, L, pdf);
+
+            for (int lane = 0; lane < lanes; lane++)
+            {
+                int slot = mDeferredSlots[begin + lane];
+                PathState &path = mPaths.state[slot];
+                path.scatterSample.f = f[lane];
+                path.scatterSample.L = L[lane];
+                path.scatterSample.pdf = pdf[lane];
+
+                // russian roulette draws after the bsdf sample
+                int index = mPaths.pixel[slot];
+                InitRNG(glm::vec2(index % mCanvasWidth, index / mCanvasWidth), mPaths.sampleIndex[slot], mSampler.get());
+                sampleDimension = mPaths.dimension[slot];
+                mPaths.alive[slot] = __continuePath(mPaths.nextRay[slot], mPaths.hitState[slot], path);
+                mPaths.dimension[slot] = sampleDimension;
+            } });
+    }
+
+    void Integrator::__wavefrontShadowConnect()
+    {
+        mShadowQueue.clear();
+        for (int i = 0; i < mRayQueue.size; i++)
+        {
+            int slot = mRayQueue.slot[i];
+            for (int j = 0; j < mPaths.numShadowRays[slot]; j++)
+            {
+                const ShadowRay &shadowRay = mPaths.shadowRays[size_t(slot) * MAX_SHADOW_RAYS + j];
+                mShadowQueue.push(shadowRay.ray, shadowRay.maxDist, slot * MAX_SHADOW_RAYS + j);
+            }
+        }
+
+        // AnyHit per chunk: the rays no analytic light blocks go to one batched scene query
+        forEachBatch(mThreadPool, mShadowQueue.size, [&](int begin, int end)
+                     {
+            BVH::QueryRay *rays = &mPaths.queryRays[begin];
+            int *queued = &mPaths.queryIndex[begin];
+            bool *occluded = &mPaths.queryOccluded[begin];
+            int count = 0;
+            for (int i = begin; i < end; i++)
+            {
+                Ray ray = mShadowQueue.ray(i);
+                BVH::QueryRay query(ray.origin, ray.direction, mShadowQueue.tMax[i]);
+                if (mScene->lightBVH.occluded1(query))
+                    mPaths.visible[mShadowQueue.slot[i]] = false;
+                else
+                {
+                    rays[count] = query;
+                    queued[count++] = i;
+                }
+            }
+            mScene->rayQuery.occluded(rays, occluded, count);
+            for (int k = 0; k < count; k++)
+                mPaths.visible[mShadowQueue.slot[queued[k]]] = !occluded[k]; });
+
+        // one writer per path, in the order the megakernel adds them
+        forEachChunk(mThreadPool, mRayQueue.size, [&](int i)
+                     {
+            int slot = mRayQueue.slot[i];
+            for (int j = 0; j < mPaths.numShadowRays[slot]; j++)
+                if (mPaths.visible[size_t(slot) * MAX_SHADOW_RAYS + j])
+                    mPaths.state[slot].radiance += mPaths.shadowRays[size_t(slot) * MAX_SHADOW_RAYS + j].contribution; });
+    }
+
+    void Integrator::__wavefrontCompact()
+    { // drops the finished paths, the survivors keep their queue order
+        mNextRayQueue.clear();
+        for (int i = 0; i < mRayQueue.size; i++)
+        {
+            int slot = mRayQueue.slot[i];
+            if (mPaths.alive[slot])
+                mNextRayQueue.push(mPaths.nextRay[slot], INF, slot);
+        }
+        mRayQueue.swap(mNextRayQueue);
+    }
+}
@@ -0,0 +1,68 @@
+#include <utils/aliasTable.hpp>
+#include <algorithm>
+
+namespace scTracer::Utils
+{
+    void AliasTable::build(const std::vector<float> &weights)
+    {
+        mBins.clear();
+        double sum = 0.0;
+        for (float w : weights)
+            sum += std::max(w, 0.0f);
+        if (!(sum > 0.0))
+            return;
+
+        int n = int(weights.size());
+        mBins.resize(n);
+        std::vector<double> scaled(n);
+        std::vector<int> under, over;
+        for (int i = 0; i < n; i++)
+        {
+            double p = std::max(weights[i], 0.0f) / sum;
+            mBins[i].p = float(p);
+            mBins[i].alias = -1;
+            scaled[i] = p * n;
+            (scaled[i] < 1.0 ? under : over).push_back(i);
+        }
+
+        // Vose: pair each under-full bin with an over-full one
+        while (!under.empty() && !over.empty())
+        {
+            int small = under.back(), large = over.back();
+            under.pop_back();
+            over.pop_back();
+            mBins[small].q = float(scaled[small]);
+            mBins[small].alias = large;
+            scaled[large] -= 1.0 - scaled[small];
+            (scaled[large] < 1.0 ? under : over).push_back(large);
+        }
+        // leftovers are full up to rounding
+        for (int i : under)
+            mBins[i].q = 1.0f;
+        for (int i : over)
+            mBins[i].q = 1.0f;
+    }
+
+    int AliasTable::sample(float u, float *pmf, float *uRemapped) const
+    {
+        int n = int(mBins.size());
+        float scaled = u * n;
+        int index = std::min(int(scaled), n - 1);
+        float up = std::min(scaled - index, 0.99999994f);
+        const Bin &bin = mBins[index];
+        if (up < bin.q)
+        {
+            if (uRemapped)
+                *uRemapped = std::min(up / bin.q, 0.99999994f);
+        }
+        else
+        {
+            if (uRemapped)
+                *uRemapped = std::min((up - bin.q) / (1.0f - bin.q), 0.99999994f);
+            index = bin.alias;
+        }
+        if (pmf)
+            *pmf = mBins[index].p;
+        return index;
+    }
+}
@@ -2,6 +2,6 @@
 #include <glm/glm.hpp>
 
 namespace scTracer::Utils {
-    float mathUtils::M_PI = 3.14159265358979323846f;
+    float mathUtils::pi = 3.14159265358979323846f;
 
 }
\ No newline at end of file
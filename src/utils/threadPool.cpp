@@ -0,0 +1,87 @@
+#include <utils/threadPool.hpp>
+
+namespace scTracer::Utils
+{
+    int ThreadPool::hardwareThreads()
+    {
+        int n = int(std::thread::hardware_concurrency());
+        return n > 0 ? n : 1;
+    }
+
+    ThreadPool::ThreadPool(int numThreads)
+    {
+        mNumThreads = numThreads > 0 ? numThreads : hardwareThreads();
+        for (int i = 1; i < mNumThreads; i++)
+            mWorkers.emplace_back(&ThreadPool::__workerLoop, this, i);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mWakeUp.notify_all();
+        for (auto &worker : mWorkers)
+            worker.join();
+    }
+
+    void ThreadPool::parallelFor(int jobCount, const std::function<void(int, int)> &task)
+    {
+        if (jobCount <= 0)
+            return;
+        if (mWorkers.empty())
+        {
+            for (int i = 0; i < jobCount; i++)
+                task(0, i);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTask = &task;
+            mJobCount = jobCount;
+            mNextJob = 0;
+            mBusyWorkers = int(mWorkers.size());
+            mGeneration++;
+        }
+        mWakeUp.notify_all();
+
+        __runJobs(0);
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDone.wait(lock, [this]
+                   { return mBusyWorkers == 0; });
+        mTask = nullptr;
+    }
+
+    void ThreadPool::__runJobs(int workerIndex)
+    {
+        for (int job = mNextJob++; job < mJobCount; job = mNextJob++)
+            (*mTask)(workerIndex, job);
+    }
+
+    void ThreadPool::__workerLoop(int workerIndex)
+    {
+        unsigned long long seenGeneration = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWakeUp.wait(lock, [&]
+                             { return mStop || mGeneration != seenGeneration; });
+                if (mStop)
+                    return;
+                seenGeneration = mGeneration;
+            }
+
+            __runJobs(workerIndex);
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mBusyWorkers--;
+            }
+            mDone.notify_one();
+        }
+    }
+}
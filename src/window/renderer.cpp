@@ -2,7 +2,9 @@
 #include <stb_image_write.h>
 #define TINYEXR_IMPLEMENTATION
 #include <tinyexr.h>
+#include <algorithm>
 #include <filesystem>
+#include <tuple>
 #include <window/renderer.hpp>
 
 namespace scTracer::Window
@@ -185,20 +187,97 @@ namespace scTracer::Window
         delete[] buffer;
     }
 
-    void RenderGPU::saveEXR(std::string filename)
+    namespace
     {
+        // named float planes of one image, stored as half floats in name order as readers expect
+        void writeEXR(const std::string &fullPath, int width, int height, std::vector<std::pair<std::string, std::vector<float>>> channels)
+        {
+            std::sort(channels.begin(), channels.end(), [](const auto &a, const auto &b)
+                      { return a.first < b.first; });
+
+            EXRHeader header;
+            InitEXRHeader(&header);
+            EXRImage exrImage;
+            InitEXRImage(&exrImage);
+
+            std::vector<float *> imagePtrs;
+            for (auto &channel : channels)
+                imagePtrs.push_back(channel.second.data());
+            exrImage.num_channels = int(channels.size());
+            exrImage.images = (unsigned char **)imagePtrs.data();
+            exrImage.width = width;
+            exrImage.height = height;
+
+            header.num_channels = int(channels.size());
+            header.channels = (EXRChannelInfo *)malloc(sizeof(EXRChannelInfo) * header.num_channels);
+            for (int i = 0; i < header.num_channels; i++)
+            {
+                strncpy(header.channels[i].name, channels[i].first.c_str(), 255);
+                header.channels[i].name[std::min<size_t>(channels[i].first.size(), 255)] = '\0';
+            }
+
+            header.pixel_types = (int *)malloc(sizeof(int) * header.num_channels);
+            header.requested_pixel_types = (int *)malloc(sizeof(int) * header.num_channels);
+            for (int i = 0; i < header.num_channels; i++)
+            {
+                header.pixel_types[i] = TINYEXR_PIXELTYPE_FLOAT;          // pixel type of input image
+                header.requested_pixel_types[i] = TINYEXR_PIXELTYPE_HALF; // pixel type of output image to be stored in .EXR
+            }
+
+            const char *err = NULL; // or nullptr in C++11 or later.
+            int ret = SaveEXRImageToFile(&exrImage, &header, fullPath.c_str(), &err);
+            if (ret != TINYEXR_SUCCESS)
+            {
+                fprintf(stderr, "Save EXR err: %s\n", err);
+                FreeEXRErrorMessage(err); // free's buffer for an error message
+                exit(ret);
+            }
+            std::cout << "Saved exr file. [" << fullPath << "]" << std::endl;
+
+            free(header.channels);
+            free(header.pixel_types);
+            free(header.requested_pixel_types);
+        }
+    }
+
+    void RenderGPU::saveEXR(std::string filename, const CPU::CPURenderer *cpuRenderer)
+    {
+        std::string fullPath = Config::outputFolder + filename;
+        if (cpuRenderer && cpuRenderer->mCanvas)
+        { // the CPU image at its own resolution, with the auxiliary buffers of its first hits
+            // what is shown, the render thread may be further along
+            int width = cpuRenderer->mCanvasWidth;
+            int height = cpuRenderer->mCanvasHeight;
+            const float *canvas = cpuRenderer->mCanvas;
+            const float *aov = cpuRenderer->mCanvasAov;
+            // name, source, channel, stride
+            std::vector<std::tuple<std::string, const float *, int, int>> planes = {
+                {"R", canvas, 0, 4}, {"G", canvas, 1, 4}, {"B", canvas, 2, 4}, {"A", canvas, 3, 4}};
+            if (aov)
+            {
+                const char *names[] = {"albedo.R", "albedo.G", "albedo.B", "Z", "N.X", "N.Y", "N.Z"};
+                for (int c = 0; c < 7; c++)
+                    planes.emplace_back(names[c], aov, c, CPU::AOV_CHANNELS);
+            }
+
+            std::vector<std::pair<std::string, std::vector<float>>> channels;
+            for (auto &[name, source, channel, stride] : planes)
+            {
+                std::vector<float> plane(size_t(width) * height);
+                for (int i = 0; i < height; i++)
+                    for (int j = 0; j < width; j++)
+                        plane[size_t(height - i - 1) * width + j] = source[(size_t(i) * width + j) * stride + channel];
+                channels.emplace_back(name, std::move(plane));
+            }
+            writeEXR(fullPath, width, height, std::move(channels));
+            return;
+        }
+
         int width = windowSize.x;
         int height = windowSize.y;
         int size = width * height * 4;
         float *buffer = new float[size];
         __captureFrame(buffer);
-        // save to file
-        std::string fullPath = Config::outputFolder + filename;
-
-        EXRHeader header;
-        InitEXRHeader(&header);
-        EXRImage exrImage;
-        InitEXRImage(&exrImage);
 
         std::vector<float> r(width * height);
         std::vector<float> g(width * height);
@@ -216,46 +295,8 @@ namespace scTracer::Window
                 a[index_height_fliped] = buffer[index * 4 + 3];
             }
         }
-        float *imagePtrs[4] = {b.data(), g.data(), r.data(), a.data()};
-
-        exrImage.num_channels = 4;
-        exrImage.images = (unsigned char **)imagePtrs;
-        exrImage.width = width;
-        exrImage.height = height;
-        EXRChannelInfo channelInfos[4];
-        header.num_channels = 4;
-        header.channels = (EXRChannelInfo *)malloc(sizeof(EXRChannelInfo) * header.num_channels);
-        strncpy(header.channels[0].name, "B", 255);
-        header.channels[0].name[strlen("B")] = '\0';
-        strncpy(header.channels[1].name, "G", 255);
-        header.channels[1].name[strlen("G")] = '\0';
-        strncpy(header.channels[2].name, "R", 255);
-        header.channels[2].name[strlen("R")] = '\0';
-        strncpy(header.channels[3].name, "A", 255);
-        header.channels[3].name[strlen("A")] = '\0';
-
-        header.pixel_types = (int *)malloc(sizeof(int) * header.num_channels);
-        header.requested_pixel_types = (int *)malloc(sizeof(int) * header.num_channels);
-        for (int i = 0; i < header.num_channels; i++)
-        {
-            header.pixel_types[i] = TINYEXR_PIXELTYPE_FLOAT;          // pixel type of input image
-            header.requested_pixel_types[i] = TINYEXR_PIXELTYPE_HALF; // pixel type of output image to be stored in .EXR
-        }
-
-        const char *err = NULL; // or nullptr in C++11 or later.
-        int ret = SaveEXRImageToFile(&exrImage, &header, fullPath.c_str(), &err);
-        if (ret != TINYEXR_SUCCESS)
-        {
-            fprintf(stderr, "Save EXR err: %s\n", err);
-            FreeEXRErrorMessage(err); // free's buffer for an error message
-            exit(ret);
-        }
-        std::cout << "Saved exr file. [" << fullPath << "]" << std::endl;
-
-        free(header.channels);
-        free(header.pixel_types);
-        free(header.requested_pixel_types);
         delete[] buffer;
+        writeEXR(fullPath, width, height, {{"R", std::move(r)}, {"G", std::move(g)}, {"B", std::move(b)}, {"A", std::move(a)}});
     }
 
     void RenderGPU::show()
@@ -316,8 +357,8 @@ namespace scTracer::Window
         if (mScene->envMapDirty)
         {
             mScene->envMapDirty = false;
-            // Update envmap
-            // TODO
+            __uploadEnvMap();
+            std::cerr << Config::LOG_BLUE << "Env Map Reloaded" << Config::LOG_RESET << std::endl;
         }
 
         if (mScene->isDirty())
@@ -352,6 +393,10 @@ namespace scTracer::Window
         glUniform1f(glGetUniformLocation(thisProgram, "camera.focalDist"), mScene->camera.mFocalDist);
         glUniform1f(glGetUniformLocation(thisProgram, "camera.aperture"), mScene->camera.mAperture);
         glUniform1i(glGetUniformLocation(thisProgram, "maxDepth"), mScene->settings.maxBounceDepth);
+        glUniform1i(glGetUniformLocation(thisProgram, "rrDepth"), mScene->settings.rrDepth);
+        glUniform1i(glGetUniformLocation(thisProgram, "enableEnvMap"), !mScene->envMap.empty());
+        glUniform2f(glGetUniformLocation(thisProgram, "envMapRes"), float(mScene->envMap.mWidth), float(mScene->envMap.mHeight));
+        glUniform1f(glGetUniformLocation(thisProgram, "envMapIntensity"), mScene->settings.envMapIntensity);
         glUniform1i(glGetUniformLocation(thisProgram, "frameNum"), frameCounter);
         mRenderPipeline.PathTracer->StopUsing();
 
@@ -456,7 +501,6 @@ namespace scTracer::Window
         mRenderPipeline.PathTracer->Use();
         GLuint thisProgram = mRenderPipeline.PathTracer->get();
 
-        // env map uniform here(not implemented yet)
         glUniform1i(glGetUniformLocation(thisProgram, "topBVHIndex"), mScene->bvhFlattor.topLevelIndex);
         glUniform2f(glGetUniformLocation(thisProgram, "resolution"), float(windowSize.x), float(windowSize.y));
         glUniform1i(glGetUniformLocation(thisProgram, "numOfLights"), mScene->lights.size());
@@ -471,6 +515,7 @@ namespace scTracer::Window
         glUniform1i(glGetUniformLocation(thisProgram, "lightsTex"), 8);
         glUniform1i(glGetUniformLocation(thisProgram, "textureMapsArrayTex"), 9);
         glUniform1i(glGetUniformLocation(thisProgram, "envMapTex"), 10);
+        glUniform1i(glGetUniformLocation(thisProgram, "envMapCDFTex"), 11);
         mRenderPipeline.PathTracer->StopUsing();
 
         mRenderPipeline.PathTracerLowResolution->Use();
@@ -489,6 +534,7 @@ namespace scTracer::Window
         glUniform1i(glGetUniformLocation(thisProgram, "lightsTex"), 8);
         glUniform1i(glGetUniformLocation(thisProgram, "textureMapsArrayTex"), 9);
         glUniform1i(glGetUniformLocation(thisProgram, "envMapTex"), 10);
+        glUniform1i(glGetUniformLocation(thisProgram, "envMapCDFTex"), 11);
 
         mRenderPipeline.PathTracerLowResolution->StopUsing();
         Utils::glUtils::checkError("RenderGPU::__loadShaders");
@@ -570,13 +616,17 @@ namespace scTracer::Window
         }
 
         // Create texture for scene textures
-        // envmap
-
+        // envmap, filled by __uploadEnvMap below
         glGenTextures(1, &mRenderFrameBuffers.envMapTex);
         glBindTexture(GL_TEXTURE_2D, mRenderFrameBuffers.envMapTex);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, 1, 1, 0, GL_RGB, GL_FLOAT, NULL);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glGenTextures(1, &mRenderFrameBuffers.envMapCDFTex);
+        glBindTexture(GL_TEXTURE_2D, mRenderFrameBuffers.envMapCDFTex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glBindTexture(GL_TEXTURE_2D, 0);
 
         glActiveTexture(GL_TEXTURE1);
@@ -600,13 +650,28 @@ namespace scTracer::Window
             glActiveTexture(GL_TEXTURE9);
             glBindTexture(GL_TEXTURE_2D_ARRAY, mRenderFrameBuffers.textureMapsArrayTex);
         }
-        glActiveTexture(GL_TEXTURE10);
-        glBindTexture(GL_TEXTURE_2D, mRenderFrameBuffers.envMapTex);
+        __uploadEnvMap(); // binds units 10 and 11
 
         std::cerr << " ... " << Config::LOG_GREEN << "Done!" << Config::LOG_RESET << std::endl;
         Utils::glUtils::checkError("RenderGPU::__initGPUDateBuffers");
     }
 
+    void RenderGPU::__uploadEnvMap()
+    {
+        // the shaders skip the env map when it is empty, a 1x1 texture keeps the samplers complete
+        const Core::EnvironmentMap &envMap = mScene->envMap;
+        const float black[3] = {0.0f, 0.0f, 0.0f}, one = 1.0f;
+        bool empty = envMap.empty();
+        glActiveTexture(GL_TEXTURE10);
+        glBindTexture(GL_TEXTURE_2D, mRenderFrameBuffers.envMapTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, empty ? 1 : envMap.mWidth, empty ? 1 : envMap.mHeight, 0, GL_RGB, GL_FLOAT, empty ? black : envMap.mData.data());
+        glActiveTexture(GL_TEXTURE11);
+        glBindTexture(GL_TEXTURE_2D, mRenderFrameBuffers.envMapCDFTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, empty ? 1 : envMap.mWidth + 1, empty ? 1 : envMap.mHeight, 0, GL_RED, GL_FLOAT, empty ? &one : envMap.mCDF.data());
+        glActiveTexture(GL_TEXTURE0);
+        Utils::glUtils::checkError("RenderGPU::__uploadEnvMap");
+    }
+
     void RenderGPU::__initFBOs()
     {
         std::cerr << Config::LOG_MAGENTA << "Init FBOs" << Config::LOG_RESET;
@@ -12,6 +12,7 @@ namespace scTracer::Window
 
     Window::~Window()
     {
+        delete mCPURenderer; // joins the render thread before the scene goes
         if (mWindow)
         {
             glfwDestroyWindow(mWindow);
@@ -74,7 +75,17 @@ namespace scTracer::Window
             ImGui_ImplOpenGL3_NewFrame();
             ImGui_ImplGlfw_NewFrame();
             ImGui::NewFrame();
-            __updateImguiWindow();
+            if (mUseCPU)
+            { // the render thread only waits for this at the start of a pass, and the UI never waits for a pass
+                std::unique_lock<std::mutex> sceneLock = mCPURenderer->lockScene();
+                __updateImguiWindow();
+                mCPURenderer->renderAsync(*mRenderer->mScene);
+            }
+            else
+            {
+                mCPURenderer->stopAsync();
+                __updateImguiWindow();
+            }
             glClearColor(0.00f, 0.0f, 0.00f, 1.00f);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
             if (!mUseCPU)
@@ -89,10 +100,11 @@ namespace scTracer::Window
             }
             else
             {
-                mCPURenderer->render2Canvas(*mRenderer->mScene); // render using cpu
+                mCPURenderer->acquireFrame(); // the latest image the render thread finished
                 glBindFramebuffer(GL_FRAMEBUFFER, 0);
                 glViewport(0, 0, mRenderer->windowSize.x, mRenderer->windowSize.y);
-                mRenderer->showCPU(mCPURenderer);
+                if (mCPURenderer->mHasCanvas)
+                    mRenderer->showCPU(mCPURenderer);
             }
             ImGui::Render();
 
@@ -139,6 +151,7 @@ namespace scTracer::Window
             if (ImGui::Combo("Scenes", &sceneIdx, sceneNames.data(), sceneNames.size()))
             {
                 glfwRestoreWindow(mWindow);
+                mCPURenderer->interruptAsync(); // the render thread must be out of the old scene
                 mRenderer->reInitScene(sceneNames[sceneIdx]);
                 glfwSetWindowSize(mWindow, mRenderer->mScene->settings.image_width, mRenderer->mScene->settings.image_height);
                 shaderNeedReload = true;
@@ -151,6 +164,90 @@ namespace scTracer::Window
             {
                 shaderNeedReload |= ImGui::SliderInt("Spp", &mRenderer->mScene->settings.maxSamples, -1, 512);
                 shaderNeedReload |= ImGui::SliderInt("Max bounces", &mRenderer->mScene->settings.maxBounceDepth, 1, 32);
+                shaderNeedReload |= ImGui::SliderInt("RR depth", &mRenderer->mScene->settings.rrDepth, -1, 32); // -1: off
+                isDirty |= ImGui::SliderInt("CPU threads", &mRenderer->mScene->settings.renderThreads, 0, Utils::ThreadPool::hardwareThreads()); // 0: all
+                {
+                    std::vector<const char *> samplerNames;
+                    for (auto &name : CPU::samplerTypeStrings)
+                        samplerNames.push_back(name.c_str());
+                    isDirty |= ImGui::Combo("CPU sampler", &mRenderer->mScene->settings.samplerType, samplerNames.data(), samplerNames.size());
+                }
+                {
+                    std::vector<const char *> lookDevNames;
+                    for (auto &name : CPU::lookDevModeStrings)
+                        lookDevNames.push_back(name.c_str());
+                    isDirty |= ImGui::Combo("CPU look-dev", &mRenderer->mScene->settings.lookDevMode, lookDevNames.data(), lookDevNames.size());
+                    if (mRenderer->mScene->settings.lookDevMode == int(CPU::LookDevMode::AmbientOcclusion))
+                        isDirty |= ImGui::SliderFloat("AO distance", &mRenderer->mScene->settings.aoDistance, 0.0f, 10.0f); // 0: from the scene size
+                }
+                isDirty |= ImGui::Checkbox("CPU wavefront", &mRenderer->mScene->settings.wavefront);
+                if (mRenderer->mScene->settings.wavefront)
+                {
+                    std::vector<const char *> sortNames;
+                    for (auto &name : CPU::wavefrontSortStrings)
+                        sortNames.push_back(name.c_str());
+                    isDirty |= ImGui::Combo("Wavefront sort", &mRenderer->mScene->settings.wavefrontSort, sortNames.data(), sortNames.size());
+                    isDirty |= ImGui::Checkbox("SIMD bsdf sampling", &mRenderer->mScene->settings.wavefrontSimd);
+                }
+                isDirty |= ImGui::Checkbox("CPU ReSTIR direct light", &mRenderer->mScene->settings.restir);
+                if (mRenderer->mScene->settings.restir)
+                {
+                    isDirty |= ImGui::SliderInt("Candidates", &mRenderer->mScene->settings.restirCandidates, 1, 64);
+                    isDirty |= ImGui::SliderInt("Spatial neighbors", &mRenderer->mScene->settings.restirSpatialNeighbors, 0, 8);
+                    isDirty |= ImGui::Checkbox("Temporal reuse", &mRenderer->mScene->settings.restirTemporal);
+                }
+                isDirty |= ImGui::Checkbox("CPU path guiding", &mRenderer->mScene->settings.pathGuiding);
+                if (mRenderer->mScene->settings.pathGuiding)
+                {
+                    isDirty |= ImGui::SliderInt("Learning iterations", &mRenderer->mScene->settings.guidingIterations, 0, 10);
+                    isDirty |= ImGui::SliderFloat("BSDF fraction", &mRenderer->mScene->settings.guidingBsdfFraction, 0.1f, 1.0f);
+                }
+                isDirty |= ImGui::Checkbox("CPU radiance cache preview", &mRenderer->mScene->settings.radianceCache);
+                if (mRenderer->mScene->settings.radianceCache)
+                    isDirty |= ImGui::SliderInt("Preview passes", &mRenderer->mScene->settings.radianceCachePasses, 0, 64); // 0: always
+                isDirty |= ImGui::Checkbox("CPU Metropolis (PSSMLT)", &mRenderer->mScene->settings.mlt);
+                if (mRenderer->mScene->settings.mlt)
+                {
+                    isDirty |= ImGui::SliderFloat("Large step probability", &mRenderer->mScene->settings.mltLargeStepProbability, 0.0f, 1.0f);
+                    isDirty |= ImGui::SliderInt("Bootstrap paths", &mRenderer->mScene->settings.mltBootstrapSamples, 1024, 1 << 20);
+                }
+                isDirty |= ImGui::Checkbox("CPU photon mapping (SPPM)", &mRenderer->mScene->settings.sppm);
+                if (mRenderer->mScene->settings.sppm)
+                {
+                    isDirty |= ImGui::SliderInt("Photons per pass", &mRenderer->mScene->settings.sppmPhotons, 1 << 14, 1 << 22);
+                    isDirty |= ImGui::SliderFloat("Initial radius", &mRenderer->mScene->settings.sppmRadius, 0.0f, 1.0f); // 0: from the scene size
+                }
+                isDirty |= ImGui::SliderFloat("Adaptive threshold", &mRenderer->mScene->settings.adaptiveThreshold, 0.0f, 0.5f, "%.4f", ImGuiSliderFlags_Logarithmic); // 0: off
+                ImGui::Checkbox("Show variance map", &mCPURenderer->mShowVarianceMap);
+                ImGui::Checkbox("Denoise", &mCPURenderer->mDenoise); // display only, nothing to restart
+                if (mCPURenderer->mDenoise)
+                {
+                    ImGui::SliderInt("Filter iterations", &mCPURenderer->mDenoiser.iterations, 0, CPU::Denoiser::maxIterations);
+                    ImGui::SliderFloat("Color sigma", &mCPURenderer->mDenoiser.colorSigma, 0.5f, 16.0f);
+                }
+            }
+            ImGui::Separator();
+        }
+
+        { // Environment
+            if (ImGui::CollapsingHeader("Environment"))
+            {
+                static char envMapPath[256] = "";
+                ImGui::InputText("HDR/EXR file", envMapPath, IM_ARRAYSIZE(envMapPath));
+                if (ImGui::Button("Load"))
+                {
+                    mCPURenderer->interruptAsync();
+                    mRenderer->mScene->loadEnvMap(envMapPath, mCPURenderer->getThreadPool());
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Remove"))
+                {
+                    mCPURenderer->interruptAsync();
+                    mRenderer->mScene->loadEnvMap("");
+                }
+                if (!mRenderer->mScene->envMap.empty())
+                    ImGui::Text("%s (%dx%d)", mRenderer->mScene->envMap.name.c_str(), mRenderer->mScene->envMap.mWidth, mRenderer->mScene->envMap.mHeight);
+                isDirty |= ImGui::SliderFloat("Intensity", &mRenderer->mScene->settings.envMapIntensity, 0.0f, 10.0f);
             }
             ImGui::Separator();
         }
@@ -174,7 +271,7 @@ namespace scTracer::Window
                     std::string fileName = filename;
                     if (fileName.find(".exr") == std::string::npos)
                         fileName += ".exr";
-                    mRenderer->saveEXR(fileName);
+                    mRenderer->saveEXR(fileName, mUseCPU ? mCPURenderer : nullptr);
                     std::cerr << Config::LOG_GREEN << "Saved image to [" << fileName << "]" << Config::LOG_RESET << std::endl;
                 }
             }
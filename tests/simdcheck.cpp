@@ -0,0 +1,150 @@
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <core/scene.hpp>
+#include <cpu/integrator.hpp>
+#include <cpu/disneysimd.hpp>
+
+// Compares SIMD::DisneyEval / DisneySample with the scalar Integrator versions on random materials,
+// normals and directions, one lobe mix per packet. Fails when an evaluated value or pdf, a sampled direction or
+// its weight f / pdf is off by more than the tolerances, or when the mean weight, the albedo estimate, drifts
+namespace scTracer::CPU
+{
+    namespace
+    {
+        const int numPackets = 20000;
+        const float tolerance = 1e-3f;       // relative, values under 1e-2 compare absolute
+        const float sampleTolerance = 1e-2f; // sampled directions differ in the last bits, sharp lobes amplify that in f / pdf
+
+        float relativeError(float a, float b) { return glm::abs(a - b) / glm::max(glm::abs(a), 1e-2f); }
+        float relativeError(glm::vec3 a, glm::vec3 b) { return glm::max(relativeError(a.x, b.x), glm::max(relativeError(a.y, b.y), relativeError(a.z, b.z))); }
+    }
+
+    struct SimdCheck
+    {
+        Integrator &integrator;
+        PCGSampler sampler; // the numbers of the bsdf samples, drawn again by the scalar DisneySample
+        std::mt19937 rng{1};
+        std::uniform_real_distribution<float> uniform{0.0f, 1.0f};
+
+        explicit SimdCheck(Integrator &integrator) : integrator(integrator) {}
+
+        float u() { return uniform(rng); }
+        glm::vec3 sphere()
+        {
+            float z = 1.0f - 2.0f * u(), r = std::sqrt(glm::max(0.0f, 1.0f - z * z)), phi = float(TWO_PI) * u();
+            return glm::vec3(r * std::cos(phi), z, r * std::sin(phi));
+        }
+        Core::Material material(int mix)
+        { // mix 0 dielectric, 1 metal, 2 glass, 3 clearcoat, 4 clearcoat + metal, 5 metal + glass
+            Core::Material mat;
+            mat.baseColor = glm::vec3(u(), u(), u());
+            mat.metallic = mix == 1 || mix == 4 || mix == 5 ? u() : 0.0f;
+            mat.roughness = 0.05f + 0.95f * u();
+            mat.subsurface = u();
+            mat.specularTint = u();
+            mat.sheen = u();
+            mat.sheenTint = u();
+            mat.clearcoat = mix == 3 || mix == 4 ? u() : 0.0f;
+            mat.clearcoatGloss = u();
+            mat.specTrans = mix == 2 || mix == 5 ? u() : 0.0f;
+            mat.anisotropic = u();
+            return mat;
+        }
+
+        bool run()
+        {
+            int evalErrors = 0, sampleErrors = 0, count = 0;
+            float maxEvalError = 0.0f, maxSampleError = 0.0f;
+            double scalarAlbedo = 0.0, simdAlbedo = 0.0;
+            Core::ShadingMaterial baked[SIMD::width];
+            for (int packet = 0; packet < numPackets; packet++)
+            {
+                SIMD::ShadingPacket sp;
+                State states[SIMD::width];
+                glm::vec3 V[SIMD::width], N[SIMD::width], L[SIMD::width];
+                SIMD::vec3x8 L8;
+                SIMD::float8 r1, r2, r3;
+                for (int lane = 0; lane < SIMD::width; lane++)
+                {
+                    baked[lane] = Core::ShadingMaterial::bake(material(packet % 6));
+                    states[lane].mat = &baked[lane];
+                    states[lane].eta = u() < 0.5f ? 1.0f / 1.5f : 1.5f;
+                    N[lane] = sphere();
+                    V[lane] = sphere();
+                    if (glm::dot(V[lane], N[lane]) < 0.0f)
+                        V[lane] = -V[lane];
+                    L[lane] = sphere();
+                    sp.set(lane, states[lane], V[lane], N[lane]);
+                    L8.insert(lane, L[lane]);
+                    InitRNG(glm::vec2(lane, packet), 0, &sampler);
+                    r1.insert(lane, rand());
+                    r2.insert(lane, rand());
+                    r3.insert(lane, rand());
+                }
+
+                SIMD::float8 pdf8;
+                SIMD::vec3x8 f8 = SIMD::DisneyEval(sp, L8, pdf8);
+                SIMD::vec3x8 Ls8;
+                SIMD::float8 samplePdf8;
+                SIMD::vec3x8 fs8 = SIMD::DisneySample(sp, r1, r2, r3, Ls8, samplePdf8);
+
+                for (int lane = 0; lane < SIMD::width; lane++, count++)
+                {
+                    float pdf;
+                    glm::vec3 f = integrator.DisneyEval(states[lane], V[lane], N[lane], L[lane], pdf);
+                    float error = glm::max(relativeError(f, f8[lane]), relativeError(pdf, pdf8[lane]));
+                    maxEvalError = glm::max(maxEvalError, error);
+                    if (!(error <= tolerance) && evalErrors++ < 5)
+                        printf("eval mismatch, packet %d lane %d: f (%g %g %g) / (%g %g %g), pdf %g / %g\n", packet, lane,
+                               f.x, f.y, f.z, f8[lane].x, f8[lane].y, f8[lane].z, pdf, pdf8[lane]);
+
+                    glm::vec3 Ls;
+                    float samplePdf;
+                    InitRNG(glm::vec2(lane, packet), 0, &sampler);
+                    glm::vec3 fs = integrator.DisneySample(states[lane], V[lane], N[lane], Ls, samplePdf);
+                    // near a sharp lobe peak the pdf swings with the last bits of L, the sample weight f / pdf does not
+                    glm::vec3 weight = samplePdf > 0.0f ? fs / samplePdf : glm::vec3(0.0f);
+                    glm::vec3 weight8 = samplePdf8[lane] > 0.0f ? fs8[lane] / samplePdf8[lane] : glm::vec3(0.0f);
+                    error = glm::max(glm::length(Ls - Ls8[lane]), relativeError(weight, weight8));
+                    maxSampleError = glm::max(maxSampleError, error);
+                    if (!(error <= sampleTolerance) && sampleErrors++ < 5)
+                        printf("sample mismatch, packet %d lane %d: L (%g %g %g) / (%g %g %g), pdf %g / %g\n", packet, lane,
+                               Ls.x, Ls.y, Ls.z, Ls8[lane].x, Ls8[lane].y, Ls8[lane].z, samplePdf, samplePdf8[lane]);
+                    scalarAlbedo += Luminance(weight);
+                    simdAlbedo += Luminance(weight8);
+                }
+            }
+            scalarAlbedo /= count;
+            simdAlbedo /= count;
+            bool albedoOk = glm::abs(scalarAlbedo - simdAlbedo) <= tolerance * scalarAlbedo;
+            printf("eval: %d points, %d mismatches, max error %.2e\n", count, evalErrors, maxEvalError);
+            printf("sample: %d points, %d mismatches, max error %.2e\n", count, sampleErrors, maxSampleError);
+            printf("mean f / pdf: scalar %.5f simd %.5f\n", scalarAlbedo, simdAlbedo);
+            return evalErrors == 0 && sampleErrors == 0 && albedoOk;
+        }
+    };
+}
+
+int main()
+{
+    using namespace scTracer;
+    // the scalar kernels are Integrator members, which wants a prepared scene: one quad is enough
+    Core::Scene scene(Core::Camera(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f), 45.0f), Core::SceneSettings(8, 8));
+    Core::Mesh *quad = new Core::Mesh();
+    quad->vertices = {glm::vec3(-1, -1, 0), glm::vec3(1, -1, 0), glm::vec3(1, 1, 0), glm::vec3(-1, 1, 0)};
+    quad->normals = std::vector<glm::vec3>(4, glm::vec3(0, 0, 1));
+    quad->uvs = {glm::vec2(0, 0), glm::vec2(1, 0), glm::vec2(1, 1), glm::vec2(0, 1)};
+    quad->indices = {glm::ivec3(0, 1, 2), glm::ivec3(0, 2, 3)};
+    scene.meshes.push_back(quad);
+    scene.materials.push_back(Core::MaterialRaw());
+    scene.instances.push_back(Core::Instance(glm::mat4(1.0f), 0, 0));
+    scene.processScene();
+
+    std::vector<float> canvas(8 * 8 * 4);
+    CPU::Integrator integrator(scene, canvas.data());
+    CPU::SimdCheck check(integrator);
+    bool passed = check.run();
+    printf(passed ? "passed\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}